@@ -0,0 +1,254 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/char_set.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define STATE_CHART_CHAR_SET_X86 1
+#include <immintrin.h>
+#endif
+
+namespace state_chart {
+namespace internal {
+
+namespace {
+
+// Scans [begin, end) one character at a time for the first character whose
+// membership in 'members' is 'in_set'.
+const char* FindScalar(const std::array<bool, 256>& members, bool in_set,
+                       const char* begin, const char* end) {
+  for (; begin != end; ++begin) {
+    if (members[static_cast<unsigned char>(*begin)] == in_set) break;
+  }
+  return begin;
+}
+
+#ifdef STATE_CHART_CHAR_SET_X86
+
+// The bit mask of the members of the set among the 16 characters at 'p'.
+__attribute__((target("ssse3"))) inline int MemberMask16(const char* p,
+                                                         __m128i low_nibbles,
+                                                         __m128i high_nibbles) {
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i low = _mm_and_si128(bytes, nibble);
+  const __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble);
+  const __m128i bits = _mm_and_si128(_mm_shuffle_epi8(low_nibbles, low),
+                                     _mm_shuffle_epi8(high_nibbles, high));
+  return ~_mm_movemask_epi8(_mm_cmpeq_epi8(bits, _mm_setzero_si128())) &
+         0xFFFF;
+}
+
+__attribute__((target("ssse3"))) const char* FindSsse3(
+    const uint8_t* low_table, const uint8_t* high_table, bool in_set,
+    const char* begin, const char* end) {
+  const __m128i low_nibbles =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(low_table));
+  const __m128i high_nibbles =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(high_table));
+  const int flip = in_set ? 0 : 0xFFFF;
+  for (; end - begin >= 16; begin += 16) {
+    const int mask = MemberMask16(begin, low_nibbles, high_nibbles) ^ flip;
+    if (mask != 0) {
+      return begin + absl::countr_zero(static_cast<uint32_t>(mask));
+    }
+  }
+  return begin;
+}
+
+__attribute__((target("avx2"))) const char* FindAvx2(const uint8_t* low_table,
+                                                     const uint8_t* high_table,
+                                                     bool in_set,
+                                                     const char* begin,
+                                                     const char* end) {
+  // The byte shuffle looks up each 16-byte lane separately, so both lanes get
+  // the tables.
+  const __m256i low_nibbles = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(low_table)));
+  const __m256i high_nibbles = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(high_table)));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const uint32_t flip = in_set ? 0 : 0xFFFFFFFFu;
+  for (; end - begin >= 32; begin += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const __m256i low = _mm256_and_si256(bytes, nibble);
+    const __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+    const __m256i bits =
+        _mm256_and_si256(_mm256_shuffle_epi8(low_nibbles, low),
+                         _mm256_shuffle_epi8(high_nibbles, high));
+    const uint32_t mask =
+        ~static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(bits, _mm256_setzero_si256()))) ^
+        flip;
+    if (mask != 0) {
+      return begin + absl::countr_zero(static_cast<uint32_t>(mask));
+    }
+  }
+  return FindSsse3(low_table, high_table, in_set, begin, end);
+}
+
+__attribute__((target("ssse3"))) uint64_t MemberMaskSsse3(
+    const uint8_t* low_table, const uint8_t* high_table, const char* text) {
+  const __m128i low_nibbles =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(low_table));
+  const __m128i high_nibbles =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(high_table));
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i += 16) {
+    mask |= static_cast<uint64_t>(
+                MemberMask16(text + i, low_nibbles, high_nibbles))
+            << i;
+  }
+  return mask;
+}
+
+__attribute__((target("avx2"))) uint64_t MemberMaskAvx2(
+    const uint8_t* low_table, const uint8_t* high_table, const char* text) {
+  const __m256i low_nibbles = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(low_table)));
+  const __m256i high_nibbles = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(high_table)));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; i += 32) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+    const __m256i low = _mm256_and_si256(bytes, nibble);
+    const __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble);
+    const __m256i bits =
+        _mm256_and_si256(_mm256_shuffle_epi8(low_nibbles, low),
+                         _mm256_shuffle_epi8(high_nibbles, high));
+    const uint32_t none = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(bits, _mm256_setzero_si256())));
+    mask |= static_cast<uint64_t>(~none) << i;
+  }
+  return mask;
+}
+
+#endif  // STATE_CHART_CHAR_SET_X86
+
+// Scans whole vectors of [begin, end) and returns the first character whose
+// membership is 'in_set' or the start of the remaining characters, which are
+// fewer than a vector.
+using VectorFind = const char* (*)(const uint8_t* low_table,
+                                   const uint8_t* high_table, bool in_set,
+                                   const char* begin, const char* end);
+
+// Returns the members among the 64 characters at 'text', one bit each.
+using VectorMemberMask = uint64_t (*)(const uint8_t* low_table,
+                                      const uint8_t* high_table,
+                                      const char* text);
+
+// The vector functions the CPU supports, which are nullptr if it supports
+// none.
+struct VectorFunctions {
+  VectorFind find = nullptr;
+  VectorMemberMask member_mask = nullptr;
+};
+
+const VectorFunctions& GetVectorFunctions() {
+  static const VectorFunctions vector_functions = [] {
+    VectorFunctions functions;
+#ifdef STATE_CHART_CHAR_SET_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      functions.find = &FindAvx2;
+      functions.member_mask = &MemberMaskAvx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+      functions.find = &FindSsse3;
+      functions.member_mask = &MemberMaskSsse3;
+    }
+#endif
+    return functions;
+  }();
+  return vector_functions;
+}
+
+}  // namespace
+
+CharSet::CharSet(absl::string_view chars)
+    : members_(), low_nibbles_(), high_nibbles_(), vectorized_(true) {
+  int next_bit = 0;
+  for (const char c : chars) {
+    const unsigned char byte = static_cast<unsigned char>(c);
+    if (members_[byte]) continue;
+    members_[byte] = true;
+    uint8_t& high_bit = high_nibbles_[byte >> 4];
+    if (high_bit == 0) {
+      if (next_bit == 8) {
+        vectorized_ = false;
+        continue;
+      }
+      high_bit = static_cast<uint8_t>(1 << next_bit++);
+    }
+    low_nibbles_[byte & 0xF] |= high_bit;
+  }
+}
+
+const char* CharSet::FindFirstIn(const char* begin, const char* end) const {
+  const VectorFind vector_find = GetVectorFunctions().find;
+  if (vectorized_ && vector_find != nullptr) {
+    begin = vector_find(low_nibbles_.data(), high_nibbles_.data(), true, begin,
+                        end);
+  }
+  return FindScalar(members_, true, begin, end);
+}
+
+const char* CharSet::FindFirstNotIn(const char* begin, const char* end) const {
+  const VectorFind vector_find = GetVectorFunctions().find;
+  if (vectorized_ && vector_find != nullptr) {
+    begin = vector_find(low_nibbles_.data(), high_nibbles_.data(), false,
+                        begin, end);
+  }
+  return FindScalar(members_, false, begin, end);
+}
+
+uint64_t CharSet::MemberMask(const char* text, ::std::size_t size) const {
+  const VectorMemberMask member_mask = GetVectorFunctions().member_mask;
+  if (vectorized_ && member_mask != nullptr) {
+    if (size == 64) {
+      return member_mask(low_nibbles_.data(), high_nibbles_.data(), text);
+    }
+    // Classify a copy of the last block, ignoring the padding.
+    char block[64] = {};
+    std::memcpy(block, text, size);
+    return member_mask(low_nibbles_.data(), high_nibbles_.data(), block) &
+           ((uint64_t{1} << size) - 1);
+  }
+  uint64_t mask = 0;
+  for (::std::size_t i = 0; i < size; ++i) {
+    mask |= static_cast<uint64_t>(Contains(text[i])) << i;
+  }
+  return mask;
+}
+
+::std::size_t CharSet::Scanner::NextBlock(::std::size_t pos) {
+  // The current block has no members from 'pos' on.
+  if (has_block_ && pos >= block_ && pos - block_ < 64) pos = block_ + 64;
+  for (; pos < text_.size(); pos += 64) {
+    block_ = pos;
+    members_ = set_.MemberMask(text_.data() + pos,
+                               std::min<::std::size_t>(64, text_.size() - pos));
+    has_block_ = true;
+    if (members_ != 0) return pos + absl::countr_zero(members_);
+  }
+  return text_.size();
+}
+
+}  // namespace internal
+}  // namespace state_chart
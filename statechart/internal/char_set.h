@@ -0,0 +1,104 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_CHAR_SET_H_
+#define STATE_CHART_INTERNAL_CHAR_SET_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/string_view.h"
+
+namespace state_chart {
+namespace internal {
+
+// A set of characters that text is scanned for. Scans look at 32 characters
+// at a time with AVX2 or 16 with SSSE3 if the CPU has them, which is checked
+// once at runtime, and at one character at a time otherwise. FindFirstIn() and
+// FindFirstNotIn() suit sparse matches; a Scanner suits dense ones.
+class CharSet {
+ public:
+  // The set of the characters in 'chars', which may contain '\0'.
+  explicit CharSet(absl::string_view chars);
+
+  bool Contains(char c) const {
+    return members_[static_cast<unsigned char>(c)];
+  }
+
+  // Returns the first character in [begin, end) that is in the set, or 'end'.
+  const char* FindFirstIn(const char* begin, const char* end) const;
+
+  // Returns the first character in [begin, end) that is not in the set, or
+  // 'end'.
+  const char* FindFirstNotIn(const char* begin, const char* end) const;
+
+  // Finds the members of a set in a text from front to back. Each block of 64
+  // characters is classified once into a bit mask, so dense members cost a
+  // bit scan each rather than a scan of the text.
+  class Scanner {
+   public:
+    // Scans 'text' for the members of 'set'. Both must outlive the scanner.
+    Scanner(const CharSet& set, absl::string_view text)
+        : set_(set), text_(text) {}
+
+    // Returns the position of the first member of the set at or after 'pos'
+    // in the text, or the size of the text if there is none. Calls with
+    // increasing positions classify each block only once.
+    ::std::size_t Next(::std::size_t pos) {
+      if (has_block_ && pos >= block_ && pos - block_ < 64) {
+        const uint64_t members = members_ >> (pos - block_);
+        if (members != 0) return pos + absl::countr_zero(members);
+      }
+      return NextBlock(pos);
+    }
+
+   private:
+    // Next() past the current block.
+    ::std::size_t NextBlock(::std::size_t pos);
+
+    const CharSet& set_;
+    const absl::string_view text_;
+    // The members among the 64 characters from 'block_' on, one bit each.
+    ::std::size_t block_ = 0;
+    uint64_t members_ = 0;
+    bool has_block_ = false;
+  };
+
+ private:
+  // Returns the members among the 'size' <= 64 characters at 'text', one bit
+  // each.
+  uint64_t MemberMask(const char* text, ::std::size_t size) const;
+
+  // Whether each character is in the set.
+  std::array<bool, 256> members_;
+  // A character c is in the set if and only if
+  // 'low_nibbles_[c & 0xF] & high_nibbles_[c >> 4]' is not 0: each distinct
+  // high nibble of the members has a bit, which is set for the low nibbles of
+  // the members with that high nibble. These are the tables of the byte
+  // shuffles of the vector scans.
+  alignas(16) std::array<uint8_t, 16> low_nibbles_;
+  alignas(16) std::array<uint8_t, 16> high_nibbles_;
+  // False if the members have more than eight distinct high nibbles, in which
+  // case scans are not vectorized.
+  bool vectorized_;
+};
+
+}  // namespace internal
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_CHAR_SET_H_
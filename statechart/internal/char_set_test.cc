@@ -0,0 +1,117 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/char_set.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+namespace internal {
+namespace {
+
+// The offset of the first character of 'text' found by 'find', which is
+// FindFirstIn or FindFirstNotIn.
+template <typename Find>
+size_t Offset(const string& text, Find find) {
+  return find(text.data(), text.data() + text.size()) - text.data();
+}
+
+TEST(CharSetTest, Contains) {
+  const CharSet set(absl::string_view("{}\"\\\0\xff", 6));
+  for (const char c : string("{}\"\\\0\xff", 6)) EXPECT_TRUE(set.Contains(c));
+  for (const char c : string("az09 []'|\x80")) EXPECT_FALSE(set.Contains(c));
+}
+
+TEST(CharSetTest, FindsAtEveryOffset) {
+  const CharSet set("+-*/");
+  // Every offset around the 16 and 32 character vectors.
+  for (size_t size = 0; size <= 100; ++size) {
+    for (size_t offset = 0; offset <= size; ++offset) {
+      string text(size, 'a');
+      if (offset < size) text[offset] = '*';
+      EXPECT_EQ(offset, Offset(text, [&set](const char* begin,
+                                            const char* end) {
+                  return set.FindFirstIn(begin, end);
+                })) << size;
+      string members(size, '-');
+      if (offset < size) members[offset] = 'a';
+      EXPECT_EQ(offset, Offset(members, [&set](const char* begin,
+                                               const char* end) {
+                  return set.FindFirstNotIn(begin, end);
+                })) << size;
+    }
+  }
+}
+
+TEST(CharSetTest, MatchesContainsForAllCharacters) {
+  // Several members share high and low nibbles with non-members.
+  const CharSet set(",()[]+-*/<=!>&|\"'{");
+  string text;
+  for (int c = 0; c < 256; ++c) text += static_cast<char>(c);
+  text += text;
+  const char* const end = text.data() + text.size();
+  for (const char* p = text.data(); p != end; ++p) {
+    const char* found = set.FindFirstIn(p, end);
+    const char* expected = p;
+    while (expected != end && !set.Contains(*expected)) ++expected;
+    EXPECT_EQ(expected - text.data(), found - text.data());
+  }
+}
+
+TEST(CharSetTest, FindsWithManyHighNibbles) {
+  // More than eight distinct high nibbles, which are not vectorized.
+  const CharSet set("\x05\x15 05EUeu\x85\x95");
+  const string text = string(40, 'x') + "u" + string(40, 'x');
+  EXPECT_EQ(40, Offset(text, [&set](const char* begin, const char* end) {
+              return set.FindFirstIn(begin, end);
+            }));
+  EXPECT_EQ(0, Offset(text, [&set](const char* begin, const char* end) {
+              return set.FindFirstNotIn(begin, end);
+            }));
+}
+
+TEST(CharSetTest, ScansAcrossBlocks) {
+  const CharSet set("{}");
+  string text(200, 'x');
+  const std::vector<size_t> members = {0, 1, 63, 64, 65, 127, 130, 199};
+  for (const size_t pos : members) text[pos] = '{';
+  CharSet::Scanner scanner(set, text);
+  std::vector<size_t> found;
+  for (size_t pos = scanner.Next(0); pos < text.size();
+       pos = scanner.Next(pos + 1)) {
+    found.push_back(pos);
+  }
+  EXPECT_EQ(members, found);
+  // Going back rescans.
+  EXPECT_EQ(63, scanner.Next(2));
+  EXPECT_EQ(0, CharSet::Scanner(set, "").Next(0));
+  EXPECT_EQ(3, CharSet::Scanner(set, "abc").Next(0));
+}
+
+TEST(CharSetTest, ScansWithManyHighNibbles) {
+  const CharSet set("\x05\x15 05EUeu\x85\x95");
+  const string text = string(70, 'x') + "\x95";
+  CharSet::Scanner scanner(set, text);
+  EXPECT_EQ(70, scanner.Next(0));
+  EXPECT_EQ(71, scanner.Next(71));
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace state_chart
@@ -14,6 +14,188 @@
 
 #include "statechart/internal/datamodel.h"
 
+#include "statechart/internal/json_text.h"
+
 namespace state_chart {
+
+CompiledExpression::~CompiledExpression() {}
+
+const int SymbolTable::kNoSlot;
+
+int SymbolTable::AddSymbol(const string& name) {
+  const auto inserted = slots_.emplace(name, names_.size());
+  if (inserted.second) {
+    names_.push_back(name);
+  }
+  return inserted.first->second;
+}
+
+int SymbolTable::FindSlot(const string& name) const {
+  const auto it = slots_.find(name);
+  return it == slots_.end() ? kNoSlot : it->second;
+}
+
+ExpressionCompiler::~ExpressionCompiler() {}
+
+// virtual
+std::shared_ptr<const CompiledExpression> ExpressionCompiler::Compile(
+    const string& expr, std::shared_ptr<const SymbolTable> symbols) const {
+  return Compile(expr);
+}
+
+// virtual
+std::shared_ptr<const CompiledExpression> ExpressionCompiler::CompileLocation(
+    const string& location, std::shared_ptr<const SymbolTable> symbols) const {
+  return Compile(location, std::move(symbols));
+}
+
+// virtual
+bool ExpressionCompiler::GetReadVariables(const string& expr,
+                                          std::set<string>* variables) const {
+  return false;
+}
+
 Datamodel::~Datamodel() {}
+
+// virtual
+bool Datamodel::IsDefined(const Expression& location) const {
+  return IsDefined(location.source());
+}
+
+// virtual
+bool Datamodel::Declare(const Expression& location) {
+  return Declare(location.source());
+}
+
+// virtual
+bool Datamodel::AssignExpression(const Expression& location,
+                                 const Expression& expr) {
+  return AssignExpression(location.source(), expr.source());
+}
+
+// virtual
+bool Datamodel::EvaluateBooleanExpression(const Expression& expr,
+                                          bool* result) const {
+  return EvaluateBooleanExpression(expr.source(), result);
+}
+
+// virtual
+bool Datamodel::EvaluateStringExpression(const Expression& expr,
+                                         string* result) const {
+  return EvaluateStringExpression(expr.source(), result);
+}
+
+// virtual
+bool Datamodel::EvaluateExpression(const Expression& expr,
+                                   string* result) const {
+  return EvaluateExpression(expr.source(), result);
+}
+
+// virtual
+std::unique_ptr<Iterator> Datamodel::EvaluateIterator(
+    const Expression& location) const {
+  return EvaluateIterator(location.source());
+}
+
+// virtual
+bool Datamodel::AssignIteratorValue(Iterator* iterator,
+                                    const Expression& location) {
+  return AssignExpression(location, Expression(iterator->GetValue()));
+}
+
+// virtual
+bool Datamodel::AssignIteratorIndex(const Iterator& iterator,
+                                    const Expression& location) {
+  return AssignExpression(location, Expression(iterator.GetIndex()));
+}
+
+// virtual
+bool Datamodel::AssignValue(const Expression& location, Json::Value value) {
+  return AssignExpression(location, Expression(ToJsonText(value)));
+}
+
+// virtual
+bool Datamodel::EvaluateValue(const Expression& expr,
+                              Json::Value* result) const {
+  string text;
+  if (!EvaluateExpression(expr, &text)) {
+    return false;
+  }
+  return ParseJsonText(text, result);
+}
+
+// virtual
+string Datamodel::EncodeParameters(
+    const std::map<string, Json::Value>& parameters) const {
+  std::map<string, string> expressions;
+  for (const auto& parameter : parameters) {
+    expressions.emplace(parameter.first, ToJsonText(parameter.second));
+  }
+  return EncodeParameters(expressions);
+}
+
+// virtual
+string Datamodel::EvaluateParameters(
+    const std::map<string, Expression>& parameters,
+    std::vector<string>* failed) const {
+  std::map<string, string> evaluated_data;
+  string result;
+  for (const auto& parameter : parameters) {
+    result.clear();
+    if (EvaluateExpression(parameter.second, &result)) {
+      evaluated_data[parameter.first] = result;
+    } else {
+      failed->push_back(parameter.first);
+    }
+  }
+  return EncodeParameters(evaluated_data);
+}
+
+// virtual
+bool Datamodel::AssignValueLazily(const Expression& location, string json) {
+  Json::Value value;
+  if (ParseJsonText(json, Json::Features::strictMode(), &value, nullptr)) {
+    return AssignValue(location, std::move(value));
+  }
+  return AssignExpression(location, Expression(json));
+}
+
+// virtual
+bool Datamodel::HasSystemVariables() const { return true; }
+
+// virtual
+bool Datamodel::EvaluateMessage(const string& location,
+                                google::protobuf::Message* message) const {
+  return false;
+}
+
+// virtual
+bool Datamodel::StoresMessages() const { return false; }
+
+// virtual
+bool Datamodel::AssignMessage(const Expression& location,
+                              const google::protobuf::Message& message) {
+  return false;
+}
+
+// virtual
+bool Datamodel::AddKeyIndex(const string& location, const string& key) {
+  return false;
+}
+
+// virtual
+uint64_t Datamodel::GetVersion() const { return 0; }
+
+// virtual
+bool Datamodel::SerializeModificationsAsString(
+    uint64_t version, std::map<string, string>* modifications) const {
+  return false;
+}
+
+// virtual
+bool Datamodel::ParseModificationsFromString(
+    const std::map<string, string>& modifications, uint64_t version) {
+  return false;
+}
+
 }  // namespace state_chart
@@ -17,16 +17,127 @@
 #ifndef STATE_CHART_INTERNAL_DATAMODEL_H_
 #define STATE_CHART_INTERNAL_DATAMODEL_H_
 
+#include <cstdint>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "include/json/json.h"
 #include "statechart/platform/types.h"
 
+namespace google {
+namespace protobuf {
+class Message;
+}  // namespace protobuf
+}  // namespace google
+
 namespace state_chart {
 
 class Runtime;
 
+// The form of an expression prepared ahead of evaluation by an
+// ExpressionCompiler. A compiled expression is shared by all datamodels that
+// evaluate the same model, hence it must not refer to the contents of any
+// particular datamodel.
+class CompiledExpression {
+ public:
+  virtual ~CompiledExpression();
+
+  // The expression language this was compiled for. A datamodel only makes use
+  // of compiled expressions of its own language.
+  virtual const char* language() const = 0;
+
+ protected:
+  CompiledExpression() = default;
+};
+
+// An expression string together with its compiled form, if it was compiled.
+// Copies share the same compiled form.
+class Expression {
+ public:
+  Expression() = default;
+  explicit Expression(const string& source) : source_(source) {}
+  Expression(const string& source,
+             std::shared_ptr<const CompiledExpression> compiled)
+      : source_(source), compiled_(std::move(compiled)) {}
+
+  const string& source() const { return source_; }
+  bool empty() const { return source_.empty(); }
+
+  // Returns nullptr if the expression was not compiled.
+  const CompiledExpression* compiled() const { return compiled_.get(); }
+
+ private:
+  string source_;
+  std::shared_ptr<const CompiledExpression> compiled_;
+};
+
+// The top-level variables of a model, i.e., the variables declared by its
+// <data> elements and the system variables, numbered by dense slot indices.
+class SymbolTable {
+ public:
+  // The slot of names that are not in the table.
+  static const int kNoSlot = -1;
+
+  SymbolTable() = default;
+  SymbolTable(const SymbolTable&) = delete;
+  SymbolTable& operator=(const SymbolTable&) = delete;
+
+  // Adds the variable 'name' if it is not in the table yet. Returns its slot.
+  int AddSymbol(const string& name);
+
+  // Returns the slot of the variable 'name' or kNoSlot.
+  int FindSlot(const string& name) const;
+
+  // Returns the name of the variable in 'slot'.
+  const string& GetName(int slot) const { return names_[slot]; }
+
+  // The number of slots.
+  int size() const { return names_.size(); }
+
+ private:
+  std::map<string, int> slots_;
+  std::vector<string> names_;
+};
+
+// Compiles expressions once, e.g., when a model is built, so that evaluation
+// does not need to parse the expression string every time.
+class ExpressionCompiler {
+ public:
+  virtual ~ExpressionCompiler();
+
+  // Returns the compiled form of 'expr', or nullptr if 'expr' can only be
+  // evaluated from its source text. Must be thread-safe.
+  virtual std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const = 0;
+
+  // Same as above, but references to the variables in 'symbols' may be
+  // compiled to their slots. Datamodels that use the same 'symbols' resolve
+  // these references without looking up their names. The default
+  // implementation ignores 'symbols'.
+  virtual std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr, std::shared_ptr<const SymbolTable> symbols) const;
+
+  // Same as above, but 'location' is a location that values are assigned to.
+  // Compilers may compile it in a form that is assigned to without being
+  // parsed. The default implementation is Compile(location, symbols).
+  virtual std::shared_ptr<const CompiledExpression> CompileLocation(
+      const string& location, std::shared_ptr<const SymbolTable> symbols) const;
+
+  // Adds the top-level variables that 'expr' reads to 'variables'. Returns
+  // false if the value of 'expr' may depend on anything else than these
+  // variables and literals, e.g., on function calls, or if 'expr' cannot be
+  // analyzed. The default implementation returns false.
+  virtual bool GetReadVariables(const string& expr,
+                                std::set<string>* variables) const;
+
+ protected:
+  ExpressionCompiler() = default;
+};
+
 // Defines the interface for an iterable collection in the datamodel.
 class Iterator {
  public:
@@ -45,6 +156,11 @@ class Iterator {
   // Retrieves the current element's index as a datamodel value expression.
   virtual string GetIndex() const = 0;
 
+  // The language of the datamodel that created this iterator, or an empty
+  // string. Datamodels use it to access the elements of their own iterators
+  // directly.
+  virtual const char* language() const { return ""; }
+
  protected:
   Iterator() = default;
 };
@@ -133,8 +249,119 @@ class Datamodel {
   // method may return nullptr.
   virtual const Runtime* GetRuntime() const = 0;
 
-  // Associates this datamodel with a given Runtime.
-  virtual void SetRuntime(const Runtime* runtime) = 0;
+  // Associates this datamodel with a given Runtime. The runtime is not const as
+  // expressions draw from its random generator, e.g., for Math.random().
+  virtual void SetRuntime(Runtime* runtime) = 0;
+
+  // Returns false if the datamodel has no data, like the SCXML null datamodel.
+  // The system variables, e.g., '_event', are then not bound. The default
+  // implementation returns true.
+  virtual bool HasSystemVariables() const;
+
+  // Copies the value at 'location' into 'message' if the datamodel stores
+  // protocol messages of its type, so that it is not converted through JSON.
+  // Returns false otherwise. The default implementation returns false.
+  virtual bool EvaluateMessage(const string& location,
+                               google::protobuf::Message* message) const;
+
+  // Returns true if the datamodel stores protocol messages, so that
+  // AssignMessage() assigns them without converting them to JSON. The default
+  // implementation returns false.
+  virtual bool StoresMessages() const;
+
+  // Assigns a copy of 'message' to 'location', e.g., a message event payload
+  // to '_event.data'. Returns false if 'location' cannot be assigned to, or if
+  // the datamodel does not store messages. The default implementation returns
+  // false.
+  virtual bool AssignMessage(const Expression& location,
+                             const google::protobuf::Message& message);
+
+  // Indexes the objects in the array at the top-level variable 'location' by
+  // their values of 'key', so that the builtins LookupByKey(),
+  // ContainsKeyValue() and FindFirstWithKeyValue() do not scan the array.
+  // Returns false if the datamodel does not support indexes, in which case the
+  // builtins scan the array. The default implementation returns false.
+  virtual bool AddKeyIndex(const string& location, const string& key);
+
+  // Variants of the above methods that take an Expression, which may carry a
+  // compiled form. The default implementations evaluate the source text with
+  // the string based methods.
+  virtual bool IsDefined(const Expression& location) const;
+  virtual bool Declare(const Expression& location);
+  virtual bool AssignExpression(const Expression& location,
+                                const Expression& expr);
+  virtual bool EvaluateBooleanExpression(const Expression& expr,
+                                         bool* result) const;
+  virtual bool EvaluateStringExpression(const Expression& expr,
+                                        string* result) const;
+  virtual bool EvaluateExpression(const Expression& expr,
+                                  string* result) const;
+  virtual std::unique_ptr<Iterator> EvaluateIterator(
+      const Expression& location) const;
+
+  // Assigns the current element of 'iterator' to 'location'. 'iterator' must
+  // not be AtEnd(). Datamodels may bind the elements of the iterators they
+  // created without converting them to expressions, and may move the element
+  // out of 'iterator'. The default implementation assigns GetValue().
+  virtual bool AssignIteratorValue(Iterator* iterator,
+                                   const Expression& location);
+
+  // Same as above, but assigns the index of the current element. The default
+  // implementation assigns GetIndex().
+  virtual bool AssignIteratorIndex(const Iterator& iterator,
+                                   const Expression& location);
+
+  // Typed variants of AssignExpression(), EvaluateExpression() and
+  // EncodeParameters() that pass values as Json::Value, as FunctionDispatcher
+  // does, instead of as value expressions. Callers that already hold values use
+  // these so that values are not formatted only to be parsed again. The default
+  // implementations convert between JSON text and value expressions with the
+  // string based methods, i.e., they assume that JSON text is a valid value
+  // expression of the datamodel.
+
+  // Assigns 'value' to 'location'. Returns false if 'location' cannot be
+  // assigned to.
+  virtual bool AssignValue(const Expression& location, Json::Value value);
+
+  // Sets 'result' to the value of 'expr'. Returns false if an evaluation error
+  // occurs.
+  virtual bool EvaluateValue(const Expression& expr, Json::Value* result) const;
+
+  // Encodes a map of parameter name to value into an implementation dependent
+  // value expression of the map.
+  virtual string EncodeParameters(
+      const std::map<string, Json::Value>& parameters) const;
+
+  // Evaluates 'parameters', a map of parameter name to value expression, and
+  // encodes the results into a value expression of the map. Parameters that
+  // fail to evaluate are left out and their names are added to 'failed'. The
+  // default implementation evaluates with EvaluateExpression() and encodes
+  // the resulting value expressions, so it does not require JSON results.
+  virtual string EvaluateParameters(
+      const std::map<string, Expression>& parameters,
+      std::vector<string>* failed) const;
+
+  // Assigns the value of the JSON text 'json', e.g., an event payload, to
+  // 'location'. Datamodels may keep 'json' unparsed until 'location' is
+  // accessed. Text that is not JSON is evaluated as a value expression. The
+  // default implementation parses 'json' immediately.
+  virtual bool AssignValueLazily(const Expression& location, string json);
+
+  // Incremental serialization. Datamodels that support it count their writes
+  // in a version and know the version in which each location was last
+  // written, so that a serialized datamodel can be updated with only the
+  // locations written since. The default implementations do not support it.
+
+  // Returns the number of writes so far, 0 if writes are not counted.
+  virtual uint64_t GetVersion() const;
+
+  // Sets 'modifications' to the serialized values of the locations written
+  // after GetVersion() returned 'version', by location. A location holds no
+  // other written location, e.g., 'a' is not set with 'a.b'. Returns false if
+  // these are not known, e.g., as the datamodel was cleared after 'version'.
+  // The datamodel must then be serialized in full.
+  virtual bool SerializeModificationsAsString(
+      uint64_t version, std::map<string, string>* modifications) const;
 
  protected:
   // Initializes datamodel from SerializeAsString() representation.
@@ -142,6 +369,13 @@ class Datamodel {
   // This method is protected to enforce that the restoration of datamodel from
   // its serialized representation should only happen at the construction time.
   virtual bool ParseFromString(const string& data) = 0;
+
+  // Assigns the locations of SerializeModificationsAsString() representation,
+  // declaring them if needed, and continues counting writes from 'version'.
+  // Only writes after 'version' are known afterwards. Returns false if a value
+  // cannot be parsed or modifications are not supported.
+  virtual bool ParseModificationsFromString(
+      const std::map<string, string>& modifications, uint64_t version);
 };
 
 }  // namespace state_chart
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_DATAMODEL_FACTORY_H_
+#define STATE_CHART_INTERNAL_DATAMODEL_FACTORY_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "statechart/internal/datamodel.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+class FunctionDispatcher;
+
+// Creates the datamodels of the state machines of models with one
+// 'datamodel_type', see StateMachineFactory::Options::datamodel_factories.
+// Must be thread-safe.
+class DatamodelFactory {
+ public:
+  virtual ~DatamodelFactory() = default;
+
+  // Returns the compiler of the expressions of models with this datamodel, or
+  // nullptr if their expressions are evaluated from source. The compiler must
+  // outlive this factory.
+  virtual const ExpressionCompiler* GetExpressionCompiler() const = 0;
+
+  // Returns a new empty datamodel, or nullptr on error. 'symbols' are the
+  // symbols that the expressions of the model were compiled against, may be
+  // nullptr. Does not take ownership of 'dispatcher'.
+  virtual std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const = 0;
+
+  // Same as above, but initialized from the SerializeAsString()
+  // representation 'serialized_data' with 'modifications' of the
+  // SerializeModificationsAsString() representation assigned, counting writes
+  // from 'version'. Returns nullptr if parsing fails.
+  virtual std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const = 0;
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_DATAMODEL_FACTORY_H_
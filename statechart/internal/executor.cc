@@ -24,6 +24,7 @@
 #include "absl/strings/match.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/substitute.h"
+#include "include/json/json.h"
 #include "statechart/internal/datamodel.h"
 #include "statechart/internal/event_dispatcher.h"
 #include "statechart/internal/model.h"
@@ -31,6 +32,7 @@
 #include "statechart/internal/runtime.h"
 #include "statechart/internal/utility.h"
 #include "statechart/logging.h"
+#include "statechart/platform/protobuf.h"
 #include "statechart/proto/state_chart.pb.h"
 
 DEFINE_int32(max_num_microsteps, 1000,
@@ -82,13 +84,13 @@ bool AssignStringOrEnqueueError(Runtime* runtime, const string& id,
   return true;
 }
 
-// Assign a datamodel expression to variable or enqueue an error.
+// Assign a value to variable or enqueue an error.
 // Returns true if assign was successful.
-bool AssignExpressionOrEnqueueError(Runtime* runtime, const string& id,
-                                    const string& expr) {
-  if (!runtime->mutable_datamodel()->AssignExpression(id, expr)) {
-    runtime->EnqueueExecutionError(
-        absl::StrCat("AssignExpression failed: ", id, " = ", expr));
+bool AssignValueOrEnqueueError(Runtime* runtime, const string& id,
+                               Json::Value value) {
+  if (!runtime->mutable_datamodel()->AssignValue(Expression(id),
+                                                 std::move(value))) {
+    runtime->EnqueueExecutionError(absl::StrCat("AssignValue failed: ", id));
     return false;
   }
   return true;
@@ -102,6 +104,24 @@ bool IsErrorEvent(const string& event) {
 
 }  // namespace
 
+// virtual
+void Executor::BindSystemVariables(const Model* model, Runtime* runtime) const {
+  RETURN_IF(model == nullptr || runtime == nullptr);
+  // Bind system variables according to specifications.
+  if (runtime->datamodel().HasSystemVariables()) {
+    DeclareOrEnqueueError(runtime, "_name");
+    AssignStringOrEnqueueError(runtime, "_name", model->GetName());
+    // Use runtime address as unique session id.
+    DeclareOrEnqueueError(runtime, "_sessionid");
+    AssignStringOrEnqueueError(runtime, "_sessionid",
+                               absl::Substitute("SESSION_$0", runtime));
+    // Create the event object.
+    DeclareOrEnqueueError(runtime, "_event");
+    AssignValueOrEnqueueError(runtime, "_event",
+                              Json::Value(Json::objectValue));
+  }
+}
+
 // virtual
 void Executor::Start(const Model* model, Runtime* runtime) const {
   RETURN_IF(model == nullptr || runtime == nullptr);
@@ -110,17 +130,7 @@ void Executor::Start(const Model* model, Runtime* runtime) const {
   runtime->Clear();
   runtime->SetRunning(true);
 
-  // Bind system variables according to specifications.
-  DeclareOrEnqueueError(runtime, "_name");
-  AssignStringOrEnqueueError(runtime, "_name", model->GetName());
-  // Use runtime address as unique session id.
-  DeclareOrEnqueueError(runtime, "_sessionid");
-  AssignStringOrEnqueueError(runtime, "_sessionid",
-                             absl::Substitute("SESSION_$0", runtime));
-  // Create the event object.
-  DeclareOrEnqueueError(runtime, "_event");
-  AssignExpressionOrEnqueueError(runtime, "_event",
-                                 runtime->datamodel().EncodeParameters({}));
+  BindSystemVariables(model, runtime);
 
   // There is currently no late binding support.
   if (model->GetDatamodelBinding() == config::StateChart::BINDING_EARLY) {
@@ -147,11 +157,47 @@ void Executor::SendEvent(const Model* model, Runtime* runtime,
                          const string& event, const string& payload) const {
   RETURN_IF(model == nullptr || runtime == nullptr);
   RETURN_IF(!runtime->IsRunning());
+  if (DropUnhandledEvent(model, runtime, event)) {
+    return;
+  }
 
   ProcessExternalEvent(model, runtime, event, payload);
   ExecuteUntilStable(model, runtime);
 }
 
+// virtual
+void Executor::SendMessageEvent(const Model* model, Runtime* runtime,
+                                const string& event,
+                                const proto2::Message& payload) const {
+  RETURN_IF(model == nullptr || runtime == nullptr);
+  RETURN_IF(!runtime->IsRunning());
+  if (DropUnhandledEvent(model, runtime, event)) {
+    return;
+  }
+
+  // The empty payload of ProcessExternalEvent() keeps this '_event.data'.
+  if (runtime->datamodel().HasSystemVariables() &&
+      !runtime->mutable_datamodel()->AssignMessage(Expression("_event.data"),
+                                                   payload)) {
+    runtime->EnqueueExecutionError(absl::StrCat(
+        "AssignMessage failed: _event.data = ", payload.ShortDebugString()));
+  }
+  ProcessExternalEvent(model, runtime, event, "");
+  ExecuteUntilStable(model, runtime);
+}
+
+bool Executor::DropUnhandledEvent(const Model* model, const Runtime* runtime,
+                                  const string& event) const {
+  // Pending internal events are still processed by the macrostep.
+  if (drop_unhandled_events_ && !runtime->HasInternalEvent() &&
+      !model->HasTransitionsForEvent(runtime, event)) {
+    ++num_dropped_events_;
+    VLOG(1) << "Dropped unhandled event: " << event;
+    return true;
+  }
+  return false;
+}
+
 // virtual
 void Executor::ExecuteUntilStable(const Model* model, Runtime* runtime) const {
   std::vector<const model::Transition*> transitions;
@@ -391,13 +437,22 @@ void Executor::ExitStates(
 // virtual
 void Executor::AssignEventData(Runtime* runtime, const string& event,
                                const string& payload) const {
+  // Datamodels without data, e.g., the null datamodel, have no '_event'.
+  if (!runtime->datamodel().HasSystemVariables()) {
+    return;
+  }
   // Fail early if one field assignment fails since only one error should be
   // raised.
   if (!AssignStringOrEnqueueError(runtime, "_event.name", event)) {
     return;
   }
-  if (!payload.empty()) {
-    AssignExpressionOrEnqueueError(runtime, "_event.data", payload);
+  // Most transitions do not read the payload, so the datamodel may defer
+  // parsing it until '_event.data' is accessed.
+  if (!payload.empty() &&
+      !runtime->mutable_datamodel()->AssignValueLazily(
+          Expression("_event.data"), payload)) {
+    runtime->EnqueueExecutionError(
+        absl::StrCat("AssignValueLazily failed: _event.data = ", payload));
   }
 }
 
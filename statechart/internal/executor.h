@@ -19,11 +19,19 @@
 #ifndef STATE_CHART_INTERNAL_EXECUTOR_H_
 #define STATE_CHART_INTERNAL_EXECUTOR_H_
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 #include "statechart/platform/types.h"
 
+namespace google {
+namespace protobuf {
+class Message;
+}  // namespace protobuf
+}  // namespace google
+
 namespace state_chart {
 class Model;
 class Runtime;
@@ -45,6 +53,13 @@ namespace state_chart {
 class Executor {
  public:
   Executor() = default;
+
+  // If 'drop_unhandled_events' is true, SendEvent() drops external events that
+  // no transition of the active states matches by event name. These events
+  // are neither assigned to '_event' nor start a macrostep.
+  explicit Executor(bool drop_unhandled_events)
+      : drop_unhandled_events_(drop_unhandled_events) {}
+
   Executor(const Executor&) = delete;
   Executor& operator=(const Executor&) = delete;
   virtual ~Executor() = default;
@@ -55,6 +70,12 @@ class Executor {
   // can be processed.
   virtual void Start(const Model* model, Runtime* runtime) const;
 
+  // Binds the system variables '_name', '_sessionid' and '_event' if the
+  // datamodel of 'runtime' has system variables. Start() calls this first.
+  // StateMachineFactory calls it for restored runtimes whose datamodel does
+  // not serialize the system variables; they get a new session id.
+  virtual void BindSystemVariables(const Model* model, Runtime* runtime) const;
+
   // Notify the Executor of an external event. Executes transitions based on
   // this event until the state machine reaches a stable state.
   // This corresponds to a 'macro step' in the SCXML algorithm specification.
@@ -62,6 +83,17 @@ class Executor {
   virtual void SendEvent(const Model* model, Runtime* runtime,
                          const string& event, const string& payload) const;
 
+  // Same as above, but with a protocol message as the payload, for datamodels
+  // that store messages. 'payload' is assigned to '_event.data' with
+  // Datamodel::AssignMessage() instead of being converted to JSON.
+  virtual void SendMessageEvent(const Model* model, Runtime* runtime,
+                                const string& event,
+                                const google::protobuf::Message& payload) const;
+
+  // The number of external events dropped by SendEvent() of all runtimes.
+  // Thread-safe.
+  int64_t num_dropped_events() const { return num_dropped_events_; }
+
  protected:
   // Handles all internal events until the state machine reaches a stable state.
   // This corresponds to mainEventLoop() procedure above from lines 6 to 35.
@@ -101,7 +133,8 @@ class Executor {
   // Assigns event data to the '_event' variable in the runtime's datamodel.
   // Parameters:
   //   event   The event name.
-  //   payload The event data.
+  //   payload The event data. '_event.data' is left as it is if empty, e.g.,
+  //           when SendMessageEvent() assigned it already.
   //
   // Input params 'model' & 'runtime' must be non-null.
   virtual void AssignEventData(Runtime* runtime, const string& event,
@@ -110,6 +143,15 @@ class Executor {
   // Shutdown the state machine by exiting all states in the correct order.
   // Input params 'model' & 'runtime' must be non-null.
   virtual void Shutdown(const Model* model, Runtime* runtime) const;
+
+ private:
+  // Returns true if 'event' is dropped as no transition matches it, and counts
+  // it. Input params 'model' & 'runtime' must be non-null.
+  bool DropUnhandledEvent(const Model* model, const Runtime* runtime,
+                          const string& event) const;
+
+  const bool drop_unhandled_events_ = false;
+  mutable std::atomic<int64_t> num_dropped_events_{0};
 };
 
 }  // namespace state_chart
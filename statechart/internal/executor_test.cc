@@ -149,6 +149,40 @@ TEST_F(ExecutorTest, NoTransitionsMatchedExternal) {
   SendEvent("E", "");
 }
 
+// Events that no transition matches by name are dropped if enabled.
+TEST_F(ExecutorTest, DropUnhandledEvents) {
+  NiceMock<DelegatingMockExecutor> executor(true /* drop_unhandled_events */);
+  runtime_.SetRunning(true);
+
+  EXPECT_CALL(model_, HasTransitionsForEvent(&runtime_, "E"))
+      .WillOnce(Return(false));
+  EXPECT_CALL(executor, ProcessExternalEvent(_, _, _, _)).Times(0);
+  EXPECT_CALL(executor, ExecuteUntilStable(_, _)).Times(0);
+  executor.SendEvent(&model_, &runtime_, "E", "payload");
+  EXPECT_EQ(1, executor.num_dropped_events());
+  Mock::VerifyAndClearExpectations(&executor);
+
+  EXPECT_CALL(model_, HasTransitionsForEvent(&runtime_, "F"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(executor, ProcessExternalEvent(&model_, &runtime_, "F", ""));
+  executor.SendEvent(&model_, &runtime_, "F", "");
+
+  // Events are not dropped while internal events are pending.
+  EXPECT_CALL(runtime_, HasInternalEvent())
+      .WillOnce(Return(true))
+      .WillRepeatedly(Return(false));
+  EXPECT_CALL(executor, ProcessExternalEvent(&model_, &runtime_, "G", ""));
+  executor.SendEvent(&model_, &runtime_, "G", "");
+  EXPECT_EQ(1, executor.num_dropped_events());
+
+  // Events are never dropped by default.
+  EXPECT_CALL(model_, HasTransitionsForEvent(_, _)).Times(0);
+  EXPECT_CALL(model_, GetTransitionsForEvent(&runtime_, "E"))
+      .WillOnce(Return(Transitions()));
+  SendEvent("E", "");
+  EXPECT_EQ(0, executor_.num_dropped_events());
+}
+
 // A single transition matches.
 TEST_F(ExecutorTest, SimpleAtoBMatch) {
   MockState state_A("A");
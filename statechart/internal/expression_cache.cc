@@ -0,0 +1,83 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/expression_cache.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+namespace state_chart {
+
+ExpressionCache::ExpressionCache(const ExpressionCompiler* compiler,
+                                 int capacity, int num_shards)
+    : compiler_(compiler),
+      shard_capacity_(std::max(1, capacity / std::max(1, num_shards))),
+      shards_(std::max(1, num_shards)) {}
+
+std::shared_ptr<const CompiledExpression> ExpressionCache::Get(
+    const string& source) {
+  if (!enabled_) {
+    return compiler_->Compile(source);
+  }
+  Shard& shard = shards_[std::hash<string>()(source) % shards_.size()];
+  {
+    absl::MutexLock lock(&shard.mutex);
+    const auto it = shard.index.find(source);
+    if (it != shard.index.end()) {
+      ++shard.hits;
+      shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+      return it->second->compiled;
+    }
+    ++shard.misses;
+  }
+
+  // Compiles without holding the lock. Threads that miss the same source at
+  // the same time compile it more than once, but cache it only once.
+  auto compiled = compiler_->Compile(source);
+  absl::MutexLock lock(&shard.mutex);
+  if (shard.index.contains(source)) {
+    return compiled;
+  }
+  shard.entries.push_front({source, compiled});
+  shard.index.emplace(shard.entries.front().source, shard.entries.begin());
+  if (static_cast<int>(shard.entries.size()) > shard_capacity_) {
+    shard.index.erase(shard.entries.back().source);
+    shard.entries.pop_back();
+    ++shard.evictions;
+  }
+  return compiled;
+}
+
+ExpressionCache::Stats ExpressionCache::GetStats() const {
+  Stats stats;
+  for (const Shard& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.size += shard.entries.size();
+  }
+  return stats;
+}
+
+void ExpressionCache::Clear() {
+  for (Shard& shard : shards_) {
+    absl::MutexLock lock(&shard.mutex);
+    shard.index.clear();
+    shard.entries.clear();
+  }
+}
+
+}  // namespace state_chart
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_EXPRESSION_CACHE_H_
+#define STATE_CHART_INTERNAL_EXPRESSION_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+// A thread-safe cache of the compiled forms of expressions by their source
+// text, for expressions that are only known when they are evaluated. Each
+// source is compiled once by the compiler of the cache until it is evicted.
+// Sources that the compiler leaves for evaluation from source are cached as
+// well, so they are not compiled again either.
+//
+// The entries are split over shards by the hash of their source. Each shard
+// has its own lock and evicts its least recently used entries when it is full.
+class ExpressionCache {
+ public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    int size = 0;
+  };
+
+  // Does not take ownership of 'compiler', which must outlive this object.
+  // The cache holds at most 'capacity' entries in 'num_shards' shards.
+  ExpressionCache(const ExpressionCompiler* compiler, int capacity,
+                  int num_shards);
+  ExpressionCache(const ExpressionCache&) = delete;
+  ExpressionCache& operator=(const ExpressionCache&) = delete;
+  ~ExpressionCache() = default;
+
+  // Returns the compiled form of 'source', or nullptr if it is evaluated from
+  // source. Compiles 'source' if it is not cached or the cache is disabled.
+  std::shared_ptr<const CompiledExpression> Get(const string& source);
+
+  // A disabled cache compiles every source and does not count hits or misses.
+  // Disabling the cache does not clear it.
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  int capacity() const {
+    return shard_capacity_ * static_cast<int>(shards_.size());
+  }
+
+  // The sums of the counters of all shards.
+  Stats GetStats() const;
+
+  // Removes all entries. Does not reset the counters.
+  void Clear();
+
+ private:
+  struct Entry {
+    string source;
+    std::shared_ptr<const CompiledExpression> compiled;
+  };
+
+  struct Shard {
+    // Guards the other members.
+    mutable absl::Mutex mutex;
+    // The entries from the most to the least recently used.
+    std::list<Entry> entries;
+    // The entries by their sources, which are owned by 'entries'.
+    absl::flat_hash_map<absl::string_view, std::list<Entry>::iterator> index;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+  };
+
+  const ExpressionCompiler* const compiler_;
+  const int shard_capacity_;
+  std::vector<Shard> shards_;
+  std::atomic<bool> enabled_{true};
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_EXPRESSION_CACHE_H_
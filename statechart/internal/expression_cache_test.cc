@@ -0,0 +1,130 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/expression_cache.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/light_weight_expression.h"
+
+namespace state_chart {
+namespace {
+
+// Counts the compiled expressions of a LightWeightBytecodeCompiler.
+class CountingCompiler : public ExpressionCompiler {
+ public:
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const override {
+    ++compiled_;
+    return compiler_.Compile(expr);
+  }
+
+  int compiled() const { return compiled_; }
+
+ private:
+  LightWeightBytecodeCompiler compiler_;
+  mutable std::atomic<int> compiled_{0};
+};
+
+TEST(ExpressionCacheTest, CompilesEachSourceOnce) {
+  CountingCompiler compiler;
+  ExpressionCache cache(&compiler, 8, 2);
+  EXPECT_EQ(8, cache.capacity());
+
+  const auto compiled = cache.Get("a + 1");
+  ASSERT_NE(nullptr, compiled);
+  EXPECT_EQ(compiled, cache.Get("a + 1"));
+  // Sources that are left for evaluation from source are cached as well.
+  EXPECT_EQ(nullptr, cache.Get("a +"));
+  EXPECT_EQ(nullptr, cache.Get("a +"));
+  EXPECT_EQ(2, compiler.compiled());
+
+  ExpressionCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(2, stats.hits);
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(0, stats.evictions);
+  EXPECT_EQ(2, stats.size);
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.GetStats().size);
+  EXPECT_NE(compiled, cache.Get("a + 1"));
+  EXPECT_EQ(3, compiler.compiled());
+}
+
+TEST(ExpressionCacheTest, EvictsLeastRecentlyUsed) {
+  CountingCompiler compiler;
+  ExpressionCache cache(&compiler, 2, 1);
+  const auto a = cache.Get("a");
+  cache.Get("b");
+  EXPECT_EQ(a, cache.Get("a"));
+  cache.Get("c");
+  ExpressionCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(1, stats.evictions);
+  EXPECT_EQ(2, stats.size);
+
+  // "b" was evicted, "a" was not.
+  EXPECT_EQ(a, cache.Get("a"));
+  EXPECT_EQ(3, compiler.compiled());
+  cache.Get("b");
+  EXPECT_EQ(4, compiler.compiled());
+  EXPECT_EQ(2, cache.GetStats().evictions);
+}
+
+TEST(ExpressionCacheTest, Disabled) {
+  CountingCompiler compiler;
+  ExpressionCache cache(&compiler, 8, 2);
+  cache.Get("a");
+  cache.set_enabled(false);
+  EXPECT_FALSE(cache.enabled());
+  EXPECT_NE(nullptr, cache.Get("a"));
+  EXPECT_NE(nullptr, cache.Get("b"));
+  EXPECT_EQ(3, compiler.compiled());
+  ExpressionCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(0, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  EXPECT_EQ(1, stats.size);
+
+  cache.set_enabled(true);
+  cache.Get("a");
+  EXPECT_EQ(1, cache.GetStats().hits);
+}
+
+TEST(ExpressionCacheTest, ThreadSafe) {
+  CountingCompiler compiler;
+  ExpressionCache cache(&compiler, 16, 4);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&cache] {
+      for (int j = 0; j < 1000; ++j) {
+        EXPECT_NE(nullptr, cache.Get("x" + std::to_string(j % 32)));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const ExpressionCache::Stats stats = cache.GetStats();
+  EXPECT_EQ(4000, stats.hits + stats.misses);
+  EXPECT_LE(stats.size, cache.capacity());
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -35,5 +35,16 @@ int FindFirstWithKeyValue(const Json::Value& array, const string& key,
   return -1;
 }
 
+Json::Value LookupByKey(const Json::Value& array, const string& key,
+                        const Json::Value& value) {
+  const int index = FindFirstWithKeyValue(array, key, value);
+  return index < 0 ? Json::Value() : array[index];
+}
+
+bool ContainsKeyValue(const Json::Value& array, const string& key,
+                      const Json::Value& value) {
+  return FindFirstWithKeyValue(array, key, value) >= 0;
+}
+
 }  // namespace builtin
 }  // namespace state_chart
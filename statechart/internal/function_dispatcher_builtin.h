@@ -45,6 +45,16 @@ bool ContainsKey(const Json::Value& value, const string& field_name);
 int FindFirstWithKeyValue(const Json::Value& array, const string& key,
                           const Json::Value& value);
 
+// Returns the first object in 'array' with the <key, value> pair as for
+// FindFirstWithKeyValue(), or null if there is none.
+Json::Value LookupByKey(const Json::Value& array, const string& key,
+                        const Json::Value& value);
+
+// Returns whether an object in 'array' has the <key, value> pair, i.e.,
+// whether FindFirstWithKeyValue() finds one.
+bool ContainsKeyValue(const Json::Value& array, const string& key,
+                      const Json::Value& value);
+
 }  // namespace builtin
 }  // namespace state_chart
 
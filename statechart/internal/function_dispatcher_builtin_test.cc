@@ -58,6 +58,24 @@ TEST(FunctionDispatcherBuiltins, FindFirstWithKeyValue) {
   EXPECT_EQ(-1, FindFirstWithKeyValue(value, "K3.lower", "l"));
 }
 
+TEST(FunctionDispatcherBuiltins, LookupByKey) {
+  Json::Reader reader;
+  Json::Value value;
+  CHECK(reader.parse(R"([ { "id" : 1, "name" : "a" },
+                          { "id" : 2, "name" : "b" },
+                          { "id" : 2, "name" : "c" } ])",
+                     value));
+
+  EXPECT_EQ("b", LookupByKey(value, "id", 2)["name"].asString());
+  EXPECT_TRUE(LookupByKey(value, "id", 3).isNull());
+  EXPECT_TRUE(LookupByKey(value, "id", "1").isNull());
+  EXPECT_TRUE(LookupByKey(Json::Value("id"), "id", 1).isNull());
+
+  EXPECT_TRUE(ContainsKeyValue(value, "name", "c"));
+  EXPECT_FALSE(ContainsKeyValue(value, "name", "d"));
+  EXPECT_FALSE(ContainsKeyValue(value, "other", 1));
+}
+
 }  // namespace
 }  // namespace builtin
 }  // namespace state_chart
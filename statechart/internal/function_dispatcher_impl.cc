@@ -17,6 +17,7 @@
 #include <glog/logging.h>
 
 #include "statechart/internal/function_dispatcher_builtin.h"
+#include "statechart/internal/json_text.h"
 #include "statechart/platform/map_util.h"
 
 namespace state_chart {
@@ -27,7 +28,7 @@ std::vector<string> JsonValuesToStrings(
     const std::vector<const Json::Value*>& values) {
   std::vector<string> json_strs;
   for (const auto* json_value : values) {
-    json_strs.push_back(Json::FastWriter().write(*json_value));
+    json_strs.push_back(ToJsonText(*json_value));
   }
   return json_strs;
 }
@@ -37,6 +38,8 @@ std::vector<string> JsonValuesToStrings(
 FunctionDispatcherImpl::FunctionDispatcherImpl() {
   RegisterFunction("ContainsKey", &builtin::ContainsKey);
   RegisterFunction("FindFirstWithKeyValue", &builtin::FindFirstWithKeyValue);
+  RegisterFunction("LookupByKey", &builtin::LookupByKey);
+  RegisterFunction("ContainsKeyValue", &builtin::ContainsKeyValue);
 }
 
 FunctionDispatcherImpl::FunctionDispatcherImpl(
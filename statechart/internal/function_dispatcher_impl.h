@@ -40,8 +40,7 @@ namespace state_chart {
 
 namespace internal {
 
-// Convert a vector of JSON value pointers to JSON strings formatted by
-// Json::FastWriter.
+// Convert a vector of JSON value pointers to compact JSON strings.
 std::vector<string> JsonValuesToStrings(
     const std::vector<const Json::Value*>& values);
 
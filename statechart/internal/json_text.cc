@@ -0,0 +1,755 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/json_text.h"
+
+#include <cmath>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "statechart/internal/char_set.h"
+
+namespace state_chart {
+namespace {
+
+// Buffers larger than this are not kept for reuse.
+constexpr size_t kMaxReusedBufferSize = 1 << 16;
+
+void AppendDouble(double value, string* output) {
+  // The same as Json::FastWriter for values that JSON cannot represent.
+  if (std::isnan(value)) {
+    output->append("null");
+    return;
+  }
+  if (std::isinf(value)) {
+    output->append(value < 0 ? "-1e+9999" : "1e+9999");
+    return;
+  }
+  // 17 significant digits, as Json::FastWriter writes doubles, e.g., "-1" and
+  // "0.10000000000000001". absl formats independently of the locale.
+  char buffer[32];
+  const int size = absl::SNPrintF(buffer, sizeof(buffer), "%.17g", value);
+  output->append(buffer, size);
+}
+
+// The nesting depth from which texts are left to Json::Reader, which limits
+// the depth of its stack to this.
+constexpr int kMaxParsedDepth = 1000;
+
+// Converts the Json::uintValue integers in 'value' that fit into
+// Json::Value::LargestInt into Json::intValue. Older versions of
+// Json::Reader read integers above Json::Value::maxInt as Json::uintValue,
+// newer ones as Json::intValue if they fit.
+void NormalizeIntegers(Json::Value* value) {
+  switch (value->type()) {
+    case Json::uintValue:
+      if (value->asLargestUInt() <=
+          Json::Value::LargestUInt(Json::Value::maxLargestInt)) {
+        *value = Json::Value(Json::Value::LargestInt(value->asLargestUInt()));
+      }
+      return;
+    case Json::arrayValue:
+    case Json::objectValue:
+      for (Json::Value& element : *value) {
+        NormalizeIntegers(&element);
+      }
+      return;
+    default:
+      return;
+  }
+}
+
+// Returns the first quote or backslash in [begin, end), or 'end'. Most
+// characters of strings need no escaping, so they are skipped 16 or 32 at a
+// time.
+const char* FindQuoteOrBackslash(const char* begin, const char* end) {
+  static const internal::CharSet* const kQuoteOrBackslash =
+      new internal::CharSet("\"\\");
+  return kQuoteOrBackslash->FindFirstIn(begin, end);
+}
+
+// Returns the first character in [begin, end) that is not JSON whitespace, or
+// 'end'. Values are mostly separated by no or a single space, which is checked
+// before the whitespace of indented texts is skipped many characters at a
+// time.
+const char* SkipWhitespace(const char* begin, const char* end) {
+  static const internal::CharSet* const kWhitespace =
+      new internal::CharSet(" \n\r\t");
+  if (begin != end && !kWhitespace->Contains(*begin)) {
+    return begin;
+  }
+  if (end - begin > 1 && !kWhitespace->Contains(begin[1])) {
+    return begin + 1;
+  }
+  return kWhitespace->FindFirstNotIn(begin, end);
+}
+
+// Parses strict JSON directly into Json values. Texts that Json::Reader may
+// read differently or only with errors are rejected, so that they are left to
+// it.
+class StrictJsonParser {
+ public:
+  StrictJsonParser(const char* begin, const char* end)
+      : current_(begin), end_(end) {}
+
+  // Parses the whole text into 'value'. Returns false if the text is
+  // rejected, in which case 'value' is undefined.
+  bool Parse(Json::Value* value) {
+    SkipSpaces();
+    if (!ParseValue(value, 0)) {
+      return false;
+    }
+    SkipSpaces();
+    return current_ == end_;
+  }
+
+ private:
+  void SkipSpaces() { current_ = SkipWhitespace(current_, end_); }
+
+  // Consumes 'c' if it is the next character.
+  bool Consume(char c) {
+    if (current_ == end_ || *current_ != c) {
+      return false;
+    }
+    ++current_;
+    return true;
+  }
+
+  bool ParseValue(Json::Value* value, int depth) {
+    if (current_ == end_) {
+      return false;
+    }
+    switch (*current_) {
+      case '{':
+        return depth < kMaxParsedDepth && ParseObject(value, depth);
+      case '[':
+        return depth < kMaxParsedDepth && ParseArray(value, depth);
+      case '"':
+        return ParseString(value);
+      case 't':
+        *value = Json::Value(true);
+        return ParseKeyword("true");
+      case 'f':
+        *value = Json::Value(false);
+        return ParseKeyword("false");
+      case 'n':
+        *value = Json::Value();
+        return ParseKeyword("null");
+      default:
+        return ParseNumber(value);
+    }
+  }
+
+  bool ParseKeyword(absl::string_view keyword) {
+    if (static_cast<size_t>(end_ - current_) < keyword.size() ||
+        absl::string_view(current_, keyword.size()) != keyword) {
+      return false;
+    }
+    current_ += keyword.size();
+    return true;
+  }
+
+  bool ParseObject(Json::Value* value, int depth) {
+    ++current_;
+    *value = Json::Value(Json::objectValue);
+    SkipSpaces();
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      SkipSpaces();
+      if (!Consume('"') || !ParseStringContents(&key_)) {
+        return false;
+      }
+      SkipSpaces();
+      if (!Consume(':')) {
+        return false;
+      }
+      SkipSpaces();
+      // Later members replace earlier ones of the same name, as in
+      // Json::Reader.
+      if (!ParseValue(&(*value)[key_], depth + 1)) {
+        return false;
+      }
+      SkipSpaces();
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  bool ParseArray(Json::Value* value, int depth) {
+    ++current_;
+    *value = Json::Value(Json::arrayValue);
+    SkipSpaces();
+    if (Consume(']')) {
+      return true;
+    }
+    do {
+      SkipSpaces();
+      if (!ParseValue(&value->append(Json::Value()), depth + 1)) {
+        return false;
+      }
+      SkipSpaces();
+    } while (Consume(','));
+    return Consume(']');
+  }
+
+  bool ParseString(Json::Value* value) {
+    ++current_;
+    // Strings without escapes are copied from the text at once.
+    const char* begin = current_;
+    const char* end = FindQuoteOrBackslash(begin, end_);
+    if (end != end_ && *end == '"') {
+      *value = Json::Value(begin, end);
+      current_ = end + 1;
+      return true;
+    }
+    if (!ParseStringContents(&string_)) {
+      return false;
+    }
+    *value = Json::Value(string_);
+    return true;
+  }
+
+  // Parses the characters of a string after its opening quote into
+  // 'contents'. Unescaped control characters are kept, as by Json::Reader.
+  bool ParseStringContents(string* contents) {
+    contents->clear();
+    while (true) {
+      const char* end = FindQuoteOrBackslash(current_, end_);
+      contents->append(current_, end);
+      current_ = end;
+      if (current_ == end_) {
+        return false;
+      }
+      if (*current_++ == '"') {
+        return true;
+      }
+      if (current_ == end_) {
+        return false;
+      }
+      switch (*current_++) {
+        case '"':
+          contents->push_back('"');
+          break;
+        case '\\':
+          contents->push_back('\\');
+          break;
+        case '/':
+          contents->push_back('/');
+          break;
+        case 'b':
+          contents->push_back('\b');
+          break;
+        case 'f':
+          contents->push_back('\f');
+          break;
+        case 'n':
+          contents->push_back('\n');
+          break;
+        case 'r':
+          contents->push_back('\r');
+          break;
+        case 't':
+          contents->push_back('\t');
+          break;
+        case 'u':
+          if (!ParseCodePoint(contents)) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+
+  // Parses the four hex digits after "\\u" and appends the code point as
+  // UTF-8. Surrogates are left to Json::Reader.
+  bool ParseCodePoint(string* contents) {
+    if (end_ - current_ < 4) {
+      return false;
+    }
+    unsigned int code_point = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char c = *current_++;
+      code_point <<= 4;
+      if (c >= '0' && c <= '9') {
+        code_point |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        code_point |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        code_point |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    if (code_point < 0x80) {
+      contents->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      contents->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      contents->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0xD800 || code_point > 0xDFFF) {
+      contents->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      contents->push_back(
+          static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      contents->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  // Parses a number into a Json::intValue if it is an integer that fits into
+  // Json::Value::LargestInt, into a Json::uintValue if it fits into
+  // Json::Value::LargestUInt and into a Json::realValue otherwise.
+  bool ParseNumber(Json::Value* value) {
+    const char* begin = current_;
+    const bool negative = Consume('-');
+    const char* digits = current_;
+    while (current_ != end_ && *current_ >= '0' && *current_ <= '9') {
+      ++current_;
+    }
+    // No digits or leading zeros, which JSON does not allow.
+    if (current_ == digits || (*digits == '0' && current_ - digits > 1)) {
+      return false;
+    }
+    bool is_double = false;
+    if (Consume('.')) {
+      is_double = true;
+      if (!ParseDigits()) {
+        return false;
+      }
+    }
+    if (Consume('e') || Consume('E')) {
+      is_double = true;
+      if (!Consume('+')) {
+        Consume('-');
+      }
+      if (!ParseDigits()) {
+        return false;
+      }
+    }
+    if (!is_double && ParseInteger(digits, negative, value)) {
+      return true;
+    }
+    // The text is a JSON number, so it has none of the whitespace, signs or
+    // words that absl::SimpleAtod() accepts besides numbers.
+    double number = 0;
+    if (!absl::SimpleAtod(absl::string_view(begin, current_ - begin),
+                          &number)) {
+      return false;
+    }
+    // Values out of range, i.e., infinities, subnormal values and zeros that
+    // are not written as zero, are left to Json::Reader, which may read them
+    // differently.
+    if (std::isinf(number) || std::fpclassify(number) == FP_SUBNORMAL ||
+        (number == 0 && !IsZero(begin, current_))) {
+      return false;
+    }
+    *value = Json::Value(number);
+    return true;
+  }
+
+  // Whether the mantissa of the number in [begin, end) is zero.
+  static bool IsZero(const char* begin, const char* end) {
+    for (; begin != end && *begin != 'e' && *begin != 'E'; ++begin) {
+      if (*begin >= '1' && *begin <= '9') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool ParseDigits() {
+    const char* begin = current_;
+    while (current_ != end_ && *current_ >= '0' && *current_ <= '9') {
+      ++current_;
+    }
+    return current_ != begin;
+  }
+
+  // Parses the digits in [digits, current_) as an integer. Returns false if
+  // it does not fit into an integer value, in which case Json::Reader reads
+  // it as a double.
+  bool ParseInteger(const char* digits, bool negative, Json::Value* value) {
+    const Json::Value::LargestUInt limit =
+        negative ? Json::Value::LargestUInt(Json::Value::maxLargestInt) + 1
+                 : Json::Value::maxLargestUInt;
+    Json::Value::LargestUInt magnitude = 0;
+    for (const char* c = digits; c != current_; ++c) {
+      const unsigned int digit = *c - '0';
+      if (magnitude > (limit - digit) / 10) {
+        return false;
+      }
+      magnitude = magnitude * 10 + digit;
+    }
+    if (negative) {
+      *value = magnitude == limit
+                   ? Json::Value(Json::Value::minLargestInt)
+                   : Json::Value(-Json::Value::LargestInt(magnitude));
+    } else if (magnitude <=
+               Json::Value::LargestUInt(Json::Value::maxLargestInt)) {
+      *value = Json::Value(Json::Value::LargestInt(magnitude));
+    } else {
+      *value = Json::Value(magnitude);
+    }
+    return true;
+  }
+
+  const char* current_;
+  const char* const end_;
+  // Buffers of the contents of keys and of strings with escapes.
+  string key_;
+  string string_;
+};
+
+// Checks that a text is JSON without parsing it into values, so that it does
+// not allocate. Texts that StrictJsonParser or Json::Reader may reject even
+// though they are JSON, e.g., surrogate escapes and numbers out of the range
+// of doubles, are rejected.
+class JsonSyntaxChecker {
+ public:
+  JsonSyntaxChecker(const char* begin, const char* end)
+      : current_(begin), end_(end) {}
+
+  bool Check() {
+    SkipSpaces();
+    if (!CheckValue(0)) {
+      return false;
+    }
+    SkipSpaces();
+    return current_ == end_;
+  }
+
+ private:
+  void SkipSpaces() { current_ = SkipWhitespace(current_, end_); }
+
+  bool Consume(char c) {
+    if (current_ == end_ || *current_ != c) {
+      return false;
+    }
+    ++current_;
+    return true;
+  }
+
+  bool CheckValue(int depth) {
+    if (current_ == end_) {
+      return false;
+    }
+    switch (*current_) {
+      case '{':
+      case '[':
+        return depth < kMaxParsedDepth && CheckContainer(depth);
+      case '"':
+        ++current_;
+        return CheckString();
+      case 't':
+        return CheckKeyword("true");
+      case 'f':
+        return CheckKeyword("false");
+      case 'n':
+        return CheckKeyword("null");
+      default:
+        return CheckNumber();
+    }
+  }
+
+  bool CheckKeyword(absl::string_view keyword) {
+    if (static_cast<size_t>(end_ - current_) < keyword.size() ||
+        absl::string_view(current_, keyword.size()) != keyword) {
+      return false;
+    }
+    current_ += keyword.size();
+    return true;
+  }
+
+  bool CheckContainer(int depth) {
+    const bool is_object = *current_++ == '{';
+    const char closing = is_object ? '}' : ']';
+    SkipSpaces();
+    if (Consume(closing)) {
+      return true;
+    }
+    do {
+      SkipSpaces();
+      if (is_object) {
+        if (!Consume('"') || !CheckString()) {
+          return false;
+        }
+        SkipSpaces();
+        if (!Consume(':')) {
+          return false;
+        }
+        SkipSpaces();
+      }
+      if (!CheckValue(depth + 1)) {
+        return false;
+      }
+      SkipSpaces();
+    } while (Consume(','));
+    return Consume(closing);
+  }
+
+  // Checks the characters of a string after its opening quote.
+  bool CheckString() {
+    while (true) {
+      current_ = FindQuoteOrBackslash(current_, end_);
+      if (current_ == end_) {
+        return false;
+      }
+      if (*current_++ == '"') {
+        return true;
+      }
+      if (current_ == end_) {
+        return false;
+      }
+      switch (*current_++) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+          break;
+        case 'u':
+          if (!CheckCodePoint()) {
+            return false;
+          }
+          break;
+        default:
+          return false;
+      }
+    }
+  }
+
+  bool CheckCodePoint() {
+    if (end_ - current_ < 4) {
+      return false;
+    }
+    unsigned int code_point = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char c = *current_++;
+      code_point <<= 4;
+      if (c >= '0' && c <= '9') {
+        code_point |= c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        code_point |= c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        code_point |= c - 'A' + 10;
+      } else {
+        return false;
+      }
+    }
+    return code_point < 0xD800 || code_point > 0xDFFF;
+  }
+
+  bool CheckNumber() {
+    const char* begin = current_;
+    Consume('-');
+    const char* digits = current_;
+    if (!CheckDigits() || (*digits == '0' && current_ - digits > 1)) {
+      return false;
+    }
+    bool is_double = false;
+    if (Consume('.')) {
+      is_double = true;
+      if (!CheckDigits()) {
+        return false;
+      }
+    }
+    if (Consume('e') || Consume('E')) {
+      is_double = true;
+      if (!Consume('+')) {
+        Consume('-');
+      }
+      if (!CheckDigits()) {
+        return false;
+      }
+    }
+    double number = 0;
+    return !is_double ||
+           (absl::SimpleAtod(absl::string_view(begin, current_ - begin),
+                             &number) &&
+            !std::isinf(number));
+  }
+
+  bool CheckDigits() {
+    const char* begin = current_;
+    while (current_ != end_ && *current_ >= '0' && *current_ <= '9') {
+      ++current_;
+    }
+    return current_ != begin;
+  }
+
+  const char* current_;
+  const char* const end_;
+};
+
+}  // namespace
+
+void AppendJsonText(const Json::Value& value, string* output) {
+  switch (value.type()) {
+    case Json::nullValue:
+      output->append("null");
+      return;
+    case Json::intValue:
+      absl::StrAppend(output, value.asLargestInt());
+      return;
+    case Json::uintValue:
+      absl::StrAppend(output, value.asLargestUInt());
+      return;
+    case Json::realValue:
+      AppendDouble(value.asDouble(), output);
+      return;
+    case Json::booleanValue:
+      output->append(value.asBool() ? "true" : "false");
+      return;
+    case Json::stringValue: {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      if (value.getString(&begin, &end)) {
+        AppendQuotedJsonString(begin, end, output);
+      } else {
+        output->append("\"\"");
+      }
+      return;
+    }
+    case Json::arrayValue: {
+      output->push_back('[');
+      const int size = value.size();
+      for (int i = 0; i < size; ++i) {
+        if (i > 0) {
+          output->push_back(',');
+        }
+        AppendJsonText(value[i], output);
+      }
+      output->push_back(']');
+      return;
+    }
+    case Json::objectValue: {
+      output->push_back('{');
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        if (it != value.begin()) {
+          output->push_back(',');
+        }
+        const char* end = nullptr;
+        const char* begin = it.memberName(&end);
+        AppendQuotedJsonString(begin, end, output);
+        output->push_back(':');
+        AppendJsonText(*it, output);
+      }
+      output->push_back('}');
+      return;
+    }
+  }
+}
+
+string ToJsonText(const Json::Value& value) {
+  if (!value.isObject() && !value.isArray()) {
+    string text;
+    AppendJsonText(value, &text);
+    return text;
+  }
+  thread_local string buffer;
+  buffer.clear();
+  AppendJsonText(value, &buffer);
+  string text = buffer;
+  if (buffer.capacity() > kMaxReusedBufferSize) {
+    string().swap(buffer);
+  }
+  return text;
+}
+
+void AppendQuotedJsonString(const char* begin, const char* end,
+                            string* output) {
+  static const char kHexDigits[] = "0123456789ABCDEF";
+  // The control characters, quote and backslash.
+  static const internal::CharSet* const kEscapedChars = [] {
+    string chars = "\"\\";
+    for (char c = 0; c < 0x20; ++c) {
+      chars.push_back(c);
+    }
+    return new internal::CharSet(chars);
+  }();
+  output->push_back('"');
+  // Copies the characters that need no escaping in runs.
+  const char* run = begin;
+  for (const char* c = kEscapedChars->FindFirstIn(begin, end); c != end;
+       c = kEscapedChars->FindFirstIn(c + 1, end)) {
+    const unsigned char ch = *c;
+    output->append(run, c);
+    run = c + 1;
+    switch (ch) {
+      case '"':
+        output->append("\\\"");
+        break;
+      case '\\':
+        output->append("\\\\");
+        break;
+      case '\b':
+        output->append("\\b");
+        break;
+      case '\f':
+        output->append("\\f");
+        break;
+      case '\n':
+        output->append("\\n");
+        break;
+      case '\r':
+        output->append("\\r");
+        break;
+      case '\t':
+        output->append("\\t");
+        break;
+      default:
+        output->append("\\u00");
+        output->push_back(kHexDigits[ch >> 4]);
+        output->push_back(kHexDigits[ch & 0xF]);
+        break;
+    }
+  }
+  output->append(run, end);
+  output->push_back('"');
+}
+
+bool ParseJsonText(absl::string_view text, const Json::Features& features,
+                   Json::Value* value, string* error) {
+  if (StrictJsonParser(text.data(), text.data() + text.size()).Parse(value) &&
+      (!features.strictRoot_ || value->isObject() || value->isArray())) {
+    return true;
+  }
+  Json::Reader reader(features);
+  if (reader.parse(text.data(), text.data() + text.size(), *value,
+                   false /* collectComments */)) {
+    NormalizeIntegers(value);
+    return true;
+  }
+  if (error != nullptr) {
+    *error = reader.getFormattedErrorMessages();
+  }
+  return false;
+}
+
+bool ParseJsonText(absl::string_view text, Json::Value* value) {
+  return ParseJsonText(text, Json::Features::all(), value, nullptr);
+}
+
+bool IsJsonText(absl::string_view text) {
+  return JsonSyntaxChecker(text.data(), text.data() + text.size()).Check();
+}
+
+}  // namespace state_chart
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Formatting of Json values as compact JSON text, which datamodels use as the
+// text of value expressions, and parsing of JSON text into Json values.
+
+#ifndef STATE_CHART_INTERNAL_JSON_TEXT_H_
+#define STATE_CHART_INTERNAL_JSON_TEXT_H_
+
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "include/json/json.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+// Appends the compact JSON text of 'value' to 'output'. The text is the same
+// as Json::FastWriter of jsoncpp 1.7.6, which the WORKSPACE pins, writes
+// without its trailing newline. Doubles are written with 17 significant
+// digits, so integral doubles have no fraction, e.g., "-1".
+void AppendJsonText(const Json::Value& value, string* output);
+
+// Returns the compact JSON text of 'value'. Objects and arrays are written to
+// a buffer that is reused by the calls of a thread, so that the text is
+// allocated only once.
+string ToJsonText(const Json::Value& value);
+
+// Appends the characters in [begin, end) as a JSON string literal to 'output'.
+// Quotes, backslashes and control characters are escaped, other characters
+// are copied.
+void AppendQuotedJsonString(const char* begin, const char* end,
+                            string* output);
+
+// Parses 'text' into 'value' with the same result as Json::Reader with
+// 'features' and without comments. Returns false if 'text' is not valid and
+// sets 'error' to the errors of Json::Reader unless it is nullptr. Integers
+// that fit into Json::Value::LargestInt are always read as Json::intValue,
+// larger ones as Json::uintValue, whichever version of jsoncpp is used.
+//
+// Texts that are strict JSON, as event payloads and serialized datamodels
+// are, are parsed directly into 'value', several times faster than by
+// Json::Reader. Everything else, e.g., comments, trailing text or numbers
+// that Json::Reader reads differently than JSON does, is left to
+// Json::Reader.
+bool ParseJsonText(absl::string_view text, const Json::Features& features,
+                   Json::Value* value, string* error);
+
+// Same as above with Json::Features::all(), which is the default of
+// Json::Reader.
+bool ParseJsonText(absl::string_view text, Json::Value* value);
+
+// Returns true if 'text' is JSON that ParseJsonText() parses, without
+// parsing it into values. This is several times faster than parsing and does
+// not allocate. A few texts that are JSON are rejected, e.g., those with
+// escaped surrogates, numbers that overflow doubles or very deep nesting.
+bool IsJsonText(absl::string_view text);
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_JSON_TEXT_H_
@@ -0,0 +1,225 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/json_text.h"
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include "absl/strings/str_cat.h"
+#include "include/json/json.h"
+
+namespace state_chart {
+namespace {
+
+Json::Value Parse(const string& text) {
+  Json::Value value;
+  EXPECT_TRUE(Json::Reader().parse(text, value, false)) << text;
+  return value;
+}
+
+TEST(JsonTextTest, WritesScalars) {
+  EXPECT_EQ("null", ToJsonText(Json::Value()));
+  EXPECT_EQ("true", ToJsonText(Json::Value(true)));
+  EXPECT_EQ("-42", ToJsonText(Json::Value(-42)));
+  EXPECT_EQ("18446744073709551615",
+            ToJsonText(Json::Value(std::numeric_limits<Json::UInt64>::max())));
+  EXPECT_EQ("-9223372036854775808",
+            ToJsonText(Json::Value(std::numeric_limits<Json::Int64>::min())));
+  EXPECT_EQ("\"a\"", ToJsonText(Json::Value("a")));
+  EXPECT_EQ("\"\"", ToJsonText(Json::Value("")));
+}
+
+TEST(JsonTextTest, WritesDoublesAsFastWriter) {
+  // Json::FastWriter of jsoncpp 1.7.6 writes 17 significant digits.
+  EXPECT_EQ("0.10000000000000001", ToJsonText(Json::Value(0.1)));
+  EXPECT_EQ("-1", ToJsonText(Json::Value(-1.0)));
+  EXPECT_EQ("0", ToJsonText(Json::Value(0.0)));
+  EXPECT_EQ("2.5", ToJsonText(Json::Value(2.5)));
+  EXPECT_EQ("1.0000000000000001e+300", ToJsonText(Json::Value(1e300)));
+  EXPECT_EQ("0.33333333333333331", ToJsonText(Json::Value(1.0 / 3)));
+  EXPECT_EQ("null", ToJsonText(Json::Value(std::nan(""))));
+  EXPECT_EQ("-1e+9999", ToJsonText(Json::Value(-HUGE_VAL)));
+
+  // Doubles parse back to the same value.
+  for (double value : {0.1, 1.0 / 3, -2.2250738585072014e-308, 123456.789}) {
+    EXPECT_EQ(value, Parse(ToJsonText(Json::Value(value))).asDouble());
+  }
+}
+
+TEST(JsonTextTest, EscapesStrings) {
+  const string text("q\"b\\s/\b\f\n\r\t\x01\x1f\xc3\xa9");
+  EXPECT_EQ(R"("q\"b\\s/\b\f\n\r\t\u0001\u001F)"
+            "\xc3\xa9\"",
+            ToJsonText(Json::Value(text)));
+  EXPECT_EQ(text,
+            Parse("[" + ToJsonText(Json::Value(text)) + "]")[0].asString());
+
+  string output = "x";
+  const string nul("a\0b", 3);
+  AppendQuotedJsonString(nul.data(), nul.data() + nul.size(), &output);
+  EXPECT_EQ(R"(x"a\u0000b")", output);
+}
+
+TEST(JsonTextTest, EscapesLongStrings) {
+  // Characters to escape at and around the ends of the scanned vectors.
+  const std::pair<char, const char*> kEscapes[] = {
+      {'"', R"(\")"},
+      {'\\', R"(\\)"},
+      {'\n', R"(\n)"},
+      {'\x1f', R"(\u001F)"},
+  };
+  for (const size_t pos : {0, 15, 16, 31, 32, 33, 63, 64, 99}) {
+    for (const auto& escape : kEscapes) {
+      string text(100, 'x');
+      text[pos] = escape.first;
+      const string json = ToJsonText(Json::Value(text));
+      EXPECT_EQ(absl::StrCat("\"", string(pos, 'x'), escape.second,
+                             string(99 - pos, 'x'), "\""),
+                json);
+      Json::Value value;
+      ASSERT_TRUE(ParseJsonText(json, &value)) << json;
+      EXPECT_EQ(text, value.asString());
+      EXPECT_TRUE(IsJsonText(json)) << json;
+    }
+  }
+}
+
+TEST(JsonTextTest, WritesContainersAsFastWriter) {
+  for (const char* text :
+       {"[]", "{}", R"({"b":[1,"x",{"c":null}],"a":{"":true},"\"":-3})",
+        R"([[],[{}],"\n",2,false])"}) {
+    const Json::Value value = Parse(text);
+    string expected = Json::FastWriter().write(value);
+    expected.pop_back();
+    EXPECT_EQ(expected, ToJsonText(value));
+    string output = "=";
+    AppendJsonText(value, &output);
+    EXPECT_EQ("=" + expected, output);
+  }
+}
+
+// Expects ParseJsonText() to read 'text' the same as Json::Reader.
+void ExpectParsedAsByReader(const string& text,
+                            const Json::Features& features) {
+  Json::Value expected;
+  const bool parsed = Json::Reader(features).parse(text, expected, false);
+  Json::Value value;
+  string error;
+  EXPECT_EQ(parsed, ParseJsonText(text, features, &value, &error)) << text;
+  if (parsed) {
+    EXPECT_EQ(expected, value) << text;
+    EXPECT_EQ(expected.type(), value.type()) << text;
+    EXPECT_EQ(ToJsonText(expected), ToJsonText(value)) << text;
+  } else {
+    EXPECT_FALSE(error.empty()) << text;
+  }
+}
+
+TEST(JsonTextTest, ParsesAsReader) {
+  for (const char* text : {
+           "null", " true ", "false", "0", "-0", "42", "-42", "2147483647",
+           "-2147483648", "-2147483649", "-9223372036854775808",
+           "-9223372036854775809", "18446744073709551616", "0.5", "-1.25e-3",
+           "1E10", "1e+2", "0e5", "1e400", "1e-400", "4.9e-324",
+           R"("")", R"("abc")", R"("a\"b\\c\/d\b\f\n\r\t")",
+           R"("\u0041\u00e9\u20AC\u0000")", R"("\ud83d\ude00")",
+           R"("\ud83d")", R"("\x")", "\"\t raw\"", "\"\xc3\xa9\"",
+           "[]", "{}", "[1, [2, [3]], {}]", R"({"a": 1, "b": [true, null]})",
+           R"({"a": 1, "a": 2})", R"({"": {"\n": "x"}})",
+           " \r\n\t[ 1 ,\n2 ]\n",
+           // Texts that are not strict JSON are left to Json::Reader.
+           "", " ", "01", "1.", ".5", "+1", "-", "1 + 1", "[1] x", "[1,]",
+           R"({"a":1,})", "[1 2]", "{a: 1}", "// c\n[1]", "[1 /* c */]",
+           "tru", "nul", "True", R"("abc)", R"({"a" 1})", "[1, 2",
+           "1.5.5", "1e", "1e+", "0x10", "[-]"}) {
+    ExpectParsedAsByReader(text, Json::Features::all());
+    ExpectParsedAsByReader(text, Json::Features::strictMode());
+  }
+
+  // Deep nesting.
+  const string deep = string(200, '[') + string(200, ']');
+  ExpectParsedAsByReader(deep, Json::Features::all());
+}
+
+// Integers above Json::Value::maxInt are read with the same types by the
+// direct parser and after falling back to Json::Reader, which reads them as
+// Json::uintValue in older versions of jsoncpp.
+TEST(JsonTextTest, ParsesLargeIntegersIntoFixedTypes) {
+  const std::pair<const char*, Json::ValueType> kIntegers[] = {
+      {"2147483648", Json::intValue},
+      {"3000000000", Json::intValue},
+      {"9223372036854775807", Json::intValue},
+      {"9223372036854775808", Json::uintValue},
+      {"18446744073709551615", Json::uintValue},
+  };
+  for (const auto& integer : kIntegers) {
+    const string strict = string(R"({"a": [)") + integer.first + "]}";
+    const string commented = strict + " // c";
+    for (const string& text : {strict, commented}) {
+      Json::Value value;
+      ASSERT_TRUE(ParseJsonText(text, &value)) << text;
+      EXPECT_EQ(integer.second, value["a"][0].type()) << text;
+      EXPECT_EQ(integer.first, ToJsonText(value["a"][0])) << text;
+    }
+  }
+}
+
+TEST(JsonTextTest, ParsesWhatItWrites) {
+  Json::Value value;
+  ASSERT_TRUE(ParseJsonText(
+      R"({"records": [{"id": 1, "name": "a\"b", "score": 0.1},
+                      {"id": -2, "tags": ["x", "\u00e9"], "on": false}]})",
+      &value));
+  Json::Value parsed;
+  ASSERT_TRUE(ParseJsonText(ToJsonText(value), &parsed));
+  EXPECT_EQ(value, parsed);
+  EXPECT_EQ(0.1, parsed["records"][0]["score"].asDouble());
+  EXPECT_EQ("\xc3\xa9", parsed["records"][1]["tags"][1].asString());
+}
+
+TEST(JsonTextTest, ParsesIndentedText) {
+  Json::Value value;
+  value["records"].append(Json::Value(string(70, 'x')));
+  value["records"].append(Json::Value(Json::objectValue))["a"] = 1;
+  const string text = Json::StyledWriter().write(value);
+  Json::Value parsed;
+  ASSERT_TRUE(ParseJsonText(string(40, ' ') + text + string(40, '\n'),
+                            &parsed));
+  EXPECT_EQ(value, parsed);
+  EXPECT_TRUE(IsJsonText("\t\r\n " + text));
+}
+
+TEST(JsonTextTest, ChecksJsonText) {
+  for (const char* text :
+       {"null", " [1, -2.5e3, true, false, null] ", "{}", "[]",
+        R"({"a": {"b": "c\"\u00e9"}})", R"("\\/\b\f\n\r\t")"}) {
+    EXPECT_TRUE(IsJsonText(text)) << text;
+    Json::Value value;
+    EXPECT_TRUE(ParseJsonText(text, &value)) << text;
+  }
+  for (const char* text :
+       {"", "[1,, 2]", R"({"a": })", "[1] 2", "[01]", "[1.]", "[.5]", "[+1]",
+        "{a: 1}", R"(["a])", R"(["\x"])", R"(["\ud800"])", "[1e999]",
+        "[tru]", "// c\n[1]", "[1,]"}) {
+    EXPECT_FALSE(IsJsonText(text)) << text;
+  }
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -31,6 +31,7 @@
 #include "statechart/platform/types.h"
 #include "absl/strings/str_cat.h"
 #include "include/json/json.h"
+#include "statechart/internal/json_text.h"
 #include "statechart/platform/logging.h"
 #include "statechart/platform/map_util.h"
 #include "statechart/platform/protobuf.h"
@@ -117,8 +118,7 @@ bool JsonValueCoder<Type>::JsonValueCoderProtocolMessage::Decode(
               << Json::StyledWriter().write(value);
     return false;
   }
-  string json_string = Json::FastWriter().write(value);
-  return json_format_ptr_->ParseFromString(json_string, result);
+  return json_format_ptr_->ParseFromString(ToJsonText(value), result);
 }
 
 // A convenience macro for defining template specializations for
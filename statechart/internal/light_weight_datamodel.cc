@@ -15,24 +15,33 @@
 #include "statechart/internal/light_weight_datamodel.h"
 
 #include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstring>
-#include <ctime>
 #include <functional>
-#include <iterator>
 #include <memory>
-#include <random>
 #include <utility>
 #include <vector>
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "absl/base/macros.h"
+#include "absl/container/inlined_vector.h"
 #include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/light_weight_expression.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/utility.h"
 #include "statechart/logging.h"
 #include "statechart/platform/map_util.h"
@@ -42,65 +51,41 @@ using state_chart::internal::ArrayReferenceIterator;
 using state_chart::internal::ArrayValueIterator;
 using ::google::int64;
 
+DEFINE_bool(cache_source_expressions, true,
+            "Whether LightWeightDatamodels cache the expressions that they "
+            "evaluate from source, so that repeated sources are parsed once.");
+DEFINE_int32(source_expression_cache_capacity, 4096,
+             "The number of expressions in each source expression cache of "
+             "LightWeightDatamodels. Read when the cache is first used.");
+
 namespace state_chart {
 
 namespace {
 
 using namespace std::placeholders;
 
-template <typename Arg1, typename Arg2, typename Arg3>
-auto BindFront(Arg1&& arg1, Arg2&& arg2, Arg3&& arg3)
-    -> decltype(::std::bind(std::forward<Arg1>(arg1), std::forward<Arg2>(arg2),
-                            std::forward<Arg3>(arg3), _1, _2, _3, _4, _5)) {
-  return ::std::bind(std::forward<Arg1>(arg1), std::forward<Arg2>(arg2),
-                     std::forward<Arg3>(arg3), _1, _2, _3, _4, _5);
-}
-
-class Token;
-bool SubstituteUntilValue(const Json::Value& store, const Runtime* runtime,
-                          FunctionDispatcher* dispatcher,
-                          std::list<Token>* expr);
-
-// Operators of expressions that delimit values/subexpressions.
-const char* const kOperators[] = {
-    ",", "(",  ")",  "[",  "]",  "+", "-",  "*",  "/",
-    "<", "<=", "==", "!=", ">=", ">", "&&", "||", "!",
-};
-
 // Special values in the system.
 const char* const kSpecialValues[] = {
     "true", "false", "null",
 };
 
-// A unary operation that stores (in arg2) the result of applying the operator
-// (arg0) on a string token (arg1).
-// Returns false if an error was encountered.
-typedef std::function<bool(const Token&, const Token&, Token*)> UnaryOperation;
-
-// A binary operation that stores (in arg3) the result of applying the operator
-// (arg0) on two string tokens (arg1, arg2).
-// Returns false if an error was encountered.
-typedef std::function<bool(const Token&, const Token&, const Token&, Token*)>
-    BinaryOperation;
-
-// A predicate that returns true if the given Token matches.
-typedef std::function<bool(const Token&)> TokenPredicate;
-
-// A vector of token predicates.
-typedef std::vector<TokenPredicate> TokenPredicates;
-
-// Substitution methods used in SubstituteUntilValue() must have the same
-// method signature as SubstituteMethod.
-// Parameters in order:
-// - The store for translating locations.
-// - The pointer to associated runtime (if present).
-// - The dispatcher for system function calls.
-// - The tokenized expression
-// - A pointer to an error flag.
-// Return true if any substitutions occurred.
-typedef std::function<bool(const Json::Value&, const Runtime*,
-                           FunctionDispatcher*, std::list<Token>*, bool*)>
-    SubstituteMethod;
+// The number of shards of the source expression caches, each with its own
+// lock.
+constexpr int kSourceExpressionCacheShards = 16;
+
+// Sources longer than this are evaluated without the source expression caches.
+// Long sources are mostly payloads that are evaluated once, and each entry
+// keeps its source and syntax tree.
+constexpr int kMaxCachedSourceLength = 256;
+
+// Returns a source expression cache of 'compiler' as configured by the flags.
+ExpressionCache* NewSourceExpressionCache(const ExpressionCompiler* compiler) {
+  auto* cache = new ExpressionCache(compiler,
+                                    FLAGS_source_expression_cache_capacity,
+                                    kSourceExpressionCacheShards);
+  cache->set_enabled(FLAGS_cache_source_expressions);
+  return cache;
+}
 
 // A special Json::Value that indicates a value does not exists.
 const Json::Value& UndefinedJSON() {
@@ -109,51 +94,65 @@ const Json::Value& UndefinedJSON() {
   return *undef_value;
 }
 
-// Return true if a value is found in a C-style string array.
-template <class CStringArray>
-bool InCStringArray(const CStringArray& cstr_array, const string& str) {
-  for (const auto& cstr : cstr_array) {
-    if (str == cstr) {
+// Sets 'hashed' to a key of a scalar 'value' in the hash indexes of
+// KeyIndexDispatcher. Values are equal by Json::Value::operator==() iff their
+// keys are equal, so the key includes the type. Returns false for objects and
+// arrays, which are not indexed, and for NaN, which equals no value.
+bool HashIndexedValue(const Json::Value& value, string* hashed) {
+  switch (value.type()) {
+    case Json::nullValue:
+      *hashed = "n";
+      return true;
+    case Json::intValue:
+      *hashed = absl::StrCat("i", value.asLargestInt());
+      return true;
+    case Json::uintValue:
+      *hashed = absl::StrCat("u", value.asLargestUInt());
+      return true;
+    case Json::realValue: {
+      double real = value.asDouble();
+      if (std::isnan(real)) {
+        return false;
+      }
+      // -0.0 == 0.0, so both have the bits of 0.0.
+      if (real == 0) {
+        real = 0;
+      }
+      uint64_t bits = 0;
+      std::memcpy(&bits, &real, sizeof(bits));
+      *hashed = absl::StrCat("r", bits);
       return true;
     }
+    case Json::stringValue:
+      *hashed = absl::StrCat("s", value.asString());
+      return true;
+    case Json::booleanValue:
+      *hashed = value.asBool() ? "t" : "f";
+      return true;
+    default:
+      return false;
   }
-  return false;
-}
-
-// Return if a string is an operator.
-bool IsOperatorString(const string& str) {
-  return InCStringArray(kOperators, str);
 }
 
-// Search for a value in the store. If found, set 'value_reference' to the
-// pointer to that value and return true.
-bool FindValueInStore(const Json::Value& store, const string& location,
-                      const Json::Value** value_reference) {
-  RETURN_FALSE_IF(value_reference == nullptr);
-  Json::Path path(location);
-  Json::Value result = path.resolve(store, UndefinedJSON());
-  if (result == UndefinedJSON()) {
-    return false;
+// Sets 'hashed' to the hashed value of 'key' of 'element', or clears it if
+// 'element' is not an object with an indexed value of 'key'.
+void HashElementKey(const Json::Value& element, const string& key,
+                    string* hashed) {
+  const Json::Value* value =
+      element.isObject() ? element.find(key.data(), key.data() + key.size())
+                         : nullptr;
+  if (value == nullptr || !HashIndexedValue(*value, hashed)) {
+    hashed->clear();
   }
-  *value_reference = &path.resolve(store);
-  return true;
 }
 
 // Convert a JSON value to a compact formatted string. Quotes values that
 // represent string literals if 'quote_string' is true.
 string ValueToString(const Json::Value& value, bool quote_string) {
-  if (value.isObject() || value.isArray()) {
-    string result = Json::FastWriter().write(value);
-    // Last char is a newline.
-    result.pop_back();
-    return result;
-  } else if (value.isNull()) {
-    return "null";
-  } else if (quote_string && value.isString()) {
-    return Quote(value.asString());
-  } else {
-    return value.asString();
+  if (value.isString()) {
+    return quote_string ? Quote(value.asString()) : value.asString();
   }
+  return ToJsonText(value);
 }
 
 // Convert a JSON value to a compact formatted string. Does not quote values
@@ -162,10 +161,127 @@ string ValueToString(const Json::Value& value) {
   return ValueToString(value, false);
 }
 
+// Returns the next number of Math.random() of 'runtime'. Datamodels without a
+// runtime share a generator per thread.
+double GenerateRandom(Runtime* runtime) {
+  if (runtime != nullptr) {
+    return runtime->GetRandomGenerator()->NextDouble();
+  }
+  thread_local RandomGenerator generator;
+  return generator.NextDouble();
+}
+
+bool IsIdentifierChar(char c) {
+  return absl::ascii_isalnum(c) || c == '_' || c == '$';
+}
+
+// Returns the identifier at the start of 'location', which is empty if
+// 'location' does not start with a variable.
+absl::string_view TopLevelVariable(absl::string_view location) {
+  const auto end = std::find_if_not(location.begin(), location.end(),
+                                    IsIdentifierChar);
+  return location.substr(0, end - location.begin());
+}
+
+// Returns true if 'location' is of the form "a.b.c".
+bool IsPath(absl::string_view location) {
+  if (location.empty() || !IsIdentifierChar(location.front()) ||
+      !IsIdentifierChar(location.back())) {
+    return false;
+  }
+  return std::all_of(location.begin(), location.end(), [](char c) {
+    return IsIdentifierChar(c) || c == '.';
+  });
+}
+
+// Returns true if 'text' is a JSON object or array that ParseJsonText()
+// parses.
+bool IsJsonContainerText(absl::string_view text) {
+  const absl::string_view stripped = absl::StripLeadingAsciiWhitespace(text);
+  return !stripped.empty() &&
+         (stripped.front() == '{' || stripped.front() == '[') &&
+         IsJsonText(text);
+}
+
+// Returns false if 'source' does not access the value at 'path', which
+// satisfies IsPath(). Occurrences of the root variable of 'path' in 'source'
+// are compared with 'path' as long as they are followed by member accesses,
+// so that, e.g., "a.b.d" and "a.c" do not access "a.b.c" but "a", "a.b" and
+// "a[k]" may. Occurrences in string literals are counted as accesses.
+bool MayAccessPath(absl::string_view source, absl::string_view path) {
+  const absl::string_view root = path.substr(0, path.find('.'));
+  for (size_t pos = source.find(root); pos != absl::string_view::npos;
+       pos = source.find(root, pos + 1)) {
+    if (pos > 0 && IsIdentifierChar(source[pos - 1])) {
+      continue;
+    }
+    size_t i = pos + root.size();  // Position in 'source'.
+    size_t j = root.size();        // Position in 'path', at a '.' or the end.
+    while (true) {
+      if (j == path.size()) {
+        return true;
+      }
+      if (i == source.size() || source[i] != '.') {
+        if (i < source.size() && IsIdentifierChar(source[i])) {
+          break;  // Another identifier with the same prefix.
+        }
+        return true;
+      }
+      size_t source_end = i + 1;
+      while (source_end < source.size() &&
+             IsIdentifierChar(source[source_end])) {
+        ++source_end;
+      }
+      size_t path_end = path.find('.', j + 1);
+      if (path_end == absl::string_view::npos) {
+        path_end = path.size();
+      }
+      if (source.substr(i + 1, source_end - i - 1) !=
+          path.substr(j + 1, path_end - j - 1)) {
+        break;  // Accesses another member.
+      }
+      i = source_end;
+      j = path_end;
+    }
+  }
+  return false;
+}
+
+// Operator Tokens hold the id of their operator instead of the operator text.
+using internal::FindOperatorId;
+using internal::OperatorId;
+using internal::kNoOperator;
+using internal::kComma;
+using internal::kOpenParenthesis;
+using internal::kCloseParenthesis;
+using internal::kOpenBracket;
+using internal::kCloseBracket;
+using internal::kPlus;
+using internal::kMinus;
+using internal::kMultiply;
+using internal::kDivide;
+using internal::kLess;
+using internal::kLessEqual;
+using internal::kEqual;
+using internal::kNotEqual;
+using internal::kGreaterEqual;
+using internal::kGreater;
+using internal::kAnd;
+using internal::kOr;
+using internal::kNot;
+
 //------------------------------------------------------------------------------
 // An omni data type class representing an expression token in the expression
 // language that can be either a value (of any allowed valid type), a reference
 // to a value, an operator, or a system function.
+//
+// A Token is a small tagged union. Values are held in an inline Json::Value,
+// which stores null, integer, double and boolean values without allocating, so
+// that evaluating numeric and boolean expressions does not touch the heap.
+// Only strings, arrays and objects allocate. References borrow the value from
+// the store and operators are held by their OperatorId. References to the
+// RecordArray of a variable and to its records, and to the nodes of a
+// ValueTree, are resolved further without converting them to Json::Values.
 class Token {
  public:
   // Create the token from an expression ('expr'), a 'store', and a function
@@ -180,26 +296,40 @@ class Token {
   // 'SystemFunction' token.
   // An optional 'is_error' flag is used to indicate if there an
   // unknown expression that is not one of the above mentioned types.
-  static Token Create(const Json::Value& store,
-                      const FunctionDispatcher& dispatcher, string expr,
-                      bool* is_error);
+  // The paths of references are looked up in 'paths' unless it is nullptr.
+  static Token Create(const internal::Store& store,
+                      const FunctionDispatcher& dispatcher,
+                      internal::PathCache* paths, string expr, bool* is_error);
 
   // Default constructor. Creates an empty token (not a JSON null value).
   // Used to create empty tokens for pass by reference.
-  Token() : reference_(nullptr) {}
+  Token() = default;
 
   // Constructor for operators.
-  explicit Token(const string& op) : reference_(nullptr), operator_(op) {}
+  explicit Token(OperatorId op) : kind_(kOperator), operator_(op) {}
 
-  // Constructor for values.
-  explicit Token(const Json::Value& value)
-      : value_(new Json::Value(value)), reference_(nullptr) {}
+  // Constructors for values. The second one takes over the contents of
+  // 'value'.
+  explicit Token(const Json::Value& value) : kind_(kValue), value_(value) {}
+  explicit Token(Json::Value&& value) : kind_(kValue) { value_.swap(value); }
 
   // Constructor for references.
-  explicit Token(const Json::Value* reference) : reference_(reference) {}
+  explicit Token(const Json::Value* reference)
+      : kind_(kReference), reference_(reference) {}
+
+  // Constructors for references to the RecordArray of a variable and to a
+  // record.
+  explicit Token(const internal::Store::Variable* packed)
+      : kind_(kRecords), packed_(packed) {}
+  explicit Token(const internal::Record* record)
+      : kind_(kRecord), record_(record) {}
+
+  // Constructor for references to a node of a ValueTree.
+  explicit Token(const internal::ValueTree* node)
+      : kind_(kNode), node_(node) {}
 
-  // Copy constructor.
-  Token(const Token& other);
+  // Copies do not allocate unless the value is a string, array or object.
+  Token(const Token& other) = default;
 
   // Assignment using copy-swap idiom.
   Token& operator=(Token other) {
@@ -212,38 +342,82 @@ class Token {
   void Swap(Token* other);
 
   // Returns the value of this Token. Does transparent dereferencing if this is
-  // a reference.
+  // a reference. RecordArrays, records and nodes are converted to
+  // Json::Values.
   // Returns UndefinedJSON() if !IsValue().
   const Json::Value& Value() const {
-    if (!IsValue()) {
-      LOG(DFATAL) << "Returning default Json::Value for token: "
-                  << DebugString();
-      return UndefinedJSON();
+    switch (kind_) {
+      case kValue:
+        return value_;
+      case kReference:
+        return *reference_;
+      case kRecords:
+        return packed_->value();
+      case kRecord:
+        if (value_.isNull()) {
+          value_ = record_->ToJson();
+        }
+        return value_;
+      case kNode:
+        return node_->json();
+      default:
+        LOG(DFATAL) << "Returning default Json::Value for token: "
+                    << DebugString();
+        return UndefinedJSON();
+    }
+  }
+
+  // Returns the variable if this is a reference to its RecordArray, otherwise
+  // nullptr.
+  const internal::Store::Variable* PackedVariable() const { return packed_; }
+  const internal::RecordArray* Records() const {
+    return packed_ == nullptr ? nullptr : packed_->records();
+  }
+  // Returns the record if this is a reference to a record, otherwise nullptr.
+  const internal::Record* Record() const { return record_; }
+  // Returns the node if this is a reference to a node of a ValueTree,
+  // otherwise nullptr.
+  const internal::ValueTree* Node() const { return node_; }
+
+  // Returns the size of the array if the value is an array, otherwise -1.
+  // RecordArrays and nodes are not converted.
+  int ArraySize() const {
+    if (packed_ != nullptr) {
+      return packed_->records()->size();
     }
-    return IsReference() ? *reference_ : *value_;
+    if (node_ != nullptr) {
+      return node_->is_array() ? node_->size() : -1;
+    }
+    return IsValue() && Value().isArray() ? static_cast<int>(Value().size())
+                                          : -1;
   }
 
   // Returns the mutable Value of this Token.
   // Returns nullptr if !IsValue() || IsReference().
   Json::Value* MutableValue() {
     RETURN_NULL_IF_MSG(
-        !IsValue() || IsReference(),
+        kind_ != kValue,
         absl::StrCat("Returning nullptr for token: ", DebugString()));
-    return value_.get();
+    return &value_;
   }
 
-  // Returns the operator, which is empty if !IsOperator().
-  const string& Operator() const { return operator_; }
+  // Returns the operator, which is kNoOperator if !IsOperator().
+  OperatorId Operator() const { return operator_; }
 
   // Returns name of the system function which is empty if !IsSystemFunction().
-  const string& SystemFunction() const { return system_function_; }
+  string SystemFunction() const {
+    return IsSystemFunction() ? value_.asString() : "";
+  }
 
   // Returns true if this is a value literal or a reference, i.e., Value() may
   // be called.
-  bool IsValue() const { return value_ != nullptr || IsReference(); }
-  bool IsReference() const { return reference_ != nullptr; }
-  bool IsOperator() const { return !operator_.empty(); }
-  bool IsSystemFunction() const { return !system_function_.empty(); }
+  bool IsValue() const { return kind_ == kValue || IsReference(); }
+  bool IsReference() const {
+    return kind_ == kReference || kind_ == kRecords || kind_ == kRecord ||
+           kind_ == kNode;
+  }
+  bool IsOperator() const { return kind_ == kOperator; }
+  bool IsSystemFunction() const { return kind_ == kSystemFunction; }
 
   // Returns true if a value is internally represented as an integer.
   // Returns false if !IsValue().
@@ -263,30 +437,161 @@ class Token {
   bool ToBool() const;
 
  private:
-  // Holds the value if this token is a literal value, otherwise nullptr.
-  std::unique_ptr<Json::Value> value_;
-  // Holds the reference if this token is a reference (from a location),
-  // otherwise nullptr. Never owned.
-  const Json::Value* reference_;
-  // Holds the operator expression if this token is an operator, otherwise
-  // empty.
-  string operator_;
-  // Holds the system function name if this token is a system function,
-  // otherwise empty.
-  string system_function_;
+  enum Kind {
+    kEmpty,
+    kValue,
+    kReference,
+    kRecords,
+    kRecord,
+    kNode,
+    kOperator,
+    kSystemFunction
+  };
+
+  // Creates a system function token for the function 'name'.
+  static Token MakeSystemFunction(const string& name);
+
+  Kind kind_ = kEmpty;
+  // The value if this token is a literal value. Holds the name of the function
+  // if this token is a system function, and the converted record if this token
+  // is a record whose Value() was read.
+  mutable Json::Value value_;
+  // The referenced value if this token is a reference (from a location). Never
+  // owned.
+  const Json::Value* reference_ = nullptr;
+  // The variable or record if this token is a reference to a RecordArray or a
+  // record. Never owned.
+  const internal::Store::Variable* packed_ = nullptr;
+  const internal::Record* record_ = nullptr;
+  // The node if this token is a reference to a node of a ValueTree. Never
+  // owned.
+  const internal::ValueTree* node_ = nullptr;
+  // The operator if this token is an operator.
+  OperatorId operator_ = kNoOperator;
 };
 
+// Returns a reference to 'child' of a node of a ValueTree: to its subtree if it
+// has one, otherwise to its value.
+Token ChildToken(const internal::ValueTree::Child& child) {
+  return child.tree != nullptr ? Token(child.tree.get()) : Token(&child.value);
+}
+
+// Resolves 'key' in the referenced 'container' the same way as Json::Path
+// resolves it: an index in an array or a member of an object. Returns false if
+// the element does not exist.
+bool ResolveKey(const Token& container, const Json::Value& key,
+                Token* result) {
+  const internal::ValueTree* node = container.Node();
+  if (node != nullptr) {
+    const internal::ValueTree::Child* child = nullptr;
+    if (node->is_array() && key.isUInt() &&
+        key.asUInt() < static_cast<unsigned>(node->size())) {
+      child = node->element(key.asUInt());
+    } else if (!node->is_array() && key.isString()) {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      key.getString(&begin, &end);
+      child = node->Find(absl::string_view(begin, end - begin));
+    }
+    if (child == nullptr) {
+      return false;
+    }
+    *result = ChildToken(*child);
+    return true;
+  }
+  const internal::RecordArray* records = container.Records();
+  if (records != nullptr) {
+    if (!key.isUInt() ||
+        key.asUInt() >= static_cast<unsigned>(records->size())) {
+      return false;
+    }
+    *result = Token(&records->record(key.asUInt()));
+    return true;
+  }
+  const Json::Value* value = nullptr;
+  if (container.Record() != nullptr) {
+    if (key.isString()) {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      key.getString(&begin, &end);
+      value = container.Record()->Find(absl::string_view(begin, end - begin));
+    }
+  } else if (container.Value().isObject() && key.isString()) {
+    const char* begin = nullptr;
+    const char* end = nullptr;
+    key.getString(&begin, &end);
+    value = container.Value().find(begin, end);
+  } else if (container.Value().isArray() && key.isUInt() &&
+             key.asUInt() < container.Value().size()) {
+    value = &container.Value()[key.asUInt()];
+  }
+  if (value == nullptr) {
+    return false;
+  }
+  *result = Token(value);
+  return true;
+}
+
+// Search for a value at 'path' in the store. If found, set 'result' to a
+// reference to that value and return true.
+bool FindValueAtPath(const internal::Store& store,
+                     const internal::StorePath& path, Token* result) {
+  const internal::Store::Variable* variable = store.FindVariable(path.variable);
+  if (variable == nullptr) {
+    return false;
+  }
+  if ((variable->records() != nullptr || variable->tree() != nullptr) &&
+      path.has_keys) {
+    // Walks the records or nodes without converting them.
+    Token value = variable->tree() != nullptr ? Token(variable->tree())
+                                              : Token(variable);
+    for (const Json::Value& key : path.keys) {
+      Token element;
+      if (!ResolveKey(value, key, &element)) {
+        return false;
+      }
+      value.Swap(&element);
+    }
+    result->Swap(&value);
+    return true;
+  }
+  const Json::Value& root = variable->value();
+  const Json::Value& found = path.members.resolve(root);
+  if (&found != &Json::Value::nullSingleton()) {
+    *result = Token(&found);
+    return true;
+  }
+  // Only a missing value resolves to the null singleton, so this does not copy
+  // large values.
+  Json::Value value = path.members.resolve(root, UndefinedJSON());
+  if (value == UndefinedJSON()) {
+    return false;
+  }
+  *result = Token(&path.members.resolve(root));
+  return true;
+}
+
+// Same as above for the path of 'location', which is looked up in 'paths'
+// unless it is nullptr.
+bool FindValueInStore(const internal::Store& store, internal::PathCache* paths,
+                      const string& location, Token* result) {
+  RETURN_FALSE_IF(result == nullptr);
+  if (paths == nullptr) {
+    return FindValueAtPath(store, internal::StorePath(location), result);
+  }
+  return FindValueAtPath(store, paths->Get(location), result);
+}
+
 // static
-Token Token::Create(const Json::Value& store,
-                    const FunctionDispatcher& dispatcher, string expr,
-                    bool* is_error) {
+Token Token::Create(const internal::Store& store,
+                    const FunctionDispatcher& dispatcher,
+                    internal::PathCache* paths, string expr, bool* is_error) {
   absl::StripAsciiWhitespace(&expr);
   if (is_error != nullptr) {
     *is_error = false;
   }
-  Json::Reader reader;
   Json::Value value_root;
-  const Json::Value* value_reference = nullptr;
+  Token reference;
   int64 value_i = 0;
   double value_d = 0;
   if (expr.empty() || expr == "null") {
@@ -301,10 +606,10 @@ Token Token::Create(const Json::Value& store,
     // False value.
     DVLOG(1) << "Created false: " << expr;
     return Token(Json::Value(false));
-  } else if (IsOperatorString(expr)) {
+  } else if (FindOperatorId(expr) != kNoOperator) {
     // Operator.
     DVLOG(1) << "Created operator: " << expr;
-    return Token(expr);
+    return Token(FindOperatorId(expr));
   } else if (absl::SimpleAtoi(expr, &value_i)) {
     // Integer.
     DVLOG(1) << "Created integer: " << expr;
@@ -318,29 +623,25 @@ Token Token::Create(const Json::Value& store,
     DVLOG(1) << "Created string: " << expr;
     return Token(Json::Value(Unquote(expr)));
   } else if ((MaybeJSONArray(expr) || MaybeJSON(expr)) &&
-             reader.parse(expr, value_root, false)) {
+             ParseJsonText(expr, &value_root)) {
     // MaybeJSON*() is required as the reader will parse "1 + 1" as valid
     // Json::Value string.
     // Object or array.
     DVLOG(1) << "Created object/array: " << expr;
     return Token(value_root);
   } else if (expr == "In") {
-    Token token;
-    token.system_function_ = expr;
     DVLOG(1) << "Created system function: " << expr;
-    return token;
+    return MakeSystemFunction(expr);
   } else if (dispatcher.HasFunction(expr)) {
     // Note that a system function name takes precedence over a location name.
     // Hence attempting to declare or assign to a system function name will
     // always result in an error.
-    Token token;
-    token.system_function_ = expr;
     DVLOG(1) << "Created system function: " << expr;
-    return token;
-  } else if (FindValueInStore(store, expr, &value_reference)) {
+    return MakeSystemFunction(expr);
+  } else if (FindValueInStore(store, paths, expr, &reference)) {
     // Reference
     DVLOG(1) << "Created reference: " << expr;
-    return Token(value_reference);
+    return reference;
   } else {
     if (is_error != nullptr) {
       *is_error = true;
@@ -349,27 +650,29 @@ Token Token::Create(const Json::Value& store,
   }
 }
 
-Token::Token(const Token& other)
-    : reference_(other.reference_),
-      operator_(other.operator_),
-      system_function_(other.system_function_) {
-  if (other.value_ != nullptr) {
-    value_.reset(new Json::Value(*other.value_));
-  }
+// static
+Token Token::MakeSystemFunction(const string& name) {
+  Token token;
+  token.kind_ = kSystemFunction;
+  token.value_ = name;
+  return token;
 }
 
 void Token::Swap(Token* other) {
   if (this != other) {
+    std::swap(kind_, other->kind_);
     value_.swap(other->value_);
     std::swap(reference_, other->reference_);
-    operator_.swap(other->operator_);
-    system_function_.swap(other->system_function_);
+    std::swap(packed_, other->packed_);
+    std::swap(record_, other->record_);
+    std::swap(node_, other->node_);
+    std::swap(operator_, other->operator_);
   }
 }
 
 string Token::DebugString() const {
   if (IsOperator()) {
-    return absl::StrCat("OP:", Operator());
+    return absl::StrCat("OP:", internal::OperatorName(Operator()));
   }
   if (IsReference()) {
     return absl::StrCat("REF:", ValueToString(Value()));
@@ -385,7 +688,9 @@ string Token::DebugString() const {
 
 bool Token::ToBool() const {
   RETURN_FALSE_IF(!IsValue());
-  if (Value().isObject() || Value().isArray()) {
+  if (packed_ != nullptr || record_ != nullptr || node_ != nullptr) {
+    return true;
+  } else if (Value().isObject() || Value().isArray()) {
     return true;
   } else if (Value().isString()) {
     return strlen(Value().asCString()) > 0;
@@ -405,78 +710,9 @@ string BinaryDebugString(const Token& op, const Token& a, const Token& b) {
                       b.DebugString());
 }
 
-// Convert a container of Tokens into a vector of their DebugStrings.
-template <class TokenContainer>
-std::vector<string> ListDebugStrings(const TokenContainer& c) {
-  std::vector<string> result;
-  for (const auto& token : c) {
-    result.push_back(token.DebugString());
-  }
-  return result;
-}
-
-// Returns true if an operator is a relational comparison operator.
-bool IsRelationalOp(const Token& op) {
-  static const char* const kRelationalOps[] = {"<", ">", "<=", ">="};
-  return InCStringArray(kRelationalOps, op.Operator());
-}
-
 // Returns true if an operator is an equality comparison operator.
 bool IsEqualityOp(const Token& op) {
-  static const char* const kEqualityOps[] = {"==", "!="};
-  return InCStringArray(kEqualityOps, op.Operator());
-}
-
-// A meta function that identifies an infix binary operator ('op') and operands
-// and substitutes them if the operands are values. Otherwise an error will be
-// reported. Returns true if a substitution occurred. The binary operator is
-// assumed to be left associative.
-// If the first two parameters are bound, the resulting function is a
-// SubstituteMethod.
-bool SubInfixBinaryOpMeta(const TokenPredicate& op_match,
-                          BinaryOperation op_function, const Json::Value&,
-                          const Runtime* /* unused */,
-                          FunctionDispatcher* /* unused */,
-                          std::list<Token>* expr, bool* is_error) {
-  *is_error = false;
-  if (expr->size() < 3) {
-    return false;
-  }
-
-  TokenPredicates predicates{
-      &Token::IsValue,
-      [&op_match](const Token& x) { return x.IsOperator() && op_match(x); },
-      &Token::IsValue};
-
-  bool substituted = false;
-  auto it = expr->begin();
-  auto it_end = expr->end();
-  // Note: Assignment in condition.
-  while (it_end != (it = SearchWithPredicates(it, it_end, predicates))) {
-    // Loop invariants.
-    LOG_IF(DFATAL, std::distance(it, it_end) < 0)
-        << "Parsing of binary op failed.";
-    LOG_IF(DFATAL, static_cast<::std::size_t>(std::distance(it, it_end)) <
-                       predicates.size())
-        << "Parsing of binary op failed.";
-
-    auto it_first = it++;
-    auto it_op = it++;
-    Token result;
-    DVLOG(1) << "BinOp: " << BinaryDebugString(*it_op, *it_first, *it);
-    if (!op_function(*it_op, *it_first, *it, &result)) {
-      *is_error = true;
-      break;
-    }
-    // Store result at it_first.
-    it_first->Swap(&result);
-    // Erase 'it_op' and 'it'.
-    expr->erase(it_op, ++it);
-    // Start from the new result at 'it_first'.
-    it = it_first;
-    substituted = true;
-  }
-  return substituted;
+  return op.Operator() == kEqual || op.Operator() == kNotEqual;
 }
 
 // A meta-function that runs a binary operator on two numeric operands such
@@ -525,12 +761,12 @@ bool MinusOperation(const Token& a, const Token& b, Token* result) {
                               result);
 }
 
-// A BinaryOperation. Selects the plus or minus operation based on 'op'.
+// A binary operation. Selects the plus or minus operation based on 'op'.
 bool AdditiveOperation(const Token& op, const Token& a, const Token& b,
                        Token* result) {
-  if (op.Operator() == "+") {
+  if (op.Operator() == kPlus) {
     return PlusOperation(a, b, result);
-  } else if (op.Operator() == "-") {
+  } else if (op.Operator() == kMinus) {
     return MinusOperation(a, b, result);
   } else {
     LOG(DFATAL) << "Unrecognized operator: " << op.DebugString();
@@ -556,12 +792,12 @@ bool DivideOperation(const Token& a, const Token& b, Token* result) {
                               result);
 }
 
-// A BinaryOperation. Selects the multiplies or divide operation based on 'op'.
+// A binary operation. Selects the multiplies or divide operation based on 'op'.
 bool MultiplicativeOperation(const Token& op, const Token& a, const Token& b,
                              Token* result) {
-  if (op.Operator() == "*") {
+  if (op.Operator() == kMultiply) {
     return MultiplyOperation(a, b, result);
-  } else if (op.Operator() == "/") {
+  } else if (op.Operator() == kDivide) {
     return DivideOperation(a, b, result);
   } else {
     LOG(DFATAL) << "Unrecognized operator: " << op.DebugString();
@@ -569,7 +805,7 @@ bool MultiplicativeOperation(const Token& op, const Token& a, const Token& b,
   }
 }
 
-// A BinaryOperation. Compares strings based on 'cmp_op'.
+// A binary operation. Compares strings based on 'cmp_op'.
 // Should be called after NumericComparison as it checks for invalid string with
 // numeric comparisons.
 // Unlike Javascript, string operands are not promoted to numbers when compared
@@ -582,44 +818,40 @@ bool StringComparison(const Token& cmp_op, const Token& a, const Token& b,
     return false;
   }
   bool result_bool = false;
-  if (cmp_op.Operator() == "==") {
-    result_bool = (va == vb);
-  } else if (cmp_op.Operator() == "!=") {
-    result_bool = (va != vb);
-  } else if (cmp_op.Operator() == "<") {
-    result_bool = (va < vb);
-  } else if (cmp_op.Operator() == "<=") {
-    result_bool = (va <= vb);
-  } else if (cmp_op.Operator() == ">") {
-    result_bool = (va > vb);
-  } else if (cmp_op.Operator() == ">=") {
-    result_bool = (va >= vb);
-  } else {
-    LOG(DFATAL) << "Unrecognized comparison: "
-                << BinaryDebugString(cmp_op, a, b);
-    return false;
+  switch (cmp_op.Operator()) {
+    case kEqual:
+      result_bool = (va == vb);
+      break;
+    case kNotEqual:
+      result_bool = (va != vb);
+      break;
+    case kLess:
+      result_bool = (va < vb);
+      break;
+    case kLessEqual:
+      result_bool = (va <= vb);
+      break;
+    case kGreater:
+      result_bool = (va > vb);
+      break;
+    case kGreaterEqual:
+      result_bool = (va >= vb);
+      break;
+    default:
+      LOG(DFATAL) << "Unrecognized comparison: "
+                  << BinaryDebugString(cmp_op, a, b);
+      return false;
   }
   *result = Token(Json::Value(result_bool));
   DVLOG(1) << "StringComparison result = " << result->DebugString();
   return true;
 }
 
-// A BinaryOperation.
+// A binary operation.
 // This function takes in two values and compares them using semantics for the
 // given 'cmp_op' for 'int64' and 'double'.
 bool NumericComparison(const Token& cmp_op, const Token& a, const Token& b,
                        Token* result) {
-  static const auto* const kComparatorTable =
-      new std::map<string, std::pair<std::function<bool(int, int)>,
-                                std::function<bool(double, double)>>>{
-          {"==", {std::equal_to<int>(), std::equal_to<double>()}},
-          {"!=", {std::not_equal_to<int>(), std::not_equal_to<double>()}},
-          {"<", {std::less<int>(), std::less<double>()}},
-          {"<=", {std::less_equal<int>(), std::less_equal<double>()}},
-          {">", {std::greater<int>(), std::greater<double>()}},
-          {">=", {std::greater_equal<int>(), std::greater_equal<double>()}},
-      };
-
   const auto& va = a.Value();
   const auto& vb = b.Value();
 
@@ -627,15 +859,34 @@ bool NumericComparison(const Token& cmp_op, const Token& a, const Token& b,
   if (!va.isNumeric() || !vb.isNumeric()) {
     return false;
   }
-  const auto& iterator = kComparatorTable->find(cmp_op.Operator());
-  // Fail if invalid comparison, this indicates a setup error.
-  RETURN_FALSE_IF(iterator == kComparatorTable->end());
-  const auto& comparators = iterator->second;
-  return NumericOperationMeta(comparators.first, comparators.second, a, b,
-                              result);
+  switch (cmp_op.Operator()) {
+    case kEqual:
+      return NumericOperationMeta(std::equal_to<int>(),
+                                  std::equal_to<double>(), a, b, result);
+    case kNotEqual:
+      return NumericOperationMeta(std::not_equal_to<int>(),
+                                  std::not_equal_to<double>(), a, b, result);
+    case kLess:
+      return NumericOperationMeta(std::less<int>(), std::less<double>(), a, b,
+                                  result);
+    case kLessEqual:
+      return NumericOperationMeta(std::less_equal<int>(),
+                                  std::less_equal<double>(), a, b, result);
+    case kGreater:
+      return NumericOperationMeta(std::greater<int>(), std::greater<double>(),
+                                  a, b, result);
+    case kGreaterEqual:
+      return NumericOperationMeta(std::greater_equal<int>(),
+                                  std::greater_equal<double>(), a, b, result);
+    default:
+      // Fail if invalid comparison, this indicates a setup error.
+      LOG(DFATAL) << "Unrecognized comparison: "
+                  << BinaryDebugString(cmp_op, a, b);
+      return false;
+  }
 }
 
-// A BinaryOperation.
+// A binary operation.
 // Does comparison operators and type promotion.
 bool ComparisonOperation(const Token& cmp_op, const Token& a, const Token& b,
                          Token* result) {
@@ -646,14 +897,14 @@ bool ComparisonOperation(const Token& cmp_op, const Token& a, const Token& b,
 
   const auto& va = a.Value();
   const auto& vb = b.Value();
-  const auto& op = cmp_op.Operator();
+  const OperatorId op = cmp_op.Operator();
 
   if (va.isBool() && vb.isBool()) {
     // Only equality comparators supported for bool. No promotion allowed.
-    if (op == "==") {
+    if (op == kEqual) {
       *result = Token(Json::Value(a.ToBool() == b.ToBool()));
       return true;
-    } else if (op == "!=") {
+    } else if (op == kNotEqual) {
       *result = Token(Json::Value(a.ToBool() != b.ToBool()));
       return true;
     }
@@ -662,8 +913,8 @@ bool ComparisonOperation(const Token& cmp_op, const Token& a, const Token& b,
     if (IsEqualityOp(cmp_op)) {
       // True when both operands are null and comparator is '=='.
       // Or when comparator is '!=' and only one operand is null.
-      if ((op == "==" && va.isNull() && vb.isNull()) ||
-          (op == "!=" && (!va.isNull() || !vb.isNull()))) {
+      if ((op == kEqual && va.isNull() && vb.isNull()) ||
+          (op == kNotEqual && (!va.isNull() || !vb.isNull()))) {
         *result = Token(Json::Value(true));
         return true;
       }
@@ -681,85 +932,26 @@ bool ComparisonOperation(const Token& cmp_op, const Token& a, const Token& b,
   return false;
 }
 
-// A BinaryOperation. Logical boolean AND.
+// A binary operation. Logical boolean AND.
 bool LogicalAndOperation(const Token& op, const Token& a, const Token& b,
                          Token* result) {
-  RETURN_FALSE_IF("&&" != op.Operator());
+  RETURN_FALSE_IF(op.Operator() != kAnd);
   *result = Token(Json::Value(a.ToBool() && b.ToBool()));
   return true;
 }
 
-// A BinaryOperation. Logical boolean OR.
+// A binary operation. Logical boolean OR.
 bool LogicalOrOperation(const Token& op, const Token& a, const Token& b,
                         Token* result) {
-  RETURN_FALSE_IF("||" != op.Operator());
+  RETURN_FALSE_IF(op.Operator() != kOr);
   *result = Token(Json::Value(a.ToBool() || b.ToBool()));
   return true;
 }
 
-// A meta function that takes in an operator matcher, 'op_matcher', and
-// performs the corresponding UnaryOperation, 'op_function', substituting the
-// sub-expression with the result. The unary operator is assumed to be right
-// associative.
-// If the first two parameters are bound, the resulting function is a
-// SubstituteMethod.
-bool SubUnaryOpMeta(const TokenPredicate& op_match, UnaryOperation op_function,
-                    const Json::Value&, const Runtime* /* unused */,
-                    FunctionDispatcher* /* unused */, std::list<Token>* expr,
-                    bool* is_error) {
-  *is_error = false;
-  if (expr->size() < 2) {
-    return false;
-  }
-
-  bool substituted = false;
-
-  // To compute with right associativity, process the expression in reverse.
-  auto it = expr->rbegin();
-  auto it_end = expr->rend();
-  // Note that the predicates are in reverse order -- value, operator.
-  TokenPredicates predicates{
-      &Token::IsValue,
-      [&op_match](const Token& x) { return x.IsOperator() && op_match(x); },
-  };
-
-  while (it_end != (it = SearchWithPredicates(it, it_end, predicates))) {
-    // Loop invariants.
-    LOG_IF(DFATAL, static_cast<::std::size_t>(std::distance(it, it_end)) <
-                       predicates.size())
-        << "Parsing of unary op failed.";
-
-    // Move 'it' to the operator.
-    auto it_value = it++;
-    // Move 'it' to one after the operator.
-    auto it_op = it++;
-    // Skip if 'it' is a value to disambiguate binary '-' operator.
-    if (it != it_end && it->IsValue()) {
-      continue;
-    }
-    DVLOG(1) << "Found unary operation: " << it_op->DebugString()
-             << it_value->DebugString();
-    Token result;
-    if (!op_function(*it_op, *it_value, &result)) {
-      *is_error = true;
-      return false;
-    }
-    // Store the result in the operator position.
-    it_op->Swap(&result);
-    // Erase the value position, 'it_op.base()' is the un-reversed iterator to
-    // the value. Note that 'it_op' is invalidated after this.
-    expr->erase(it_op.base());
-    // Continue from the result (new value) position.
-    --it;
-    substituted = true;
-  }
-  return substituted;
-}
-
-// A UnaryOperation. Evaluates the unary '-' operator.
+// A unary operation. Evaluates the unary '-' operator.
 // Only works on numeric operands.
 bool UnaryMinusOperation(const Token& op, const Token& value, Token* result) {
-  RETURN_FALSE_IF(op.Operator() != "-");
+  RETURN_FALSE_IF(op.Operator() != kMinus);
   const auto& v = value.Value();
   if (!v.isNumeric()) {
     LOG(INFO) << "Operand is not a number: " << UnaryDebugString(op, value);
@@ -770,550 +962,126 @@ bool UnaryMinusOperation(const Token& op, const Token& value, Token* result) {
   return true;
 }
 
-// A UnaryOperation. Evaluates boolean NOT.
+// A unary operation. Evaluates boolean NOT.
 bool LogicalNotOperation(const Token& op, const Token& value, Token* result) {
-  RETURN_FALSE_IF(op.Operator() != "!");
+  RETURN_FALSE_IF(op.Operator() != kNot);
   *result = Token(Json::Value(!value.ToBool()));
   return true;
 }
 
-// Check if an expression sequence is a valid sequence of values separated by
-// ','. Returns true for a valid sequence or empty expression.
-// 'InputIterator' must have value type 'Token'.
-template <class InputIterator>
-bool IsValueSequence(InputIterator first, InputIterator last) {
-  if (first == last) {
-    return true;
-  }
-  auto size = std::distance(first, last);
-  // First element must be a value, sequence must have odd number of tokens.
-  if (!first->IsValue() || size % 2 == 0) {
-    return false;
-  }
-  // We check for a following sequence of ',', 'value', ',', 'value', ...
-  // 'it_op' points to the ',' operator.
-  // 'first' points to the value.
-  auto it_op = first;
-  ++it_op;
-  while (it_op != last) {
-    std::advance(first, 2);
-    if (it_op->Operator() != "," || !first->IsValue()) {
+// Accesses the element at 'key' of 'container', which must be an array or an
+// object. The result is a reference if 'container' is a reference, otherwise it
+// is a copy of the element. Returns false if the element does not exist.
+bool AccessElement(const Token& container, const Token& key, Token* result) {
+  const internal::ValueTree* node = container.Node();
+  if (node != nullptr) {
+    // Same as for arrays and objects below, without converting the node.
+    const internal::ValueTree::Child* child = nullptr;
+    if (!node->is_array()) {
+      child = node->Find(ValueToString(key.Value()));
+    } else if (ValueToString(key.Value()) == "length") {
+      *result = Token(Json::Value(static_cast<Json::ArrayIndex>(node->size())));
+      return true;
+    } else if (key.Value().isIntegral()) {
+      child = node->element(key.Value().asInt());
+    }
+    if (child == nullptr) {
+      DVLOG(1) << "Accessing node at: " << container.DebugString()
+               << ", with invalid key: " << key.DebugString();
       return false;
     }
-    // Move 'it_op' to next ','.
-    std::advance(it_op, 2);
+    *result = ChildToken(*child);
+    return true;
   }
-  return true;
-}
-
-template <class T>
-bool PairEquals(const std::pair<T, T>& x) {
-  return x.first == x.second;
-}
-
-// Recursively evaluates the sub expressions in the outermost parentheses.
-// If the first three parameters are bound, this is a SubstituteMethod.
-// Parentheses may also occur for system function calls. In this case, and in
-// the case of array or dictionary element accesses, the arguments in the
-// parentheses are evaluated and replaced with a value sequence but the
-// parentheses are not stripped.
-bool SubstituteParentheses(const Json::Value& store, const Runtime* runtime,
-                           FunctionDispatcher* dispatcher,
-                           std::list<Token>* expr, bool* is_error) {
-  *is_error = false;
-
-  // A string that holds the current type, either of '(' or '['. The type
-  // will be auto-detected and set by 'is_start' below. Then, 'is_end' will
-  // adjust its detection type based on 'parenthesis_type'.
-  string parenthesis_type;
-
-  // This will match the start parentheses as either type and set the type.
-  auto is_start = [&parenthesis_type](const Token& x) {
-    if (!x.IsOperator()) {
+  const internal::RecordArray* records = container.Records();
+  if (records != nullptr) {
+    // Same as for arrays below, without converting the records.
+    if (ValueToString(key.Value()) == "length") {
+      *result =
+          Token(Json::Value(static_cast<Json::ArrayIndex>(records->size())));
+    } else if (!key.Value().isIntegral() || key.Value().asInt() < 0 ||
+               key.Value().asInt() >= records->size()) {
+      DVLOG(1) << "Accessing array at: " << container.DebugString()
+               << ", with invalid index: " << key.DebugString();
       return false;
+    } else {
+      *result = Token(&records->record(key.Value().asInt()));
     }
-    // Detect type if empty.
-    if (parenthesis_type.empty()) {
-      if (x.Operator() == "(" || x.Operator() == "[") {
-        parenthesis_type = x.Operator();
-        return true;
-      }
+    return true;
+  }
+  if (container.Record() != nullptr) {
+    const string location = ValueToString(key.Value());
+    const Json::Value* member = container.Record()->Find(location);
+    if (member == nullptr) {
+      DVLOG(1) << "Accessing object at: " << container.DebugString()
+               << ", with invalid field: " << key.DebugString();
       return false;
     }
-    // Use detected type if non-empty.
-    if (parenthesis_type == x.Operator()) {
-      return true;
-    }
-    return false;
-  };
-  // End will return true for either parenthesis type until 'is_start' has
-  // detected the parenthesis type. After which 'is_end' will only match based
-  // on the detected type. This allows for early error detection if a closing
-  // parenthesis is detected before any opening parenthesis.
-  auto is_end = [&parenthesis_type](const Token& x) {
-    if (!x.IsOperator()) {
+    *result = Token(member);
+    return true;
+  }
+  const Json::Value& value = container.Value();
+  if (value.isArray()) {
+    // Special built-in array property, 'length'.
+    // Unlike Javascript, 'length' is not assignable since it is not a
+    // store location reference, but a literal integer value.
+    if (ValueToString(key.Value()) == "length") {
+      *result = Token(Json::Value(value.size()));
+    } else if (!key.Value().isIntegral() || key.Value().asInt() < 0 ||
+               static_cast<::std::size_t>(key.Value().asInt()) >=
+                   value.size()) {
+      // Error if using non-integral value to access an array.
+      DVLOG(1) << "Accessing array at: " << container.DebugString()
+               << ", with invalid index: " << key.DebugString();
       return false;
+    } else if (container.IsReference()) {
+      // Array reference index element access.
+      *result = Token(&value[key.Value().asInt()]);
+    } else {
+      // Array value index element access, copy element.
+      *result = Token(value[key.Value().asInt()]);
     }
-    if (parenthesis_type.empty()) {
-      // A match here indicates an error detectable within
-      // FindOuterMostParenthesis().
-      if (x.Operator() == ")" || x.Operator() == "]") {
-        return true;
-      }
+  } else if (value.isObject()) {
+    const string location = ValueToString(key.Value());
+    if (!value.isMember(location)) {
+      DVLOG(1) << "Accessing object at: " << container.DebugString()
+               << ", with invalid field: " << key.DebugString();
       return false;
     }
-    if (parenthesis_type == "(" && x.Operator() == ")") {
-      return true;
-    }
-    if (parenthesis_type == "[" && x.Operator() == "]") {
-      return true;
-    }
-    return false;
-  };
-
-  bool substituted = false;
-  auto it_begin = expr->begin();
-  auto it = it_begin;
-  auto it_end = expr->end();
-  auto range = std::make_pair(it_end, it_end);
-  std::list<Token> sub_expr;
-  // Note assignment in condition.
-  while (!PairEquals(
-      range = FindOuterMostParentheses(it, it_end, is_start, is_end))) {
-    // Check loop invariant.
-    LOG_IF(DFATAL, !(parenthesis_type == "(" || parenthesis_type == "["))
-        << parenthesis_type;
-    auto first = range.first;
-    ++first;
-    auto before_first = range.first;
-    if (range.first != it_begin) {
-      --before_first;
-    }
-    // Nothing to do if it is function call or element access and the expression
-    // within the parenthesis is a value sequence.
-    if (IsValueSequence(first, range.second)) {
-      if (parenthesis_type == "[" ||
-          (parenthesis_type == "(" && before_first->IsSystemFunction())) {
-        it = ++range.second;
-        parenthesis_type.clear();
-        continue;
-      }
-    }
-    // Moves [first, range.second) to 'sub_expr'.
-    sub_expr.clear();
-    sub_expr.splice(sub_expr.end(), *expr, first, range.second);
-    // There may not be an empty expression within '[]' parenthesis.
-    if (sub_expr.empty() && parenthesis_type == "[") {
-      DVLOG(1) << "Error: empty expression between '[]'.";
-      *is_error = true;
-      return true;
-    }
-    // There may be an empty expression within '()' parenthesis, e.g., a
-    // function call with no arguments.
-    if (!sub_expr.empty() &&
-        !SubstituteUntilValue(store, runtime, dispatcher, &sub_expr)) {
-      *is_error = true;
-      return true;
-    }
-    // Move the entire result back into the expression.
-    expr->splice(range.second, sub_expr);
-    substituted = true;
-    // Remove parenthesis or not depending on type.
-    // Continue detection after the parenthesis group.
-    if (parenthesis_type == "(" && !before_first->IsSystemFunction()) {
-      expr->erase(range.first);
-      it = expr->erase(range.second);
-    } else {  // parenthesis_type == "[" or a function call.
-      it = ++range.second;
-    }
-    parenthesis_type.clear();
-  }
-  return substituted;
-}
-
-// A SubstituteMethod.
-// Substitute element accesses on references with new reference Tokens.
-bool SubstituteElementAccess(const Json::Value& store,
-                             const Runtime* /* unused */,
-                             FunctionDispatcher* /* unused */,
-                             std::list<Token>* expr, bool* is_error) {
-  // Matcher for element access.
-  static const auto* const kElementAccessMatcher = new TokenPredicates{
-      [](const Token& x) {
-        return x.IsValue() && (x.Value().isObject() || x.Value().isArray());
-      },
-      [](const Token& x) { return x.IsOperator() && x.Operator() == "["; },
-      &Token::IsValue,
-      [](const Token& x) { return x.IsOperator() && x.Operator() == "]"; },
-  };
-
-  *is_error = false;
-  bool substituted = false;
-  string location;
-  auto it = expr->begin();
-  auto it_end = expr->end();
-  // Note assignment in condition.
-  while (it_end !=
-         (it = SearchWithPredicates(it, it_end, *kElementAccessMatcher))) {
-    // Stores the reference of the object/array. Will be replaced with the value
-    // of the element access.
-    auto it_ref = it;
-    // Move 'it' to element index value.
-    std::advance(it, 2);
-    if (it_ref->Value().isArray()) {
-      // Special built-in array property, 'length'.
-      // Unlike Javascript, 'length' is not assignable since it is not a
-      // store location reference, but a literal integer value.
-      if (ValueToString(it->Value()) == "length") {
-        *it_ref = Token(Json::Value(it_ref->Value().size()));
-      } else if (!it->Value().isIntegral() || it->Value().asInt() < 0 ||
-                 static_cast<::std::size_t>(it->Value().asInt()) >=
-                     it_ref->Value().size()) {
-        // Error if using non-integral value to access an array.
-        *is_error = true;
-        DVLOG(1) << "Accessing array at: " << it_ref->DebugString()
-                 << ", with invalid index: " << it->DebugString();
-        return substituted;
-      } else if (it_ref->IsReference()) {
-        // Array reference index element access.
-        *it_ref = Token(&it_ref->Value()[it->Value().asInt()]);
-      } else {
-        // Array value index element access, copy element.
-        *it_ref = Token(it_ref->Value()[it->Value().asInt()]);
-      }
-    } else if (it_ref->Value().isObject()) {
-      location = ValueToString(it->Value());
-      if (!it_ref->Value().isMember(location)) {
-        *is_error = true;
-        DVLOG(1) << "Accessing object at: " << it_ref->DebugString()
-                 << ", with invalid field: " << it->DebugString();
-        return substituted;
-      }
-      if (it_ref->IsReference()) {
-        // Object reference element access.
-        *it_ref = Token(&it_ref->Value()[location]);
-      } else {
-        // Object value element access, copy element.
-        *it_ref = Token(it_ref->Value()[location]);
-      }
+    if (container.IsReference()) {
+      // Object reference element access.
+      *result = Token(&value[location]);
     } else {
-      *is_error = true;
-      DVLOG(1) << "Element access error, reference is not an array or object: "
-               << it_ref->DebugString();
-      return substituted;
-    }
-    substituted = true;
-    // Result of element access has been stored in 'it_ref'.
-    // Erase elements from '[' to ']', backup old position in 'it_new'.
-    auto it_new = it_ref++;  // Move to '['.
-    std::advance(it, 2);     // Move to one after ']'.
-    expr->erase(it_ref, it);
-    // Restart from 'it_new' so that 'foo[1][2]' can be processed.
-    it = it_new;
-  }  // while
-  return substituted;
-}
-
-// A substitute method. Processes a system function call and returns the result.
-// Expects that all arguments to functions have been evaluated to values,
-// otherwise returns false.
-bool SubstituteSystemFunctionCalls(const Json::Value& store,
-                                   const Runtime* runtime,
-                                   FunctionDispatcher* dispatcher,
-                                   std::list<Token>* expr, bool* is_error) {
-  // Matcher for start of a function call.
-  static const auto* const kStartFunctionCallMatcher = new TokenPredicates{
-      std::mem_fn(&Token::IsSystemFunction),
-      [](const Token& x) { return x.IsOperator() && x.Operator() == "("; },
-  };
-  *is_error = false;
-  bool substituted = false;
-  auto it = expr->begin();
-  auto it_end = expr->end();
-  auto range = std::make_pair(it_end, it_end);
-  std::list<Token> arg_sequence;
-  std::vector<const Json::Value*> arguments;
-  // Search for the start of a function call.
-  // Note the assignment in the condition.
-  while (it_end !=
-         (it = SearchWithPredicates(it, it_end, *kStartFunctionCallMatcher))) {
-    // Search for the end of the function call.
-    range = FindOuterMostParentheses(
-        it, it_end, kStartFunctionCallMatcher->at(1),
-        [](const Token& x) { return x.Operator() == ")"; });
-    if (PairEquals(range)) {
-      DVLOG(1) << "Invalid function call syntax for: " << it->DebugString();
-      *is_error = true;
-      return substituted;
-    }
-    // Advance to the first argument.
-    ++range.first;
-    arg_sequence.clear();
-    arg_sequence.splice(arg_sequence.end(), *expr, range.first, range.second);
-    arguments.clear();
-    if (!arg_sequence.empty()) {
-      substituted = true;
-      RETURN_FALSE_IF_MSG(
-          !IsValueSequence(arg_sequence.begin(), arg_sequence.end()),
-          absl::StrCat(
-              "Invalid argument list for function call: ", it->DebugString(),
-              absl::StrJoin(ListDebugStrings(arg_sequence), " ")));
-
-      for (const auto& token : arg_sequence) {
-        if (token.IsValue()) {
-          arguments.push_back(&token.Value());
-        }
-      }
-    }
-    Token return_value((Json::Value()));
-    // return_value.MutableValue() will be non-NULL.
-    if (it->SystemFunction() == "In") {
-      if (runtime == nullptr || arguments.size() != 1 ||
-          !arguments[0]->isString()) {
-        DVLOG(1) << "Invalid call to function In("
-                 << absl::StrJoin(ListDebugStrings(arg_sequence), ",") << ")\n"
-                 << "Needs a valid Runtime and a single string argument.";
-        *is_error = true;
-        return substituted;
-      }
-      const string& state_id = arguments[0]->asString();
-      *return_value.MutableValue() =
-          Json::Value(runtime->IsActiveState(state_id));
-    } else if (!dispatcher->Execute(it->SystemFunction(), arguments,
-                                    return_value.MutableValue())) {
-      *is_error = true;
-      DVLOG(1) << "Error executing system function call: "
-               << it->SystemFunction() << "("
-               << absl::StrJoin(ListDebugStrings(arg_sequence), ",") << ")";
-      return substituted;
-    }
-    // Substitute the function call with the result.
-    // Erase the function name and '(' tokens. The argument sequence was
-    // previously spliced out.
-    it = expr->erase(it, range.second);
-    // Replace the ')' token with the result.
-    it->Swap(&return_value);
-    // Start from one after the result.
-    ++it;
-  }
-  return substituted;
-}
-
-// Hackish way to process 'Math.random()'.
-// Seed a random generator with the current millisecond and draw real
-// numbers uniformly within [0, 1).
-void ComputeRandom(std::list<string>* expr) {
-  static const auto* const kMathRandomExpr =
-      new std::vector<string>{"Math.random", "(", ")"};
-  std::unique_ptr<std::default_random_engine> lazy_generator;
-
-  auto it = expr->begin();
-  const auto it_end = expr->end();
-  while (it_end !=
-         // Assignment.
-         (it = std::search(it, it_end, kMathRandomExpr->begin(),
-                           kMathRandomExpr->end()))) {
-    if (!lazy_generator) {
-      lazy_generator.reset(
-          new std::default_random_engine(time(nullptr) % 1000));
-    }
-
-    auto random_expr_start = it;
-    std::advance(it, kMathRandomExpr->size());
-    // Store result in the 'Math.random' node.
-    *random_expr_start = absl::StrCat(
-        std::uniform_real_distribution<>()(*lazy_generator));
-    // Erase the excess nodes.
-    ++random_expr_start;
-    it = expr->erase(random_expr_start, it);
-  }
-}
-
-// This preprocesses the expression before calling SubstituteUntilValue.
-// It is used to convert the token values to standard form. It does the
-// following conversions:
-// - All single quoted strings to double quoted strings.
-// - Substitute "Math.random()" with a random double in [0, 1).
-// - All subpath expressions, ".<some_path>", occurring after an element access
-//   are converted to element access tokens: "[", "<some_path>", "]". For
-//   example, 'goo.foo[0].bar' becomes 'goo.foo[0]["bar"]'.
-// - Replaces built-in object properties with element access. For example,
-//   'some_array.length' becomes 'some_array["length"]'.
-void PresubstituteStringTokens(const Json::Value& store,
-                               std::list<string>* expr) {
-  string object_location;
-  for (auto it = expr->begin(), it_end = expr->end(); it != it_end; ++it) {
-    const Json::Value* value_reference = nullptr;
-    // Replace all singly quoted strings with double quotes.
-    if (IsQuotedString(*it, '\'')) {
-      *it = Quote(Unquote(*it, '\''));
-    } else if (::absl::StartsWith(*it, ".")) {
-      std::vector<absl::string_view> path_tokens =
-          absl::StrSplit(*it, ".", absl::SkipEmpty());
-      for (const auto& path_token : path_tokens) {
-        expr->insert(it, "[");
-        expr->insert(it, Quote(string(path_token)));
-        expr->insert(it, "]");
-      }
-      it = expr->erase(it);
-      --it;  // Move back one step since 'it' is incremented by loop.
-    } else if (absl::EndsWith(*it, ".length")) {
-      // Built-in length property replacement for arrays.
-      object_location = it->substr(0, it->size() - strlen(".length"));
-      if (FindValueInStore(store, object_location, &value_reference) &&
-          value_reference->isArray()) {
-        it->swap(object_location);
-        // Insert after the object location.
-        ++it;
-        expr->insert(it, "[");
-        expr->insert(it, Quote("length"));
-        expr->insert(it, "]");
-        --it;  // Move back to "]" since 'it' is incremented by loop.
-      }
-    }
-  }
-  // Process 'Math.random()' as if it is a macro substitution.
-  ComputeRandom(expr);
-}
-
-// Returns the SubstituteMethods for the operators in substitution order.
-const std::vector<SubstituteMethod>& GetSubstituteMethods() {
-  // This list of substitutions defines the substitution order.
-  static const auto* const kSubstituteMethods = new std::vector<
-      SubstituteMethod>{
-      // Recursively evaluate all parentheses.
-      &SubstituteParentheses,
-      // Do all system calls.
-      &SubstituteSystemFunctionCalls,
-      // Resolve all element access.
-      &SubstituteElementAccess,
-      // Unary minus takes highest precedence among arithmetic operations.
-      // TODO(qplau): Combine unary negation and logical not if this precedence
-      // poses a problem. Both are of equal precedence in JavaScript.
-      BindFront(&SubUnaryOpMeta,
-                [](const Token& op) { return op.Operator() == "-"; },
-                &UnaryMinusOperation),
-      // Do logical NOT.
-      BindFront(&SubUnaryOpMeta,
-                [](const Token& op) { return op.Operator() == "!"; },
-                &LogicalNotOperation),
-      // Do all multiplication or division.
-      BindFront(&SubInfixBinaryOpMeta,
-                [](const Token& op) {
-                  return op.Operator() == "*" || op.Operator() == "/";
-                },
-                &MultiplicativeOperation),
-      // Do all addition or subtraction.
-      BindFront(&SubInfixBinaryOpMeta,
-                [](const Token& op) {
-                  return op.Operator() == "+" || op.Operator() == "-";
-                },
-                &AdditiveOperation),
-      // Do relational comparisons.
-      BindFront(&SubInfixBinaryOpMeta, &IsRelationalOp, &ComparisonOperation),
-      // Do equality comparisons.
-      BindFront(&SubInfixBinaryOpMeta, &IsEqualityOp, &ComparisonOperation),
-      // Do logical AND.
-      BindFront(&SubInfixBinaryOpMeta,
-                [](const Token& op) { return op.Operator() == "&&"; },
-                &LogicalAndOperation),
-      // Do logical OR.
-      BindFront(&SubInfixBinaryOpMeta,
-                [](const Token& op) { return op.Operator() == "||"; },
-                &LogicalOrOperation),
-  };
-  return *kSubstituteMethods;
-}
-
-// Substitute the tokenized 'expr' repeatedly until an error has
-// occurred or 'expr' IsValueSequence().
-// Returns false if an error occurred.
-// Note that expression must be a pure expression without side effects.
-// This method implements a simple expression evaluator through substitution on
-// a tokenized form of the expression.
-// Each SubstitueMethod is called in substitution order on the expression and
-// must guarantee that applying it more than once on the 'expr' has no effect.
-// Terminate substitution early when an error occurs.
-bool SubstituteUntilValue(const Json::Value& store, const Runtime* runtime,
-                          FunctionDispatcher* dispatcher,
-                          std::list<Token>* expr) {
-  // This list of substitutions defines the substitution order.
-  const auto& substitute_methods = GetSubstituteMethods();
-
-  bool is_error = false;
-  for (const SubstituteMethod& method : substitute_methods) {
-    if (method(store, runtime, dispatcher, expr, &is_error)) {
-      DVLOG(1) << "expr: " << absl::StrJoin(ListDebugStrings(*expr), " ");
+      // Object value element access, copy element.
+      *result = Token(value[location]);
     }
-    if (is_error) {
-      break;
-    }
-  }
-
-  if (!is_error && IsValueSequence(expr->begin(), expr->end())) {
-    return true;
+  } else {
+    DVLOG(1) << "Element access error, reference is not an array or object: "
+             << container.DebugString();
+    return false;
   }
-  DVLOG(1) << "Eval error, remaining tokens: "
-           << absl::StrJoin(ListDebugStrings(*expr), " ");
-  return false;
+  return true;
 }
 
-// Convert a list of string tokens to a list of Tokens. Returns false if an
-// error occurred during conversion.
-bool ConvertTokens(const Json::Value& store,
-                   const FunctionDispatcher& dispatcher,
-                   const std::list<string>& str_tokens,
-                   std::list<Token>* tokens) {
-  for (const string& str : str_tokens) {
-    bool is_error = false;
-    tokens->push_back(Token::Create(store, dispatcher, str, &is_error));
-    if (is_error) {
-      DVLOG(1) << "Token creation failed for token: " << str;
+// Calls the system function 'function' with 'arguments' and stores the return
+// value in 'result'. The function 'In' is handled by 'runtime'.
+// Returns false if the call failed.
+bool CallSystemFunction(const Runtime* runtime, FunctionDispatcher* dispatcher,
+                        const string& function,
+                        const std::vector<const Json::Value*>& arguments,
+                        Json::Value* result) {
+  if (function == "In") {
+    if (runtime == nullptr || arguments.size() != 1 ||
+        !arguments[0]->isString()) {
+      DVLOG(1) << "Invalid call to function In() with " << arguments.size()
+               << " argument(s).\n"
+               << "Needs a valid Runtime and a single string argument.";
       return false;
     }
-  }
-  return true;
-}
-
-// Converts a string expression into the internal format and stores the result
-// in 'result'. Returns true if evaluation succeeded.
-bool ProcessExpression(const Json::Value& store, const Runtime* runtime,
-                       FunctionDispatcher* dispatcher, string expression,
-                       Token* result) {
-  absl::StripAsciiWhitespace(&expression);
-  if (expression.empty()) {
-    return false;
-  }
-
-  bool is_error = false;
-  *result = Token::Create(store, *dispatcher, expression, &is_error);
-  if (!is_error && result->IsValue()) {
-    DVLOG(1) << "expression is value: " << expression;
+    *result = Json::Value(runtime->IsActiveState(arguments[0]->asString()));
     return true;
   }
-
-  std::list<string> string_tokens;
-  internal::TokenizeExpression(expression, &string_tokens);
-  // Do preprocessing on the string tokens.
-  PresubstituteStringTokens(store, &string_tokens);
-
-  // Convert string tokens to Tokens.
-  std::list<Token> tokens;
-  if (!ConvertTokens(store, *dispatcher, string_tokens, &tokens)) {
-    DVLOG(1) << "Token conversion failure for expression: " << expression;
-    return false;
-  }
-
-  if (!SubstituteUntilValue(store, runtime, dispatcher, &tokens)) {
-    return false;
-  }
-  // Only allow value sequences that are of size 1.
-  if (tokens.size() != 1) {
-    return false;
-  }
-  // Store result.
-  tokens.front().Swap(result);
-  return true;
+  return dispatcher->Execute(function, arguments, result);
 }
 
 // Validate that 'path' is a valid dot-separated JSON path.
@@ -1345,130 +1113,1043 @@ bool IsDotSeparatedPath(const FunctionDispatcher& dispatcher,
   return true;
 }
 
-// Computes a location expression and destructively modifies the store to
-// create the evaluated location if the location does not exists or is null.
-// Returns false if an error occurred. Otherwise stores the address of the
-// newly created store Json::Value in 'location'.
-bool ProcessLocationExpression(Json::Value* store, const Runtime* runtime,
-                               FunctionDispatcher* dispatcher,
-                               string expression, Json::Value** location) {
-  absl::StripAsciiWhitespace(&expression);
-  if (expression.empty()) {
-    return false;
-  }
-
-  std::list<string> string_tokens;
-  internal::TokenizeExpression(expression, &string_tokens);
-  // Do preprocessing on the string tokens.
-  PresubstituteStringTokens(*store, &string_tokens);
-
-  // Validate that the first token is a path.
-  // Also check that the token is not a function.
-  if (!IsDotSeparatedPath(*dispatcher, string_tokens.front())) {
+// Resolves a location that was compiled to a slot 'reference' the same way as
+// FindValueInStore() resolves it by name, including the built-in 'length'
+// property of arrays. The top-level variable is looked up in 'slots'.
+bool ResolveSlotReference(const internal::Store& store,
+                          const internal::SlotCache& slots,
+                          const internal::SlotReference& reference,
+                          Token* result) {
+  const internal::Store::Variable* variable =
+      slots.Find(store, reference.slot);
+  const auto& members = reference.members;
+  if (variable != nullptr && variable->records() != nullptr) {
+    // An array has no members but 'length'.
+    if (members.empty()) {
+      *result = Token(variable);
+      return true;
+    }
+    if (members.size() == 1 && members[0] == "length") {
+      *result = Token(Json::Value(
+          static_cast<Json::ArrayIndex>(variable->records()->size())));
+      return true;
+    }
     return false;
   }
-  // Additionally convert leading '.' paths into element accesses so that
-  // they can be validated step by step that the Json::Value is of the correct
-  // type. E.g. if 'arr' is an array, we need to ensure 'arr.foo' returns
-  // false and not assert-fail when Json::Path::make() is called.
-  std::vector<absl::string_view> path_tokens =
-      absl::StrSplit(string_tokens.front(), ".", absl::SkipEmpty());
-  // Insert right after the first token.
-  auto it = ++string_tokens.begin();
-  for (::std::size_t i = 1; i < path_tokens.size(); ++i) {
-    // Convert to element access.
-    string_tokens.insert(it, "[");
-    string_tokens.insert(it, Quote(string(path_tokens[i])));
-    string_tokens.insert(it, "]");
+  const Json::Value* value = nullptr;
+  ::std::size_t i = 0;
+  if (variable != nullptr && variable->tree() != nullptr) {
+    // Walks the nodes without converting them, up to a member that is not a
+    // node.
+    const internal::ValueTree* node = variable->tree();
+    for (; value == nullptr && i < members.size(); ++i) {
+      if (node->is_array()) {
+        if (i + 1 != members.size() || members[i] != "length") {
+          return false;
+        }
+        *result =
+            Token(Json::Value(static_cast<Json::ArrayIndex>(node->size())));
+        return true;
+      }
+      const internal::ValueTree::Child* child = node->Find(members[i]);
+      if (child == nullptr) {
+        return false;
+      }
+      if (child->tree == nullptr) {
+        value = &child->value;
+      } else {
+        node = child->tree.get();
+      }
+    }
+    if (value == nullptr) {
+      *result = Token(node);
+      return true;
+    }
+  } else if (variable != nullptr) {
+    value = &variable->value();
   }
-  // Replace the first string_token with the first path_token.
-  string_tokens.front() = string(path_tokens.front());
-
-  // Create the root if needed.
-  Json::Path json_root_path(string_tokens.front());
-  // Flag used to track if a new location was created or not.
-  bool is_new_location =
-      UndefinedJSON() == json_root_path.resolve(*store, UndefinedJSON());
-  Json::Value* new_loc = &json_root_path.make(*store);
-
-  // Convert string tokens to Tokens.
-  std::list<Token> tokens;
-  if (!ConvertTokens(*store, *dispatcher, string_tokens, &tokens)) {
-    DVLOG(1) << "Token conversion failure for expression: " << expression;
+  for (; value != nullptr && i < members.size(); ++i) {
+    if (value->isArray() && i + 1 == members.size() &&
+        members[i] == "length") {
+      *result = Token(Json::Value(value->size()));
+      return true;
+    }
+    value = value->isObject()
+                ? value->find(members[i].data(),
+                              members[i].data() + members[i].size())
+                : nullptr;
+  }
+  if (value == nullptr) {
     return false;
   }
+  *result = Token(value);
+  return true;
+}
 
-  // Process all sub-expressions in the parentheses.
-  bool is_error = false;
-  SubstituteParentheses(*store, runtime, dispatcher, &tokens, &is_error);
-  // Token elements must be of the form "root[key1][key2]...[keyN]".
-  if (is_error || (tokens.size() - 1) % 3 != 0) {
+// Resolves a dot separated location 'name' in the store the same way as
+// Token::Create() does, including the built-in 'length' property of arrays.
+// If 'slots' is not nullptr and 'name' was compiled to a slot 'reference', the
+// top-level variable is looked up by its slot instead of its name.
+bool ResolveIdentifier(const internal::Store& store,
+                       const FunctionDispatcher& dispatcher,
+                       const internal::SlotCache* slots,
+                       internal::PathCache* paths, const string& name,
+                       const internal::SlotReference& reference,
+                       Token* result) {
+  // System functions are not values.
+  if (name == "In" || dispatcher.HasFunction(name)) {
+    DVLOG(1) << "System function used as a value: " << name;
+    return false;
+  }
+  if (slots != nullptr && reference.slot != SymbolTable::kNoSlot) {
+    if (!ResolveSlotReference(store, *slots, reference, result)) {
+      DVLOG(1) << "Location not found: " << name;
+      return false;
+    }
+    return true;
+  }
+  if (absl::EndsWith(name, ".length")) {
+    // Built-in length property of arrays.
+    Token array;
+    if (FindValueInStore(store, paths,
+                         name.substr(0, name.size() - strlen(".length")),
+                         &array) &&
+        array.ArraySize() >= 0) {
+      *result = Token(
+          Json::Value(static_cast<Json::ArrayIndex>(array.ArraySize())));
+      return true;
+    }
+  }
+  if (!FindValueInStore(store, paths, name, result)) {
+    DVLOG(1) << "Location not found: " << name;
     return false;
   }
+  return true;
+}
 
-  // Create the subpaths under the root object.
-  // Do validation in the process.
-  tokens.pop_front();
-  for (auto it = tokens.begin(), it_end = tokens.end(); it != it_end; ++it) {
-    // Do validation.
-    if (!it->IsOperator() || it->Operator() != "[") {
+// Evaluates the syntax 'tree' of an expression. Identifiers are resolved by
+// their slots in 'slots' unless it is nullptr.
+// Returns false if an error occurred.
+bool EvaluateSyntaxTree(const internal::Store& store, Runtime* runtime,
+                        FunctionDispatcher* dispatcher,
+                        const internal::SlotCache* slots,
+                        internal::PathCache* paths,
+                        const internal::ExpressionNode& tree, Token* result) {
+  using internal::ExpressionNode;
+  switch (tree.type) {
+    case ExpressionNode::kLiteral:
+      *result = Token(tree.value);
+      return true;
+    case ExpressionNode::kIdentifier:
+      return ResolveIdentifier(store, *dispatcher, slots, paths, tree.name,
+                               tree.reference, result);
+    case ExpressionNode::kRandom:
+      *result = Token(Json::Value(GenerateRandom(runtime)));
+      return true;
+    case ExpressionNode::kCall: {
+      if (tree.name != "In" && !dispatcher->HasFunction(tree.name)) {
+        // Empty parentheses after a location are dropped, i.e., 'foo()' is
+        // 'foo'.
+        return tree.operands.empty() &&
+               ResolveIdentifier(store, *dispatcher, slots, paths, tree.name,
+                                 tree.reference, result);
+      }
+      std::vector<Token> argument_tokens(tree.operands.size());
+      std::vector<const Json::Value*> arguments;
+      for (::std::size_t i = 0; i < tree.operands.size(); ++i) {
+        if (!EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                                *tree.operands[i], &argument_tokens[i])) {
+          return false;
+        }
+        arguments.push_back(&argument_tokens[i].Value());
+      }
+      Json::Value return_value;
+      if (!CallSystemFunction(runtime, dispatcher, tree.name, arguments,
+                              &return_value)) {
+        DVLOG(1) << "Error executing system function call: "
+                 << tree.DebugString();
+        return false;
+      }
+      *result = Token(return_value);
+      return true;
+    }
+    case ExpressionNode::kElementAccess: {
+      Token container;
+      Token key;
+      if (!EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                              *tree.operands[0], &container) ||
+          !EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                              *tree.operands[1], &key)) {
+        return false;
+      }
+      return AccessElement(container, key, result);
+    }
+    case ExpressionNode::kUnaryOperation: {
+      Token operand;
+      if (!EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                              *tree.operands[0], &operand)) {
+        return false;
+      }
+      const Token op(tree.op_id);
+      switch (tree.op_id) {
+        case kMinus:
+          return UnaryMinusOperation(op, operand, result);
+        case kNot:
+          return LogicalNotOperation(op, operand, result);
+        default:
+          break;
+      }
+      LOG(DFATAL) << "Unrecognized operator: " << tree.DebugString();
       return false;
     }
-    ++it;
-    if (it == it_end || !it->IsValue()) {
+    case ExpressionNode::kBinaryOperation: {
+      Token a;
+      if (!EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                              *tree.operands[0], &a)) {
+        return false;
+      }
+      // The right operand of a logical operator is not evaluated if the left
+      // operand decides the result.
+      if ((tree.op_id == kAnd && !a.ToBool()) ||
+          (tree.op_id == kOr && a.ToBool())) {
+        *result = Token(Json::Value(a.ToBool()));
+        return true;
+      }
+      Token b;
+      if (!EvaluateSyntaxTree(store, runtime, dispatcher, slots, paths,
+                              *tree.operands[1], &b)) {
+        return false;
+      }
+      const Token op(tree.op_id);
+      DVLOG(1) << "BinOp: " << BinaryDebugString(op, a, b);
+      switch (tree.op_id) {
+        case kMultiply:
+        case kDivide:
+          return MultiplicativeOperation(op, a, b, result);
+        case kPlus:
+        case kMinus:
+          return AdditiveOperation(op, a, b, result);
+        case kLess:
+        case kLessEqual:
+        case kGreaterEqual:
+        case kGreater:
+        case kEqual:
+        case kNotEqual:
+          return ComparisonOperation(op, a, b, result);
+        case kAnd:
+          return LogicalAndOperation(op, a, b, result);
+        case kOr:
+          return LogicalOrOperation(op, a, b, result);
+        default:
+          break;
+      }
+      LOG(DFATAL) << "Unrecognized operator: " << tree.DebugString();
       return false;
     }
-    const Token& field_token = *it;
-    ++it;
-    if (it == it_end || !it->IsOperator() || it->Operator() != "]") {
+  }
+  LOG(DFATAL) << "Unknown expression node type: " << tree.type;
+  return false;
+}
+
+// Parses a string expression into a syntax tree, evaluates it and stores the
+// result in 'result'. Returns true if evaluation succeeded.
+bool ProcessExpression(const internal::Store& store, Runtime* runtime,
+                       FunctionDispatcher* dispatcher,
+                       internal::PathCache* paths, string expression,
+                       Token* result) {
+  absl::StripAsciiWhitespace(&expression);
+  if (expression.empty()) {
+    return false;
+  }
+
+  bool is_error = false;
+  *result = Token::Create(store, *dispatcher, paths, expression, &is_error);
+  if (!is_error && result->IsValue()) {
+    DVLOG(1) << "expression is value: " << expression;
+    return true;
+  }
+
+  const auto tree = internal::ParseExpression(expression);
+  if (tree == nullptr) {
+    DVLOG(1) << "Failed to parse expression: " << expression;
+    return false;
+  }
+  return EvaluateSyntaxTree(store, runtime, dispatcher, nullptr, paths, *tree,
+                            result);
+}
+
+// The keys of a location under its top-level variable.
+using LocationKeys = absl::InlinedVector<const Json::Value*, 4>;
+
+// Returns true if 'name' is a member that a location may access with '.'.
+bool IsIdentifier(absl::string_view name) {
+  return !name.empty() && !absl::ascii_isdigit(name.front()) &&
+         std::all_of(name.begin(), name.end(), IsIdentifierChar);
+}
+
+// Appends 'key' to 'path' as a location accesses it: '.name' for members
+// that are identifiers, '["name"]' for other members and '[n]' for elements.
+void AppendPathKey(const Json::Value& key, string* path) {
+  if (key.isIntegral()) {
+    absl::StrAppend(path, "[", key.asInt(), "]");
+    return;
+  }
+  const char* begin = nullptr;
+  const char* end = nullptr;
+  key.getString(&begin, &end);
+  const absl::string_view name(begin, end - begin);
+  if (IsIdentifier(name)) {
+    absl::StrAppend(path, ".", name);
+  } else {
+    absl::StrAppend(path, "[\"", EscapeQuotes(string(name)), "\"]");
+  }
+}
+
+// Splits a path of keys written by AppendPathKey() into the text of each key.
+std::vector<absl::string_view> SplitPathKeys(absl::string_view path) {
+  std::vector<absl::string_view> keys;
+  std::size_t start = 0;
+  while (start < path.size()) {
+    std::size_t end = start + 1;
+    if (path[start] == '.') {
+      end = std::min(path.find_first_of(".[", end), path.size());
+    } else if (end < path.size() && path[end] == '"') {
+      // Skip to the closing quote that is not escaped, then past the ']'.
+      for (++end; end < path.size() && path[end] != '"'; ++end) {
+        if (path[end] == '\\') {
+          ++end;
+        }
+      }
+      end = std::min(end + 2, path.size());
+    } else {
+      end = std::min(path.find(']', end) + 1, path.size());
+    }
+    keys.push_back(path.substr(start, end - start));
+    start = end;
+  }
+  return keys;
+}
+
+// Returns the key of a text from SplitPathKeys().
+Json::Value PathKey(absl::string_view text) {
+  if (absl::ConsumePrefix(&text, ".")) {
+    return Json::Value(string(text));
+  }
+  text = text.substr(1, text.size() - 2);
+  int index = 0;
+  if (absl::SimpleAtoi(text, &index)) {
+    return Json::Value(index);
+  }
+  return Json::Value(Unquote(string(text)));
+}
+
+// Appends the JSON text of the value at 'path' under 'variable' to 'output',
+// where 'path' is written by AppendPathKey(). Returns false if there is no
+// value at 'path'.
+bool AppendValueAtPath(const internal::Store::Variable& variable,
+                       absl::string_view path, string* output) {
+  if (path.empty()) {
+    variable.AppendJsonText(output);
+    return true;
+  }
+  const std::vector<absl::string_view> keys = SplitPathKeys(path);
+  const Json::Value* value = nullptr;
+  Json::Value record;
+  std::size_t i = 0;
+  const internal::ValueTree* node = variable.tree();
+  if (node != nullptr) {
+    // Reads the nodes on the path rather than converting the whole tree.
+    for (; value == nullptr && i < keys.size(); ++i) {
+      const Json::Value key = PathKey(keys[i]);
+      const internal::ValueTree::Child* child =
+          key.isIntegral() ? node->element(key.asInt())
+                           : node->Find(key.asString());
+      if (child == nullptr) {
+        return false;
+      }
+      if (child->tree == nullptr) {
+        value = &child->value;
+      } else {
+        node = child->tree.get();
+      }
+    }
+    if (value == nullptr) {
+      node->AppendJsonText(output);
+      return true;
+    }
+  }
+  const internal::RecordArray* records = variable.records();
+  if (records != nullptr) {
+    // Reads the record rather than converting the whole RecordArray.
+    const Json::Value index = PathKey(keys[0]);
+    if (!index.isIntegral() || index.asInt() < 0 ||
+        index.asInt() >= records->size()) {
       return false;
     }
-    // Create subpath locations.
-    if (field_token.Value().isString()) {
+    if (keys.size() == 1) {
+      records->record(index.asInt()).AppendJsonText(output);
+      return true;
+    }
+    record = records->record(index.asInt()).ToJson();
+    value = &record;
+    i = 1;
+  }
+  if (value == nullptr) {
+    value = &variable.value();
+  }
+  for (; i < keys.size(); ++i) {
+    const Json::Value key = PathKey(keys[i]);
+    if (key.isIntegral()) {
+      if (!value->isArray() || key.asInt() < 0 ||
+          static_cast<Json::ArrayIndex>(key.asInt()) >= value->size()) {
+        return false;
+      }
+      value = &(*value)[static_cast<Json::ArrayIndex>(key.asInt())];
+    } else {
+      const string& name = key.asString();
+      if (!value->isObject() ||
+          (value = value->find(name.data(), name.data() + name.size())) ==
+              nullptr) {
+        return false;
+      }
+    }
+  }
+  AppendJsonText(*value, output);
+  return true;
+}
+
+// The number of written paths of a variable above which its writes are
+// counted as writes of the whole variable.
+constexpr std::size_t kMaxWrittenPaths = 32;
+
+// Returns true if a value that holds 'path' was written after 'version',
+// where 'paths' are the written paths of a variable with their versions.
+bool IsOverwritten(const std::map<string, uint64_t, std::less<>>& paths,
+                   absl::string_view path, uint64_t version) {
+  std::size_t size = 0;
+  for (const absl::string_view key : SplitPathKeys(path)) {
+    const auto it = paths.find(path.substr(0, size));
+    if (it != paths.end() && it->second > version) {
+      return true;
+    }
+    size += key.size();
+  }
+  return false;
+}
+
+// The value that a write to a location writes, as found by WalkLocation():
+// either 'value', or the record at 'index' of 'records', which may be one past
+// the last record, or 'child' of the node 'tree' of a ValueTree, or else the
+// top-level 'variable' itself.
+struct WriteTarget {
+  const internal::Store::Variable* variable = nullptr;
+  Json::Value* value = nullptr;
+  internal::RecordArray* records = nullptr;
+  int index = 0;
+  internal::ValueTree* tree = nullptr;
+  internal::ValueTree::Child* child = nullptr;
+  // Whether a variable, member or element was created on the way to the
+  // target, which changes the store even if the location is not resolved.
+  bool created = false;
+  // The keys under 'variable' of the value that the write changes, see
+  // AppendPathKey(): those of the target, or up to the first value that was
+  // created on the way to it. Empty if the write changes the whole variable.
+  string path;
+};
+
+// Walks 'keys' from the top-level 'shared_variable' of 'store' and stores the
+// value at their end in 'target'. The variable is owned by 'store' first, see
+// Store::Own(). 'is_new_location' tells whether the variable was just
+// declared. If 'declare' is true, missing values along the path are created:
+// objects for string keys and arrays for integral keys. Otherwise only the
+// last key may add a new member or array element. Records and their members
+// are written in place, other writes convert the RecordArray of the variable
+// to JSON. The nodes of a ValueTree on the path are owned by 'store', see
+// ValueTree::MutableTree(), and written in place. 'location' is only logged.
+bool WalkLocation(internal::Store* store,
+                  const internal::Store::Variable& shared_variable,
+                  bool is_new_location, const LocationKeys& keys, bool declare,
+                  const string& location, WriteTarget* target) {
+  const internal::Store::Variable& variable = store->Own(shared_variable);
+  target->variable = &variable;
+  if (keys.empty()) {
+    return true;
+  }
+  // Adds the keys to the written path until a value is created.
+  bool is_path_complete = target->created;
+  const auto add_to_path = [target, &is_path_complete](const Json::Value& key) {
+    if (!is_path_complete) {
+      AppendPathKey(key, &target->path);
+      is_path_complete = target->created;
+    }
+  };
+  Json::Value* value = nullptr;
+  std::size_t i = 0;
+  const internal::RecordArray* records = variable.records();
+  if (records != nullptr && keys[0]->isIntegral() && keys[0]->asInt() >= 0) {
+    const int index = keys[0]->asInt();
+    if (keys.size() == 1 && index <= records->size()) {
+      target->records = store->MutableRecords(variable);
+      target->index = index;
+      add_to_path(*keys[0]);
+      return true;
+    }
+    if (index < records->size() && keys[1]->isString()) {
+      internal::Record* record =
+          store->MutableRecords(variable)->mutable_record(index);
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      keys[1]->getString(&begin, &end);
+      const absl::string_view member(begin, end - begin);
+      value = record->Find(member);
+      const bool is_new_member = value == nullptr;
+      if (is_new_member) {
+        if (!declare && keys.size() > 2) {
+          return false;
+        }
+        // nullptr if the key is not interned, which is written below.
+        value = record->FindOrAdd(member);
+        target->created = value != nullptr;
+      }
+      if (value != nullptr) {
+        is_new_location = is_new_member;
+        i = 2;
+        AppendPathKey(*keys[0], &target->path);
+        add_to_path(*keys[1]);
+      }
+    }
+  }
+  if (value == nullptr && variable.tree() != nullptr) {
+    internal::ValueTree* node = store->MutableTree(variable);
+    for (; value == nullptr && i < keys.size(); ++i) {
+      const Json::Value& key = *keys[i];
+      const bool is_last_step = i + 1 == keys.size();
+      bool is_new_member = false;
+      internal::ValueTree::Child* child = nullptr;
+      if (key.isString() && !node->is_array()) {
+        const char* begin = nullptr;
+        const char* end = nullptr;
+        key.getString(&begin, &end);
+        const absl::string_view member(begin, end - begin);
+        is_new_member = node->Find(member) == nullptr;
+        if (is_new_member && !declare && !is_last_step) {
+          return false;
+        }
+        child = node->FindOrAddMember(member);
+      } else if (key.isIntegral() && key.asInt() >= 0 && node->is_array()) {
+        is_new_member = key.asInt() >= node->size();
+        if (is_new_member && !declare && !is_last_step) {
+          return false;
+        }
+        child = node->FindOrAddElement(key.asInt());
+      } else {
+        LOG(INFO) << "Element access failed on "
+                  << (node->is_array() ? "array" : "object")
+                  << " with key: " << ValueToString(key, true)
+                  << ", in location: " << location;
+        return false;
+      }
+      target->created = target->created || is_new_member;
+      add_to_path(key);
+      if (is_last_step) {
+        // Large values are held as subtrees, see AssignToTarget().
+        target->tree = node;
+        target->child = child;
+        return true;
+      }
+      if (child->tree != nullptr) {
+        node = node->MutableTree(child);
+      } else {
+        value = &child->value;
+        is_new_location = is_new_member;
+      }
+    }
+  }
+  if (value == nullptr) {
+    value = store->Mutable(variable);
+  }
+
+  for (; i < keys.size(); ++i) {
+    const Json::Value& key = *keys[i];
+    const bool is_last_step = i + 1 == keys.size();
+    if (key.isString()) {
       // Automatically create object if the location is new.
       if (is_new_location) {
-        *new_loc = Json::Value(Json::objectValue);
+        *value = Json::Value(Json::objectValue);
       }
-      if (!new_loc->isObject()) {
+      if (!value->isObject()) {
         LOG(INFO) << "Object element access failed on non-object: "
-                  << ValueToString(*new_loc, true);
+                  << ValueToString(*value, true);
         return false;
       }
-      string key = field_token.Value().asString();
-      is_new_location = !new_loc->isMember(key);
-      new_loc = &(*new_loc)[key];
-    } else if (field_token.Value().isIntegral()) {
-      const int index = field_token.Value().asInt();
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      key.getString(&begin, &end);
+      Json::Value* member = const_cast<Json::Value*>(value->find(begin, end));
+      is_new_location = member == nullptr;
+      if (is_new_location) {
+        if (!declare && !is_last_step) {
+          return false;
+        }
+        member = &(*value)[key.asString()];
+        target->created = true;
+      }
+      add_to_path(key);
+      value = member;
+    } else if (key.isIntegral()) {
+      const int index = key.asInt();
       if (index < 0) {
-        LOG(INFO) << "Array index out of bounds: " << field_token.DebugString()
-                  << ", from expression: " << expression;
+        LOG(INFO) << "Array index out of bounds: " << index
+                  << ", in location: " << location;
         return false;
       }
       // Automatically create new array if location is new.
       if (is_new_location) {
-        *new_loc = Json::Value(Json::arrayValue);
+        *value = Json::Value(Json::arrayValue);
       }
-      if (!new_loc->isArray()) {
+      if (!value->isArray()) {
         LOG(INFO) << "Array element access failed on non-array: "
-                  << ValueToString(*new_loc, true);
+                  << ValueToString(*value, true);
         return false;
       }
-      is_new_location = static_cast<::std::size_t>(index) >= new_loc->size();
-      new_loc = &(*new_loc)[index];
+      is_new_location = static_cast<std::size_t>(index) >= value->size();
+      if (is_new_location && !declare && !is_last_step) {
+        return false;
+      }
+      target->created = target->created || is_new_location;
+      add_to_path(key);
+      value = &(*value)[index];
     } else {
       LOG(INFO) << "Field is not an index or a string: "
-                << field_token.DebugString();
+                << ValueToString(key, true);
       return false;
     }
-  }  // for each token group
-  *location = new_loc;
+  }
+  target->value = value;
   return true;
 }
 
+// Moves 'value' into 'target'. A value written to a top-level variable is held
+// as a RecordArray or ValueTree if 'pack' is true and it is large, see
+// Store::Set(), and a large value written to a node of a ValueTree as a
+// subtree. Other values written to records convert their RecordArray to JSON.
+void AssignToTarget(internal::Store* store, const WriteTarget& target,
+                    Json::Value* value, bool pack) {
+  if (target.value != nullptr) {
+    target.value->swap(*value);
+  } else if (target.child != nullptr) {
+    target.tree->Set(target.child, value);
+  } else if (target.records == nullptr) {
+    store->Set(*target.variable, value, pack);
+  } else {
+    internal::InternedKeys keys;
+    internal::Record record;
+    if (!internal::Record::FromJson(value, &keys, &record)) {
+      (*store->Mutable(*target.variable))[target.index].swap(*value);
+    } else if (target.index < target.records->size()) {
+      *target.records->mutable_record(target.index) = std::move(record);
+    } else {
+      target.records->AddRecord(std::move(record));
+    }
+  }
+}
+
+// Computes a location expression and destructively modifies the store to
+// create the evaluated location if the location does not exists or is null.
+// Returns false if an error occurred. Otherwise stores the target of the
+// location in 'target'.
+bool ProcessLocationExpression(internal::Store* store, Runtime* runtime,
+                               FunctionDispatcher* dispatcher,
+                               internal::PathCache* paths,
+                               const string& expression, WriteTarget* target) {
+  const auto tree = internal::ParseExpression(expression);
+  if (tree == nullptr) {
+    DVLOG(1) << "Failed to parse location expression: " << expression;
+    return false;
+  }
+  // The location must be of the form "root[key1][key2]...[keyN]". Collect the
+  // key subexpressions from the innermost access outwards.
+  using internal::ExpressionNode;
+  const ExpressionNode* root = tree.get();
+  std::vector<const ExpressionNode*> key_nodes;
+  while (root->type == ExpressionNode::kElementAccess) {
+    key_nodes.push_back(root->operands[1].get());
+    root = root->operands[0].get();
+  }
+  // Validate that the root is a path that is not a function.
+  if (root->type != ExpressionNode::kIdentifier ||
+      !IsDotSeparatedPath(*dispatcher, root->name)) {
+    return false;
+  }
+  // Additionally convert the '.' path under the root into string keys so that
+  // they can be validated step by step that the Json::Value is of the correct
+  // type. E.g. if 'arr' is an array, we need to ensure 'arr.foo' returns
+  // false and not assert-fail when Json::Path::make() is called.
+  std::vector<absl::string_view> path_tokens =
+      absl::StrSplit(root->name, ".", absl::SkipEmpty());
+
+  // Create the root if needed.
+  // Flag used to track if a new location was created or not.
+  const internal::Store::Variable* variable =
+      store->FindVariable(path_tokens.front());
+  const bool is_new_location = variable == nullptr;
+  if (is_new_location) {
+    store->FindOrDeclare(path_tokens.front());
+    variable = store->FindVariable(path_tokens.front());
+    target->created = true;
+  }
+
+  // Evaluate the keys. They are copied as the store is modified below.
+  std::vector<Json::Value> keys;
+  for (::std::size_t i = 1; i < path_tokens.size(); ++i) {
+    keys.emplace_back(string(path_tokens[i]));
+  }
+  for (auto it = key_nodes.rbegin(); it != key_nodes.rend(); ++it) {
+    Token key;
+    if (!EvaluateSyntaxTree(*store, runtime, dispatcher, nullptr, paths, **it,
+                            &key)) {
+      return false;
+    }
+    keys.push_back(key.Value());
+  }
+  LocationKeys key_pointers;
+  for (const Json::Value& key : keys) {
+    key_pointers.push_back(&key);
+  }
+
+  // Create the subpaths under the root object.
+  // Do validation in the process.
+  return WalkLocation(store, *variable, is_new_location, key_pointers,
+                      true /* declare */, expression, target);
+}
+
+// Returns the operator Token of an operator instruction of the stack machine.
+// The Tokens are indexed by opcode, so that looking them up is not a search.
+const Token& OperatorToken(internal::Instruction::OpCode opcode) {
+  using internal::Instruction;
+  static const auto* const kOperatorTokens = [] {
+    auto* tokens = new std::array<Token, Instruction::kToBool + 1>();
+    (*tokens)[Instruction::kNegate] = Token(kMinus);
+    (*tokens)[Instruction::kNot] = Token(kNot);
+    (*tokens)[Instruction::kLess] = Token(kLess);
+    (*tokens)[Instruction::kLessEqual] = Token(kLessEqual);
+    (*tokens)[Instruction::kGreater] = Token(kGreater);
+    (*tokens)[Instruction::kGreaterEqual] = Token(kGreaterEqual);
+    (*tokens)[Instruction::kEqual] = Token(kEqual);
+    (*tokens)[Instruction::kNotEqual] = Token(kNotEqual);
+    return tokens;
+  }();
+  return (*kOperatorTokens)[opcode];
+}
+
+// The stack of the stack machine. The stacks of typical expressions fit in the
+// inline storage, so that running them does not allocate.
+using TokenStack = absl::InlinedVector<Token, 8>;
+
+// Pops the two operands of a binary operation from 'stack' and pushes the
+// result of 'operation'.
+template <class Operation>
+bool ApplyBinaryOperation(Operation operation, TokenStack* stack) {
+  RETURN_FALSE_IF(stack->size() < 2);
+  Token result;
+  if (!operation((*stack)[stack->size() - 2], stack->back(), &result)) {
+    return false;
+  }
+  stack->pop_back();
+  stack->back().Swap(&result);
+  return true;
+}
+
+// Runs a bytecode 'program' compiled by LightWeightBytecodeCompiler. The
+// semantics are the same as those of EvaluateSyntaxTree().
+// Returns false if an error occurred.
+bool RunBytecode(const internal::Store& store, Runtime* runtime,
+                 FunctionDispatcher* dispatcher,
+                 const internal::SlotCache* slots, internal::PathCache* paths,
+                 const internal::BytecodeProgram& program, Token* result) {
+  using internal::Instruction;
+  TokenStack stack;
+  stack.reserve(program.max_stack_size);
+  std::vector<const Json::Value*> arguments;
+  for (::std::size_t pc = 0; pc < program.code.size();) {
+    const Instruction& instruction = program.code[pc++];
+    bool success = true;
+    switch (instruction.opcode) {
+      case Instruction::kPushConstant:
+        stack.emplace_back(program.constants[instruction.operand]);
+        break;
+      case Instruction::kPushLocation:
+        stack.emplace_back();
+        success = ResolveIdentifier(store, *dispatcher, slots, paths,
+                                    program.names[instruction.operand],
+                                    program.references[instruction.operand],
+                                    &stack.back());
+        break;
+      case Instruction::kRandom:
+        stack.emplace_back(Json::Value(GenerateRandom(runtime)));
+        break;
+      case Instruction::kCall: {
+        const string& name = program.names[instruction.operand];
+        const ::std::size_t argument_count = instruction.argument_count;
+        RETURN_FALSE_IF(stack.size() < argument_count);
+        if (name != "In" && !dispatcher->HasFunction(name)) {
+          // Same as EvaluateSyntaxTree(), 'foo()' is 'foo'.
+          stack.emplace_back();
+          success = argument_count == 0 &&
+                    ResolveIdentifier(store, *dispatcher, slots, paths, name,
+                                      program.references[instruction.operand],
+                                      &stack.back());
+          break;
+        }
+        arguments.clear();
+        for (auto it = stack.end() - argument_count; it != stack.end(); ++it) {
+          arguments.push_back(&it->Value());
+        }
+        Json::Value return_value;
+        success = CallSystemFunction(runtime, dispatcher, name, arguments,
+                                     &return_value);
+        stack.resize(stack.size() - argument_count);
+        stack.emplace_back(return_value);
+        break;
+      }
+      case Instruction::kElementAccess:
+        success = ApplyBinaryOperation(&AccessElement, &stack);
+        break;
+      case Instruction::kNegate:
+      case Instruction::kNot: {
+        RETURN_FALSE_IF(stack.empty());
+        const Token& op = OperatorToken(instruction.opcode);
+        Token value;
+        success = instruction.opcode == Instruction::kNegate
+                      ? UnaryMinusOperation(op, stack.back(), &value)
+                      : LogicalNotOperation(op, stack.back(), &value);
+        stack.back().Swap(&value);
+        break;
+      }
+      case Instruction::kMultiply:
+        success = ApplyBinaryOperation(&MultiplyOperation, &stack);
+        break;
+      case Instruction::kDivide:
+        success = ApplyBinaryOperation(&DivideOperation, &stack);
+        break;
+      case Instruction::kAdd:
+        success = ApplyBinaryOperation(&PlusOperation, &stack);
+        break;
+      case Instruction::kSubtract:
+        success = ApplyBinaryOperation(&MinusOperation, &stack);
+        break;
+      case Instruction::kLess:
+      case Instruction::kLessEqual:
+      case Instruction::kGreater:
+      case Instruction::kGreaterEqual:
+      case Instruction::kEqual:
+      case Instruction::kNotEqual:
+        success = ApplyBinaryOperation(
+            std::bind(&ComparisonOperation,
+                      std::cref(OperatorToken(instruction.opcode)), _1, _2, _3),
+            &stack);
+        break;
+      case Instruction::kJumpIfFalse:
+      case Instruction::kJumpIfTrue: {
+        RETURN_FALSE_IF(stack.empty());
+        const bool value = stack.back().ToBool();
+        if (value == (instruction.opcode == Instruction::kJumpIfTrue)) {
+          stack.back() = Token(Json::Value(value));
+          pc = instruction.operand;
+        } else {
+          stack.pop_back();
+        }
+        break;
+      }
+      case Instruction::kToBool:
+        RETURN_FALSE_IF(stack.empty());
+        stack.back() = Token(Json::Value(stack.back().ToBool()));
+        break;
+    }
+    if (!success) {
+      DVLOG(1) << "Bytecode execution failed for program:\n"
+               << program.DebugString();
+      return false;
+    }
+  }
+  RETURN_FALSE_IF(stack.size() != 1);
+  stack.back().Swap(result);
+  return true;
+}
+
+// Returns 'slots' if 'expression' was compiled against the SymbolTable of
+// 'slots', otherwise nullptr.
+const internal::SlotCache* GetCompiledSlots(const internal::SlotCache& slots,
+                                            const Expression& expression) {
+  return slots.symbols() != nullptr &&
+                 internal::GetCompiledSymbolTable(expression) == slots.symbols()
+             ? &slots
+             : nullptr;
+}
+
+// Evaluates 'expression' from its compiled form if it was compiled by
+// LightWeightExpressionCompiler or LightWeightBytecodeCompiler, otherwise from
+// the compiled form of its source in 'source_cache', or from source if the
+// compiler of the cache leaves it or 'source_cache' is nullptr. Literal and
+// long sources are evaluated without the cache. References compiled against
+// the SymbolTable of 'slots' are resolved by their slots.
+bool ProcessExpression(const internal::Store& store, Runtime* runtime,
+                       FunctionDispatcher* dispatcher,
+                       const internal::SlotCache& slots,
+                       internal::PathCache* paths,
+                       ExpressionCache* source_cache,
+                       const Expression& expression, Token* result) {
+  const internal::SlotCache* compiled_slots =
+      GetCompiledSlots(slots, expression);
+  const internal::ExpressionNode* tree = internal::GetSyntaxTree(expression);
+  if (tree != nullptr) {
+    return EvaluateSyntaxTree(store, runtime, dispatcher, compiled_slots, paths,
+                              *tree, result);
+  }
+  const internal::BytecodeProgram* program =
+      internal::GetBytecodeProgram(expression);
+  if (program != nullptr) {
+    return RunBytecode(store, runtime, dispatcher, compiled_slots, paths,
+                       *program, result);
+  }
+  const string source(absl::StripAsciiWhitespace(expression.source()));
+  // Literals, e.g., JSON payloads, are neither worth caching nor worth pushing
+  // the expressions that are out of the cache.
+  Json::Value literal;
+  if (!source.empty() && internal::ParseLiteral(source, &literal)) {
+    *result = Token(std::move(literal));
+    return true;
+  }
+  if (source_cache == nullptr || source.size() > kMaxCachedSourceLength) {
+    return ProcessExpression(store, runtime, dispatcher, paths, source, result);
+  }
+  const Expression cached(source, source_cache->Get(source));
+  tree = internal::GetSyntaxTree(cached);
+  if (tree != nullptr) {
+    return EvaluateSyntaxTree(store, runtime, dispatcher, nullptr, paths, *tree,
+                              result);
+  }
+  program = internal::GetBytecodeProgram(cached);
+  if (program != nullptr) {
+    return RunBytecode(store, runtime, dispatcher, nullptr, paths, *program,
+                       result);
+  }
+  return ProcessExpression(store, runtime, dispatcher, paths, source, result);
+}
+
+// Walks the steps of a compiled 'location' from its top-level variable and
+// stores the target of the location in 'target'. If 'declare' is true, missing
+// values along the path are created the same way as
+// ProcessLocationExpression() creates them. Otherwise the location must be
+// assignable as defined by LightWeightDatamodel::IsAssignable(), i.e., only its
+// last step may add a new member or array element. The top-level variable is
+// looked up in 'slots' if it is not nullptr.
+bool ResolveLocation(internal::Store* store, Runtime* runtime,
+                     FunctionDispatcher* dispatcher,
+                     const internal::SlotCache* slots,
+                     internal::PathCache* paths,
+                     const internal::LocationProgram& location, bool declare,
+                     WriteTarget* target) {
+  for (const string& path : location.paths) {
+    if (dispatcher->HasFunction(path)) {
+      return false;
+    }
+  }
+  const internal::Store::Variable* variable =
+      slots != nullptr && location.slot != SymbolTable::kNoSlot
+          ? slots->Find(*store, location.slot)
+          : store->FindVariable(location.root);
+  // Flag used to track if a new location was created or not.
+  const bool is_new_location = variable == nullptr;
+  if (is_new_location) {
+    if (!declare) {
+      return false;
+    }
+    store->FindOrDeclare(location.root);
+    variable = store->FindVariable(location.root);
+    target->created = true;
+  }
+
+  absl::InlinedVector<Token, 4> key_tokens(location.steps.size());
+  LocationKeys keys;
+  for (std::size_t i = 0; i < location.steps.size(); ++i) {
+    const internal::LocationProgram::Step& step = location.steps[i];
+    if (step.key_expression == nullptr) {
+      keys.push_back(&step.key);
+    } else if (EvaluateSyntaxTree(*store, runtime, dispatcher, slots, paths,
+                                  *step.key_expression, &key_tokens[i])) {
+      keys.push_back(&key_tokens[i].Value());
+    } else {
+      return false;
+    }
+  }
+  return WalkLocation(store, *variable, is_new_location, keys, declare,
+                      location.root, target);
+}
+
 }  // namespace
 
 LightWeightDatamodel::LightWeightDatamodel(FunctionDispatcher* dispatcher)
-    : dispatcher_(dispatcher) {}
+    : key_indexes_(dispatcher, &store_), dispatcher_(&key_indexes_) {}
+
+void LightWeightDatamodel::CountWrite(absl::string_view location,
+                                      absl::string_view path) {
+  ++version_;
+  location = absl::StripLeadingAsciiWhitespace(location);
+  const absl::string_view variable = TopLevelVariable(location);
+  if (variable.empty()) {
+    ForgetModifications();
+    key_indexes_.InvalidateAll();
+    return;
+  }
+  // Writes to an element, e.g., 'devices[3].online', only update the index
+  // entries of that element.
+  absl::string_view element = path;
+  int position = -1;
+  if (absl::ConsumePrefix(&element, "[") &&
+      absl::SimpleAtoi(element.substr(0, element.find(']')), &position)) {
+    key_indexes_.InvalidateElement(variable, position);
+  } else {
+    key_indexes_.Invalidate(variable);
+  }
+  const internal::Store::Variable* written = store_.FindVariable(variable);
+  if (written == nullptr) {
+    // Variables that are not declared have no modifications to serialize.
+    return;
+  }
+  PathVersions& paths = *store_.MutableWriteVersions(*written);
+  // Versions are either all from before the last ForgetModifications() or
+  // all from after it.
+  if (!paths.empty() && paths.begin()->second <= known_since_version_) {
+    paths.clear();
+  }
+  // The write replaces the values under 'path'.
+  for (auto under = paths.lower_bound(path);
+       under != paths.end() && absl::StartsWith(under->first, path);) {
+    if (under->first.size() == path.size() ||
+        under->first[path.size()] == '.' || under->first[path.size()] == '[') {
+      under = paths.erase(under);
+    } else {
+      ++under;
+    }
+  }
+  if (paths.size() >= kMaxWrittenPaths) {
+    // Writes to many members or elements are counted as writes of the whole
+    // variable, so that they are serialized at once.
+    paths.clear();
+    path = absl::string_view();
+  }
+  paths.emplace(string(path), version_);
+}
+
+bool LightWeightDatamodel::MayPackRecords(absl::string_view location) const {
+  return !key_indexes_.IsIndexed(
+      TopLevelVariable(absl::StripLeadingAsciiWhitespace(location)));
+}
+
+void LightWeightDatamodel::ForgetModifications() {
+  known_since_version_ = version_;
+}
 
 // static
 std::unique_ptr<LightWeightDatamodel> LightWeightDatamodel::Create(
@@ -1477,6 +2158,17 @@ std::unique_ptr<LightWeightDatamodel> LightWeightDatamodel::Create(
   return ::absl::WrapUnique(new LightWeightDatamodel(dispatcher));
 }
 
+void LightWeightDatamodel::SetSymbolTable(
+    std::shared_ptr<const SymbolTable> symbols) {
+  slots_.SetSymbolTable(std::move(symbols));
+}
+
+void LightWeightDatamodel::SetExpressionCompiler(
+    const ExpressionCompiler* compiler) {
+  source_cache_ =
+      compiler == nullptr ? nullptr : GetSourceExpressionCache(compiler);
+}
+
 // static
 std::unique_ptr<LightWeightDatamodel> LightWeightDatamodel::Create(
     const string& serialized_data, FunctionDispatcher* dispatcher) {
@@ -1487,10 +2179,57 @@ std::unique_ptr<LightWeightDatamodel> LightWeightDatamodel::Create(
   return datamodel;
 }
 
+// static
+std::unique_ptr<LightWeightDatamodel> LightWeightDatamodel::Create(
+    const string& serialized_data,
+    const std::map<string, string>& modifications, uint64_t version,
+    FunctionDispatcher* dispatcher) {
+  auto datamodel = LightWeightDatamodel::Create(serialized_data, dispatcher);
+  if (datamodel == nullptr ||
+      !datamodel->ParseModificationsFromString(modifications, version)) {
+    return nullptr;
+  }
+  return datamodel;
+}
+
+// static
+const ExpressionCompiler* LightWeightDatamodel::GetExpressionCompiler() {
+  static const auto* const kCompiler = new LightWeightExpressionCompiler();
+  return kCompiler;
+}
+
+// static
+const ExpressionCompiler* LightWeightDatamodel::GetBytecodeCompiler() {
+  static const auto* const kCompiler = new LightWeightBytecodeCompiler();
+  return kCompiler;
+}
+
+// static
+ExpressionCache* LightWeightDatamodel::GetSourceExpressionCache(
+    const ExpressionCompiler* compiler) {
+  static auto* const kTreeCache =
+      NewSourceExpressionCache(GetExpressionCompiler());
+  static auto* const kBytecodeCache =
+      NewSourceExpressionCache(GetBytecodeCompiler());
+  if (compiler == GetExpressionCompiler()) {
+    return kTreeCache;
+  }
+  LOG_IF(DFATAL, compiler != GetBytecodeCompiler())
+      << "No source expression cache for the compiler.";
+  return kBytecodeCache;
+}
+
 // override
 bool LightWeightDatamodel::IsDefined(const string& location) const {
+  return IsDefined(Expression(location));
+}
+
+// override
+bool LightWeightDatamodel::IsDefined(const Expression& location) const {
+  ParseDeferredValue(location);
   Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, location, &token)) {
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, location, &token)) {
     return false;
   }
   return token.IsReference();
@@ -1498,34 +2237,57 @@ bool LightWeightDatamodel::IsDefined(const string& location) const {
 
 // override
 bool LightWeightDatamodel::Declare(const string& location) {
-  if (IsDefined(location) || dispatcher_->HasFunction(location)) {
+  return Declare(Expression(location));
+}
+
+// override
+bool LightWeightDatamodel::Declare(const Expression& location) {
+  if (IsDefined(location) || dispatcher_->HasFunction(location.source())) {
     return false;
   }
-  return DeclareAndAssignJson(location, Json::Value());  // Assigns null.
+  // Assigns null.
+  return DeclareAndAssignJson(location, Json::Value());
 }
 
 // override
 bool LightWeightDatamodel::AssignExpression(const string& location,
                                             const string& expr) {
+  return AssignExpression(Expression(location), Expression(expr));
+}
+
+// override
+bool LightWeightDatamodel::AssignExpression(const Expression& location,
+                                            const Expression& expr) {
   Json::Value value;  // null
   if (!expr.empty() && !EvaluateJsonExpression(expr, &value)) {
-    LOG(INFO) << "AssignExpression: error evaluating expression: " << expr;
+    LOG(INFO) << "AssignExpression: error evaluating expression: "
+              << expr.source();
     return false;
   }
-  return AssignJson(location, value);
+  return AssignJson(location, std::move(value));
 }
 
 // override
 bool LightWeightDatamodel::AssignString(const string& location,
                                         const string& str) {
-  return AssignExpression(location, Quote(str));
+  return AssignJson(Expression(location), Json::Value(str));
 }
 
 // override
 bool LightWeightDatamodel::EvaluateBooleanExpression(const string& expr,
                                                      bool* result) const {
+  return EvaluateBooleanExpression(Expression(expr), result);
+}
+
+// override
+bool LightWeightDatamodel::EvaluateBooleanExpression(const Expression& expr,
+                                                     bool* result) const {
+  if (!ParseDeferredValue(expr)) {
+    return false;
+  }
   Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, expr, &token)) {
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, expr, &token)) {
     return false;
   }
   *result = token.ToBool();
@@ -1535,134 +2297,372 @@ bool LightWeightDatamodel::EvaluateBooleanExpression(const string& expr,
 // override
 bool LightWeightDatamodel::EvaluateStringExpression(const string& expr,
                                                     string* result) const {
+  return EvaluateStringExpression(Expression(expr), result);
+}
+
+// override
+bool LightWeightDatamodel::EvaluateStringExpression(const Expression& expr,
+                                                    string* result) const {
+  if (!ParseDeferredValue(expr)) {
+    return false;
+  }
+  Token token;
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, expr, &token)) {
+    return false;
+  }
+  *result = ValueToString(token.Value());
+  return true;
+}
+
+// override
+bool LightWeightDatamodel::EvaluateExpression(const string& expr,
+                                              string* result) const {
+  return EvaluateExpression(Expression(expr), result);
+}
+
+// override
+bool LightWeightDatamodel::EvaluateExpression(const Expression& expr,
+                                              string* result) const {
+  if (!ParseDeferredValue(expr)) {
+    return false;
+  }
   Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, expr, &token)) {
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, expr, &token)) {
+    return false;
+  }
+  *result = ValueToString(token.Value(), true);
+  return true;
+}
+
+// override
+string LightWeightDatamodel::EncodeParameters(
+    const std::map<string, string>& parameters) const {
+  return MakeJSONFromStringMap(parameters);
+}
+
+// override
+bool LightWeightDatamodel::AssignValue(const Expression& location,
+                                       Json::Value value) {
+  return AssignJson(location, std::move(value));
+}
+
+// override
+bool LightWeightDatamodel::EvaluateValue(const Expression& expr,
+                                         Json::Value* result) const {
+  return EvaluateJsonExpression(expr, result);
+}
+
+// override
+string LightWeightDatamodel::EncodeParameters(
+    const std::map<string, Json::Value>& parameters) const {
+  Json::Value object(Json::objectValue);
+  for (const auto& parameter : parameters) {
+    object[parameter.first] = parameter.second;
+  }
+  return ValueToString(object);
+}
+
+// override
+string LightWeightDatamodel::EvaluateParameters(
+    const std::map<string, Expression>& parameters,
+    std::vector<string>* failed) const {
+  Json::Value object(Json::objectValue);
+  for (const auto& parameter : parameters) {
+    Json::Value result;
+    if (EvaluateJsonExpression(parameter.second, &result)) {
+      object[parameter.first].swap(result);
+    } else {
+      failed->push_back(parameter.first);
+    }
+  }
+  return ValueToString(object);
+}
+
+// override
+bool LightWeightDatamodel::AssignValueLazily(const Expression& location,
+                                             string json) {
+  // Only JSON is deferred, so that the value parses when it is accessed and
+  // errors are reported now.
+  if (!IsPath(location.source()) || !IsJsonContainerText(json)) {
+    // Parsed now. A deferred value that 'location' overlaps is parsed first.
+    return Datamodel::AssignValueLazily(location, std::move(json));
+  }
+  // Only one value is deferred at a time.
+  if (location.source() != deferred_location_) {
+    ParseDeferredValue();
+  }
+  deferred_location_.clear();
+  // Assigns null now so that errors in 'location' are reported now.
+  if (!AssignJson(location, Json::Value())) {
     return false;
   }
-  *result = ValueToString(token.Value());
+  deferred_location_ = location.source();
+  deferred_json_ = std::move(json);
   return true;
 }
 
-// override
-bool LightWeightDatamodel::EvaluateExpression(const string& expr,
-                                              string* result) const {
-  Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, expr, &token)) {
-    return false;
+bool LightWeightDatamodel::ParseDeferredValue(const Expression& expr) const {
+  if (!deferred_location_.empty() &&
+      MayAccessPath(expr.source(), deferred_location_)) {
+    return ParseDeferredValue();
   }
-  *result = ValueToString(token.Value(), true);
   return true;
 }
 
-// override
-string LightWeightDatamodel::EncodeParameters(
-    const std::map<string, string>& parameters) const {
-  return MakeJSONFromStringMap(parameters);
+bool LightWeightDatamodel::ParseDeferredValue() const {
+  if (deferred_location_.empty()) {
+    return true;
+  }
+  const string location = std::move(deferred_location_);
+  const string json = std::move(deferred_json_);
+  deferred_location_.clear();
+  deferred_json_.clear();
+
+  Json::Value value;
+  if (!ParseJsonText(json, Json::Features::strictMode(), &value, nullptr) &&
+      !EvaluateJsonExpression(Expression(json), &value)) {
+    LOG(INFO) << "ParseDeferredValue: error evaluating value of " << location
+              << ": " << json;
+    return false;
+  }
+  // The location holds the null assigned by AssignValueLazily(). Writes that
+  // may access it parse the value first, so the members on its path exist.
+  std::vector<absl::string_view> members = absl::StrSplit(location, '.');
+  const internal::Store::Variable* variable =
+      store_.FindVariable(members.front());
+  RETURN_FALSE_IF_MSG(variable == nullptr,
+                      "Deferred location not found: " << location);
+  if (members.size() == 1) {
+    store_.Set(*variable, &value, MayPackRecords(location));
+    key_indexes_.Invalidate(location);
+    return true;
+  }
+  Json::Value* target = store_.Mutable(*variable);
+  for (std::size_t i = 1; i < members.size(); ++i) {
+    target = target->isObject() ? const_cast<Json::Value*>(target->find(
+                                      members[i].data(),
+                                      members[i].data() + members[i].size()))
+                                : nullptr;
+    RETURN_FALSE_IF_MSG(target == nullptr,
+                        "Deferred location not found: " << location);
+  }
+  target->swap(value);
+  key_indexes_.Invalidate(location.substr(0, location.find('.')));
+  return true;
 }
 
 bool LightWeightDatamodel::IsAssignable(const string& location) const {
+  ParseDeferredValue(Expression(location));
   if (IsDefined(location)) {
     return true;
   }
-  std::list<string> string_tokens;
-  internal::TokenizeExpression(location, &string_tokens);
-  // Do preprocessing on the string tokens.
-  PresubstituteStringTokens(store_, &string_tokens);
-
+  const auto tree = internal::ParseExpression(location);
+  if (tree == nullptr) {
+    return false;
+  }
+  using internal::ExpressionNode;
   bool is_error = false;
 
-  // Single value, this is a path type expression that is undefined.
-  if (string_tokens.size() == 1) {
+  // Single path, this is a path type expression that is undefined.
+  if (tree->type == ExpressionNode::kIdentifier) {
     // Check if the parent path is an object.
-    Token token = Token::Create(store_, *dispatcher_,
-                                string_tokens.front().substr(
-                                    0, string_tokens.front().find_last_of('.')),
-                                &is_error);
-    return !is_error && token.IsReference() && token.Value().isObject();
-  }
-  // Convert string tokens to Tokens.
-  std::list<Token> tokens;
-  if (!ConvertTokens(store_, *dispatcher_, string_tokens, &tokens)) {
-    return false;
+    Token token = Token::Create(
+        store_, *dispatcher_, &paths_,
+        tree->name.substr(0, tree->name.find_last_of('.')), &is_error);
+    if (is_error || !token.IsReference()) {
+      return false;
+    }
+    if (token.Node() != nullptr) {
+      return !token.Node()->is_array();
+    }
+    return token.Record() != nullptr ||
+           (token.Records() == nullptr && token.Value().isObject());
   }
-  // Process all sub-expressions in the parentheses.
-  SubstituteParentheses(store_, GetRuntime(), dispatcher_, &tokens, &is_error);
-  // Token elements must be of the form "root[key1][key2]...[keyN]".
-  if (is_error || (tokens.size() - 1) % 3 != 0) {
+  // Otherwise the location must be of the form "parent[key]" where 'parent'
+  // evaluates to a reference in the store.
+  if (tree->type != ExpressionNode::kElementAccess) {
     return false;
   }
-  // Create a new expression list excluding the last access operation (last 3
-  // tokens). This 'parent' expression must evaluate to a reference in the
-  // store.
-  auto it = tokens.begin();
-  std::advance(it, tokens.size() - 3);
-  std::list<Token> parent_tokens;
-  parent_tokens.splice(parent_tokens.end(), tokens, tokens.begin(), it);
-  if (!SubstituteUntilValue(store_, GetRuntime(), dispatcher_,
-                            &parent_tokens)) {
+  Token parent;
+  Token key;
+  if (!EvaluateSyntaxTree(store_, runtime_, dispatcher_, nullptr, &paths_,
+                          *tree->operands[0], &parent) ||
+      !EvaluateSyntaxTree(store_, runtime_, dispatcher_, nullptr, &paths_,
+                          *tree->operands[1], &key)) {
     return false;
   }
-  RETURN_FALSE_IF(parent_tokens.empty());
-  if (!parent_tokens.front().IsReference()) {
+  if (!parent.IsReference()) {
     return false;
   }
-  const Json::Value& parent_value = parent_tokens.front().Value();
-  if (!parent_value.isArray() && !parent_value.isObject()) {
-    return false;
+  if (parent.Records() != nullptr) {
+    return key.Value().isIntegral();
+  }
+  if (parent.Record() != nullptr) {
+    return key.Value().isString();
   }
-  // Check the type of the access key and the parent reference.
-  it = ++tokens.begin();
-  RETURN_FALSE_IF_MSG(!it->IsValue(), it->DebugString());
+  if (parent.Node() != nullptr) {
+    return parent.Node()->is_array() ? key.Value().isIntegral()
+                                     : key.Value().isString();
+  }
+  const Json::Value& parent_value = parent.Value();
   // Array access must have integral operand.
-  if (parent_value.isArray() && !it->Value().isIntegral()) {
-    return false;
+  if (parent_value.isArray()) {
+    return key.Value().isIntegral();
   }
   // Object access requires string operand.
-  if (parent_value.isObject() && !it->Value().isString()) {
-    return false;
+  if (parent_value.isObject()) {
+    return key.Value().isString();
   }
-  return true;
+  return false;
 }
 
 // override
 string LightWeightDatamodel::DebugString() const {
+  ParseDeferredValue();
   Json::StyledStreamWriter json_writer("  ");
   std::stringstream sstream;
-  json_writer.write(sstream, store_);
+  json_writer.write(sstream, store_.ToJson());
   return sstream.str();
 }
 
 // override
 string LightWeightDatamodel::SerializeAsString() const {
-  Json::FastWriter json_writer;
-  return json_writer.write(store_);
+  ParseDeferredValue();
+  string serialized;
+  store_.AppendJsonText(&serialized);
+  // The same trailing newline as Json::FastWriter.
+  serialized.push_back('\n');
+  return serialized;
 }
 
 // override
 bool LightWeightDatamodel::ParseFromString(const string& data) {
-  Json::Reader reader;
-  const bool success = reader.parse(data, store_, false /* collectComments */);
+  deferred_location_.clear();
+  slots_.Reset();
+  ++version_;
+  ForgetModifications();
+  key_indexes_.InvalidateAll();
+  Json::Value root;
+  string error;
+  bool success = ParseJsonText(data, Json::Features::all(), &root, &error);
+  if (success && !store_.Assign(&root)) {
+    success = false;
+    error = "The value is neither an object nor null.";
+  }
+  store_.PackRecords([this](absl::string_view variable) {
+    return !key_indexes_.IsIndexed(variable);
+  });
   LOG_IF(ERROR, !success) << "Failed in reading as Json::Value. Error: "
-                          << reader.getFormattedErrorMessages()
+                          << error
                           << "\nValue : " << data;
   return success;
 }
 
 // override
-void LightWeightDatamodel::Clear() { store_.clear(); }
+void LightWeightDatamodel::Clear() {
+  deferred_location_.clear();
+  slots_.Reset();
+  ++version_;
+  ForgetModifications();
+  key_indexes_.InvalidateAll();
+  store_.Clear();
+}
 
 // override
 std::unique_ptr<Datamodel> LightWeightDatamodel::Clone() const {
-  auto lwdm = absl::WrapUnique(new LightWeightDatamodel(this->dispatcher_));
-  lwdm->store_ = this->store_;
+  auto lwdm =
+      absl::WrapUnique(new LightWeightDatamodel(key_indexes_.dispatcher()));
+  // Shares the values of the variables, which are copied when either datamodel
+  // writes them.
+  lwdm->store_ = store_.Share();
+  lwdm->deferred_location_ = this->deferred_location_;
+  lwdm->deferred_json_ = this->deferred_json_;
+  lwdm->version_ = this->version_;
+  lwdm->known_since_version_ = this->known_since_version_;
   lwdm->runtime_ = this->runtime_;
+  lwdm->key_indexes_.CopyIndexes(key_indexes_);
+  lwdm->SetSymbolTable(slots_.shared_symbols());
+  lwdm->source_cache_ = source_cache_;
   return lwdm;
 }
 
+// override
+bool LightWeightDatamodel::SerializeModificationsAsString(
+    uint64_t version, std::map<string, string>* modifications) const {
+  if (version < known_since_version_ || version > version_) {
+    return false;
+  }
+  ParseDeferredValue();
+  modifications->clear();
+  bool found = true;
+  store_.ForEach([&](const internal::Store::Variable& variable) {
+    const PathVersions& paths = variable.write_versions();
+    for (const auto& path : paths) {
+      if (path.second <= version ||
+          IsOverwritten(paths, path.first, version)) {
+        continue;
+      }
+      string* text =
+          &(*modifications)[absl::StrCat(variable.name(), path.first)];
+      if (!AppendValueAtPath(variable, path.first, text)) {
+        LOG(DFATAL) << "No value at written location: " << variable.name()
+                    << path.first;
+        found = false;
+      }
+    }
+  });
+  return found;
+}
+
+// override
+bool LightWeightDatamodel::AddKeyIndex(const string& location,
+                                       const string& key) {
+  if (!key_indexes_.AddIndex(location, key)) {
+    return false;
+  }
+  const internal::Store::Variable* variable = store_.FindVariable(location);
+  if (variable != nullptr &&
+      (variable->records() != nullptr || variable->tree() != nullptr)) {
+    // Converts the records or tree, which the index reads as a whole.
+    store_.Mutable(*variable);
+  }
+  return true;
+}
+
+// override
+bool LightWeightDatamodel::ParseModificationsFromString(
+    const std::map<string, string>& modifications, uint64_t version) {
+  for (const auto& modification : modifications) {
+    Json::Value value;
+    if (!ParseJsonText(modification.second, &value)) {
+      LOG(INFO) << "Failed in reading modification of " << modification.first
+                << " as Json::Value: " << modification.second;
+      return false;
+    }
+    if (!DeclareAndAssignJson(modification.first, value)) {
+      return false;
+    }
+  }
+  version_ = version;
+  ForgetModifications();
+  return true;
+}
+
 bool LightWeightDatamodel::EvaluateJsonExpression(const string& expr,
                                                   Json::Value* result) const {
+  return EvaluateJsonExpression(Expression(expr), result);
+}
+
+bool LightWeightDatamodel::EvaluateJsonExpression(const Expression& expr,
+                                                  Json::Value* result) const {
+  if (!ParseDeferredValue(expr)) {
+    return false;
+  }
   Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, expr, &token)) {
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, expr, &token)) {
     return false;
   }
   *result = token.Value();
@@ -1672,23 +2672,78 @@ bool LightWeightDatamodel::EvaluateJsonExpression(const string& expr,
 // override
 std::unique_ptr<Iterator> LightWeightDatamodel::EvaluateIterator(
     const string& location) const {
+  return EvaluateIterator(Expression(location));
+}
+
+// override
+std::unique_ptr<Iterator> LightWeightDatamodel::EvaluateIterator(
+    const Expression& location) const {
+  if (!ParseDeferredValue(location)) {
+    return nullptr;
+  }
   // Only arrays are supported.
   Token token;
-  if (!ProcessExpression(store_, GetRuntime(), dispatcher_, location, &token) ||
-      !token.IsValue() || !token.Value().isArray()) {
-    LOG(INFO) << "EvaluateIterator: error evaluating location: " << location
+  if (!ProcessExpression(store_, runtime_, dispatcher_, slots_, &paths_,
+                         source_cache_, location, &token) ||
+      token.ArraySize() < 0) {
+    LOG(INFO) << "EvaluateIterator: error evaluating location: "
+              << location.source()
               << ", resulting token: " << token.DebugString();
     return nullptr;
   }
-  // If it is a location in the store, do not copy, use reference.
+  // Records are converted one at a time.
+  if (token.PackedVariable() != nullptr) {
+    return absl::make_unique<internal::RecordArrayIterator>(
+        token.PackedVariable()->shared_records());
+  }
+  // If it is a location in the store, do not copy, use reference. The
+  // iterator keeps the value of the variable, which a write that holds the
+  // variable as a RecordArray releases. Values in a ValueTree are copied,
+  // since writes of their nodes would release them.
   if (token.IsReference()) {
-    return absl::make_unique<ArrayReferenceIterator>(token.Value());
+    const internal::Store::Variable* variable =
+        store_.FindVariable(TopLevelVariable(
+            absl::StripLeadingAsciiWhitespace(location.source())));
+    if (variable != nullptr && variable->tree() != nullptr) {
+      Json::Value array = token.Value();
+      return absl::make_unique<ArrayValueIterator>(&array);
+    }
+    return absl::make_unique<ArrayReferenceIterator>(
+        token.Value(),
+        variable == nullptr ? nullptr : variable->shared_value());
   }
   // 'token' has a value. 'token.MutableValue()' is not NULL. Move value into
   // the iterator.
   return absl::make_unique<ArrayValueIterator>(token.MutableValue());
 }
 
+// override
+bool LightWeightDatamodel::AssignIteratorValue(Iterator* iterator,
+                                               const Expression& location) {
+  if (strcmp(iterator->language(), internal::kLightWeightExpressionLanguage) !=
+      0) {
+    return Datamodel::AssignIteratorValue(iterator, location);
+  }
+  auto* array_iterator = static_cast<internal::JsonArrayIterator*>(iterator);
+  RETURN_FALSE_IF(array_iterator->AtEnd());
+  Json::Value value;
+  array_iterator->TakeValue(&value);
+  return AssignJson(location, std::move(value));
+}
+
+// override
+bool LightWeightDatamodel::AssignIteratorIndex(const Iterator& iterator,
+                                               const Expression& location) {
+  if (strcmp(iterator.language(), internal::kLightWeightExpressionLanguage) !=
+      0) {
+    return Datamodel::AssignIteratorIndex(iterator, location);
+  }
+  return AssignJson(
+      location,
+      Json::Value(
+          static_cast<const internal::JsonArrayIterator&>(iterator).index()));
+}
+
 bool LightWeightDatamodel::AssignJson(const string& location,
                                       const Json::Value& value) {
   if (!IsAssignable(location)) {
@@ -1699,86 +2754,704 @@ bool LightWeightDatamodel::AssignJson(const string& location,
   return DeclareAndAssignJson(location, value);
 }
 
+bool LightWeightDatamodel::AssignJson(const Expression& location,
+                                      Json::Value value) {
+  ParseDeferredValue(location);
+  const internal::LocationProgram* program =
+      internal::GetLocationProgram(location);
+  if (program == nullptr) {
+    return AssignJson(location.source(), value);
+  }
+  WriteTarget target;
+  if (!ResolveLocation(&store_, runtime_, dispatcher_,
+                       GetCompiledSlots(slots_, location), &paths_, *program,
+                       false /* declare */, &target)) {
+    VLOG(1) << "AssignJson: location is not assignable: " << location.source();
+    return false;
+  }
+  CountWrite(location.source(), target.path);
+  AssignToTarget(&store_, target, &value, MayPackRecords(location.source()));
+  return true;
+}
+
+bool LightWeightDatamodel::DeclareAndAssignJson(const Expression& location,
+                                                Json::Value value) {
+  ParseDeferredValue(location);
+  const internal::LocationProgram* program =
+      internal::GetLocationProgram(location);
+  if (program == nullptr) {
+    return DeclareAndAssignJson(location.source(), value);
+  }
+  WriteTarget target;
+  if (!ResolveLocation(&store_, runtime_, dispatcher_,
+                       GetCompiledSlots(slots_, location), &paths_, *program,
+                       true /* declare */, &target)) {
+    LOG(INFO) << "DeclareAndAssignJson: error evaluating location: "
+              << location.source();
+    // Values declared on the way to the location stay in the store.
+    if (target.created) {
+      CountWrite(location.source(), target.path);
+    }
+    return false;
+  }
+  CountWrite(location.source(), target.path);
+  AssignToTarget(&store_, target, &value, MayPackRecords(location.source()));
+  return true;
+}
+
 bool LightWeightDatamodel::DeclareAndAssignJson(const string& location,
                                                 const Json::Value& value) {
-  Json::Value* new_loc = nullptr;
+  ParseDeferredValue(Expression(location));
+  WriteTarget target;
   // Evaluate the location expression and destructively create new paths
   // in the store.
-  if (!ProcessLocationExpression(&store_, GetRuntime(), dispatcher_, location,
-                                 &new_loc)) {
+  if (!ProcessLocationExpression(&store_, runtime_, dispatcher_,
+                                 &paths_, location, &target)) {
     LOG(INFO) << "DeclareAndAssignJson: error evaluating location: "
               << location;
+    if (target.created) {
+      CountWrite(location, target.path);
+    }
     return false;
   }
+  CountWrite(location, target.path);
   DVLOG(1) << "DeclareAndAssignJson: Storing: " << location << " = "
-           << Json::FastWriter().write(value);
-  *new_loc = value;
+           << ToJsonText(value);
+  Json::Value copy = value;
+  AssignToTarget(&store_, target, &copy, MayPackRecords(location));
   return true;
 }
 
 namespace internal {
 
-void TokenizeExpression(const string& expr, std::list<string>* tokens) {
-  // Marks the start of an operand token (i.e. a non-operator token).
-  ::std::size_t token_start = 0;
-  // The type of string quote character.
-  char str_quote_type = 0;
-  bool in_string = false;
-  string operand;
-  for (::std::size_t i = 0; i < expr.size(); ++i) {
-    // Set the string flag if we enter or exit a string.
-    if (expr[i] == '"' || expr[i] == '\'') {
-      if (in_string) {
-        // No longer in a string if non-escaped 'str_quote_type' met.
-        in_string = (expr[i - 1] == '\\' || expr[i] != str_quote_type);
-      } else {
-        in_string = true;
-        str_quote_type = expr[i];
+void Store::Variable::AppendJsonText(string* output) const {
+  if (records_ != nullptr) {
+    records_->AppendJsonText(output);
+  } else if (tree_ != nullptr) {
+    tree_->AppendJsonText(output);
+  } else {
+    state_chart::AppendJsonText(*value_, output);
+  }
+}
+
+namespace {
+
+// Returns a new owner token or generation of stores, which is unique in the
+// process.
+uint64_t NewStoreId() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+// A node of the tree of variables. Its subtrees hold the variables with
+// smaller and larger names, and their heights differ by at most one.
+struct Store::Node {
+  Variable variable;
+  NodePtr left;
+  NodePtr right;
+  int height = 1;
+
+  static int Height(const NodePtr& node) {
+    return node == nullptr ? 0 : node->height;
+  }
+  void UpdateHeight() { height = std::max(Height(left), Height(right)) + 1; }
+};
+
+Store::Store() : token_(NewStoreId()), generation_(NewStoreId()) {}
+
+Store::Store(Store&& other)
+    : root_(std::move(other.root_)),
+      token_(other.token()),
+      generation_(NewStoreId()),
+      is_object_(other.is_object_) {
+  other.Clear();
+  other.token_.store(NewStoreId(), std::memory_order_relaxed);
+}
+
+Store& Store::operator=(Store&& other) {
+  if (this != &other) {
+    root_ = std::move(other.root_);
+    token_.store(other.token(), std::memory_order_relaxed);
+    generation_ = NewStoreId();
+    is_object_ = other.is_object_;
+    other.Clear();
+    other.token_.store(NewStoreId(), std::memory_order_relaxed);
+  }
+  return *this;
+}
+
+Store Store::Share() const {
+  Store shared;
+  shared.root_ = root_;
+  shared.is_object_ = is_object_;
+  // Neither store may write the nodes and values that are shared now.
+  token_.store(NewStoreId(), std::memory_order_relaxed);
+  return shared;
+}
+
+const Store::Variable* Store::FindVariable(absl::string_view name) const {
+  const Node* node = root_.get();
+  while (node != nullptr) {
+    const int comparison = name.compare(node->variable.name_);
+    if (comparison == 0) {
+      return &node->variable;
+    }
+    node = comparison < 0 ? node->left.get() : node->right.get();
+  }
+  return nullptr;
+}
+
+const Json::Value* Store::Find(absl::string_view name) const {
+  const Variable* variable = FindVariable(name);
+  return variable == nullptr ? nullptr : &variable->value();
+}
+
+Store::Node* Store::OwnNode(NodePtr* link) {
+  if ((*link)->variable.owner_ != token()) {
+    *link = std::make_shared<Node>(**link);
+    (*link)->variable.owner_ = token();
+    generation_ = NewStoreId();
+  }
+  return link->get();
+}
+
+const Store::Variable& Store::Own(const Variable& variable) {
+  if (variable.owner_ == token()) {
+    return variable;
+  }
+  // Copying the node of 'variable' may release it.
+  const string name = variable.name_;
+  NodePtr* link = &root_;
+  while (true) {
+    Node* node = OwnNode(link);
+    const int comparison = name.compare(node->variable.name_);
+    if (comparison == 0) {
+      return node->variable;
+    }
+    link = comparison < 0 ? &node->left : &node->right;
+  }
+}
+
+Store::PathVersions* Store::MutableWriteVersions(const Variable& variable) {
+  return &const_cast<Variable&>(Own(variable)).write_versions_;
+}
+
+Store::Variable* Store::Insert(NodePtr* link, absl::string_view name) {
+  if (*link == nullptr) {
+    *link = std::make_shared<Node>();
+    Variable* variable = &(*link)->variable;
+    variable->name_ = string(name);
+    variable->value_ = std::make_shared<Json::Value>();
+    variable->owner_ = token();
+    variable->value_owner_ = token();
+    return variable;
+  }
+  Node* node = OwnNode(link);
+  Variable* variable =
+      Insert(name < node->variable.name_ ? &node->left : &node->right, name);
+  Rebalance(link);
+  return variable;
+}
+
+void Store::Rebalance(NodePtr* link) {
+  Node* node = link->get();
+  const int balance = Node::Height(node->left) - Node::Height(node->right);
+  if (balance > 1) {
+    if (Node::Height(node->left->left) < Node::Height(node->left->right)) {
+      RotateLeft(&node->left);
+    }
+    RotateRight(link);
+  } else if (balance < -1) {
+    if (Node::Height(node->right->right) < Node::Height(node->right->left)) {
+      RotateRight(&node->right);
+    }
+    RotateLeft(link);
+  } else {
+    node->UpdateHeight();
+  }
+}
+
+void Store::RotateLeft(NodePtr* link) {
+  OwnNode(link);
+  NodePtr node = std::move(*link);
+  OwnNode(&node->right);
+  NodePtr right = std::move(node->right);
+  node->right = std::move(right->left);
+  node->UpdateHeight();
+  right->left = std::move(node);
+  right->UpdateHeight();
+  *link = std::move(right);
+}
+
+void Store::RotateRight(NodePtr* link) {
+  OwnNode(link);
+  NodePtr node = std::move(*link);
+  OwnNode(&node->left);
+  NodePtr left = std::move(node->left);
+  node->left = std::move(left->right);
+  node->UpdateHeight();
+  left->right = std::move(node);
+  left->UpdateHeight();
+  *link = std::move(left);
+}
+
+void Store::ForEach(const Node* node,
+                    const std::function<void(const Variable&)>& visit) {
+  if (node != nullptr) {
+    ForEach(node->left.get(), visit);
+    visit(node->variable);
+    ForEach(node->right.get(), visit);
+  }
+}
+
+Json::Value* Store::MutableValue(Variable* variable) {
+  if (variable->records_ != nullptr) {
+    variable->value_ = std::make_shared<Json::Value>(
+        variable->value_owner_ == token() ? variable->records_->ReleaseJson()
+                                          : variable->records_->ToJson());
+    variable->records_.reset();
+    variable->value_owner_ = token();
+  }
+  if (variable->tree_ != nullptr) {
+    variable->value_ = std::make_shared<Json::Value>(
+        variable->value_owner_ == token() ? variable->tree_->ReleaseJson()
+                                          : variable->tree_->ToJson());
+    variable->tree_.reset();
+    variable->value_owner_ = token();
+  }
+  if (variable->value_owner_ != token()) {
+    variable->value_ = std::make_shared<Json::Value>(*variable->value_);
+    variable->value_owner_ = token();
+  }
+  return variable->value_.get();
+}
+
+Json::Value* Store::Mutable(const Variable& variable) {
+  // The owned variable is in a node of the mutable tree.
+  return MutableValue(const_cast<Variable*>(&Own(variable)));
+}
+
+RecordArray* Store::MutableRecords(const Variable& variable) {
+  Variable* mutable_variable = const_cast<Variable*>(&Own(variable));
+  if (mutable_variable->value_owner_ != token()) {
+    mutable_variable->records_ =
+        std::make_shared<RecordArray>(*mutable_variable->records_);
+    mutable_variable->value_owner_ = token();
+  }
+  return mutable_variable->records_.get();
+}
+
+ValueTree* Store::MutableTree(const Variable& variable) {
+  Variable* mutable_variable = const_cast<Variable*>(&Own(variable));
+  if (mutable_variable->value_owner_ != token()) {
+    mutable_variable->tree_ =
+        std::make_shared<ValueTree>(*mutable_variable->tree_, token());
+    mutable_variable->value_owner_ = token();
+  }
+  return mutable_variable->tree_.get();
+}
+
+void Store::Set(const Variable& variable, Json::Value* value, bool pack) {
+  Variable* mutable_variable = const_cast<Variable*>(&Own(variable));
+  mutable_variable->records_ = pack ? RecordArray::FromJson(value) : nullptr;
+  mutable_variable->tree_ =
+      pack && mutable_variable->records_ == nullptr
+          ? ValueTree::FromJson(value, token())
+          : nullptr;
+  if (mutable_variable->records_ != nullptr ||
+      mutable_variable->tree_ != nullptr) {
+    mutable_variable->value_.reset();
+    mutable_variable->value_owner_ = token();
+    return;
+  }
+  // Iterators may reference the value, so an unshared value is written in
+  // place.
+  if (mutable_variable->value_ == nullptr ||
+      mutable_variable->value_owner_ != token()) {
+    mutable_variable->value_ = std::make_shared<Json::Value>();
+    mutable_variable->value_owner_ = token();
+  }
+  mutable_variable->value_->swap(*value);
+}
+
+void Store::PackRecords(
+    const std::function<bool(absl::string_view)>& may_pack) {
+  // The nodes that the store may write are those on paths from the root that
+  // it wrote since it was shared.
+  const std::function<void(Node*)> pack = [&](Node* node) {
+    if (node == nullptr || node->variable.owner_ != token()) {
+      return;
+    }
+    pack(node->left.get());
+    Variable& variable = node->variable;
+    if (variable.value_ != nullptr && variable.value_owner_ == token() &&
+        may_pack(variable.name_)) {
+      variable.records_ = RecordArray::FromJson(variable.value_.get());
+      if (variable.records_ == nullptr) {
+        variable.tree_ = ValueTree::FromJson(variable.value_.get(), token());
+      }
+      if (variable.records_ != nullptr || variable.tree_ != nullptr) {
+        variable.value_.reset();
       }
     }
-    if (in_string) {
-      continue;
+    pack(node->right.get());
+  };
+  pack(root_.get());
+}
+
+Json::Value* Store::FindOrDeclare(absl::string_view name) {
+  is_object_ = true;
+  const Variable* variable = FindVariable(name);
+  if (variable == nullptr) {
+    return MutableValue(Insert(&root_, name));
+  }
+  return Mutable(*variable);
+}
+
+bool Store::Assign(Json::Value* root) {
+  Clear();
+  if (root->isNull()) {
+    return true;
+  }
+  if (!root->isObject()) {
+    return false;
+  }
+  is_object_ = true;
+  for (auto it = root->begin(); it != root->end(); ++it) {
+    Insert(&root_, it.name())->value_->swap(*it);
+  }
+  return true;
+}
+
+void Store::Clear() {
+  root_.reset();
+  is_object_ = false;
+  generation_ = NewStoreId();
+}
+
+void Store::AppendJsonText(string* output) const {
+  if (!is_object_) {
+    output->append("null");
+    return;
+  }
+  output->push_back('{');
+  ForEach(root_.get(), [output](const Variable& variable) {
+    if (output->back() != '{') {
+      output->push_back(',');
     }
-    // Expression from i-th position onwards.
-    absl::string_view subexpr(expr.data() + i);
-    // Search for the longest operator (or delimiter) match.
-    absl::string_view matched_op;
-    for (const auto& op : kOperators) {
-      if (!::absl::StartsWith(subexpr, op)) {
-        continue;
+    AppendQuotedJsonString(variable.name_.data(),
+                           variable.name_.data() + variable.name_.size(),
+                           output);
+    output->push_back(':');
+    variable.AppendJsonText(output);
+  });
+  output->push_back('}');
+}
+
+Json::Value Store::ToJson() const {
+  Json::Value root;
+  if (is_object_) {
+    root = Json::Value(Json::objectValue);
+  }
+  ForEach(root_.get(), [&root](const Variable& variable) {
+    const RecordArray* records = variable.records();
+    const ValueTree* tree = variable.tree();
+    root[variable.name_] = records != nullptr ? records->ToJson()
+                           : tree != nullptr  ? tree->ToJson()
+                                              : variable.value();
+  });
+  return root;
+}
+
+namespace {
+
+// Returns the position of the top-level variable in 'location', skipping the
+// separators that Json::Path skips.
+std::size_t VariableStart(const string& location) {
+  const std::size_t start = location.find_first_not_of(".]");
+  return start == string::npos ? location.size() : start;
+}
+
+// Returns the end of the top-level variable in 'location', where its members
+// start.
+std::size_t VariableEnd(const string& location) {
+  const std::size_t start = VariableStart(location);
+  if (start == location.size() || location[start] == '[' ||
+      location[start] == '%') {
+    return start;
+  }
+  const std::size_t end = location.find_first_of(".[", start);
+  return end == string::npos ? location.size() : end;
+}
+
+}  // namespace
+
+StorePath::StorePath(const string& location)
+    : variable(location.substr(
+          VariableStart(location),
+          VariableEnd(location) - VariableStart(location))),
+      members(location.substr(VariableEnd(location))) {
+  // Reads the keys the same way as Json::Path::makePath().
+  const char* current = location.data() + VariableEnd(location);
+  const char* const end = location.data() + location.size();
+  while (current != end) {
+    if (*current == '[') {
+      ++current;
+      if (current != end && *current == '%') {
+        has_keys = false;
+        keys.clear();
+        return;
+      }
+      Json::ArrayIndex index = 0;
+      for (; current != end && absl::ascii_isdigit(*current); ++current) {
+        index = index * 10 + (*current - '0');
+      }
+      keys.emplace_back(index);
+      if (current != end) {
+        ++current;
       }
-      if (strlen(op) > matched_op.size()) {
-        matched_op = op;
+    } else if (*current == '%') {
+      has_keys = false;
+      keys.clear();
+      return;
+    } else if (*current == '.' || *current == ']') {
+      ++current;
+    } else {
+      const char* const name = current;
+      while (current != end && *current != '[' && *current != '.') {
+        ++current;
       }
+      keys.emplace_back(string(name, current));
+    }
+  }
+}
+
+void SlotCache::SetSymbolTable(std::shared_ptr<const SymbolTable> symbols) {
+  symbols_ = std::move(symbols);
+  variables_.assign(symbols_ == nullptr ? 0 : symbols_->size(), nullptr);
+}
+
+const Store::Variable* SlotCache::Find(const Store& store, int slot) const {
+  if (generation_ != store.generation()) {
+    std::fill(variables_.begin(), variables_.end(), nullptr);
+    generation_ = store.generation();
+  }
+  const Store::Variable*& variable = variables_[slot];
+  if (variable == nullptr) {
+    variable = store.FindVariable(symbols_->GetName(slot));
+  }
+  return variable;
+}
+
+void SlotCache::Reset() {
+  std::fill(variables_.begin(), variables_.end(), nullptr);
+}
+
+string RecordArrayIterator::GetValue() const {
+  RETURN_VALUE_IF_MSG(
+      AtEnd(), "", "Returning empty string; Accessing out of bounds value.");
+  string text;
+  records_->record(index_).AppendJsonText(&text);
+  return text;
+}
+
+void RecordArrayIterator::TakeValue(Json::Value* value) {
+  *value = records_->record(index_).ToJson();
+}
+
+const StorePath& PathCache::Get(const string& location) {
+  const auto it = index_.find(location);
+  if (it != index_.end()) {
+    ++hits_;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->path;
+  }
+  ++misses_;
+  if (!entries_.empty() && static_cast<int>(entries_.size()) >= capacity_) {
+    ++evictions_;
+    index_.erase(entries_.back().location);
+    entries_.pop_back();
+  }
+  entries_.push_front({location, StorePath(location)});
+  index_.emplace(entries_.front().location, entries_.begin());
+  return entries_.front().path;
+}
+
+bool KeyIndexDispatcher::AddIndex(const string& variable, const string& key) {
+  RETURN_FALSE_IF_MSG(
+      variable.empty() || absl::ascii_isdigit(variable.front()) ||
+          !std::all_of(variable.begin(), variable.end(), IsIdentifierChar),
+      "Only top-level variables may be indexed: " << variable);
+  for (const auto& index : indexes_) {
+    if (index.variable == variable && index.key == key) {
+      return true;
+    }
+  }
+  indexes_.emplace_back();
+  indexes_.back().variable = variable;
+  indexes_.back().key = key;
+  return true;
+}
+
+bool KeyIndexDispatcher::IsIndexed(absl::string_view variable) const {
+  return std::any_of(
+      indexes_.begin(), indexes_.end(),
+      [variable](const Index& index) { return index.variable == variable; });
+}
+
+void KeyIndexDispatcher::CopyIndexes(const KeyIndexDispatcher& other) {
+  indexes_ = other.indexes_;
+}
+
+void KeyIndexDispatcher::Invalidate(absl::string_view variable) {
+  for (auto& index : indexes_) {
+    if (index.variable == variable) {
+      index.stale = true;
     }
-    // No operator found.
-    if (matched_op.empty()) {
+  }
+}
+
+void KeyIndexDispatcher::InvalidateElement(absl::string_view variable,
+                                           int position) {
+  for (auto& index : indexes_) {
+    if (index.variable != variable || index.stale) {
       continue;
     }
-    // Write out the current operand token.
-    if (token_start < i) {
-      operand = expr.substr(token_start, i - token_start);
-      absl::StripAsciiWhitespace(&operand);
-      if (!operand.empty()) {
-        tokens->push_back(operand);
-      }
+    index.written.push_back(position);
+    // Many writes without lookups cost no more than a rebuild.
+    if (index.written.size() > index.element_keys.size()) {
+      index.stale = true;
+    }
+  }
+}
+
+void KeyIndexDispatcher::InvalidateAll() {
+  for (auto& index : indexes_) {
+    index.stale = true;
+  }
+}
+
+// override
+bool KeyIndexDispatcher::HasFunction(const string& function_name) const {
+  return dispatcher_->HasFunction(function_name);
+}
+
+// override
+bool KeyIndexDispatcher::Execute(const string& function_name,
+                                 const std::vector<const Json::Value*>& inputs,
+                                 Json::Value* return_value) {
+  int position = -1;
+  if (!indexes_.empty() && inputs.size() == 3 && inputs[1]->isString() &&
+      (function_name == "LookupByKey" || function_name == "ContainsKeyValue" ||
+       function_name == "FindFirstWithKeyValue") &&
+      Find(*inputs[0], inputs[1]->asString(), *inputs[2], &position)) {
+    if (function_name == "LookupByKey") {
+      *return_value = position < 0 ? Json::Value() : (*inputs[0])[position];
+    } else if (function_name == "ContainsKeyValue") {
+      *return_value = position >= 0;
+    } else {
+      *return_value = position;
+    }
+    return true;
+  }
+  return dispatcher_->Execute(function_name, inputs, return_value);
+}
+
+bool KeyIndexDispatcher::Find(const Json::Value& array, const string& key,
+                              const Json::Value& value, int* position) {
+  if (!array.isArray()) {
+    return false;
+  }
+  string hashed;
+  if (!HashIndexedValue(value, &hashed)) {
+    return false;
+  }
+  for (auto& index : indexes_) {
+    // Only arrays that are the indexed variables themselves are answered, not
+    // copies of them.
+    if (index.key != key) {
+      continue;
+    }
+    // Indexed variables do not hold RecordArrays or ValueTrees.
+    const Store::Variable* variable = store_->FindVariable(index.variable);
+    if (variable == nullptr || variable->records() != nullptr ||
+        variable->tree() != nullptr ||
+        &variable->value() != &array) {
+      continue;
+    }
+    if (index.stale || !UpdateWrittenElements(array, &index)) {
+      Rebuild(array, &index);
+    }
+    const auto it = index.positions.find(hashed);
+    *position = it == index.positions.end() ? -1 : it->second.first;
+    return true;
+  }
+  return false;
+}
+
+void KeyIndexDispatcher::Rebuild(const Json::Value& array, Index* index) {
+  ++rebuilds_;
+  index->positions.clear();
+  index->written.clear();
+  const int size = array.size();
+  index->element_keys.assign(size, string());
+  for (int i = 0; i < size; ++i) {
+    string& hashed = index->element_keys[i];
+    HashElementKey(array[i], index->key, &hashed);
+    if (hashed.empty()) {
+      continue;
+    }
+    Positions& positions = index->positions[hashed];
+    if (positions.count++ == 0) {
+      positions.first = i;
     }
-    // Write the operator.
-    tokens->push_back(string(matched_op));
-    // Next operand comes after operator.
-    token_start = i + matched_op.size();
-    // Move i forward so that we do not match another operator
-    // that is a substring of the previous operator.
-    i += matched_op.size() - 1;
   }
-  // Store the final operand.
-  if (token_start < expr.size()) {
-    operand = expr.substr(token_start);
-    absl::StripAsciiWhitespace(&operand);
-    if (!operand.empty()) {
-      tokens->push_back(operand);
+  index->stale = false;
+}
+
+// static
+bool KeyIndexDispatcher::UpdateWrittenElements(const Json::Value& array,
+                                               Index* index) {
+  std::vector<string>& element_keys = index->element_keys;
+  const int size = array.size();
+  for (int position : index->written) {
+    if (position >= size) {
+      return false;
+    }
+    if (position >= static_cast<int>(element_keys.size())) {
+      // Assigning after the end of an array appends nulls up to the element.
+      element_keys.resize(position + 1);
+    }
+    string hashed;
+    HashElementKey(array[position], index->key, &hashed);
+    if (hashed == element_keys[position]) {
+      continue;
+    }
+    if (!element_keys[position].empty()) {
+      auto it = index->positions.find(element_keys[position]);
+      if (--it->second.count == 0) {
+        index->positions.erase(it);
+      } else if (it->second.first == position) {
+        // Another object with the value follows the element.
+        int next = position + 1;
+        while (element_keys[next] != element_keys[position]) {
+          ++next;
+        }
+        it->second.first = next;
+      }
+    }
+    if (!hashed.empty()) {
+      Positions& positions = index->positions[hashed];
+      if (positions.count++ == 0 || position < positions.first) {
+        positions.first = position;
+      }
     }
+    element_keys[position] = std::move(hashed);
   }
+  index->written.clear();
+  return static_cast<int>(element_keys.size()) == size;
 }
 
 }  // namespace internal
@@ -17,24 +17,426 @@
 #ifndef STATE_CHART_INTERNAL_LIGHT_WEIGHT_DATAMODEL_H_
 #define STATE_CHART_INTERNAL_LIGHT_WEIGHT_DATAMODEL_H_
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <list>
 #include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <glog/logging.h>
 
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
 #include "include/json/json.h"
 #include "statechart/internal/datamodel.h"
+#include "statechart/internal/expression_cache.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/light_weight_expression.h"
+#include "statechart/internal/record_array.h"
 #include "statechart/internal/runtime.h"
+#include "statechart/internal/value_tree.h"
 #include "statechart/logging.h"
 #include "statechart/platform/str_util.h"
 #include "statechart/platform/types.h"
 
 namespace state_chart {
 
-class FunctionDispatcher;
+namespace internal {
+
+// The top-level variables of a LightWeightDatamodel in a persistent tree.
+// The variables are the nodes of a balanced search tree by name, and the
+// nodes are shared by reference counts: Share() shares the whole tree with
+// another store at once, and the first write of a variable after it copies
+// only the nodes on the path from the root to the variable, which are a few
+// even for thousands of variables. Nodes that only this store holds are
+// written in place.
+//
+// The values of the variables are shared with the nodes. Large values are
+// persistent as well, see Set(): a large array of records is held as a
+// RecordArray, which shares chunks of records, and other large objects and
+// arrays as a ValueTree, which shares its large members and elements as
+// subtrees. So the first write to a member of a shared variable copies only
+// the chunk of a written record, or the nodes of the value tree on the path
+// to the written member, while untouched members stay shared. Small values
+// are copied whole.
+//
+// Whether a node or value is shared is recorded by the stores rather than
+// read from reference counts: each store writes in place only the nodes and
+// values that it created since it was last shared, which are marked with its
+// current owner token. Shared nodes and values are never written again, so
+// stores that share them may be used on different threads. A single store is
+// not thread-safe, except that Share() may be called concurrently on the same
+// store. It only copies the root and replaces the owner token of the store,
+// which is atomic.
+//
+// A variable that holds a large value may hold it as a RecordArray or a
+// ValueTree, see Set(). Its elements and members are then read and written
+// without converting the value, while reads of the whole value, e.g., by
+// value(), convert it once until it is written again. The nodes of a
+// ValueTree are owned by the same tokens as the variables.
+class Store {
+ public:
+  // The versions of the last writes of values under a variable by the keys
+  // of the values, empty for the variable itself.
+  using PathVersions = std::map<string, uint64_t, std::less<>>;
+
+  // A declared variable. It stays at the same address until the store is
+  // cleared or assigned or, after Share(), until the store writes it or a
+  // variable that is created after it or that its node is on the path to,
+  // which copies its node. generation() tells whether variables may have
+  // moved.
+  class Variable {
+   public:
+    Variable() = default;
+
+    const string& name() const { return name_; }
+
+    // The value of the variable. A RecordArray or ValueTree is converted to
+    // JSON.
+    const Json::Value& value() const {
+      return records_ != nullptr ? records_->json()
+                                 : tree_ != nullptr ? tree_->json() : *value_;
+    }
+
+    // The records of the variable, or nullptr if it does not hold a
+    // RecordArray.
+    const RecordArray* records() const { return records_.get(); }
+    // Same as above, for readers that may outlive writes of the variable.
+    std::shared_ptr<const RecordArray> shared_records() const {
+      return records_;
+    }
+
+    // The tree of the variable, or nullptr if it does not hold a ValueTree.
+    const ValueTree* tree() const { return tree_.get(); }
+
+    // The value for readers that may outlive writes of the variable, or
+    // nullptr if the variable holds a RecordArray or ValueTree.
+    std::shared_ptr<const Json::Value> shared_value() const { return value_; }
+
+    // Appends the JSON text of the value to 'output'.
+    void AppendJsonText(string* output) const;
+
+    // The versions of the writes of the variable, which the store keeps for
+    // LightWeightDatamodel::SerializeModificationsAsString().
+    const PathVersions& write_versions() const { return write_versions_; }
+
+   private:
+    friend class Store;
+
+    string name_;
+    // The value, unless the variable holds 'records_' or 'tree_'. Exactly
+    // one of them is set.
+    std::shared_ptr<Json::Value> value_;
+    std::shared_ptr<RecordArray> records_;
+    std::shared_ptr<ValueTree> tree_;
+    // The owner tokens of the store that created the node of the variable
+    // and of the store that created 'value_', 'records_' or 'tree_'.
+    uint64_t owner_ = 0;
+    uint64_t value_owner_ = 0;
+    // Copied with the node, so it is shared like the node.
+    PathVersions write_versions_;
+  };
+
+  Store();
+  Store(Store&& other);
+  Store& operator=(Store&& other);
+  Store(const Store&) = delete;
+  Store& operator=(const Store&) = delete;
+
+  // Returns a store with the same variables. The nodes and values are shared
+  // until either store writes them. Takes constant time.
+  Store Share() const;
+
+  // Returns the variable 'name', or nullptr if it is not declared.
+  const Variable* FindVariable(absl::string_view name) const;
+  const Json::Value* Find(absl::string_view name) const;
+
+  // Returns 'variable', a variable of this store, with the nodes on the path
+  // to it copied first if they are shared, so that it may be written without
+  // moving. Writers that hold a variable across several writes get it here
+  // first.
+  const Variable& Own(const Variable& variable);
+
+  // Returns the value of 'variable', a variable of this store, for writing.
+  // The value is copied first if it is shared. A RecordArray or ValueTree is
+  // converted to JSON.
+  Json::Value* Mutable(const Variable& variable);
+
+  // Returns the write versions of 'variable', a variable of this store, for
+  // writing. The node of the variable is owned first, see Own().
+  PathVersions* MutableWriteVersions(const Variable& variable);
+
+  // Returns the records of 'variable', which holds a RecordArray, for writing.
+  // The records are copied first if they are shared.
+  RecordArray* MutableRecords(const Variable& variable);
+
+  // Returns the tree of 'variable', which holds a ValueTree, for writing. The
+  // root of the tree is copied first if it is shared, and the nodes below it
+  // are copied by ValueTree::MutableTree() as they are written.
+  ValueTree* MutableTree(const Variable& variable);
+
+  // Moves 'value' into 'variable'. If 'pack' is true and 'value' is an array
+  // that RecordArray::FromJson() accepts, the variable holds it as a
+  // RecordArray, or else if ValueTree::FromJson() accepts it, as a ValueTree.
+  // Otherwise a value that is not shared is written in place, so references
+  // to it stay valid.
+  void Set(const Variable& variable, Json::Value* value, bool pack);
+
+  // Holds the values of the variables as RecordArrays or ValueTrees as Set()
+  // does, except for the variables that 'may_pack' returns false for and the
+  // shared ones.
+  void PackRecords(const std::function<bool(absl::string_view)>& may_pack);
+
+  // Returns the value of the variable 'name' for writing, declaring the
+  // variable as null if it is not declared.
+  Json::Value* FindOrDeclare(absl::string_view name);
+
+  // Replaces the variables by the members of 'root', which are moved out of
+  // it. Returns false and leaves the store empty if 'root' is neither an
+  // object nor null.
+  bool Assign(Json::Value* root);
+
+  // Removes all variables.
+  void Clear();
+
+  // Appends the JSON text of the object of the variables to 'output', or
+  // "null" if no variable was declared since the store was cleared.
+  void AppendJsonText(string* output) const;
+
+  // Returns a copy of the object of the variables, or null as above.
+  Json::Value ToJson() const;
+
+  // Calls 'visit' for the variables in order of their names.
+  void ForEach(const std::function<void(const Variable&)>& visit) const {
+    ForEach(root_.get(), visit);
+  }
+
+  // Changes whenever variables of the store may have moved. It is unique
+  // among all stores of the process.
+  uint64_t generation() const { return generation_; }
+
+ private:
+  struct Node;
+  using NodePtr = std::shared_ptr<Node>;
+
+  // Returns the node at '*link' for writing, copying it first if it is
+  // shared.
+  Node* OwnNode(NodePtr* link);
+
+  // Inserts the variable 'name' into the subtree at '*link', which must not
+  // hold it, and rebalances the subtree. Returns the new variable.
+  Variable* Insert(NodePtr* link, absl::string_view name);
+
+  // Restores the balance of the subtree at '*link', whose node is owned and
+  // whose subtrees differ in height by at most two, by rotating it.
+  void Rebalance(NodePtr* link);
+  void RotateLeft(NodePtr* link);
+  void RotateRight(NodePtr* link);
+
+  // Calls 'visit' for the variables in the subtree 'node' in order of their
+  // names.
+  static void ForEach(const Node* node,
+                      const std::function<void(const Variable&)>& visit);
+
+  // Returns the value of the owned 'variable' for writing, see Mutable().
+  Json::Value* MutableValue(Variable* variable);
+
+  // The owner token of the nodes and values that the store may write.
+  uint64_t token() const { return token_.load(std::memory_order_relaxed); }
+
+  NodePtr root_;
+  // Replaced by Share(), which may run on several threads at once.
+  mutable std::atomic<uint64_t> token_;
+  uint64_t generation_;
+  // Whether the store is an object rather than null, even if it is empty.
+  bool is_object_ = false;
+};
+
+// A location split into its top-level variable and the Json path of the
+// members under the variable, e.g., "a" and ".b[0]" for "a.b[0]". 'variable'
+// is empty if the location does not start with a variable.
+struct StorePath {
+  explicit StorePath(const string& location);
+
+  string variable;
+  Json::Path members;
+  // The keys of 'members' as they are read by Json::Path, e.g., "b" and 0 for
+  // ".b[0]", for walking values that are not Json::Values. 'has_keys' is false
+  // if 'members' has placeholders, which are not keys.
+  std::vector<Json::Value> keys;
+  bool has_keys = true;
+};
+
+// Caches the top-level variables of a store by their slots in a SymbolTable,
+// so that references compiled to slots are resolved without looking up their
+// names. Only declared variables are cached. The cache is reset when the
+// generation of the store changes, i.e., when variables may have moved.
+class SlotCache {
+ public:
+  SlotCache() = default;
+  SlotCache(const SlotCache&) = delete;
+  SlotCache& operator=(const SlotCache&) = delete;
+
+  // Sets the symbols of the slots and resets the cache.
+  void SetSymbolTable(std::shared_ptr<const SymbolTable> symbols);
+
+  // The symbols of the slots, may be nullptr.
+  const SymbolTable* symbols() const { return symbols_.get(); }
+  const std::shared_ptr<const SymbolTable>& shared_symbols() const {
+    return symbols_;
+  }
+
+  // Returns the top-level variable in 'slot' of 'store', or nullptr if it is
+  // not declared. 'slot' must be a slot of symbols().
+  const Store::Variable* Find(const Store& store, int slot) const;
+
+  // Forgets all cached variables.
+  void Reset();
+
+ private:
+  std::shared_ptr<const SymbolTable> symbols_;
+  // The cached variables by slot. nullptr if not looked up or not declared.
+  mutable std::vector<const Store::Variable*> variables_;
+  // The generation of the store of the cached variables.
+  mutable uint64_t generation_ = 0;
+};
+
+// Caches the parsed paths of locations by their source, so that locations
+// that are evaluated from source are not parsed on every lookup. A path
+// depends only on its source, not on the values of a store, so cached paths
+// stay valid however the store changes. The cache holds at most 'capacity'
+// paths and evicts the least recently used one when it is full.
+class PathCache {
+ public:
+  explicit PathCache(int capacity = 256) : capacity_(capacity) {}
+  PathCache(const PathCache&) = delete;
+  PathCache& operator=(const PathCache&) = delete;
+
+  // Returns the path of 'location'. The reference is valid until the next
+  // call to Get() or Clear().
+  const StorePath& Get(const string& location);
+
+  // Forgets all cached paths.
+  void Clear() {
+    index_.clear();
+    entries_.clear();
+  }
+
+  int capacity() const { return capacity_; }
+  int size() const { return entries_.size(); }
+  // The numbers of calls to Get() that found a cached path and that parsed
+  // one, and of paths evicted to make room.
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+  uint64_t evictions() const { return evictions_; }
+
+ private:
+  struct Entry {
+    string location;
+    StorePath path;
+  };
+
+  const int capacity_;
+  // The entries from the most to the least recently used.
+  std::list<Entry> entries_;
+  // The entries by their locations, which are owned by 'entries_'.
+  absl::flat_hash_map<absl::string_view, std::list<Entry>::iterator> index_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+  uint64_t evictions_ = 0;
+};
+
+// Answers the builtins LookupByKey(), ContainsKeyValue() and
+// FindFirstWithKeyValue() on indexed arrays of a store from hash indexes, and
+// forwards all other calls to another dispatcher. An index is built on the
+// first lookup after the variable holding its array was written, so a bulk
+// assignment costs one rebuild rather than one per element. Writes to single
+// elements, e.g., 'devices[3].online', only update the entries of these
+// elements on the next lookup.
+class KeyIndexDispatcher : public FunctionDispatcher {
+ public:
+  // Does not take ownership of 'dispatcher' or 'store', which must outlive
+  // this object.
+  KeyIndexDispatcher(FunctionDispatcher* dispatcher, const Store* store)
+      : dispatcher_(dispatcher), store_(store) {}
+  KeyIndexDispatcher(const KeyIndexDispatcher&) = delete;
+  KeyIndexDispatcher& operator=(const KeyIndexDispatcher&) = delete;
+  ~KeyIndexDispatcher() override = default;
+
+  // The dispatcher that calls are forwarded to.
+  FunctionDispatcher* dispatcher() const { return dispatcher_; }
+
+  // Indexes the objects of the array in the top-level 'variable' by 'key'.
+  // Returns false if 'variable' is not an identifier.
+  bool AddIndex(const string& variable, const string& key);
+
+  // Returns true if the top-level 'variable' has an index.
+  bool IsIndexed(absl::string_view variable) const;
+
+  // Copies the indexes of 'other'.
+  void CopyIndexes(const KeyIndexDispatcher& other);
+
+  // Marks the indexes of 'variable' for rebuilding.
+  void Invalidate(absl::string_view variable);
+  // Marks the element 'position' of the array of 'variable' for updating.
+  void InvalidateElement(absl::string_view variable, int position);
+  // Marks all indexes for rebuilding.
+  void InvalidateAll();
+
+  bool HasFunction(const string& function_name) const override;
+  bool Execute(const string& function_name,
+               const std::vector<const Json::Value*>& inputs,
+               Json::Value* return_value) override;
+
+  // The number of times that indexes were built from their whole arrays.
+  int rebuilds() const { return rebuilds_; }
+
+ private:
+  // The objects with a hashed value of the key.
+  struct Positions {
+    int first = -1;
+    int count = 0;
+  };
+
+  struct Index {
+    string variable;
+    string key;
+    // Whether 'positions' needs to be rebuilt.
+    bool stale = true;
+    // The elements that were written since 'positions' was updated.
+    std::vector<int> written;
+    // The hashed value of 'key' of each element, empty if it has none.
+    std::vector<string> element_keys;
+    // The objects by their hashed value of 'key'.
+    std::unordered_map<string, Positions> positions;
+  };
+
+  // Returns the position of the first object in 'array' with 'value' for
+  // 'key', or -1 if there is none. Returns false if no index answers the
+  // lookup.
+  bool Find(const Json::Value& array, const string& key,
+            const Json::Value& value, int* position);
+
+  // Builds 'index' from all elements of 'array'.
+  void Rebuild(const Json::Value& array, Index* index);
+
+  // Updates the entries of the written elements of 'index' from 'array'.
+  // Returns false if 'array' changed otherwise, e.g., it was shortened.
+  static bool UpdateWrittenElements(const Json::Value& array, Index* index);
+
+  FunctionDispatcher* const dispatcher_;
+  const Store* const store_;
+  std::vector<Index> indexes_;
+  int rebuilds_ = 0;
+};
+
+}  // namespace internal
 
 // A light weight interpreter for ECMAScript-like expressions.
 class LightWeightDatamodel : public Datamodel {
@@ -50,6 +452,13 @@ class LightWeightDatamodel : public Datamodel {
   static std::unique_ptr<LightWeightDatamodel> Create(
       const string& serialized_data, FunctionDispatcher* dispatcher);
 
+  // Same as above, with serialized 'modifications' of the datamodel applied and
+  // counting writes from 'version'. See SerializeModificationsAsString().
+  static std::unique_ptr<LightWeightDatamodel> Create(
+      const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher);
+
   LightWeightDatamodel(const LightWeightDatamodel&) = delete;
   LightWeightDatamodel& operator=(const LightWeightDatamodel&) = delete;
   ~LightWeightDatamodel() override = default;
@@ -85,6 +494,14 @@ class LightWeightDatamodel : public Datamodel {
   // Returns a copy of this datamodel. The clone points to the same
   // FunctionDispatcher and Runtime and will be valid only until the original
   // FunctionDispatcher and Runtime remain valid.
+  // The store is a persistent tree of the top-level variables: Clone() takes
+  // constant time, and the clone shares the tree until either datamodel
+  // writes it. A write after Clone() copies the nodes on the path to the
+  // variable that it writes, and within a large value only the chunk of a
+  // written record or the nodes on the path to the written member, see
+  // internal::Store. Small values are copied whole. The clone may be used on
+  // another thread. Clone() may run concurrently with other calls of Clone()
+  // on this datamodel, but not with any other calls.
   std::unique_ptr<Datamodel> Clone() const override;
 
   // Returns a string representation used for serializing the contents of the
@@ -95,14 +512,87 @@ class LightWeightDatamodel : public Datamodel {
   std::unique_ptr<Iterator> EvaluateIterator(
       const string& location) const override;
 
+  // Expressions compiled by GetExpressionCompiler() are evaluated from their
+  // syntax trees and those compiled by GetBytecodeCompiler() run on a stack
+  // machine. Others are evaluated from source. Locations that were compiled
+  // with ExpressionCompiler::CompileLocation() are declared and assigned by
+  // walking their location programs, others are parsed.
+  bool IsDefined(const Expression& location) const override;
+  bool Declare(const Expression& location) override;
+  bool AssignExpression(const Expression& location,
+                        const Expression& expr) override;
+  bool EvaluateBooleanExpression(const Expression& expr,
+                                 bool* result) const override;
+  bool EvaluateStringExpression(const Expression& expr,
+                                string* result) const override;
+  bool EvaluateExpression(const Expression& expr,
+                          string* result) const override;
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const Expression& location) const override;
+  // The elements of iterators returned by EvaluateIterator() are copied or
+  // moved into 'location' without being serialized.
+  bool AssignIteratorValue(Iterator* iterator,
+                           const Expression& location) override;
+  bool AssignIteratorIndex(const Iterator& iterator,
+                           const Expression& location) override;
+  // Values are assigned and evaluated without being formatted or parsed.
+  bool AssignValue(const Expression& location, Json::Value value) override;
+  bool EvaluateValue(const Expression& expr,
+                     Json::Value* result) const override;
+  string EncodeParameters(
+      const std::map<string, Json::Value>& parameters) const override;
+  string EvaluateParameters(const std::map<string, Expression>& parameters,
+                            std::vector<string>* failed) const override;
+  // JSON objects and arrays assigned to locations of the form "a.b.c" are
+  // parsed when an expression may access them, e.g., when an expression
+  // contains "a.b" or "a[k]" but not if it only contains "a.d". Until then,
+  // the location holds null. Only text that IsJsonText() accepts is
+  // deferred. Other text, including malformed payloads, is parsed or
+  // evaluated immediately, so that it fails here.
+  bool AssignValueLazily(const Expression& location, string json) override;
+
+  // Returns the compiler for expressions of this datamodel. The compiled
+  // expressions do not depend on the store or the FunctionDispatcher and may
+  // be shared by any number of LightWeightDatamodels.
+  static const ExpressionCompiler* GetExpressionCompiler();
+
+  // Returns the compiler of expressions into bytecode. Evaluation results are
+  // the same as for GetExpressionCompiler().
+  static const ExpressionCompiler* GetBytecodeCompiler();
+
+  // Returns the process-wide cache of the expressions that are evaluated from
+  // source and compiled by 'compiler', which is GetExpressionCompiler() or
+  // GetBytecodeCompiler(). It is shared by all LightWeightDatamodels that use
+  // 'compiler', so that repeated sources are not parsed again. Literals, e.g.,
+  // payloads, and sources of more than 256 characters are not cached. Its
+  // capacity and whether it starts enabled are set by the flags
+  // --source_expression_cache_capacity and --cache_source_expressions.
+  static ExpressionCache* GetSourceExpressionCache(
+      const ExpressionCompiler* compiler);
+
+  // Sets the compiler of the expressions of the model, GetExpressionCompiler()
+  // by default. Expressions that are evaluated from source are compiled by the
+  // same compiler through its source expression cache. If 'compiler' is
+  // nullptr, they are parsed and evaluated on every evaluation instead.
+  void SetExpressionCompiler(const ExpressionCompiler* compiler);
+
+  // Sets the symbols of the model that the expressions are compiled against.
+  // References to top-level variables in expressions compiled with 'symbols'
+  // are then resolved by their slots instead of their names. The serialized
+  // form of the datamodel does not depend on the symbols.
+  void SetSymbolTable(std::shared_ptr<const SymbolTable> symbols);
+
   // Declares a variable 'location' in the store and assigns 'value'
-  // (initializes) to the variable.
+  // (initializes) to the variable. Compiled locations are not parsed.
   // Returns false if creating the location failed.
   bool DeclareAndAssignJson(const string& location, const Json::Value& value);
+  bool DeclareAndAssignJson(const Expression& location, Json::Value value);
 
   // Evaluate an expression and sets 'result' to the evaluated Json::Value
   // result. Returns false if an error has occurred.
   bool EvaluateJsonExpression(const string& expr, Json::Value* result) const;
+  bool EvaluateJsonExpression(const Expression& expr,
+                              Json::Value* result) const;
 
   // Returns a const-pointer to the Runtime associated with this datamodel, if
   // present. Returns nullptr otherwise.
@@ -111,10 +601,31 @@ class LightWeightDatamodel : public Datamodel {
   }
 
   // Associates this datamodel with a given Runtime.
-  void SetRuntime(const Runtime* runtime) override {
+  void SetRuntime(Runtime* runtime) override {
     runtime_ = runtime;
   }
 
+  // Writes are counted by the members and elements that they write, so that
+  // modifications are keyed by locations such as 'a.b[2]'. Writes that create
+  // values are counted by the first value created, e.g., 'a.b' for 'a.b.c' if
+  // 'a.b' did not exist. A variable with many written locations is
+  // serialized whole. Writes to locations that do not start with a variable,
+  // as well as Clear(), make the modifications before them unknown.
+  uint64_t GetVersion() const override { return version_; }
+  bool SerializeModificationsAsString(
+      uint64_t version, std::map<string, string>* modifications) const override;
+
+  // 'location' must be a top-level variable. Its index is rebuilt on the next
+  // lookup after the variable is written or the datamodel is parsed. Indexed
+  // variables do not hold RecordArrays, since lookups read the whole array.
+  bool AddKeyIndex(const string& location, const string& key) override;
+
+  // The parsed paths of the locations that were looked up from source.
+  const internal::PathCache& path_cache() const { return paths_; }
+
+  // The top-level variables.
+  const internal::Store& store() const { return store_; }
+
  protected:
   // Returns true if a location is assignable given the current state of the
   // store. A location is assignable if any of the following is true:
@@ -125,41 +636,115 @@ class LightWeightDatamodel : public Datamodel {
 
   // Assign a Json value to a location expression.
   // Works the same way as AssignExpression() except that the value is already
-  // a Json::Value.
+  // a Json::Value. Compiled locations are not parsed.
   // Returns false if this location is non-assignable.
   bool AssignJson(const string& location, const Json::Value& value);
+  bool AssignJson(const Expression& location, Json::Value value);
 
   // Initializes datamodel from SerializeAsString() representation.
   // Returns true if parsing is successful.
   bool ParseFromString(const string& data) override;
 
+  bool ParseModificationsFromString(
+      const std::map<string, string>& modifications, uint64_t version) override;
+
  private:
   // Does not take ownership of 'dispatcher'.
   // 'dispatcher' must be non-null.
   explicit LightWeightDatamodel(FunctionDispatcher* dispatcher);
 
-  // Storage for locations. This holds the root JSON object.
-  Json::Value store_;
+  // Parses the value deferred by AssignValueLazily() into the store if 'expr'
+  // may access it. Returns false if the value failed to parse.
+  bool ParseDeferredValue(const Expression& expr) const;
+
+  // Parses the value deferred by AssignValueLazily() into the store. Storing
+  // the value is not counted as a write, since the location already holds it
+  // as seen by users of the datamodel. Returns false if the value failed to
+  // parse, in which case the location keeps null.
+  bool ParseDeferredValue() const;
+
+  // Counts a write to the value at 'path' under the top-level variable of
+  // 'location', where 'path' holds the keys of the value, e.g., '.b[2]'.
+  void CountWrite(absl::string_view location, absl::string_view path);
+
+  // Returns true if the top-level variable of 'location' may hold a
+  // RecordArray or ValueTree, i.e., it is not indexed.
+  bool MayPackRecords(absl::string_view location) const;
+
+  // Forgets the modifications before the current version.
+  void ForgetModifications();
+
+  // Storage for locations. Clone() shares the values of its variables, which
+  // are copied on write. ParseDeferredValue() writes it from const methods.
+  mutable internal::Store store_;
+
+  // The location and JSON text of the value deferred by AssignValueLazily().
+  // 'deferred_location_' is empty if no value is deferred.
+  mutable string deferred_location_;
+  mutable string deferred_json_;
+
+  // The number of writes to the store.
+  uint64_t version_ = 0;
+  // The version before which modifications are not known.
+  uint64_t known_since_version_ = 0;
+  // The versions of the last writes of the values under each variable are
+  // kept in 'store_', see Store::Variable::write_versions(), so that clones
+  // share them. A write replaces the versions of the values under it.
+  // Versions up to 'known_since_version_' are stale and dropped by the next
+  // write of the variable.
+  using PathVersions = internal::Store::PathVersions;
+
+  // The top-level variables of 'store_' by their slots.
+  internal::SlotCache slots_;
+
+  // The paths of locations that are evaluated from source. Lookups from const
+  // methods update it.
+  mutable internal::PathCache paths_;
+
+  // The source expression cache of the compiler of the model, nullptr if
+  // sources are evaluated without compiling them.
+  ExpressionCache* source_cache_ =
+      GetSourceExpressionCache(GetExpressionCompiler());
 
   // A pointer to the runtime, this datamodel is associated with.
-  const Runtime* runtime_ = nullptr;
+  Runtime* runtime_ = nullptr;
+
+  // Answers lookups on indexed arrays of 'store_' and forwards other calls to
+  // the dispatcher of the datamodel. Lookups from const methods update it.
+  mutable internal::KeyIndexDispatcher key_indexes_;
 
-  // A dispatcher for C++ function calls.
+  // A dispatcher for C++ function calls, i.e., '&key_indexes_'.
   FunctionDispatcher* const dispatcher_;
 };
 
 // Internal functions, do not use.
 namespace internal {
 
-// Converts an expression into a list of string tokens. Tokens are either
-// operators or operands. Excess trailing and leading whitespace for each token
-// are stripped.
-void TokenizeExpression(const string& expr, std::list<string>* tokens);
+// An iterator of LightWeightDatamodel over the elements of a Json array.
+// LightWeightDatamodel binds its elements without serializing them.
+class JsonArrayIterator : public Iterator {
+ public:
+  ~JsonArrayIterator() override = default;
+
+  const char* language() const override {
+    return kLightWeightExpressionLanguage;
+  }
+
+  // The index of the current element.
+  virtual int index() const = 0;
+
+  // Stores the current element in 'value'. The element is moved if the
+  // iterator owns the array, otherwise it is copied. Must not be AtEnd().
+  virtual void TakeValue(Json::Value* value) = 0;
+
+ protected:
+  JsonArrayIterator() = default;
+};
 
 // Base array iterator class implements functionality but no public CTOR.
 // Derived classes implement public CTOR for efficiency.
 template <class ArrayType>
-class BaseArrayIterator : public Iterator {
+class BaseArrayIterator : public JsonArrayIterator {
  public:
   ~BaseArrayIterator() override = default;
 
@@ -174,13 +759,13 @@ class BaseArrayIterator : public Iterator {
   string GetValue() const override {
     RETURN_VALUE_IF_MSG(
         AtEnd(), "", "Returning empty string; Accessing out of bounds value.");
-    string value = Json::FastWriter().write(array_[index_]);
-    absl::StripAsciiWhitespace(&value);
-    return value;
+    return ToJsonText(array_[index_]);
   }
 
   string GetIndex() const override { return absl::StrCat(index_); }
 
+  int index() const override { return index_; }
+
  protected:
   BaseArrayIterator() = default;
   explicit BaseArrayIterator(ArrayType array) : array_(array) {}
@@ -192,11 +777,19 @@ class BaseArrayIterator : public Iterator {
   int index_ = 0;
 };
 
-// LightWeightDatamodel Iterator for an array by reference.
+// LightWeightDatamodel Iterator for an array by reference. 'owner', if not
+// nullptr, is a value that contains 'array' and is kept alive by the iterator.
 class ArrayReferenceIterator : public BaseArrayIterator<const Json::Value&> {
  public:
-  explicit ArrayReferenceIterator(const Json::Value& array)
-      : BaseArrayIterator(array) {}
+  explicit ArrayReferenceIterator(
+      const Json::Value& array,
+      std::shared_ptr<const Json::Value> owner = nullptr)
+      : BaseArrayIterator(array), owner_(std::move(owner)) {}
+
+  void TakeValue(Json::Value* value) override { *value = array_[index()]; }
+
+ private:
+  const std::shared_ptr<const Json::Value> owner_;
 };
 
 // LightWeightDatamodel for an array by value.
@@ -205,6 +798,39 @@ class ArrayValueIterator : public BaseArrayIterator<Json::Value> {
   // Internal 'array' will be moved into 'array_'.
   // TODO(qplau): Change to r-value CTOR (move CTOR) when allowed.
   explicit ArrayValueIterator(Json::Value* array) { array->swap(array_); }
+
+  void TakeValue(Json::Value* value) override {
+    value->swap(array_[index()]);
+  }
+};
+
+// LightWeightDatamodel Iterator for the records of a RecordArray. Each record
+// is converted to JSON when it is taken. The iterator keeps the array, so that
+// it stays valid when the variable that holds it is assigned.
+class RecordArrayIterator : public JsonArrayIterator {
+ public:
+  explicit RecordArrayIterator(std::shared_ptr<const RecordArray> records)
+      : records_(std::move(records)) {}
+
+  bool AtEnd() const override { return index_ >= records_->size(); }
+
+  bool Next() override {
+    if (AtEnd()) return false;
+    ++index_;
+    return true;
+  }
+
+  string GetValue() const override;
+
+  string GetIndex() const override { return absl::StrCat(index_); }
+
+  int index() const override { return index_; }
+
+  void TakeValue(Json::Value* value) override;
+
+ private:
+  const std::shared_ptr<const RecordArray> records_;
+  int index_ = 0;
 };
 
 }  // namespace internal
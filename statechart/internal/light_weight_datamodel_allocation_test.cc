@@ -0,0 +1,226 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests that evaluating compiled numeric and boolean expressions does not
+// allocate. This is a separate test as it replaces the global allocation
+// functions.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "absl/base/attributes.h"
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/light_weight_datamodel.h"
+#include "statechart/platform/types.h"
+
+namespace {
+
+// The number of heap allocations of the process.
+std::atomic<long> allocation_count(0);
+
+// Counts and makes an allocation of 'size' bytes aligned to 'alignment'.
+// Returns null if it fails. All allocations are released by Deallocate().
+ABSL_ATTRIBUTE_NOINLINE void* Allocate(std::size_t size,
+                                       std::size_t alignment) noexcept {
+  ++allocation_count;
+  if (size == 0) {
+    size = 1;
+  }
+  if (alignment <= alignof(std::max_align_t)) {
+    return std::malloc(size);
+  }
+  // std::aligned_alloc() requires a multiple of the alignment.
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+}
+
+// Releases an allocation of Allocate(). Neither is inlined into the
+// replacements, so that the compiler does not take std::free() for the
+// release of memory from operator new.
+ABSL_ATTRIBUTE_NOINLINE void Deallocate(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void* AllocateOrThrow(std::size_t size, std::size_t alignment) {
+  void* pointer = Allocate(size, alignment);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+}  // namespace
+
+// Replaces every global allocation and deallocation function, so that the
+// standard library and the replacements never mix their allocations.
+void* operator new(std::size_t size) {
+  return AllocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size) {
+  return AllocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  return AllocateOrThrow(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+  return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t&) noexcept {
+  return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* pointer) noexcept { Deallocate(pointer); }
+
+void operator delete[](void* pointer) noexcept { Deallocate(pointer); }
+
+void operator delete(void* pointer, std::size_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t,
+                     const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t,
+                       const std::nothrow_t&) noexcept {
+  Deallocate(pointer);
+}
+
+namespace state_chart {
+namespace {
+
+// A dispatcher without functions. Unlike a mock, it does not allocate.
+class NoFunctionDispatcher : public FunctionDispatcher {
+ public:
+  bool HasFunction(const string& function_name) const override {
+    return false;
+  }
+
+  bool Execute(const string& function_name,
+               const std::vector<const Json::Value*>& inputs,
+               Json::Value* return_value) override {
+    return false;
+  }
+};
+
+TEST(LightWeightDatamodelAllocationTest, GuardsDoNotAllocate) {
+  NoFunctionDispatcher dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  auto symbols = std::make_shared<SymbolTable>();
+  for (const char* name : {"_event", "x", "y", "flag"}) {
+    symbols->AddSymbol(name);
+  }
+  datamodel->SetSymbolTable(symbols);
+  ASSERT_TRUE(datamodel->DeclareAndAssignJson("x", Json::Value(5)));
+  ASSERT_TRUE(datamodel->DeclareAndAssignJson("y", Json::Value(2.5)));
+  ASSERT_TRUE(datamodel->DeclareAndAssignJson("flag", Json::Value(true)));
+  Json::Value event;
+  event["data"]["n"] = 3;
+  ASSERT_TRUE(datamodel->DeclareAndAssignJson("_event", event));
+
+  const string kGuards[] = {
+      "x > 3 && y < 3.5",
+      "!flag || x * 2 + 1 >= y",
+      "_event.data.n == 3 && _event.data.n != x",
+      "-x < y / 2 && (x - 1) * 2 == 8",
+      "flag == true && !(x <= 4) || false",
+  };
+  std::vector<Expression> expressions;
+  for (const ExpressionCompiler* compiler :
+       {LightWeightDatamodel::GetExpressionCompiler(),
+        LightWeightDatamodel::GetBytecodeCompiler()}) {
+    for (const string& guard : kGuards) {
+      expressions.emplace_back(guard, compiler->Compile(guard, symbols));
+      ASSERT_NE(nullptr, expressions.back().compiled()) << guard;
+    }
+  }
+
+  // The first evaluation may initialize static data.
+  for (const Expression& expr : expressions) {
+    bool result = false;
+    ASSERT_TRUE(datamodel->EvaluateBooleanExpression(expr, &result))
+        << expr.source();
+    EXPECT_TRUE(result) << expr.source();
+  }
+
+  const long allocations_before = allocation_count;
+  bool all_true = true;
+  for (int i = 0; i < 100; ++i) {
+    for (const Expression& expr : expressions) {
+      bool result = false;
+      all_true &= datamodel->EvaluateBooleanExpression(expr, &result) && result;
+    }
+  }
+  const long allocations = allocation_count - allocations_before;
+  EXPECT_TRUE(all_true);
+  EXPECT_EQ(0, allocations);
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -0,0 +1,386 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <memory>
+
+#include "absl/strings/str_cat.h"
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/function_dispatcher_impl.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/light_weight_datamodel.h"
+#include "statechart/internal/model/for_each.h"
+#include "statechart/internal/runtime.h"
+#include "statechart/internal/runtime_impl.h"
+
+#include <benchmark/benchmark.h>
+
+namespace state_chart {
+namespace {
+
+// An array of 'size' objects like the records that state machines iterate
+// over.
+Json::Value ObjectArray(int size) {
+  Json::Value array(Json::arrayValue);
+  for (int i = 0; i < size; ++i) {
+    Json::Value& record = array.append(Json::Value(Json::objectValue));
+    record["id"] = i;
+    record["name"] = absl::StrCat("record ", i);
+    record["score"] = i * 0.5;
+    record["tags"].append("a");
+    record["tags"].append("b");
+  }
+  return array;
+}
+
+// Returns a runtime whose datamodel holds 'records' with 'size' objects.
+std::unique_ptr<Runtime> CreateRuntime(FunctionDispatcher* dispatcher,
+                                       int size) {
+  auto datamodel = LightWeightDatamodel::Create(dispatcher);
+  datamodel->DeclareAndAssignJson("records", ObjectArray(size));
+  return RuntimeImpl::Create(std::move(datamodel));
+}
+
+// Executes <foreach> over 'records'. Items processed are loop iterations.
+void BM_ForEachObjectArray(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto runtime = CreateRuntime(&dispatcher, state.range(0));
+  const ExpressionCompiler* compiler =
+      LightWeightDatamodel::GetBytecodeCompiler();
+  const model::ForEach for_each(
+      Expression("records", compiler->Compile("records")),
+      Expression("item", compiler->CompileLocation("item", nullptr)),
+      Expression("index", compiler->CompileLocation("index", nullptr)),
+      nullptr /* body */);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(for_each.Execute(runtime.get()));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ForEachObjectArray)->Arg(100)->Arg(5000);
+
+// The same loop with the elements serialized by the iterator and parsed back
+// into the item, as <foreach> used to bind them.
+void BM_ForEachObjectArrayBySerializing(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto runtime = CreateRuntime(&dispatcher, state.range(0));
+  Datamodel* datamodel = runtime->mutable_datamodel();
+  datamodel->Declare("item");
+  datamodel->Declare("index");
+  for (auto _ : state) {
+    auto iterator = datamodel->EvaluateIterator("records");
+    for (; !iterator->AtEnd(); iterator->Next()) {
+      benchmark::DoNotOptimize(
+          datamodel->AssignExpression("item", iterator->GetValue()));
+      benchmark::DoNotOptimize(
+          datamodel->AssignExpression("index", iterator->GetIndex()));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ForEachObjectArrayBySerializing)->Arg(100)->Arg(5000);
+
+// An event payload of 'size' records.
+string Payload(int size) {
+  Json::Value payload;
+  payload["records"] = ObjectArray(size);
+  return ToJsonText(payload);
+}
+
+// Assigns an event with a payload and evaluates a guard that does not read
+// the payload, as for most events.
+void BM_AssignEventPayload(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("_event", Json::Value(Json::objectValue));
+  const string payload = Payload(state.range(0));
+  const Expression data("_event.data");
+  const Expression guard("_event.name == 'E'");
+  for (auto _ : state) {
+    datamodel->AssignString("_event.name", "E");
+    datamodel->AssignValueLazily(data, payload);
+    bool result = false;
+    benchmark::DoNotOptimize(
+        datamodel->EvaluateBooleanExpression(guard, &result));
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_AssignEventPayload)->Arg(10)->Arg(200);
+
+// The same with the payload parsed when it is assigned.
+void BM_AssignEventPayloadEagerly(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("_event", Json::Value(Json::objectValue));
+  const string payload = Payload(state.range(0));
+  const Expression data("_event.data");
+  const Expression guard("_event.name == 'E'");
+  for (auto _ : state) {
+    datamodel->AssignString("_event.name", "E");
+    Json::Value value;
+    Json::Reader().parse(payload, value, false /* collectComments */);
+    datamodel->AssignValue(data, std::move(value));
+    bool result = false;
+    benchmark::DoNotOptimize(
+        datamodel->EvaluateBooleanExpression(guard, &result));
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_AssignEventPayloadEagerly)->Arg(10)->Arg(200);
+
+// Clones a datamodel holding 'records' and writes one variable of the clone,
+// as for a what-if simulation of a state machine.
+void BM_CloneAndAssign(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("records", ObjectArray(state.range(0)));
+  datamodel->DeclareAndAssignJson("count", Json::Value(0));
+  const Expression count("count");
+  for (auto _ : state) {
+    auto clone = datamodel->Clone();
+    benchmark::DoNotOptimize(clone->AssignValue(count, Json::Value(1)));
+  }
+}
+BENCHMARK(BM_CloneAndAssign)->Arg(100)->Arg(5000);
+
+// Clones a datamodel holding 'records' and writes a member of one of them in
+// the clone. The records are a top-level array, which is held as a
+// RecordArray, if the second argument is 0, and a member of a top-level object
+// otherwise. Either way, the write copies what the clone shares: the written
+// chunk of the RecordArray, or the whole object.
+void BM_CloneAndWriteRecord(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  string location;
+  if (state.range(1) == 0) {
+    datamodel->DeclareAndAssignJson("records", ObjectArray(state.range(0)));
+    location = "records";
+  } else {
+    Json::Value object;
+    object["records"] = ObjectArray(state.range(0));
+    datamodel->DeclareAndAssignJson("object", object);
+    location = "object.records";
+  }
+  const Expression score(
+      absl::StrCat(location, "[", state.range(0) / 2, "].score"));
+  for (auto _ : state) {
+    auto clone = datamodel->Clone();
+    benchmark::DoNotOptimize(clone->AssignValue(score, Json::Value(1)));
+  }
+}
+BENCHMARK(BM_CloneAndWriteRecord)->ArgPair(100, 0)->ArgPair(100, 1)
+    ->ArgPair(5000, 0)->ArgPair(5000, 1);
+
+// Clones a datamodel with 'variables' top-level variables and writes one of
+// them in the clone, which copies the nodes on the path to it.
+void BM_CloneManyVariablesAndAssign(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  for (int i = 0; i < state.range(0); ++i) {
+    datamodel->DeclareAndAssignJson(absl::StrCat("variable", i),
+                                    Json::Value(i));
+  }
+  const Expression variable(absl::StrCat("variable", state.range(0) / 2));
+  for (auto _ : state) {
+    auto clone = datamodel->Clone();
+    benchmark::DoNotOptimize(clone->AssignValue(variable, Json::Value(-1)));
+  }
+}
+BENCHMARK(BM_CloneManyVariablesAndAssign)->Arg(10)->Arg(1000)->Arg(100000);
+
+// Clones a datamodel holding 'records' without writing the clone, as for a
+// snapshot.
+void BM_Clone(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("records", ObjectArray(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(datamodel->Clone());
+  }
+}
+BENCHMARK(BM_Clone)->Arg(100)->Arg(5000);
+
+// Looks up the last of 'records' by its id, with 'records' indexed by id if
+// the second argument is 1. Items processed are array elements.
+void BM_LookupByKey(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("records", ObjectArray(state.range(0)));
+  if (state.range(1) == 1) {
+    datamodel->AddKeyIndex("records", "id");
+  }
+  const string source =
+      absl::StrCat("LookupByKey(records, 'id', ", state.range(0) - 1, ")");
+  const Expression lookup(
+      source, LightWeightDatamodel::GetBytecodeCompiler()->Compile(source));
+  for (auto _ : state) {
+    Json::Value result;
+    benchmark::DoNotOptimize(datamodel->EvaluateValue(lookup, &result));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_LookupByKey)->ArgPair(100, 0)->ArgPair(100, 1)
+    ->ArgPair(5000, 0)->ArgPair(5000, 1);
+
+// Evaluates a guard from source on nested locations of an event, as for
+// expressions that are not compiled.
+void BM_EvaluateNestedLocations(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  Json::Value event;
+  event["name"] = "E";
+  event["data"]["device"]["state"] = "on";
+  event["data"]["device"]["level"] = 3;
+  datamodel->DeclareAndAssignJson("_event", event);
+  const string guard =
+      "_event.name == 'E' && _event.data.device.state == 'on' && "
+      "_event.data.device.level > 2";
+  for (auto _ : state) {
+    bool result = false;
+    benchmark::DoNotOptimize(
+        datamodel->EvaluateBooleanExpression(guard, &result));
+  }
+}
+BENCHMARK(BM_EvaluateNestedLocations);
+
+// The values that expressions commonly evaluate to: a number for argument 0,
+// a short string for 1 and 100 records for 2.
+Json::Value FormattedValue(int kind) {
+  switch (kind) {
+    case 0:
+      return Json::Value(12.5);
+    case 1:
+      return Json::Value("record 42");
+    default:
+      return ObjectArray(100);
+  }
+}
+
+// Formats a value as expression text with ToJsonText().
+void BM_FormatJsonText(benchmark::State& state) {
+  const Json::Value value = FormattedValue(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToJsonText(value));
+  }
+}
+BENCHMARK(BM_FormatJsonText)->Arg(0)->Arg(1)->Arg(2);
+
+// The same with Json::FastWriter, as the datamodel used to format values.
+void BM_FormatWithFastWriter(benchmark::State& state) {
+  const Json::Value value = FormattedValue(state.range(0));
+  for (auto _ : state) {
+    string text = Json::FastWriter().write(value);
+    text.pop_back();
+    benchmark::DoNotOptimize(text);
+  }
+}
+BENCHMARK(BM_FormatWithFastWriter)->Arg(0)->Arg(1)->Arg(2);
+
+// Parses a payload of 'records' with ParseJsonText(). 2000 records are about
+// the size of a large serialized datamodel.
+void BM_ParseJsonText(benchmark::State& state) {
+  const string payload = Payload(state.range(0));
+  for (auto _ : state) {
+    Json::Value value;
+    benchmark::DoNotOptimize(ParseJsonText(payload, &value));
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_ParseJsonText)->Arg(10)->Arg(2000);
+
+// The same with Json::Reader.
+void BM_ParseWithReader(benchmark::State& state) {
+  const string payload = Payload(state.range(0));
+  for (auto _ : state) {
+    Json::Value value;
+    benchmark::DoNotOptimize(
+        Json::Reader().parse(payload, value, false /* collectComments */));
+  }
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_ParseWithReader)->Arg(10)->Arg(2000);
+
+// An indented document of 'size' records with a description of a few hundred
+// characters each, as configuration and documents sent in events are.
+string Document(int size) {
+  Json::Value document;
+  Json::Value& records = document["records"] = ObjectArray(size);
+  for (Json::Value& record : records) {
+    record["description"] =
+        absl::StrCat("The description of ", record["name"].asString(), ". ",
+                     string(300, 'x'), "\n");
+  }
+  return Json::StyledWriter().write(document);
+}
+
+// Parses a document of 'records' with ParseJsonText().
+void BM_ParseJsonDocument(benchmark::State& state) {
+  const string document = Document(state.range(0));
+  for (auto _ : state) {
+    Json::Value value;
+    benchmark::DoNotOptimize(ParseJsonText(document, &value));
+  }
+  state.SetBytesProcessed(state.iterations() * document.size());
+}
+BENCHMARK(BM_ParseJsonDocument)->Arg(10)->Arg(2000);
+
+// The same with Json::Reader.
+void BM_ParseDocumentWithReader(benchmark::State& state) {
+  const string document = Document(state.range(0));
+  for (auto _ : state) {
+    Json::Value value;
+    benchmark::DoNotOptimize(
+        Json::Reader().parse(document, value, false /* collectComments */));
+  }
+  state.SetBytesProcessed(state.iterations() * document.size());
+}
+BENCHMARK(BM_ParseDocumentWithReader)->Arg(10)->Arg(2000);
+
+// Checks a document of 'records' with IsJsonText(), as for payloads that are
+// assigned lazily.
+void BM_CheckJsonDocument(benchmark::State& state) {
+  const string document = Document(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(IsJsonText(document));
+  }
+  state.SetBytesProcessed(state.iterations() * document.size());
+}
+BENCHMARK(BM_CheckJsonDocument)->Arg(10)->Arg(2000);
+
+// Formats a document of 'records' with ToJsonText().
+void BM_FormatJsonDocument(benchmark::State& state) {
+  Json::Value document;
+  ParseJsonText(Document(state.range(0)), &document);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ToJsonText(document));
+  }
+}
+BENCHMARK(BM_FormatJsonDocument)->Arg(10)->Arg(2000);
+
+// Restores a datamodel holding 'records' from its serialized form.
+void BM_RestoreDatamodel(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = LightWeightDatamodel::Create(&dispatcher);
+  datamodel->DeclareAndAssignJson("records", ObjectArray(state.range(0)));
+  const string serialized = datamodel->SerializeAsString();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        LightWeightDatamodel::Create(serialized, &dispatcher));
+  }
+  state.SetBytesProcessed(state.iterations() * serialized.size());
+}
+BENCHMARK(BM_RestoreDatamodel)->Arg(2000);
+
+}  // namespace
+}  // namespace state_chart
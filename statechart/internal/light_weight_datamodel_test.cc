@@ -14,8 +14,10 @@
 
 #include "statechart/internal/light_weight_datamodel.h"
 
-#include <list>
+#include <cmath>
+#include <map>
 #include <memory>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -23,17 +25,23 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "absl/base/macros.h"
 #include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/strings/substitute.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/random_generator.h"
+#include "statechart/internal/record_array.h"
+#include "statechart/internal/testing/mock_datamodel.h"
 #include "statechart/internal/testing/mock_function_dispatcher.h"
 #include "statechart/internal/testing/mock_runtime.h"
+#include "statechart/internal/value_tree.h"
 
 using ::absl::StrCat;
 using testing::_;
 using testing::DoAll;
-using testing::ElementsAreArray;
+using testing::ElementsAre;
 using testing::Eq;
 using testing::NiceMock;
 using testing::Return;
@@ -42,77 +50,10 @@ using testing::SetArgPointee;
 namespace state_chart {
 namespace {
 
-// Test that the tokenizer can tokenize the expressions we are supporting.
-TEST(InternalTokenizeExpression, TokenizeExpression) {
-  std::pair<string, std::vector<string>> cases[] = {
-      // Values that are numbers.
-      {"1", {"1"}},
-      {"1.2", {"1.2"}},
-      {" 1.2 ", {"1.2"}},
-      // String values.
-      {"\"ABC\"", {"\"ABC\""}},
-      {"\"A B C \" ", {"\"A B C \""}},
-      {"\"A \\\"B C\" ", {"\"A \\\"B C\""}},
-      {"\"A 'B' C\" ", {"\"A 'B' C\""}},
-      // Single quoted string values.
-      {"'ABC'", {"'ABC'"}},
-      {"'A B C ' ", {"'A B C '"}},
-      {"'A \'B C'", {"'A \'B C'"}},
-      {"'A \"B\" C'", {"'A \"B\" C'"}},
-      // Locations.
-      {"_foo.bar", {"_foo.bar"}},
-      {" foo.bar ", {"foo.bar"}},
-      {"foo ", {"foo"}},
-      // Unary or Binary operations.
-      {"\"A B\" + \" C D\"", {"\"A B\"", "+", "\" C D\""}},
-      {"\"A\" + foo.bar", {"\"A\"", "+", "foo.bar"}},
-      {"foo.bar / 0.34", {"foo.bar", "/", "0.34"}},
-      {"foo.bar != bar.foo", {"foo.bar", "!=", "bar.foo"}},
-      {"- 1", {"-", "1"}},
-      // Mixed string quotes expressions.
-      {"\"A B\" + 'C D'", {"\"A B\"", "+", "'C D'"}},
-      // Function call.
-      {" Math.Random() ", {"Math.Random", "(", ")"}},
-      {"binary_op( a +b, c -d  )",
-       {"binary_op", "(", "a", "+", "b", ",", "c", "-", "d", ")"}},
-      // Array addressing.
-      {"foo.bar[5]", {"foo.bar", "[", "5", "]"}},
-      {"foo.bar[i+1]", {"foo.bar", "[", "i", "+", "1", "]"}},
-      // Dictionary addressing.
-      {"foo[\"bar\"]", {"foo", "[", "\"bar\"", "]"}},
-      {"foo[\"bar\" + \"goo\"]", {"foo", "[", "\"bar\"", "+", "\"goo\"", "]"}},
-      {"foo[bar]", {"foo", "[", "bar", "]"}},
-      // Nested object addressing.
-      {"foo[1][2]", {"foo", "[", "1", "]", "[", "2", "]"}},
-      {"foo[\"bar\"][\"goo\"]",
-       {"foo", "[", "\"bar\"", "]", "[", "\"goo\"", "]"}},
-      {"foo[1][\"bar\"]", {"foo", "[", "1", "]", "[", "\"bar\"", "]"}},
-      {"foo[1].bar[2]", {"foo", "[", "1", "]", ".bar", "[", "2", "]"}},
-      {"foo[\"goo\"].bar[2]",
-       {"foo", "[", "\"goo\"", "]", ".bar", "[", "2", "]"}},
-      // Complex expressions.
-      {"1 *2   +  3", {"1", "*", "2", "+", "3"}},
-      {"A < B && ( C >= D || C <= E )",
-       {"A", "<", "B", "&&", "(", "C", ">=", "D", "||", "C", "<=", "E", ")"}},
-      {" - ( foo.bar - bar.foo )", {"-", "(", "foo.bar", "-", "bar.foo", ")"}},
-      {"binary_op( \"str\" + Math.random(), Math.random() * 2 )",
-       {"binary_op", "(", "\"str\"", "+", "Math.random", "(", ")", ",",
-        "Math.random", "(", ")", "*", "2", ")"}},
-      {"foo.op1(foo.op2(a - b()) + goo_op(foo.op4(bar)))",
-       {"foo.op1", "(", "foo.op2", "(", "a", "-", "b", "(", ")", ")", "+",
-        "goo_op", "(", "foo.op4", "(", "bar", ")", ")", ")"}},
-  };
-
-  for (const auto& test_case : cases) {
-    std::list<string> tokens;
-    internal::TokenizeExpression(test_case.first, &tokens);
-    EXPECT_THAT(tokens, ElementsAreArray(test_case.second)) << test_case.first;
-  }
-}
-
-class LightWeightDatamodelTest : public testing::Test {
+// A datamodel with a mock dispatcher and runtime.
+class DatamodelFixture {
  public:
-  LightWeightDatamodelTest()
+  DatamodelFixture()
       : dispatcher_(new NiceMock<MockFunctionDispatcher>()),
         datamodel_(LightWeightDatamodel::Create(dispatcher_.get())) {}
 
@@ -130,9 +71,56 @@ class LightWeightDatamodelTest : public testing::Test {
   MockRuntime runtime_;
 };
 
+// The ways that a LightWeightDatamodel evaluates expressions: parsed from
+// source on every evaluation, compiled to syntax trees, or compiled to
+// bytecode. Each must give the same results.
+enum class Evaluator { kSource, kSyntaxTree, kBytecode };
+
+const ExpressionCompiler* GetCompiler(Evaluator evaluator) {
+  switch (evaluator) {
+    case Evaluator::kSource:
+      return nullptr;
+    case Evaluator::kSyntaxTree:
+      return LightWeightDatamodel::GetExpressionCompiler();
+    case Evaluator::kBytecode:
+      return LightWeightDatamodel::GetBytecodeCompiler();
+  }
+  return nullptr;
+}
+
+// Runs each test with each Evaluator, so that the evaluators are checked
+// against each other by the whole suite.
+class LightWeightDatamodelTest : public DatamodelFixture,
+                                 public testing::TestWithParam<Evaluator> {
+ public:
+  LightWeightDatamodelTest() {
+    datamodel_->SetExpressionCompiler(GetCompiler(GetParam()));
+  }
+};
+
+INSTANTIATE_TEST_SUITE_P(
+    Evaluators, LightWeightDatamodelTest,
+    testing::Values(Evaluator::kSource, Evaluator::kSyntaxTree,
+                    Evaluator::kBytecode),
+    [](const testing::TestParamInfo<Evaluator>& info) -> string {
+      switch (info.param) {
+        case Evaluator::kSource:
+          return "Source";
+        case Evaluator::kSyntaxTree:
+          return "SyntaxTree";
+        case Evaluator::kBytecode:
+          return "Bytecode";
+      }
+      return "";
+    });
+
+// Tests of the process-wide source expression caches, which run once.
+class SourceExpressionCacheTest : public DatamodelFixture,
+                                  public testing::Test {};
+
 // Test that primitive value expressions are returned the same way they are
 // expressed.
-TEST_F(LightWeightDatamodelTest, EvaluatePrimitiveValues) {
+TEST_P(LightWeightDatamodelTest, EvaluatePrimitiveValues) {
   string result;
 
   for (const auto& value :
@@ -144,7 +132,7 @@ TEST_F(LightWeightDatamodelTest, EvaluatePrimitiveValues) {
 
 // Test that variables that are assigned with non-object values exists and can
 // be evaluated to obtain their value.
-TEST_F(LightWeightDatamodelTest, AssignPrimitiveValues) {
+TEST_P(LightWeightDatamodelTest, AssignPrimitiveValues) {
   string result;
 
   // Test assign.
@@ -171,7 +159,7 @@ TEST_F(LightWeightDatamodelTest, AssignPrimitiveValues) {
 }
 
 // Test that JSON objects can be used in assignment.
-TEST_F(LightWeightDatamodelTest, AssignJSON) {
+TEST_P(LightWeightDatamodelTest, AssignJSON) {
   string result;
 
   // Test that the locations are assigned correctly.
@@ -269,7 +257,7 @@ TEST_F(LightWeightDatamodelTest, AssignJSON) {
 }
 
 // Test the assignment of a complex JSON object with multiple nested objects.
-TEST_F(LightWeightDatamodelTest, AssignJSONWithMultipleChildObjects) {
+TEST_P(LightWeightDatamodelTest, AssignJSONWithMultipleChildObjects) {
   string result;
 
   const string kJSON = R"({"music_fact_input":{"count":0},)"
@@ -296,7 +284,7 @@ TEST_F(LightWeightDatamodelTest, AssignJSONWithMultipleChildObjects) {
 
 // Test the assignment of a complex JSON object with deeply nested object with
 // arrays (that are currently unsupported).
-TEST_F(LightWeightDatamodelTest, AssignJSONDeeplyNestedObjects) {
+TEST_P(LightWeightDatamodelTest, AssignJSONDeeplyNestedObjects) {
   // Deeper nested object.
   const string kJSON = R"({
   "type": 1,
@@ -379,7 +367,7 @@ TEST_F(LightWeightDatamodelTest, AssignJSONDeeplyNestedObjects) {
 
 // Assign a JSON object, retrieve it, put the JSON formatted result as a string
 // field in a new JSON object, assign, and retrieve it again.
-TEST_F(LightWeightDatamodelTest, AssignJSONRecursively) {
+TEST_P(LightWeightDatamodelTest, AssignJSONRecursively) {
   string result;
 
   const char kJSON[] = R"({"a":"1","b":{"c":"\"2\"","d":"3"},"e":{"f":"4"}})";
@@ -405,7 +393,7 @@ TEST_F(LightWeightDatamodelTest, AssignJSONRecursively) {
 }
 
 // Test that declared ancestor objects are created if they do not exists.
-TEST_F(LightWeightDatamodelTest, DeclareAncestorsCreated) {
+TEST_P(LightWeightDatamodelTest, DeclareAncestorsCreated) {
   string result;
 
   // Test declare then assignment to a missing nested object's field, i.e.,
@@ -431,7 +419,7 @@ TEST_F(LightWeightDatamodelTest, DeclareAncestorsCreated) {
 }
 
 // Test that declaration errors are detected.
-TEST_F(LightWeightDatamodelTest, DeclareError) {
+TEST_P(LightWeightDatamodelTest, DeclareError) {
   // Duplicate declaration should return false.
   EXPECT_TRUE(datamodel_->Declare("foo"));
   EXPECT_FALSE(datamodel_->Declare("foo"));
@@ -450,7 +438,7 @@ TEST_F(LightWeightDatamodelTest, DeclareError) {
   EXPECT_FALSE(datamodel_->Declare("null_id[\"foo\"]"));
 }
 
-TEST_F(LightWeightDatamodelTest, EvaluateStringExpression) {
+TEST_P(LightWeightDatamodelTest, EvaluateStringExpression) {
   string result;
 
   EXPECT_TRUE(datamodel_->EvaluateStringExpression("\"foo\"", &result));
@@ -482,7 +470,7 @@ TEST_F(LightWeightDatamodelTest, EvaluateStringExpression) {
   EXPECT_EQ("f\"o\"o", result);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusDoublesAndBoolean) {
+TEST_P(LightWeightDatamodelTest, PlusDoublesAndBoolean) {
   string result;
   double resultd = 0;
 
@@ -518,7 +506,7 @@ TEST_F(LightWeightDatamodelTest, PlusDoublesAndBoolean) {
   EXPECT_DOUBLE_EQ(1.0, resultd);
 }
 
-TEST_F(LightWeightDatamodelTest, ArithmeticIntegersAndBoolean) {
+TEST_P(LightWeightDatamodelTest, ArithmeticIntegersAndBoolean) {
   string result;
 
   // Test operations on integer and boolean values.
@@ -540,7 +528,7 @@ TEST_F(LightWeightDatamodelTest, ArithmeticIntegersAndBoolean) {
   EXPECT_EQ("1", result);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusBoolean) {
+TEST_P(LightWeightDatamodelTest, PlusBoolean) {
   string result;
 
   // Test adding boolean values.
@@ -562,7 +550,7 @@ TEST_F(LightWeightDatamodelTest, PlusBoolean) {
   EXPECT_EQ("0", result);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusIntegers) {
+TEST_P(LightWeightDatamodelTest, PlusIntegers) {
   string result;
 
   // Test adding integer values.
@@ -580,7 +568,7 @@ TEST_F(LightWeightDatamodelTest, PlusIntegers) {
   EXPECT_EQ("20", result);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusDoubles) {
+TEST_P(LightWeightDatamodelTest, PlusDoubles) {
   string result;
   double resultd = 0;
 
@@ -608,7 +596,7 @@ TEST_F(LightWeightDatamodelTest, PlusDoubles) {
   EXPECT_DOUBLE_EQ(11, resultd);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusStrings) {
+TEST_P(LightWeightDatamodelTest, PlusStrings) {
   string result;
 
   // Test concatenating strings.
@@ -647,7 +635,7 @@ TEST_F(LightWeightDatamodelTest, PlusStrings) {
   EXPECT_EQ(R"("foo {\"bar\":2}")", result);
 }
 
-TEST_F(LightWeightDatamodelTest, PlusError) {
+TEST_P(LightWeightDatamodelTest, PlusError) {
   string result;
 
   // Test missing operands.
@@ -658,7 +646,7 @@ TEST_F(LightWeightDatamodelTest, PlusError) {
   EXPECT_FALSE(datamodel_->EvaluateExpression(R"(- + "foo")", &result));
 }
 
-TEST_F(LightWeightDatamodelTest, UnaryMinus) {
+TEST_P(LightWeightDatamodelTest, UnaryMinus) {
   string result;
 
   // Test plain unary minus.
@@ -683,7 +671,7 @@ TEST_F(LightWeightDatamodelTest, UnaryMinus) {
 }
 
 // Test that number only arithmetic operators do not work with string.
-TEST_F(LightWeightDatamodelTest, ArithmeticErrors) {
+TEST_P(LightWeightDatamodelTest, ArithmeticErrors) {
   string result;
 
   EXPECT_FALSE(datamodel_->EvaluateExpression("-\"a\"", &result));
@@ -699,7 +687,7 @@ TEST_F(LightWeightDatamodelTest, ArithmeticErrors) {
   }
 }
 
-TEST_F(LightWeightDatamodelTest, MinusNumbers) {
+TEST_P(LightWeightDatamodelTest, MinusNumbers) {
   string result;
   double resultd = 0;
 
@@ -748,7 +736,7 @@ TEST_F(LightWeightDatamodelTest, MinusNumbers) {
   EXPECT_DOUBLE_EQ(0.4, resultd);
 }
 
-TEST_F(LightWeightDatamodelTest, MultiplyNumbers) {
+TEST_P(LightWeightDatamodelTest, MultiplyNumbers) {
   string result;
   double resultd = 0;
 
@@ -781,7 +769,7 @@ TEST_F(LightWeightDatamodelTest, MultiplyNumbers) {
   EXPECT_DOUBLE_EQ(0, resultd);
 }
 
-TEST_F(LightWeightDatamodelTest, DivideNumbers) {
+TEST_P(LightWeightDatamodelTest, DivideNumbers) {
   string result;
   double resultd = 0;
 
@@ -820,7 +808,7 @@ TEST_F(LightWeightDatamodelTest, DivideNumbers) {
   EXPECT_FALSE(datamodel_->EvaluateExpression("0 / 0", &result));
 }
 
-TEST_F(LightWeightDatamodelTest, ArithmeticPrecedence) {
+TEST_P(LightWeightDatamodelTest, ArithmeticPrecedence) {
   string result;
 
   EXPECT_TRUE(datamodel_->EvaluateExpression("5 / 2 + 1", &result));
@@ -833,7 +821,7 @@ TEST_F(LightWeightDatamodelTest, ArithmeticPrecedence) {
   EXPECT_EQ("-3", result);
 }
 
-TEST_F(LightWeightDatamodelTest, ArithmeticLogicalPrecedence) {
+TEST_P(LightWeightDatamodelTest, ArithmeticLogicalPrecedence) {
   string result;
 
   EXPECT_TRUE(datamodel_->EvaluateExpression("4 / 2 + true", &result));
@@ -848,7 +836,7 @@ TEST_F(LightWeightDatamodelTest, ArithmeticLogicalPrecedence) {
   EXPECT_EQ("true", result);
 }
 
-TEST_F(LightWeightDatamodelTest, AssignAndEvalBooleanValues) {
+TEST_P(LightWeightDatamodelTest, AssignAndEvalBooleanValues) {
   bool result;
 
   EXPECT_TRUE(DeclareAndAssign("foo", "true"));
@@ -872,7 +860,7 @@ TEST_F(LightWeightDatamodelTest, AssignAndEvalBooleanValues) {
   EXPECT_FALSE(result);
 }
 
-TEST_F(LightWeightDatamodelTest, StringComparisons) {
+TEST_P(LightWeightDatamodelTest, StringComparisons) {
   bool result;
 
   // Test '=='.
@@ -935,7 +923,7 @@ TEST_F(LightWeightDatamodelTest, StringComparisons) {
       datamodel_->EvaluateBooleanExpression(R"(2.0 == "bac")", &result));
 }
 
-TEST_F(LightWeightDatamodelTest, NumericComparisons) {
+TEST_P(LightWeightDatamodelTest, NumericComparisons) {
   bool result;
 
   // Test '=='.
@@ -988,7 +976,7 @@ TEST_F(LightWeightDatamodelTest, NumericComparisons) {
   EXPECT_FALSE(datamodel_->EvaluateBooleanExpression("2.0 == bac", &result));
 }
 
-TEST_F(LightWeightDatamodelTest, NullComparisons) {
+TEST_P(LightWeightDatamodelTest, NullComparisons) {
   bool result;
 
   EXPECT_TRUE(DeclareAndAssign("foo", ""));
@@ -1010,7 +998,7 @@ TEST_F(LightWeightDatamodelTest, NullComparisons) {
   EXPECT_FALSE(datamodel_->EvaluateBooleanExpression("null < 1.4", &result));
 }
 
-TEST_F(LightWeightDatamodelTest, BooleanComparisons) {
+TEST_P(LightWeightDatamodelTest, BooleanComparisons) {
   bool result;
 
   const std::pair<string, bool> test_cases[] = {
@@ -1037,7 +1025,7 @@ TEST_F(LightWeightDatamodelTest, BooleanComparisons) {
 
 // Test that the relational comparison operators (e.g. '>', '<=', etc) has a
 // higher precedence than the equality comparison operators (e.g. '==', '!=').
-TEST_F(LightWeightDatamodelTest, RelationalPrecedesEquality) {
+TEST_P(LightWeightDatamodelTest, RelationalPrecedesEquality) {
   bool result;
 
   // Correct evaluation order:
@@ -1048,7 +1036,7 @@ TEST_F(LightWeightDatamodelTest, RelationalPrecedesEquality) {
   EXPECT_TRUE(result);
 }
 
-TEST_F(LightWeightDatamodelTest, MathRandomComputation) {
+TEST_P(LightWeightDatamodelTest, MathRandomComputation) {
   bool result;
 
   EXPECT_TRUE(
@@ -1065,7 +1053,25 @@ TEST_F(LightWeightDatamodelTest, MathRandomComputation) {
   EXPECT_TRUE(result);
 }
 
-TEST_F(LightWeightDatamodelTest, InStateComputation) {
+// Math.random() continues the sequence of the runtime's generator.
+TEST_P(LightWeightDatamodelTest, MathRandomOfRuntime) {
+  datamodel_->SetRuntime(&runtime_);
+  RandomGenerator expected(*runtime_.GetRandomGenerator());
+  Json::Value value;
+  for (const ExpressionCompiler* compiler :
+       {LightWeightDatamodel::GetExpressionCompiler(),
+        LightWeightDatamodel::GetBytecodeCompiler()}) {
+    const Expression expr("Math.random()", compiler->Compile("Math.random()"));
+    for (int i = 0; i < 3; ++i) {
+      ASSERT_TRUE(datamodel_->EvaluateValue(expr, &value));
+      EXPECT_EQ(expected.NextDouble(), value.asDouble());
+    }
+  }
+  ASSERT_TRUE(datamodel_->EvaluateValue(Expression("Math.random()"), &value));
+  EXPECT_EQ(expected.NextDouble(), value.asDouble());
+}
+
+TEST_P(LightWeightDatamodelTest, InStateComputation) {
   bool result;
 
   datamodel_->SetRuntime(&runtime_);
@@ -1096,7 +1102,7 @@ TEST_F(LightWeightDatamodelTest, InStateComputation) {
 }
 
 // Test the boolean '!', '&&' and '||' operations.
-TEST_F(LightWeightDatamodelTest, BooleanOperations) {
+TEST_P(LightWeightDatamodelTest, BooleanOperations) {
   bool result;
 
   // Truth table.
@@ -1133,6 +1139,10 @@ TEST_F(LightWeightDatamodelTest, BooleanOperations) {
       {"!1 || 0 && 1", false},
       {"!0 && !0", true},
       {"!0 || !!!1", true},
+      // Long guards.
+      {"1 && 1 && 1 && 1 && 1 && 1 && 1 && 1 && 1 && 1 && 0", false},
+      {"0 || 0 || 0 || 0 || 0 || 1 && 0 || 0 || 0 || 0 || 1", true},
+      {"1 < 2 && 2 < 3 && 3 < 4 && 4 < 5 && 5 < 6 || 6 < 7 && 7 > 8", true},
   };
   for (const auto& entry : truth_table) {
     result = !entry.second;
@@ -1142,7 +1152,7 @@ TEST_F(LightWeightDatamodelTest, BooleanOperations) {
 }
 
 // Test that the () parentheses works as expected.
-TEST_F(LightWeightDatamodelTest, ParenthesesTest) {
+TEST_P(LightWeightDatamodelTest, ParenthesesTest) {
   string result;
 
   const std::pair<string, string> success_test_cases[] = {
@@ -1174,7 +1184,7 @@ TEST_F(LightWeightDatamodelTest, ParenthesesTest) {
 }
 
 // Test that element access works.
-TEST_F(LightWeightDatamodelTest, ElementAccess) {
+TEST_P(LightWeightDatamodelTest, ElementAccess) {
   string result;
 
   // Test 1d array access.
@@ -1268,7 +1278,7 @@ TEST_F(LightWeightDatamodelTest, ElementAccess) {
   }
 }
 
-TEST_F(LightWeightDatamodelTest, AssignWithLocationExpressions) {
+TEST_P(LightWeightDatamodelTest, AssignWithLocationExpressions) {
   struct TestCase {
     // Path to root object or array.
     string object;
@@ -1420,7 +1430,7 @@ void SetupMockFunctions(MockFunctionDispatcher* dispatcher) {
       .WillByDefault(ReturnTestArray());
 }
 
-TEST_F(LightWeightDatamodelTest, SystemFunctionCallExpressions) {
+TEST_P(LightWeightDatamodelTest, SystemFunctionCallExpressions) {
   SetupMockFunctions(dispatcher_.get());
   const std::pair<string, bool> kTestCases[] = {
       {"ftrue()", true},
@@ -1444,7 +1454,7 @@ TEST_F(LightWeightDatamodelTest, SystemFunctionCallExpressions) {
 }
 
 // Test system function calls mixed with other expressions.
-TEST_F(LightWeightDatamodelTest, MixedSystemFunctionCallExpressions) {
+TEST_P(LightWeightDatamodelTest, MixedSystemFunctionCallExpressions) {
   SetupMockFunctions(dispatcher_.get());
   const std::pair<string, bool> kTestCases[] = {
       {"ftrue() && 1", true},
@@ -1472,9 +1482,41 @@ TEST_F(LightWeightDatamodelTest, MixedSystemFunctionCallExpressions) {
   }
 }
 
+// Test that the right operand of a logical operator is not evaluated if the
+// left operand decides the result, for source and compiled expressions.
+TEST_P(LightWeightDatamodelTest, ShortCircuitEvaluation) {
+  SetupMockFunctions(dispatcher_.get());
+  EXPECT_CALL(*dispatcher_, Execute(_, _, _)).Times(0);
+  const std::pair<string, bool> kTestCases[] = {
+      {"false && ftrue()", false},
+      {"true || ffalse()", true},
+      {"1 && 0 && not(ftrue())", false},
+      {"(0 || 1) || and(ftrue(), 1)", true},
+      // Undefined locations on the skipped side are not errors.
+      {"0 && undefined.location", false},
+      {"1 || undefined[0].x + 1", true},
+      {"!(1 || undefined) && ftrue()", false},
+  };
+
+  for (const auto& test_case : kTestCases) {
+    const string& source = test_case.first;
+    for (const Expression& expr :
+         {Expression(source),
+          Expression(source, LightWeightDatamodel::GetExpressionCompiler()
+                                 ->Compile(source)),
+          Expression(source, LightWeightDatamodel::GetBytecodeCompiler()
+                                 ->Compile(source))}) {
+      bool result = !test_case.second;
+      EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(expr, &result))
+          << source;
+      EXPECT_EQ(test_case.second, result) << source;
+    }
+  }
+}
+
 // Test that attempting to declare or assign to a system function name results
 // in an error.
-TEST_F(LightWeightDatamodelTest, InvalidSystemFunctionUse) {
+TEST_P(LightWeightDatamodelTest, InvalidSystemFunctionUse) {
   SetupMockFunctions(dispatcher_.get());
   ON_CALL(*dispatcher_, HasFunction("foo.bar")).WillByDefault(Return(true));
 
@@ -1498,7 +1540,7 @@ TEST_F(LightWeightDatamodelTest, InvalidSystemFunctionUse) {
 // as a function. However it is only possible to access this store location
 // using element access. In general, system function names take precedence over
 // store location names.
-TEST_F(LightWeightDatamodelTest, DictionaryDeclarationWithFunctionNameIsValid) {
+TEST_P(LightWeightDatamodelTest, DictionaryDeclarationWithFunctionNameIsValid) {
   ON_CALL(*dispatcher_, HasFunction("foo.bar")).WillByDefault(Return(true));
 
   EXPECT_TRUE(datamodel_->Declare("foo['bar']"));
@@ -1523,7 +1565,7 @@ TEST_F(LightWeightDatamodelTest, DictionaryDeclarationWithFunctionNameIsValid) {
 
 // Test that the array's 'length' property works. Unlike Javascript, 'length'
 // is not assignable.
-TEST_F(LightWeightDatamodelTest, ArrayLengthProperty) {
+TEST_P(LightWeightDatamodelTest, ArrayLengthProperty) {
   string result;
 
   EXPECT_TRUE(DeclareAndAssign("myarray", "[]"));
@@ -1566,6 +1608,169 @@ TEST_F(LightWeightDatamodelTest, ArrayLengthProperty) {
   EXPECT_EQ("123", result);
 }
 
+// Test expressions that the other tests do not cover. The results are fixed
+// rather than computed from the sources, so that the evaluators are checked
+// against them as well as against each other.
+TEST_P(LightWeightDatamodelTest, ExpressionResults) {
+  SetupMockFunctions(dispatcher_.get());
+  datamodel_->SetRuntime(&runtime_);
+  EXPECT_TRUE(DeclareAndAssign("num", "5"));
+  EXPECT_TRUE(DeclareAndAssign("real", "2.5"));
+  EXPECT_TRUE(DeclareAndAssign("str", "'abc'"));
+  EXPECT_TRUE(DeclareAndAssign("array1", R"([{"0":0}, {"1":1}, {"2":[2]}])"));
+  EXPECT_TRUE(DeclareAndAssign(
+      "obj1", R"({"0":{"foo0":0},"1":{"foo1":1},"2":{"foo2":2}})"));
+
+  // The results of the expressions, or nullptr if they fail, and whether they
+  // are defined locations.
+  const struct {
+    string source;
+    const char* result;
+    bool is_defined;
+  } kExpressions[] = {
+      {"obj1.1.foo1", "1", true},
+      {"undefined_location", nullptr, false},
+      {"", nullptr, false},
+      {"str + num", R"("abc5")", false},
+      {"num + str + real", R"("5abc2.5")", false},
+      {"-str", nullptr, false},
+      {"str < 'abd'", "true", false},
+      {"0 || ''", "false", false},
+      {"1 && {}", "true", false},
+      {R"(array1[obj1["2"]["foo"+2]]["2"])", "[2]", true},
+      {"array1['length']", "3", false},
+      {"In(1)", nullptr, false},
+      {"not", nullptr, false},
+      {"num()", "5", true},
+      // Syntax errors.
+      {"1 +", nullptr, false},
+      {"(1", nullptr, false},
+      {"1)", nullptr, false},
+      {"a[", nullptr, false},
+      {"f(,)", nullptr, false},
+      {"1 (2)", nullptr, false},
+  };
+  for (const auto& expr : kExpressions) {
+    string result;
+    EXPECT_EQ(expr.result != nullptr,
+              datamodel_->EvaluateExpression(expr.source, &result))
+        << expr.source;
+    if (expr.result != nullptr) {
+      EXPECT_EQ(expr.result, result) << expr.source;
+    }
+    EXPECT_EQ(expr.is_defined, datamodel_->IsDefined(expr.source))
+        << expr.source;
+  }
+}
+
+// Test that the compiled form of an expression is evaluated instead of its
+// source.
+TEST_P(LightWeightDatamodelTest, EvaluateCompiledExpression) {
+  const ExpressionCompiler* compiler =
+      LightWeightDatamodel::GetExpressionCompiler();
+  const Expression expr("1 + 1", compiler->Compile("2 + 2"));
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression(expr, &result));
+  EXPECT_EQ("4", result);
+
+  EXPECT_TRUE(datamodel_->Declare(Expression("foo")));
+  EXPECT_TRUE(datamodel_->AssignExpression(Expression("foo"), expr));
+  EXPECT_TRUE(
+      datamodel_->IsDefined(Expression("foo", compiler->Compile("foo"))));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("foo", &result));
+  EXPECT_EQ("4", result);
+
+  EXPECT_TRUE(datamodel_->AssignExpression("foo", "[1, 2]"));
+  auto iterator =
+      datamodel_->EvaluateIterator(Expression("foo", compiler->Compile("foo")));
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ("1", iterator->GetValue());
+
+  const ExpressionCompiler* bytecode_compiler =
+      LightWeightDatamodel::GetBytecodeCompiler();
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      Expression("foo[0]", bytecode_compiler->Compile("foo[1] * 3")), &result));
+  EXPECT_EQ("6", result);
+}
+
+// Test that references compiled to the slots of top-level variables evaluate
+// the same way as their sources and that the slots follow changes to the store.
+TEST_P(LightWeightDatamodelTest, EvaluateSlotReferences) {
+  auto symbols = std::make_shared<SymbolTable>();
+  for (const char* name : {"num", "arr", "obj", "later"}) {
+    symbols->AddSymbol(name);
+  }
+  datamodel_->SetSymbolTable(symbols);
+  EXPECT_TRUE(DeclareAndAssign("num", "5"));
+  EXPECT_TRUE(DeclareAndAssign("arr", "[1, 2, 3]"));
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({"a":{"b":"c"}})"));
+  EXPECT_TRUE(DeclareAndAssign("other", "1"));
+
+  const string kExpressions[] = {
+      "num + 1",      "arr.length", "arr[1] * num", "obj.a.b",
+      "obj.a.length", "obj.x",      "num.x",        "arr.length.x",
+      "later",        "other + num",
+  };
+  for (const ExpressionCompiler* compiler :
+       {LightWeightDatamodel::GetExpressionCompiler(),
+        LightWeightDatamodel::GetBytecodeCompiler()}) {
+    for (const string& source : kExpressions) {
+      const Expression compiled(source, compiler->Compile(source, symbols));
+      string source_result;
+      string compiled_result;
+      EXPECT_EQ(datamodel_->EvaluateExpression(source, &source_result),
+                datamodel_->EvaluateExpression(compiled, &compiled_result))
+          << source;
+      EXPECT_EQ(source_result, compiled_result) << source;
+    }
+  }
+
+  const Expression num("num", LightWeightDatamodel::GetExpressionCompiler()
+                                  ->Compile("num", symbols));
+  const Expression later("later", LightWeightDatamodel::GetBytecodeCompiler()
+                                      ->Compile("later", symbols));
+  string result;
+  // Variables are found once declared and follow assignments.
+  EXPECT_FALSE(datamodel_->EvaluateExpression(later, &result));
+  EXPECT_TRUE(DeclareAndAssign("later", "7"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(later, &result));
+  EXPECT_EQ("7", result);
+  EXPECT_TRUE(datamodel_->AssignExpression("num", "6"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(num, &result));
+  EXPECT_EQ("6", result);
+
+  // The serialized form does not depend on the symbols.
+  const string serialized = datamodel_->SerializeAsString();
+  auto plain = LightWeightDatamodel::Create(serialized, dispatcher_.get());
+  ASSERT_NE(nullptr, plain);
+  EXPECT_EQ(serialized, plain->SerializeAsString());
+  plain->SetSymbolTable(symbols);
+  EXPECT_TRUE(plain->EvaluateExpression(later, &result));
+  EXPECT_EQ("7", result);
+
+  // Clones resolve the slots in their own store.
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(datamodel_->AssignExpression("num", "8"));
+  EXPECT_TRUE(clone->EvaluateExpression(num, &result));
+  EXPECT_EQ("6", result);
+
+  // Clearing the store forgets the variables.
+  datamodel_->Clear();
+  EXPECT_FALSE(datamodel_->EvaluateExpression(num, &result));
+  EXPECT_TRUE(DeclareAndAssign("num", "9"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(num, &result));
+  EXPECT_EQ("9", result);
+
+  // Expressions compiled against other symbols are resolved by name.
+  auto other_symbols = std::make_shared<SymbolTable>();
+  other_symbols->AddSymbol("other");
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      Expression("num", LightWeightDatamodel::GetExpressionCompiler()->Compile(
+                            "num", other_symbols)),
+      &result));
+  EXPECT_EQ("9", result);
+}
+
 TEST(LightWeightDatamodel, Clone) {
   MockFunctionDispatcher mock_dispatcher;
   std::unique_ptr<Datamodel> clone;
@@ -1590,7 +1795,638 @@ TEST(LightWeightDatamodel, Clone) {
   }
 }
 
-TEST_F(LightWeightDatamodelTest, ArrayReferenceIteratorTest) {
+TEST_P(LightWeightDatamodelTest, CloneIsCopiedOnWrite) {
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({ "a" : [1, 2], "b" : "x" })"));
+  auto clone = datamodel_->Clone();
+  auto second_clone = clone->Clone();
+
+  // Writes to a clone are not seen by the datamodels sharing its store.
+  EXPECT_TRUE(clone->AssignExpression("obj.a[0]", "5"));
+  EXPECT_TRUE(clone->Declare("y"));
+  string result;
+  EXPECT_TRUE(clone->EvaluateExpression("obj.a", &result));
+  EXPECT_EQ("[5,2]", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("obj.a", &result));
+  EXPECT_EQ("[1,2]", result);
+  EXPECT_FALSE(datamodel_->IsDefined("y"));
+  EXPECT_TRUE(second_clone->EvaluateExpression("obj.a", &result));
+  EXPECT_EQ("[1,2]", result);
+
+  // Nor are writes to the original.
+  auto iterator = second_clone->EvaluateIterator("obj.a");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.b", R"("z")"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("obj.b", &result));
+  EXPECT_EQ(R"("z")", result);
+  EXPECT_TRUE(second_clone->EvaluateExpression("obj.b", &result));
+  EXPECT_EQ(R"("x")", result);
+  EXPECT_EQ("1", iterator->GetValue());
+
+  datamodel_->Clear();
+  EXPECT_TRUE(second_clone->IsDefined("obj"));
+}
+
+// Test that a datamodel may be cloned on several threads at once, and that
+// the clones may be written on their threads.
+TEST_P(LightWeightDatamodelTest, ClonesConcurrently) {
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({ "a" : [1, 2], "b" : "x" })"));
+  // Held as a RecordArray, whose clones share chunks of records.
+  Json::Value records(Json::arrayValue);
+  for (int i = 0; i < 40; ++i) {
+    records[i]["v"] = i;
+  }
+  EXPECT_TRUE(datamodel_->DeclareAndAssignJson("records", records));
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([this, i] {
+      for (int j = 0; j < 100; ++j) {
+        auto clone = datamodel_->Clone();
+        EXPECT_TRUE(clone->AssignExpression("obj.a[0]", StrCat(i)));
+        EXPECT_TRUE(clone->AssignExpression("records[20].v", StrCat(-i)));
+        string result;
+        EXPECT_TRUE(clone->EvaluateExpression("obj.a", &result));
+        EXPECT_EQ(StrCat("[", i, ",2]"), result);
+        EXPECT_TRUE(clone->EvaluateExpression("records[20].v", &result));
+        EXPECT_EQ(StrCat(-i), result);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("obj.a", &result));
+  EXPECT_EQ("[1,2]", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("records[20].v", &result));
+  EXPECT_EQ("20", result);
+}
+
+TEST(LightWeightDatamodel, StorePath) {
+  Json::Value value;
+  value["b"][0] = 1;
+  const internal::StorePath path("a.b[0]");
+  EXPECT_EQ("a", path.variable);
+  EXPECT_EQ(1, path.members.resolve(value).asInt());
+  EXPECT_EQ(&value, &internal::StorePath("a").members.resolve(value));
+  EXPECT_EQ("a", internal::StorePath(".a[1]").variable);
+  EXPECT_EQ("", internal::StorePath("[1].a").variable);
+  EXPECT_EQ("", internal::StorePath("").variable);
+}
+
+TEST(LightWeightDatamodel, StoreSharesVariablesUntilWritten) {
+  internal::Store store;
+  *store.FindOrDeclare("a") = 1;
+  *store.FindOrDeclare("b") = Json::Value(Json::arrayValue);
+  internal::Store clone = store.Share();
+  EXPECT_EQ(store.FindVariable("a"), clone.FindVariable("a"));
+  EXPECT_EQ(store.FindVariable("b"), clone.FindVariable("b"));
+
+  // A write copies the variable that it writes and its value.
+  const uint64_t generation = clone.generation();
+  *clone.FindOrDeclare("a") = 2;
+  EXPECT_NE(generation, clone.generation());
+  EXPECT_NE(store.FindVariable("a"), clone.FindVariable("a"));
+  EXPECT_EQ(1, store.Find("a")->asInt());
+  EXPECT_EQ(2, clone.Find("a")->asInt());
+  EXPECT_EQ(store.Find("b"), clone.Find("b"));
+  // Written variables are not shared anymore.
+  const internal::Store::Variable* a = clone.FindVariable("a");
+  *clone.FindOrDeclare("a") = 3;
+  EXPECT_EQ(a, clone.FindVariable("a"));
+  EXPECT_EQ(3, a->value().asInt());
+  *clone.FindOrDeclare("a") = 2;
+
+  // The store that was shared copies its values before writing them as well.
+  store.Mutable(*store.FindVariable("b"))->append(3);
+  EXPECT_NE(store.Find("b"), clone.Find("b"));
+  EXPECT_TRUE(clone.Find("b")->empty());
+  // Written values are not shared anymore.
+  const Json::Value* b = store.Find("b");
+  EXPECT_EQ(b, store.Mutable(*store.FindVariable("b")));
+
+  string text;
+  clone.AppendJsonText(&text);
+  EXPECT_EQ(R"({"a":2,"b":[]})", text);
+  EXPECT_EQ(*store.Find("b"), store.ToJson()["b"]);
+
+  // An empty store is null unless it is an object.
+  Json::Value root;
+  EXPECT_TRUE(store.Assign(&root));
+  EXPECT_EQ(nullptr, store.Find("a"));
+  text.clear();
+  store.AppendJsonText(&text);
+  EXPECT_EQ("null", text);
+  root = Json::Value(Json::objectValue);
+  EXPECT_TRUE(store.Assign(&root));
+  text.clear();
+  store.AppendJsonText(&text);
+  EXPECT_EQ("{}", text);
+  root = Json::Value(5);
+  EXPECT_FALSE(store.Assign(&root));
+}
+
+TEST(LightWeightDatamodel, StoreCopiesOnlyThePathToWrittenVariables) {
+  internal::Store store;
+  constexpr int kVariables = 1000;
+  for (int i = 0; i < kVariables; ++i) {
+    *store.FindOrDeclare(StrCat("v", i)) = i;
+  }
+  internal::Store clone = store.Share();
+  *clone.FindOrDeclare("v500") = -1;
+  *clone.FindOrDeclare("w") = -2;
+  // Only the nodes on the paths to the written variables are copied, about
+  // twice the height of the tree of 1000 variables.
+  int copied = 0;
+  for (int i = 0; i < kVariables; ++i) {
+    const string name = StrCat("v", i);
+    if (i != 500) {
+      EXPECT_EQ(store.Find(name), clone.Find(name)) << name;
+    }
+    if (store.FindVariable(name) != clone.FindVariable(name)) {
+      ++copied;
+    }
+  }
+  EXPECT_LE(copied, 30);
+  EXPECT_EQ(500, store.Find("v500")->asInt());
+  EXPECT_EQ(-1, clone.Find("v500")->asInt());
+  EXPECT_EQ(nullptr, store.Find("w"));
+
+  // Both serialize all their variables in order.
+  Json::Value expected = store.ToJson();
+  string text;
+  store.AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+  expected["v500"] = -1;
+  expected["w"] = -2;
+  text.clear();
+  clone.AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+  EXPECT_EQ(expected, clone.ToJson());
+}
+
+TEST_P(LightWeightDatamodelTest, KeyIndexLookups) {
+  ON_CALL(*dispatcher_, HasFunction(testing::AnyOf(
+                            "LookupByKey", "ContainsKeyValue",
+                            "FindFirstWithKeyValue")))
+      .WillByDefault(Return(true));
+  EXPECT_TRUE(DeclareAndAssign(
+      "devices", R"([{"id": "a", "on": true}, {"id": 2}, {"id": "a"}, 5])"));
+  EXPECT_TRUE(DeclareAndAssign("other", "devices"));
+  EXPECT_TRUE(datamodel_->AddKeyIndex("devices", "id"));
+  EXPECT_TRUE(datamodel_->AddKeyIndex("devices", "id"));
+
+  // Lookups on the indexed array are not dispatched.
+  EXPECT_CALL(*dispatcher_, Execute(_, _, _)).Times(0);
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(LookupByKey(devices, "id", "a"))", &result));
+  EXPECT_EQ(R"({"id":"a","on":true})", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(LookupByKey(devices, "id", "b"))", &result));
+  EXPECT_EQ("null", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(FindFirstWithKeyValue(devices, "id", 2))", &result));
+  EXPECT_EQ("1", result);
+  bool found = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(
+      R"(ContainsKeyValue(devices, "id", "2"))", &found));
+  EXPECT_FALSE(found);
+
+  // Writes to the array are seen by the next lookup, also in clones.
+  EXPECT_TRUE(datamodel_->AssignExpression("devices[4]", R"({"id": "b"})"));
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(clone->AssignExpression("devices[0].id", R"("c")"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(FindFirstWithKeyValue(devices, "id", "b"))", &result));
+  EXPECT_EQ("4", result);
+  EXPECT_TRUE(clone->EvaluateExpression(
+      R"(FindFirstWithKeyValue(devices, "id", "a"))", &result));
+  EXPECT_EQ("2", result);
+  auto restored = LightWeightDatamodel::Create(clone->SerializeAsString(),
+                                               dispatcher_.get());
+  ASSERT_NE(nullptr, restored);
+  EXPECT_TRUE(restored->AddKeyIndex("devices", "id"));
+  EXPECT_TRUE(restored->EvaluateBooleanExpression(
+      R"(ContainsKeyValue(devices, "id", "c"))", &found));
+  EXPECT_TRUE(found);
+  testing::Mock::VerifyAndClearExpectations(dispatcher_.get());
+
+  // Other arrays and other keys are dispatched.
+  EXPECT_CALL(*dispatcher_, Execute("LookupByKey", _, _))
+      .Times(2)
+      .WillRepeatedly(Return(true));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(LookupByKey(other, "id", "a"))", &result));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      R"(LookupByKey(devices, "on", true))", &result));
+}
+
+TEST(LightWeightDatamodel, KeyIndexUpdatesWrittenElements) {
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  internal::Store store;
+  Json::Value* devices = store.FindOrDeclare("devices");
+  for (int i = 0; i < 4; ++i) {
+    (*devices)[i]["id"] = i % 2;
+  }
+  internal::KeyIndexDispatcher indexes(&dispatcher, &store);
+  EXPECT_TRUE(indexes.AddIndex("devices", "id"));
+  const Json::Value key("id");
+  const auto find = [&](const Json::Value& value) {
+    Json::Value result;
+    EXPECT_TRUE(indexes.Execute("FindFirstWithKeyValue",
+                                {devices, &key, &value}, &result));
+    return result.asInt();
+  };
+  EXPECT_EQ(1, find(Json::Value(1)));
+  EXPECT_EQ(1, indexes.rebuilds());
+
+  // Writes to elements update their entries without a rebuild.
+  (*devices)[1]["id"] = 2;
+  indexes.InvalidateElement("devices", 1);
+  EXPECT_EQ(3, find(Json::Value(1)));
+  EXPECT_EQ(1, find(Json::Value(2)));
+  (*devices)[0]["online"] = true;
+  indexes.InvalidateElement("devices", 0);
+  (*devices)[5]["id"] = 1;
+  indexes.InvalidateElement("devices", 5);
+  (*devices)[3] = Json::Value();
+  indexes.InvalidateElement("devices", 3);
+  EXPECT_EQ(0, find(Json::Value(0)));
+  EXPECT_EQ(5, find(Json::Value(1)));
+  EXPECT_EQ(1, indexes.rebuilds());
+
+  // Shortening the array rebuilds the index.
+  devices->resize(2);
+  indexes.InvalidateElement("devices", 1);
+  EXPECT_EQ(-1, find(Json::Value(1)));
+  EXPECT_EQ(2, indexes.rebuilds());
+  indexes.Invalidate("devices");
+  EXPECT_EQ(1, find(Json::Value(2)));
+  EXPECT_EQ(3, indexes.rebuilds());
+}
+
+TEST(LightWeightDatamodel, KeyIndexComparesRealsByValue) {
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  internal::Store store;
+  Json::Value* values = store.FindOrDeclare("values");
+  (*values)[0]["v"] = std::nan("");
+  (*values)[1]["v"] = -0.0;
+  (*values)[2]["v"] = 0;
+  internal::KeyIndexDispatcher indexes(&dispatcher, &store);
+  EXPECT_TRUE(indexes.AddIndex("values", "v"));
+  const Json::Value key("v");
+  Json::Value result;
+  const Json::Value zero(0.0);
+  EXPECT_TRUE(indexes.Execute("FindFirstWithKeyValue", {values, &key, &zero},
+                              &result));
+  EXPECT_EQ(1, result.asInt());
+  // Reals do not equal integers, and NaN equals nothing, so it is looked up
+  // by the dispatcher.
+  const Json::Value integer_zero(0);
+  EXPECT_TRUE(indexes.Execute("FindFirstWithKeyValue",
+                              {values, &key, &integer_zero}, &result));
+  EXPECT_EQ(2, result.asInt());
+  const Json::Value nan(std::nan(""));
+  EXPECT_CALL(dispatcher, Execute("FindFirstWithKeyValue", _, _))
+      .WillOnce(DoAll(SetArgPointee<2>(Json::Value(-1)), Return(true)));
+  EXPECT_TRUE(indexes.Execute("FindFirstWithKeyValue", {values, &key, &nan},
+                              &result));
+  EXPECT_EQ(-1, result.asInt());
+}
+
+TEST(LightWeightDatamodel, PathCache) {
+  internal::PathCache paths(2);
+  Json::Value a;
+  a["b"] = 1;
+  EXPECT_EQ("a", paths.Get("a.b").variable);
+  EXPECT_EQ(1, paths.Get("a.b").members.resolve(a).asInt());
+  EXPECT_EQ("c", paths.Get("c[1]").variable);
+  EXPECT_EQ(1, paths.hits());
+  EXPECT_EQ(2, paths.misses());
+  EXPECT_EQ(2, paths.size());
+
+  // A full cache evicts the least recently used path.
+  EXPECT_EQ("d", paths.Get("d").variable);
+  EXPECT_EQ(2, paths.size());
+  EXPECT_EQ(1, paths.evictions());
+  EXPECT_EQ("c", paths.Get("c[1]").variable);
+  EXPECT_EQ(2, paths.hits());
+  EXPECT_EQ("a", paths.Get("a.b").variable);
+  EXPECT_EQ(4, paths.misses());
+  EXPECT_EQ(2, paths.evictions());
+  paths.Clear();
+  EXPECT_EQ(0, paths.size());
+}
+
+TEST_P(LightWeightDatamodelTest, CachesPathsOfLocations) {
+  datamodel_->SetRuntime(&runtime_);
+  EXPECT_TRUE(DeclareAndAssign("x", R"({"y": {"z": 1}})"));
+  const uint64_t misses = datamodel_->path_cache().misses();
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("x.y.z", &result));
+  EXPECT_EQ("1", result);
+  EXPECT_EQ(misses + 1, datamodel_->path_cache().misses());
+  const uint64_t hits = datamodel_->path_cache().hits();
+  EXPECT_TRUE(datamodel_->EvaluateExpression("x.y.z", &result));
+  EXPECT_EQ(hits + 1, datamodel_->path_cache().hits());
+
+  // Cached paths resolve against the current shape of the store.
+  EXPECT_TRUE(datamodel_->AssignExpression("x.y", "[1, 2]"));
+  EXPECT_FALSE(datamodel_->IsDefined("x.y.z"));
+  EXPECT_TRUE(datamodel_->AssignExpression("x", R"({"y": {"z": "a"}})"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("x.y.z", &result));
+  EXPECT_EQ(R"("a")", result);
+  EXPECT_TRUE(datamodel_->AssignExpression("x", "5"));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("x.y.z", &result));
+
+  // Clones start with an empty cache.
+  auto clone = datamodel_->Clone();
+  EXPECT_EQ(0, static_cast<LightWeightDatamodel*>(clone.get())
+                   ->path_cache()
+                   .size());
+}
+
+TEST_F(SourceExpressionCacheTest, CachesExpressionsOfSources) {
+  ExpressionCache* cache = LightWeightDatamodel::GetSourceExpressionCache(
+      LightWeightDatamodel::GetExpressionCompiler());
+  EXPECT_TRUE(DeclareAndAssign("n", "1"));
+  const ExpressionCache::Stats before = cache->GetStats();
+  string result;
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_TRUE(datamodel_->EvaluateExpression(" n * 7 + 1 ", &result));
+    EXPECT_EQ("8", result);
+  }
+  ExpressionCache::Stats after = cache->GetStats();
+  EXPECT_EQ(before.misses + 1, after.misses);
+  EXPECT_EQ(before.hits + 2, after.hits);
+
+  // Disabled, the cache is bypassed with the same results.
+  cache->set_enabled(false);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("n * 7 + 1", &result));
+  EXPECT_EQ("8", result);
+  EXPECT_EQ(after.hits, cache->GetStats().hits);
+  cache->set_enabled(true);
+}
+
+TEST_F(SourceExpressionCacheTest, DoesNotCacheLiteralsOrLongSources) {
+  ExpressionCache* cache = LightWeightDatamodel::GetSourceExpressionCache(
+      LightWeightDatamodel::GetExpressionCompiler());
+  const ExpressionCache::Stats before = cache->GetStats();
+  EXPECT_TRUE(DeclareAndAssign("n", "1"));
+  for (int i = 0; i < 10; ++i) {
+    const string payload =
+        absl::StrCat(R"({"id": )", i, R"(, "text": ")", string(300, 'x'),
+                     R"("})");
+    EXPECT_TRUE(datamodel_->AssignExpression("n", payload));
+    EXPECT_TRUE(datamodel_->AssignExpression("n", absl::StrCat(i)));
+    EXPECT_TRUE(datamodel_->AssignString("n", absl::StrCat("id ", i)));
+    EXPECT_TRUE(
+        datamodel_->AssignExpression("n", absl::StrCat("\"s", i, "\"")));
+  }
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("n", &result));
+  EXPECT_EQ(R"("s9")", result);
+  const string long_source =
+      absl::StrCat("n", string(300, ' '), "+ 1");
+  EXPECT_TRUE(datamodel_->EvaluateExpression(long_source, &result));
+  EXPECT_EQ(R"("s91")", result);
+  // "n" is the only source that may have been added.
+  const ExpressionCache::Stats after = cache->GetStats();
+  EXPECT_LE(after.size, before.size + 1);
+  EXPECT_LE(after.misses, before.misses + 1);
+
+  // Strings are assigned as they are.
+  EXPECT_TRUE(datamodel_->AssignString("n", R"(a "b" \c)"));
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("n", &result));
+  EXPECT_EQ(R"(a "b" \c)", result);
+}
+
+TEST_F(SourceExpressionCacheTest, CachesExpressionsOfSourcesByCompiler) {
+  ExpressionCache* tree_cache = LightWeightDatamodel::GetSourceExpressionCache(
+      LightWeightDatamodel::GetExpressionCompiler());
+  ExpressionCache* bytecode_cache =
+      LightWeightDatamodel::GetSourceExpressionCache(
+          LightWeightDatamodel::GetBytecodeCompiler());
+  ASSERT_NE(tree_cache, bytecode_cache);
+  EXPECT_TRUE(DeclareAndAssign("n", "2"));
+
+  // Sources are compiled to syntax trees by default, like models are.
+  ExpressionCache::Stats tree_before = tree_cache->GetStats();
+  ExpressionCache::Stats bytecode_before = bytecode_cache->GetStats();
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("n * 5 - 2", &result));
+  EXPECT_EQ("8", result);
+  EXPECT_EQ(tree_before.misses + 1, tree_cache->GetStats().misses);
+  EXPECT_EQ(bytecode_before.misses, bytecode_cache->GetStats().misses);
+
+  datamodel_->SetExpressionCompiler(
+      LightWeightDatamodel::GetBytecodeCompiler());
+  tree_before = tree_cache->GetStats();
+  bytecode_before = bytecode_cache->GetStats();
+  EXPECT_TRUE(datamodel_->EvaluateExpression("n * 5 - 3", &result));
+  EXPECT_EQ("7", result);
+
+  // Clones evaluate sources with the same compiler.
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(clone->EvaluateExpression("n * 5 - 3", &result));
+  EXPECT_EQ("7", result);
+  EXPECT_EQ(bytecode_before.misses + 1, bytecode_cache->GetStats().misses);
+  EXPECT_EQ(bytecode_before.hits + 1, bytecode_cache->GetStats().hits);
+  EXPECT_EQ(tree_before.misses, tree_cache->GetStats().misses);
+  EXPECT_EQ(tree_before.hits, tree_cache->GetStats().hits);
+}
+
+TEST_P(LightWeightDatamodelTest, SerializeModificationsAsString) {
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({ "a" : [1, 2], "b" : "x" })"));
+  EXPECT_TRUE(DeclareAndAssign("num", "1"));
+  const string serialized = datamodel_->SerializeAsString();
+  const uint64_t version = datamodel_->GetVersion();
+  std::map<string, string> modifications;
+  EXPECT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_TRUE(modifications.empty());
+
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a[0]", "5"));
+  EXPECT_TRUE(datamodel_->AssignValue(Expression("obj.b"), Json::Value("y")));
+  EXPECT_TRUE(DeclareAndAssign("str", R"("s")"));
+  EXPECT_FALSE(datamodel_->AssignExpression("(1)", "2"));
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a[0]", "5"},
+                                       {"obj.b", R"("y")"},
+                                       {"str", R"("s")"}}),
+            modifications);
+
+  const uint64_t second_version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a[1]", "6"));
+  EXPECT_TRUE(datamodel_->AssignString("str", "t"));
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(second_version,
+                                                         &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a[1]", "6"}, {"str", R"("t")"}}),
+            modifications);
+
+  // The modifications restore the datamodel from its serialized form.
+  auto restored = LightWeightDatamodel::Create(
+      datamodel_->SerializeAsString(), modifications, 42, dispatcher_.get());
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(datamodel_->SerializeAsString(), restored->SerializeAsString());
+  EXPECT_EQ(42, restored->GetVersion());
+  EXPECT_FALSE(restored->SerializeModificationsAsString(41, &modifications));
+  EXPECT_TRUE(restored->AssignExpression("num", "2"));
+  ASSERT_TRUE(restored->SerializeModificationsAsString(42, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"num", "2"}}), modifications);
+  EXPECT_EQ(nullptr, LightWeightDatamodel::Create(
+                         serialized, {{"num", "{"}}, 0, dispatcher_.get()));
+
+  datamodel_->Clear();
+  EXPECT_FALSE(datamodel_->SerializeModificationsAsString(second_version,
+                                                          &modifications));
+}
+
+// Test that a clone knows the modifications of its original, and that later
+// writes of either are not modifications of the other.
+TEST_P(LightWeightDatamodelTest, ClonesKeepModifications) {
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({"a": 1, "b": 2})"));
+  EXPECT_TRUE(DeclareAndAssign("num", "1"));
+  const uint64_t version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a", "3"));
+
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(clone->AssignExpression("obj.b", "4"));
+  EXPECT_TRUE(datamodel_->AssignExpression("num", "5"));
+  std::map<string, string> modifications;
+  ASSERT_TRUE(clone->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a", "3"}, {"obj.b", "4"}}),
+            modifications);
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a", "3"}, {"num", "5"}}),
+            modifications);
+
+  // Writes after the modifications are forgotten do not carry earlier ones.
+  datamodel_->Clear();
+  EXPECT_TRUE(DeclareAndAssign("obj", "{}"));
+  const uint64_t cleared_version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.c", "6"));
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(cleared_version,
+                                                         &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.c", "6"}}), modifications);
+}
+
+// Test that modifications are keyed by the locations written, and that a
+// write of a value replaces the writes under it.
+TEST_P(LightWeightDatamodelTest, ModificationsAreKeyedByLocation) {
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({"a": {"b": 1}, "list": [1, 2]})"));
+  const string serialized = datamodel_->SerializeAsString();
+  const uint64_t version = datamodel_->GetVersion();
+
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a.b", "2"));
+  EXPECT_TRUE(datamodel_->AssignExpression(R"(obj["x y"])", "3"));
+  EXPECT_TRUE(datamodel_->Declare("obj.c.d"));
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.list[2]", "4"));
+  std::map<string, string> modifications;
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  // Declaring 'obj.c.d' creates 'obj.c', which is serialized whole.
+  EXPECT_EQ((std::map<string, string>{{"obj.a.b", "2"},
+                                       {R"(obj["x y"])", "3"},
+                                       {"obj.c", R"({"d":null})"},
+                                       {"obj.list[2]", "4"}}),
+            modifications);
+  auto restored = LightWeightDatamodel::Create(serialized, modifications, 5,
+                                               dispatcher_.get());
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(datamodel_->SerializeAsString(), restored->SerializeAsString());
+
+  // Writes under a value that is written later are serialized with it, but
+  // remain known for versions after the later write.
+  const uint64_t second_version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a", R"({"b": 5})"));
+  const uint64_t third_version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignExpression("obj.a.b", "6"));
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(second_version,
+                                                         &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a", R"({"b":6})"}}),
+            modifications);
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(third_version,
+                                                         &modifications));
+  EXPECT_EQ((std::map<string, string>{{"obj.a.b", "6"}}), modifications);
+
+  // A variable with many written locations is serialized whole.
+  for (int i = 0; i < 40; ++i) {
+    EXPECT_TRUE(datamodel_->AssignExpression(absl::StrCat("obj.m", i), "0"));
+  }
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(third_version,
+                                                         &modifications));
+  ASSERT_EQ(1, modifications.size());
+  EXPECT_EQ("obj", modifications.begin()->first);
+  restored = LightWeightDatamodel::Create(serialized, modifications, 5,
+                                          dispatcher_.get());
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(datamodel_->SerializeAsString(), restored->SerializeAsString());
+}
+
+// Test that writes that fail are not counted, unless they declared values on
+// the way to their location.
+TEST_P(LightWeightDatamodelTest, FailedWritesAreNotCounted) {
+  auto symbols = std::make_shared<SymbolTable>();
+  symbols->AddSymbol("obj");
+  datamodel_->SetSymbolTable(symbols);
+  EXPECT_TRUE(DeclareAndAssign("obj", R"({"a": 5})"));
+  EXPECT_TRUE(DeclareAndAssign("arr", "[1]"));
+  const uint64_t version = datamodel_->GetVersion();
+  const ExpressionCompiler* compiler =
+      LightWeightDatamodel::GetExpressionCompiler();
+  for (const char* location : {"obj.a.b", "arr[-1]", "undeclared", "(1)"}) {
+    EXPECT_FALSE(datamodel_->AssignExpression(location, "1")) << location;
+    EXPECT_FALSE(datamodel_->AssignValue(
+        Expression(location, compiler->CompileLocation(location, symbols)),
+        Json::Value(1)))
+        << location;
+  }
+  for (const char* location : {"obj.a.b", "arr[-1]", "obj[true]"}) {
+    EXPECT_FALSE(datamodel_->Declare(location)) << location;
+    EXPECT_FALSE(datamodel_->Declare(
+        Expression(location, compiler->CompileLocation(location, symbols))))
+        << location;
+  }
+  EXPECT_EQ(version, datamodel_->GetVersion());
+  std::map<string, string> modifications;
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_TRUE(modifications.empty());
+
+  // The variable is declared before its location fails.
+  EXPECT_FALSE(datamodel_->Declare("fresh[true]"));
+  EXPECT_LT(version, datamodel_->GetVersion());
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"fresh", "null"}}), modifications);
+}
+
+TEST_P(LightWeightDatamodelTest, SerializeModificationsOfDeferredValue) {
+  EXPECT_TRUE(DeclareAndAssign("_event", "{}"));
+  EXPECT_TRUE(DeclareAndAssign("x", "1"));
+  const uint64_t version = datamodel_->GetVersion();
+  EXPECT_TRUE(datamodel_->AssignValueLazily(Expression("_event.data"),
+                                            R"({"a": [1, 2]})"));
+  const uint64_t deferred_version = datamodel_->GetVersion();
+  EXPECT_LT(version, deferred_version);
+
+  // Serializing parses the deferred value without recording a write.
+  std::map<string, string> modifications;
+  ASSERT_TRUE(datamodel_->SerializeModificationsAsString(deferred_version,
+                                                         &modifications));
+  EXPECT_TRUE(modifications.empty());
+  EXPECT_EQ(deferred_version, datamodel_->GetVersion());
+  ASSERT_TRUE(
+      datamodel_->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"_event.data", R"({"a":[1,2]})"}}),
+            modifications);
+  EXPECT_EQ(deferred_version, datamodel_->GetVersion());
+}
+
+TEST_P(LightWeightDatamodelTest, ArrayReferenceIteratorTest) {
   EXPECT_TRUE(DeclareAndAssign("myarray", "[0, 2, 4]"));
   auto iterator = datamodel_->EvaluateIterator("myarray");
   ASSERT_NE(nullptr, iterator);
@@ -1604,7 +2440,7 @@ TEST_F(LightWeightDatamodelTest, ArrayReferenceIteratorTest) {
   EXPECT_TRUE(iterator->AtEnd());
 }
 
-TEST_F(LightWeightDatamodelTest, ArrayValueIteratorTest) {
+TEST_P(LightWeightDatamodelTest, ArrayValueIteratorTest) {
   auto iterator = datamodel_->EvaluateIterator("[0, 2, 4]");
   ASSERT_NE(nullptr, iterator);
 
@@ -1617,14 +2453,152 @@ TEST_F(LightWeightDatamodelTest, ArrayValueIteratorTest) {
   EXPECT_TRUE(iterator->AtEnd());
 }
 
-TEST_F(LightWeightDatamodelTest, ArrayIteratorErrorExpressionTest) {
+// Test that the elements of iterators are bound to the item and index without
+// changing the iterated array in the store.
+TEST_P(LightWeightDatamodelTest, AssignIteratorValueAndIndex) {
+  EXPECT_TRUE(DeclareAndAssign("myarray", R"([{"a": [1]}, "b"])"));
+  EXPECT_TRUE(DeclareAndAssign("item", "null"));
+  EXPECT_TRUE(DeclareAndAssign("index", "null"));
+  const Expression item("item");
+  const Expression index("index");
+  string result;
+
+  for (const char* array : {"myarray", R"([{"a": [1]}, "b"])"}) {
+    auto iterator = datamodel_->EvaluateIterator(array);
+    ASSERT_NE(nullptr, iterator);
+    EXPECT_TRUE(datamodel_->AssignIteratorValue(iterator.get(), item));
+    EXPECT_TRUE(datamodel_->AssignIteratorIndex(*iterator, index));
+    EXPECT_TRUE(datamodel_->EvaluateExpression("item.a[0] + index", &result));
+    EXPECT_EQ("1", result);
+    iterator->Next();
+    EXPECT_TRUE(datamodel_->AssignIteratorValue(iterator.get(), item));
+    EXPECT_TRUE(datamodel_->AssignIteratorIndex(*iterator, index));
+    EXPECT_TRUE(datamodel_->EvaluateExpression("item", &result));
+    EXPECT_EQ("\"b\"", result);
+    EXPECT_TRUE(datamodel_->EvaluateExpression("index", &result));
+    EXPECT_EQ("1", result);
+    iterator->Next();
+    EXPECT_TRUE(iterator->AtEnd());
+  }
+  EXPECT_TRUE(datamodel_->EvaluateExpression("myarray", &result));
+  EXPECT_EQ(R"([{"a":[1]},"b"])", result);
+
+  // Iterators of other datamodels are bound from their expressions.
+  MockIterator mock_iterator({"[2, 3]"});
+  EXPECT_TRUE(datamodel_->AssignIteratorValue(&mock_iterator, item));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("item[1]", &result));
+  EXPECT_EQ("3", result);
+}
+
+TEST_P(LightWeightDatamodelTest, TypedValues) {
+  Json::Value object;
+  object["a"].append(1);
+  object["b"] = "text";
+  EXPECT_TRUE(DeclareAndAssign("x", "null"));
+  EXPECT_TRUE(datamodel_->AssignValue(Expression("x"), object));
+  EXPECT_TRUE(datamodel_->AssignValue(Expression("x.c"), Json::Value(2.5)));
+  EXPECT_FALSE(datamodel_->AssignValue(Expression("y.c"), Json::Value(1)));
+
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("x", &result));
+  EXPECT_EQ(R"({"a":[1],"b":"text","c":2.5})", result);
+
+  Json::Value value;
+  EXPECT_TRUE(datamodel_->EvaluateValue(Expression("x.a[0] + 1"), &value));
+  EXPECT_EQ(Json::Value(2), value);
+  EXPECT_TRUE(datamodel_->EvaluateValue(Expression("x.b"), &value));
+  EXPECT_EQ(Json::Value("text"), value);
+  EXPECT_FALSE(datamodel_->EvaluateValue(Expression("y"), &value));
+
+  // Values are encoded the same as their value expressions.
+  std::map<string, Json::Value> values;
+  std::map<string, string> expressions;
+  for (const char* expr : {"x", "x.a", "x.b", "x.c", "null", "true"}) {
+    ASSERT_TRUE(datamodel_->EvaluateValue(Expression(expr), &values[expr]));
+    ASSERT_TRUE(datamodel_->EvaluateExpression(expr, &expressions[expr]));
+  }
+  EXPECT_EQ(datamodel_->EncodeParameters(expressions),
+            datamodel_->EncodeParameters(values));
+
+  // Parameters are evaluated as values, and those that fail are left out.
+  std::vector<string> failed;
+  EXPECT_EQ(R"({"a":[1],"n":3})",
+            datamodel_->EvaluateParameters({{"a", Expression("x.a")},
+                                            {"n", Expression("x.a[0] + 2")},
+                                            {"y", Expression("y")}},
+                                           &failed));
+  EXPECT_THAT(failed, ElementsAre("y"));
+}
+
+TEST_P(LightWeightDatamodelTest, AssignValueLazily) {
+  const Expression data("_event.data");
+  EXPECT_TRUE(DeclareAndAssign("_event", "{}"));
+  EXPECT_TRUE(DeclareAndAssign("x", "1"));
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, R"({"a": [1, 2]})"));
+  EXPECT_FALSE(datamodel_->AssignValueLazily(Expression("y.data"), "{}"));
+
+  // Accesses to other members do not see the value.
+  EXPECT_TRUE(datamodel_->AssignString("_event.name", "E"));
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.name + x", &result));
+  EXPECT_EQ(R"("E1")", result);
+
+  // The clone has its own copy of the value.
+  std::unique_ptr<Datamodel> clone = datamodel_->Clone();
+  for (const char* expr :
+       {"_event.data.a[1]", "_event['data'].a[1]", "_event.data['a'][1]"}) {
+    EXPECT_TRUE(datamodel_->EvaluateExpression(expr, &result)) << expr;
+    EXPECT_EQ("2", result) << expr;
+  }
+  EXPECT_TRUE(clone->EvaluateExpression("_event", &result));
+  EXPECT_EQ(R"({"data":{"a":[1,2]},"name":"E"})", result);
+
+  // Assigning to a member of the value parses it first.
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, R"({"a": [3, 4]})"));
+  EXPECT_TRUE(datamodel_->AssignExpression("_event.data.b", "5"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data", &result));
+  EXPECT_EQ(R"({"a":[3,4],"b":5})", result);
+
+  // Replaced values are never parsed.
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, "[5]"));
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, "[6]"));
+  // Parsing the value does not count as a write.
+  const uint64_t version = datamodel_->GetVersion();
+  EXPECT_EQ(R"({"_event":{"data":[6],"name":"E"},"x":1})"
+            "\n",
+            datamodel_->SerializeAsString());
+  EXPECT_EQ(version, datamodel_->GetVersion());
+
+  // Members of a deferred object are assignable.
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, R"({"a": 1})"));
+  EXPECT_TRUE(datamodel_->AssignExpression("_event.data.a", "2"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data.a", &result));
+  EXPECT_EQ("2", result);
+
+  // Malformed text fails when it is assigned, not when it is accessed, and
+  // does not change the location.
+  for (const char* json :
+       {"[1, ", "{\"a\": [1}", "[\"a]", "[1,, 2]", "{\"a\": }"}) {
+    EXPECT_FALSE(datamodel_->AssignValueLazily(data, json)) << json;
+    EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data", &result));
+    EXPECT_EQ(R"({"a":2})", result);
+  }
+
+  // Values that are not JSON are evaluated as expressions.
+  EXPECT_TRUE(datamodel_->AssignValueLazily(data, "x + 1"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data", &result));
+  EXPECT_EQ("2", result);
+  EXPECT_FALSE(datamodel_->AssignValueLazily(data, "x +"));
+}
+
+TEST_P(LightWeightDatamodelTest, ArrayIteratorErrorExpressionTest) {
   for (const auto& expr : {"1", "myarray", "null", "+"}) {
     auto iterator = datamodel_->EvaluateIterator(expr);
     EXPECT_EQ(nullptr, iterator) << "Expression: " << expr;
   }
 }
 
-TEST_F(LightWeightDatamodelTest, SerializeAsString) {
+TEST_P(LightWeightDatamodelTest, SerializeAsString) {
   EXPECT_EQ("null\n", datamodel_->SerializeAsString());
 
   // Set something in the data model.
@@ -1638,7 +2612,7 @@ TEST_F(LightWeightDatamodelTest, SerializeAsString) {
 }
 
 // Tests for verifying de-serializing of datamodel works.
-TEST_F(LightWeightDatamodelTest, CreateLightWeightDatamodel) {
+TEST_P(LightWeightDatamodelTest, CreateLightWeightDatamodel) {
   NiceMock<MockFunctionDispatcher> mock_dispatcher;
   {
     std::unique_ptr<Datamodel> lwdm =
@@ -1683,7 +2657,7 @@ TEST_F(LightWeightDatamodelTest, CreateLightWeightDatamodel) {
 
 // Test that JSON objects can be used in assignment.  It generally works, but
 // not if your string contains \'
-TEST_F(LightWeightDatamodelTest, AssignJSONList) {
+TEST_P(LightWeightDatamodelTest, AssignJSONList) {
   string result;
 
   const char kJSON1[] =
@@ -1696,5 +2670,521 @@ TEST_F(LightWeightDatamodelTest, AssignJSONList) {
   EXPECT_FALSE(DeclareAndAssign("synonyms", kJSON2));
 }
 
+// Test that declaring and assigning compiled locations has the same results as
+// parsing the locations.
+TEST_P(LightWeightDatamodelTest, AssignCompiledLocations) {
+  auto symbols = std::make_shared<SymbolTable>();
+  for (const char* name : {"num", "arr", "obj", "i"}) {
+    symbols->AddSymbol(name);
+  }
+  const string kInitialStore =
+      R"({"num": 5, "arr": [1, 2], "obj": {"a": {"b": "c"}}, "i": 1})";
+  // Locations that are declared and then assigned, or only assigned.
+  const string kLocations[] = {
+      "num",        "new_var",   "obj.a.b",       "obj.a.d",   "obj.x.y",
+      "obj['a']",   "obj[1]",    "arr[0]",        "arr[2]",    "arr[5]",
+      "arr[-1]",    "arr[i]",    "arr[i + 1]",    "arr.x",     "num.x",
+      "num[0]",     "new[0][1]", "obj.a['e'][0]", "arr[0][0]", "obj.a.b.c",
+  };
+  for (const ExpressionCompiler* compiler :
+       {LightWeightDatamodel::GetExpressionCompiler(),
+        LightWeightDatamodel::GetBytecodeCompiler()}) {
+    for (const string& source : kLocations) {
+      const Expression compiled(source,
+                                compiler->CompileLocation(source, symbols));
+      ASSERT_NE(nullptr, internal::GetLocationProgram(compiled)) << source;
+      for (const bool declare : {false, true}) {
+        auto source_datamodel = LightWeightDatamodel::Create(
+            kInitialStore, dispatcher_.get());
+        auto compiled_datamodel = LightWeightDatamodel::Create(
+            kInitialStore, dispatcher_.get());
+        compiled_datamodel->SetSymbolTable(symbols);
+        if (declare) {
+          EXPECT_EQ(source_datamodel->Declare(source),
+                    compiled_datamodel->Declare(compiled))
+              << source;
+        }
+        EXPECT_EQ(source_datamodel->AssignExpression(source, "{\"v\": 1}"),
+                  compiled_datamodel->AssignExpression(
+                      compiled, Expression("{\"v\": 1}")))
+            << source;
+        EXPECT_EQ(source_datamodel->SerializeAsString(),
+                  compiled_datamodel->SerializeAsString())
+            << source;
+      }
+    }
+  }
+
+  // Function names cannot be declared.
+  ON_CALL(*dispatcher_, HasFunction("obj.a")).WillByDefault(Return(true));
+  const Expression function(
+      "obj.a.b", LightWeightDatamodel::GetExpressionCompiler()->CompileLocation(
+                     "obj.a.b", symbols));
+  auto datamodel = LightWeightDatamodel::Create(kInitialStore,
+                                                dispatcher_.get());
+  EXPECT_FALSE(datamodel->AssignExpression(function, Expression("1")));
+}
+
+// Returns an array of 'size' records with the keys "id", "name" and "tags".
+Json::Value MakeRecords(int size) {
+  Json::Value array(Json::arrayValue);
+  for (int i = 0; i < size; ++i) {
+    Json::Value& record = array[i];
+    record["id"] = i;
+    record["name"] = StrCat("record ", i);
+    record["tags"].append("t");
+  }
+  return array;
+}
+
+// Same as above, as an expression.
+string MakeRecordsExpression(int size) {
+  string expr = "[";
+  for (int i = 0; i < size; ++i) {
+    absl::StrAppend(&expr, i == 0 ? "" : ", ", R"({"id": )", i,
+                    R"(, "name": "record )", i, R"(", "tags": ["t"]})");
+  }
+  return StrCat(expr, "]");
+}
+
+TEST(LightWeightDatamodel, StoreHoldsRecordArrays) {
+  internal::Store store;
+  store.FindOrDeclare("a");
+  store.FindOrDeclare("b");
+  const internal::Store::Variable* a = store.FindVariable("a");
+  Json::Value value = MakeRecords(internal::RecordArray::kMinSize);
+  const Json::Value expected = value;
+  store.Set(*a, &value, true);
+  ASSERT_NE(nullptr, a->records());
+  EXPECT_EQ(expected, a->value());
+  EXPECT_EQ(expected, *store.Find("a"));
+  EXPECT_EQ(expected, store.ToJson()["a"]);
+  string text;
+  a->AppendJsonText(&text);
+  string expected_text;
+  internal::Store expected_store;
+  *expected_store.FindOrDeclare("a") = expected;
+  expected_store.FindVariable("a")->AppendJsonText(&expected_text);
+  EXPECT_EQ(expected_text, text);
+
+  // Records are copied before they are written if they are shared.
+  internal::Store clone = store.Share();
+  EXPECT_EQ(a, clone.FindVariable("a"));
+  *clone.MutableRecords(*a)->mutable_record(0)->Find("id") = 5;
+  const internal::Store::Variable* clone_a = clone.FindVariable("a");
+  EXPECT_NE(a->records(), clone_a->records());
+  EXPECT_EQ(0, a->value()[0]["id"].asInt());
+  EXPECT_EQ(5, clone_a->value()[0]["id"].asInt());
+  const internal::RecordArray* records = clone_a->records();
+  clone.MutableRecords(*clone_a);
+  EXPECT_EQ(records, clone_a->records());
+
+  // Writing the whole value converts the records.
+  store.Mutable(*a)->append(1);
+  a = store.FindVariable("a");
+  EXPECT_EQ(nullptr, a->records());
+  EXPECT_EQ(internal::RecordArray::kMinSize + 1, store.Find("a")->size());
+  EXPECT_NE(nullptr, clone_a->records());
+
+  // Values are held as RecordArrays only if they are packed.
+  value = MakeRecords(internal::RecordArray::kMinSize);
+  store.Set(*a, &value, false);
+  EXPECT_EQ(nullptr, a->records());
+  *store.FindOrDeclare("b") = MakeRecords(internal::RecordArray::kMinSize);
+  store.PackRecords([](absl::string_view name) { return name == "a"; });
+  EXPECT_NE(nullptr, a->records());
+  EXPECT_EQ(nullptr, store.FindVariable("b")->records());
+}
+
+// Test that arrays held as RecordArrays are read and written the same way as
+// arrays that are not, which indexed arrays never are.
+TEST_P(LightWeightDatamodelTest, RecordArraysBehaveAsJsonArrays) {
+  auto symbols = std::make_shared<SymbolTable>();
+  for (const char* name : {"items", "i", "item"}) {
+    symbols->AddSymbol(name);
+  }
+  // Creates a datamodel with 20 records in "items" that are packed unless
+  // 'indexed'.
+  const auto create = [this, &symbols](bool indexed) {
+    auto datamodel = LightWeightDatamodel::Create(dispatcher_.get());
+    datamodel->SetSymbolTable(symbols);
+    if (indexed) {
+      CHECK(datamodel->AddKeyIndex("items", "id"));
+    }
+    CHECK(datamodel->Declare("items"));
+    CHECK(datamodel->AssignExpression("items", MakeRecordsExpression(20)));
+    CHECK(datamodel->Declare("i"));
+    CHECK(datamodel->AssignExpression("i", "4"));
+    return datamodel;
+  };
+  // Returns the expression of 'source' compiled by 'compiler', if any.
+  const auto compile = [&symbols](const ExpressionCompiler* compiler,
+                                  bool location, const string& source) {
+    if (compiler == nullptr) {
+      return Expression(source);
+    }
+    return Expression(source, location
+                                  ? compiler->CompileLocation(source, symbols)
+                                  : compiler->Compile(source, symbols));
+  };
+
+  const string kExpressions[] = {
+      "items[3].name",     "items.length",         "items[i].id",
+      "items[20]",         "items[3]",             "items",
+      "items[3].tags[0]",  "items[3].tags.length", "items[3].missing",
+      "items[-1]",         "items.x",              "items[3].name.length",
+      "items[i].name + items[2].name",
+  };
+  // The assignments before the first that converts the records.
+  const std::pair<string, string> kAssignments[] = {
+      {"items[3].name", R"("renamed")"},
+      {"items[3].added", "[1, 2]"},
+      {"items[i]", R"({"id": 40})"},
+      {"items[3].tags[0]", R"("u")"},
+      {"items[i].tags", "items[3].tags"},
+      {"items[20]", R"({"id": 20})"},
+      {"items[5]", "5"},
+      {"items[6].name", R"("after")"},
+      {"items[30]", "1"},
+  };
+  constexpr int kPackedAssignments = 6;
+  for (const ExpressionCompiler* compiler :
+       {static_cast<const ExpressionCompiler*>(nullptr),
+        LightWeightDatamodel::GetExpressionCompiler(),
+        LightWeightDatamodel::GetBytecodeCompiler()}) {
+    auto packed = create(false);
+    auto unpacked = create(true);
+    ASSERT_NE(nullptr, packed->store().FindVariable("items")->records());
+    ASSERT_EQ(nullptr, unpacked->store().FindVariable("items")->records());
+    EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString());
+
+    for (int i = 0; i < static_cast<int>(ABSL_ARRAYSIZE(kAssignments)); ++i) {
+      for (const string& source : kExpressions) {
+        const Expression expr = compile(compiler, false, source);
+        string packed_result;
+        string unpacked_result;
+        EXPECT_EQ(unpacked->EvaluateExpression(expr, &unpacked_result),
+                  packed->EvaluateExpression(expr, &packed_result))
+            << source;
+        EXPECT_EQ(unpacked_result, packed_result) << source;
+      }
+      const Expression location =
+          compile(compiler, true, kAssignments[i].first);
+      const Expression expr = compile(compiler, false, kAssignments[i].second);
+      EXPECT_EQ(unpacked->AssignExpression(location, expr),
+                packed->AssignExpression(location, expr))
+          << kAssignments[i].first;
+      EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString())
+          << kAssignments[i].first;
+      EXPECT_EQ(i < kPackedAssignments,
+                packed->store().FindVariable("items")->records() != nullptr)
+          << kAssignments[i].first;
+    }
+  }
+
+  // Iterators read the records without converting them.
+  auto packed = create(false);
+  auto unpacked = create(true);
+  auto packed_iterator = packed->EvaluateIterator("items");
+  auto unpacked_iterator = unpacked->EvaluateIterator("items");
+  ASSERT_NE(nullptr, packed_iterator);
+  ASSERT_NE(nullptr, unpacked_iterator);
+  ASSERT_TRUE(packed->Declare("item"));
+  ASSERT_TRUE(unpacked->Declare("item"));
+  for (; !unpacked_iterator->AtEnd();
+       unpacked_iterator->Next(), packed_iterator->Next()) {
+    ASSERT_FALSE(packed_iterator->AtEnd());
+    EXPECT_EQ(unpacked_iterator->GetIndex(), packed_iterator->GetIndex());
+    EXPECT_EQ(unpacked_iterator->GetValue(), packed_iterator->GetValue());
+    EXPECT_TRUE(unpacked->AssignIteratorValue(unpacked_iterator.get(),
+                                              Expression("item")));
+    EXPECT_TRUE(
+        packed->AssignIteratorValue(packed_iterator.get(), Expression("item")));
+    EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString());
+  }
+  EXPECT_TRUE(packed_iterator->AtEnd());
+  EXPECT_NE(nullptr, packed->store().FindVariable("items")->records());
+
+  // The records are parsed as RecordArrays unless they are indexed.
+  const string serialized = packed->SerializeAsString();
+  auto parsed = LightWeightDatamodel::Create(serialized, dispatcher_.get());
+  ASSERT_NE(nullptr, parsed);
+  EXPECT_NE(nullptr, parsed->store().FindVariable("items")->records());
+  EXPECT_EQ(serialized, parsed->SerializeAsString());
+  EXPECT_TRUE(parsed->AddKeyIndex("items", "id"));
+  EXPECT_EQ(nullptr, parsed->store().FindVariable("items")->records());
+  EXPECT_EQ(serialized, parsed->SerializeAsString());
+}
+
+TEST_P(LightWeightDatamodelTest, RecordArraysAreCopiedOnWrite) {
+  EXPECT_TRUE(DeclareAndAssign("items", MakeRecordsExpression(20)));
+  const internal::RecordArray* records =
+      datamodel_->store().FindVariable("items")->records();
+  ASSERT_NE(nullptr, records);
+  const uint64_t version = datamodel_->GetVersion();
+  auto clone = datamodel_->Clone();
+
+  EXPECT_TRUE(clone->AssignExpression("items[0].name", R"("changed")"));
+  string result;
+  EXPECT_TRUE(clone->EvaluateExpression("items[0].name", &result));
+  EXPECT_EQ(R"("changed")", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("items[0].name", &result));
+  EXPECT_EQ(R"("record 0")", result);
+  EXPECT_EQ(records, datamodel_->store().FindVariable("items")->records());
+  EXPECT_NE(nullptr, static_cast<LightWeightDatamodel*>(clone.get())
+                         ->store()
+                         .FindVariable("items")
+                         ->records());
+
+  // Modifications of packed variables are serialized from the records.
+  std::map<string, string> modifications;
+  ASSERT_TRUE(clone->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"items[0].name", R"("changed")"}}),
+            modifications);
+}
+
+// Returns an object that is held as a ValueTree, with the large members "a"
+// and "b", each with a large object "config" and a small array of records
+// "items", and the small member "name".
+Json::Value MakeTree() {
+  Json::Value value;
+  for (const char* branch : {"a", "b"}) {
+    for (int i = 0; i < internal::ValueTree::kMinSize; ++i) {
+      value[branch]["config"][StrCat("key", i)] = i;
+    }
+    value[branch]["items"] = MakeRecords(4);
+  }
+  value["name"] = "tree";
+  return value;
+}
+
+TEST(LightWeightDatamodel, StoreHoldsValueTrees) {
+  internal::Store store;
+  store.FindOrDeclare("a");
+  const internal::Store::Variable* a = store.FindVariable("a");
+  Json::Value value = MakeTree();
+  const Json::Value expected = value;
+  store.Set(*a, &value, true);
+  const internal::ValueTree* tree = a->tree();
+  ASSERT_NE(nullptr, tree);
+  EXPECT_EQ(nullptr, a->records());
+  EXPECT_EQ(expected, a->value());
+  EXPECT_EQ(expected, store.ToJson()["a"]);
+  string text;
+  a->AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+
+  // A nested write to a shared tree copies only the nodes on its path.
+  internal::Store clone = store.Share();
+  internal::ValueTree* root = clone.MutableTree(*a);
+  internal::ValueTree* branch = root->MutableTree(root->FindOrAddMember("a"));
+  branch->MutableTree(branch->FindOrAddMember("config"))
+      ->FindOrAddMember("key1")
+      ->value = -1;
+  const internal::ValueTree* clone_tree = clone.FindVariable("a")->tree();
+  EXPECT_EQ(root, clone_tree);
+  EXPECT_NE(tree, clone_tree);
+  EXPECT_NE(tree->Find("a")->tree.get(), branch);
+  EXPECT_EQ(tree->Find("b")->tree, clone_tree->Find("b")->tree);
+  EXPECT_EQ(1, a->value()["a"]["config"]["key1"].asInt());
+  EXPECT_EQ(-1, (*clone.Find("a"))["a"]["config"]["key1"].asInt());
+  // Nodes that the clone copied are written in place.
+  EXPECT_EQ(root, clone.MutableTree(*clone.FindVariable("a")));
+  EXPECT_EQ(branch, root->MutableTree(root->FindOrAddMember("a")));
+
+  // Writing the whole value converts the tree.
+  store.Mutable(*a)->removeMember("name");
+  a = store.FindVariable("a");
+  EXPECT_EQ(nullptr, a->tree());
+  EXPECT_FALSE(store.Find("a")->isMember("name"));
+  EXPECT_NE(nullptr, clone.FindVariable("a")->tree());
+
+  // Values are held as ValueTrees only if they are packed and large.
+  value = MakeTree();
+  store.Set(*a, &value, false);
+  EXPECT_EQ(nullptr, a->tree());
+  *store.FindOrDeclare("b") = MakeTree();
+  *store.FindOrDeclare("c") = MakeRecords(2);
+  store.PackRecords([](absl::string_view name) { return name != "b"; });
+  EXPECT_NE(nullptr, a->tree());
+  EXPECT_EQ(nullptr, store.FindVariable("b")->tree());
+  EXPECT_EQ(nullptr, store.FindVariable("c")->tree());
+}
+
+// Test that a write deep in a large value after Clone() copies only the nodes
+// on the path to the written member, and the members that it does not touch
+// stay shared with the original.
+TEST_P(LightWeightDatamodelTest, ValueTreesAreCopiedOnWrite) {
+  EXPECT_TRUE(DeclareAndAssign("tree", ToJsonText(MakeTree())));
+  const internal::ValueTree* tree =
+      datamodel_->store().FindVariable("tree")->tree();
+  ASSERT_NE(nullptr, tree);
+  const uint64_t version = datamodel_->GetVersion();
+  auto clone = datamodel_->Clone();
+
+  EXPECT_TRUE(clone->AssignExpression("tree.a.config.key1", "-1"));
+  string result;
+  EXPECT_TRUE(clone->EvaluateExpression("tree.a.config.key1", &result));
+  EXPECT_EQ("-1", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("tree.a.config.key1", &result));
+  EXPECT_EQ("1", result);
+  EXPECT_EQ(tree, datamodel_->store().FindVariable("tree")->tree());
+
+  const internal::ValueTree* clone_tree =
+      static_cast<LightWeightDatamodel*>(clone.get())
+          ->store()
+          .FindVariable("tree")
+          ->tree();
+  ASSERT_NE(nullptr, clone_tree);
+  // The nodes on the path are copied, their untouched siblings are shared.
+  const internal::ValueTree* a = tree->Find("a")->tree.get();
+  const internal::ValueTree* clone_a = clone_tree->Find("a")->tree.get();
+  EXPECT_NE(tree, clone_tree);
+  EXPECT_NE(a, clone_a);
+  EXPECT_NE(a->Find("config")->tree, clone_a->Find("config")->tree);
+  EXPECT_EQ(tree->Find("b")->tree, clone_tree->Find("b")->tree);
+
+  // Modifications are serialized from the nodes on their paths.
+  std::map<string, string> modifications;
+  ASSERT_TRUE(clone->SerializeModificationsAsString(version, &modifications));
+  EXPECT_EQ((std::map<string, string>{{"tree.a.config.key1", "-1"}}),
+            modifications);
+}
+
+// Test that values held as ValueTrees are read and written the same way as
+// values that are not, which the values of indexed variables never are.
+TEST_P(LightWeightDatamodelTest, ValueTreesBehaveAsJsonValues) {
+  // Creates a datamodel with the tree of MakeTree() in "tree", which is held
+  // as a ValueTree unless 'indexed'.
+  const auto create = [this](bool indexed) {
+    auto datamodel = LightWeightDatamodel::Create(dispatcher_.get());
+    datamodel->SetExpressionCompiler(GetCompiler(GetParam()));
+    if (indexed) {
+      CHECK(datamodel->AddKeyIndex("tree", "id"));
+    }
+    CHECK(datamodel->Declare("tree"));
+    CHECK(datamodel->AssignExpression("tree", ToJsonText(MakeTree())));
+    CHECK(datamodel->Declare("i"));
+    CHECK(datamodel->AssignExpression("i", "2"));
+    return datamodel;
+  };
+  auto packed = create(false);
+  auto unpacked = create(true);
+  ASSERT_NE(nullptr, packed->store().FindVariable("tree")->tree());
+  ASSERT_EQ(nullptr, unpacked->store().FindVariable("tree")->tree());
+  EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString());
+  const uint64_t version = packed->GetVersion();
+  ASSERT_EQ(unpacked->GetVersion(), version);
+
+  const string kExpressions[] = {
+      "tree.name",          "tree.a.config.key3",
+      "tree.a.items[i].name", "tree.a.items.length",
+      "tree.a.config",      "tree.b",
+      "tree.a.missing",     "tree.a.items[10]",
+      "tree.a[0]",          "tree.a.config.key3 + tree.b.config.key4",
+      "tree.name.length",   "tree.c.a.config.length",
+      "tree.c.a.config.key0.id", "tree.a.items[1].tags[0]",
+  };
+  const std::pair<string, string> kAssignments[] = {
+      {"tree.a.config.key3", "100"},
+      {"tree.a.items[i].name", R"("renamed")"},
+      {"tree.a.items[6]", R"({"id": 6})"},
+      {"tree.b.added", "[1, 2]"},
+      {"tree.c", ToJsonText(MakeTree())},
+      {"tree.c.a.config.key0", "tree.a.items[1]"},
+      {"tree.a.items", "tree.b.config"},
+      {"tree.a.config.key3.x", "1"},
+      {"tree.a[0]", "1"},
+      {"tree.c.a.config.key1[0]", "1"},
+      {"tree.name", "5"},
+  };
+  for (const auto& assignment : kAssignments) {
+    for (const string& source : kExpressions) {
+      string packed_result;
+      string unpacked_result;
+      EXPECT_EQ(unpacked->EvaluateExpression(source, &unpacked_result),
+                packed->EvaluateExpression(source, &packed_result))
+          << source;
+      EXPECT_EQ(unpacked_result, packed_result) << source;
+    }
+    EXPECT_EQ(unpacked->AssignExpression(assignment.first, assignment.second),
+              packed->AssignExpression(assignment.first, assignment.second))
+        << assignment.first;
+    EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString())
+        << assignment.first;
+  }
+  EXPECT_NE(nullptr, packed->store().FindVariable("tree")->tree());
+
+  // Iterator values are assigned to the same locations, which are checked by
+  // IsAssignable() when they are not compiled.
+  for (const auto& assignment : kAssignments) {
+    auto packed_iterator = packed->EvaluateIterator("[7]");
+    auto unpacked_iterator = unpacked->EvaluateIterator("[7]");
+    ASSERT_NE(nullptr, packed_iterator);
+    ASSERT_NE(nullptr, unpacked_iterator);
+    EXPECT_EQ(unpacked->AssignIteratorValue(unpacked_iterator.get(),
+                                            Expression(assignment.first)),
+              packed->AssignIteratorValue(packed_iterator.get(),
+                                          Expression(assignment.first)))
+        << assignment.first;
+    EXPECT_EQ(unpacked->SerializeAsString(), packed->SerializeAsString())
+        << assignment.first;
+  }
+
+  std::map<string, string> packed_modifications;
+  std::map<string, string> unpacked_modifications;
+  EXPECT_TRUE(
+      packed->SerializeModificationsAsString(version, &packed_modifications));
+  EXPECT_TRUE(unpacked->SerializeModificationsAsString(
+      version, &unpacked_modifications));
+  EXPECT_EQ(unpacked_modifications, packed_modifications);
+
+  // Iterators read the same elements, and arrays in trees are copied so that
+  // writes do not invalidate them.
+  for (const char* location : {"tree.c.a.items", "tree.a.config"}) {
+    auto packed_iterator = packed->EvaluateIterator(location);
+    auto unpacked_iterator = unpacked->EvaluateIterator(location);
+    ASSERT_EQ(unpacked_iterator == nullptr, packed_iterator == nullptr)
+        << location;
+    if (unpacked_iterator == nullptr) {
+      continue;
+    }
+    EXPECT_TRUE(packed->AssignExpression("tree.c.a.items", "[]"));
+    for (; !unpacked_iterator->AtEnd();
+         unpacked_iterator->Next(), packed_iterator->Next()) {
+      ASSERT_FALSE(packed_iterator->AtEnd());
+      EXPECT_EQ(unpacked_iterator->GetValue(), packed_iterator->GetValue());
+    }
+    EXPECT_TRUE(packed_iterator->AtEnd());
+  }
+}
+
+// Test that an iterator stays valid when the body of a <foreach> assigns the
+// array that it iterates, including when the new array is held as a
+// RecordArray.
+TEST_P(LightWeightDatamodelTest, ForEachAssignsItsArray) {
+  EXPECT_TRUE(DeclareAndAssign(
+      "arr", R"(["aaaaaaaaaaaaaaaa", "bbbbbbbbbbbbbbbb", 3])"));
+  auto iterator = datamodel_->EvaluateIterator("arr");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ(R"("aaaaaaaaaaaaaaaa")", iterator->GetValue());
+  EXPECT_TRUE(datamodel_->AssignExpression("arr", R"(["x", "y"])"));
+  iterator->Next();
+  EXPECT_FALSE(iterator->AtEnd());
+  EXPECT_EQ(R"("y")", iterator->GetValue());
+  iterator->Next();
+  EXPECT_TRUE(iterator->AtEnd());
+
+  iterator = datamodel_->EvaluateIterator("arr");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_TRUE(datamodel_->AssignExpression("arr", MakeRecordsExpression(20)));
+  ASSERT_NE(nullptr, datamodel_->store().FindVariable("arr")->records());
+  iterator->Next();
+  EXPECT_FALSE(iterator->AtEnd());
+  EXPECT_EQ(R"("y")", iterator->GetValue());
+  iterator->Next();
+  EXPECT_TRUE(iterator->AtEnd());
+}
+
 }  // namespace
 }  // namespace state_chart
@@ -0,0 +1,912 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/light_weight_expression.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "absl/base/macros.h"
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "statechart/internal/char_set.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/utility.h"
+#include "statechart/logging.h"
+
+using ::google::int64;
+
+namespace state_chart {
+
+namespace {
+
+// Operators of expressions that delimit values/subexpressions, indexed by
+// their OperatorId.
+const char* const kOperatorNames[] = {
+    "",  ",",  "(",  ")",  "[",  "]",  "+", "-",  "*",  "/",
+    "<", "<=", "==", "!=", ">=", ">", "&&", "||", "!",
+};
+static_assert(ABSL_ARRAYSIZE(kOperatorNames) == internal::kNot + 1,
+              "A name is required for every operator.");
+
+// Returns the characters that may start an operator or a string. All other
+// characters are part of operands.
+const internal::CharSet& SpecialChars() {
+  static const auto* const kSpecialChars = [] {
+    string chars = "\"'";
+    for (int id = internal::kComma; id <= internal::kNot; ++id) {
+      chars += kOperatorNames[id][0];
+    }
+    return new internal::CharSet(chars);
+  }();
+  return *kSpecialChars;
+}
+
+// Returns the size of the longest operator at position 'i' of 'expr', or 0 if
+// there is no operator at 'i'. All operators have one or two characters.
+::std::size_t OperatorSizeAt(absl::string_view expr, ::std::size_t i) {
+  const char next = i + 1 < expr.size() ? expr[i + 1] : '\0';
+  switch (expr[i]) {
+    case '<':
+    case '>':
+    case '!':
+      return next == '=' ? 2 : 1;
+    case '=':
+      return next == '=' ? 2 : 0;
+    case '&':
+      return next == '&' ? 2 : 0;
+    case '|':
+      return next == '|' ? 2 : 0;
+    default:
+      return 1;
+  }
+}
+
+// Appends 'operand' without leading and trailing whitespace to 'tokens' unless
+// it is empty.
+void AppendOperand(absl::string_view operand,
+                   std::vector<absl::string_view>* tokens) {
+  operand = absl::StripAsciiWhitespace(operand);
+  if (!operand.empty()) {
+    tokens->push_back(operand);
+  }
+}
+
+// Binary operators and their precedence. Higher values bind tighter. All
+// binary operators are left associative.
+const struct {
+  const char* op;
+  int precedence;
+} kBinaryOperators[] = {
+    {"||", 1}, {"&&", 2}, {"==", 3}, {"!=", 3}, {"<", 4}, {"<=", 4},
+    {">", 4},  {">=", 4}, {"+", 5},  {"-", 5},  {"*", 6}, {"/", 6},
+};
+
+// Returns the precedence of 'op' as a binary operator, or 0 if 'op' is not a
+// binary operator.
+int BinaryPrecedence(const string& op) {
+  for (const auto& binary_operator : kBinaryOperators) {
+    if (op == binary_operator.op) {
+      return binary_operator.precedence;
+    }
+  }
+  return 0;
+}
+
+// A token of an expression, classified at parse time.
+struct Lexeme {
+  enum Kind { kOperator, kLiteral, kName };
+
+  Kind kind;
+  string text;
+  // Set for kLiteral.
+  Json::Value value;
+  // For kOperator, the precedence of the operator in infix position. 0 if the
+  // operator is not a binary operator and for all other kinds.
+  int precedence;
+};
+
+// Classifies string tokens into Lexemes. This performs the following rewrites:
+// - Single quoted strings become string literals.
+// - Subpaths, ".<some_path>", following an element access become element
+//   accesses with string keys, e.g., 'foo[0].bar' is 'foo[0]["bar"]'.
+std::vector<Lexeme> MakeLexemes(const std::vector<absl::string_view>& tokens) {
+  std::vector<Lexeme> lexemes;
+  lexemes.reserve(tokens.size());
+  for (const absl::string_view token_view : tokens) {
+    string token(token_view);
+    if (IsQuotedString(token, '\'')) {
+      token = Quote(Unquote(token, '\''));
+    }
+    if (absl::StartsWith(token, ".")) {
+      for (const auto& path_token :
+           absl::StrSplit(token, ".", absl::SkipEmpty())) {
+        lexemes.push_back({Lexeme::kOperator, "[", Json::Value(), 0});
+        lexemes.push_back({Lexeme::kLiteral, string(path_token),
+                           Json::Value(string(path_token)), 0});
+        lexemes.push_back({Lexeme::kOperator, "]", Json::Value(), 0});
+      }
+      continue;
+    }
+    Lexeme lexeme{Lexeme::kName, token, Json::Value(), 0};
+    if (internal::IsOperator(token)) {
+      lexeme.kind = Lexeme::kOperator;
+      lexeme.precedence = BinaryPrecedence(token);
+    } else if (internal::ParseLiteral(token, &lexeme.value)) {
+      lexeme.kind = Lexeme::kLiteral;
+    }
+    lexemes.push_back(std::move(lexeme));
+  }
+  return lexemes;
+}
+
+// A precedence climbing (Pratt) parser over the Lexemes of an expression. The
+// tree is built in a single pass over the Lexemes.
+class Parser {
+ public:
+  // Identifiers are compiled to their slots in 'symbols' unless it is nullptr.
+  Parser(std::vector<Lexeme> lexemes, const SymbolTable* symbols)
+      : lexemes_(std::move(lexemes)), symbols_(symbols) {}
+  Parser(const Parser&) = delete;
+  Parser& operator=(const Parser&) = delete;
+
+  // Returns nullptr if the Lexemes do not form exactly one expression.
+  std::unique_ptr<internal::ExpressionNode> Parse() {
+    auto root = ParseSubexpression(0);
+    if (root == nullptr || position_ != lexemes_.size()) {
+      return nullptr;
+    }
+    return root;
+  }
+
+ private:
+  using Node = internal::ExpressionNode;
+
+  bool AtOperator(const char* op) const {
+    return position_ < lexemes_.size() &&
+           lexemes_[position_].kind == Lexeme::kOperator &&
+           lexemes_[position_].text == op;
+  }
+
+  bool ConsumeOperator(const char* op) {
+    if (!AtOperator(op)) {
+      return false;
+    }
+    ++position_;
+    return true;
+  }
+
+  // Parses a subexpression whose binary operators all have a precedence higher
+  // than 'min_precedence'.
+  std::unique_ptr<Node> ParseSubexpression(int min_precedence) {
+    auto lhs = ParsePrefix();
+    while (lhs != nullptr && position_ < lexemes_.size()) {
+      const Lexeme& op = lexemes_[position_];
+      if (op.kind != Lexeme::kOperator || op.precedence <= min_precedence) {
+        break;
+      }
+      ++position_;
+      // Binding the right operand at the operator's own precedence makes the
+      // operator left associative.
+      auto rhs = ParseSubexpression(op.precedence);
+      if (rhs == nullptr) {
+        return nullptr;
+      }
+      auto node = absl::make_unique<Node>(Node::kBinaryOperation);
+      node->op_id = internal::FindOperatorId(op.text);
+      node->operands.push_back(std::move(lhs));
+      node->operands.push_back(std::move(rhs));
+      lhs = std::move(node);
+    }
+    return lhs;
+  }
+
+  // Unary operators are right associative and bind tighter than any binary
+  // operator.
+  std::unique_ptr<Node> ParsePrefix() {
+    for (const char* op : {"-", "!"}) {
+      if (ConsumeOperator(op)) {
+        auto operand = ParsePrefix();
+        if (operand == nullptr) {
+          return nullptr;
+        }
+        auto node = absl::make_unique<Node>(Node::kUnaryOperation);
+        node->op_id = internal::FindOperatorId(op);
+        node->operands.push_back(std::move(operand));
+        return node;
+      }
+    }
+    return ParsePostfix();
+  }
+
+  // Parses a primary expression followed by any number of element accesses.
+  std::unique_ptr<Node> ParsePostfix() {
+    auto node = ParsePrimary();
+    while (node != nullptr && ConsumeOperator("[")) {
+      auto key = ParseSubexpression(0);
+      if (key == nullptr || !ConsumeOperator("]")) {
+        return nullptr;
+      }
+      auto access = absl::make_unique<Node>(Node::kElementAccess);
+      access->operands.push_back(std::move(node));
+      access->operands.push_back(std::move(key));
+      node = std::move(access);
+    }
+    return node;
+  }
+
+  std::unique_ptr<Node> ParsePrimary() {
+    if (position_ >= lexemes_.size()) {
+      return nullptr;
+    }
+    const Lexeme& lexeme = lexemes_[position_];
+    if (lexeme.kind == Lexeme::kLiteral) {
+      ++position_;
+      auto node = absl::make_unique<Node>(Node::kLiteral);
+      node->value = lexeme.value;
+      return node;
+    }
+    if (lexeme.kind == Lexeme::kName) {
+      ++position_;
+      if (AtOperator("(")) {
+        return ParseCall(lexeme.text);
+      }
+      auto node = absl::make_unique<Node>(Node::kIdentifier);
+      node->name = lexeme.text;
+      if (symbols_ != nullptr) {
+        node->reference = internal::MakeSlotReference(node->name, *symbols_);
+      }
+      return node;
+    }
+    if (ConsumeOperator("(")) {
+      auto node = ParseSubexpression(0);
+      if (node == nullptr || !ConsumeOperator(")")) {
+        return nullptr;
+      }
+      return node;
+    }
+    return nullptr;
+  }
+
+  // Parses the argument list of a call to 'name'.
+  std::unique_ptr<Node> ParseCall(const string& name) {
+    // The caller has checked that the call starts with "(".
+    ConsumeOperator("(");
+    auto node = absl::make_unique<Node>(Node::kCall);
+    node->name = name;
+    if (!ConsumeOperator(")")) {
+      do {
+        auto argument = ParseSubexpression(0);
+        if (argument == nullptr) {
+          return nullptr;
+        }
+        node->operands.push_back(std::move(argument));
+      } while (ConsumeOperator(","));
+      if (!ConsumeOperator(")")) {
+        return nullptr;
+      }
+    }
+    if (name == "Math.random" && node->operands.empty()) {
+      return absl::make_unique<Node>(Node::kRandom);
+    }
+    return node;
+  }
+
+  const std::vector<Lexeme> lexemes_;
+  const SymbolTable* const symbols_;
+  ::std::size_t position_ = 0;
+};
+
+// Returns the instruction of the unary operator 'op', or false if 'op' is not
+// a unary operator of the stack machine.
+bool FindUnaryOpCode(internal::OperatorId op,
+                     internal::Instruction::OpCode* opcode) {
+  using internal::Instruction;
+  switch (op) {
+    case internal::kMinus:
+      *opcode = Instruction::kNegate;
+      return true;
+    case internal::kNot:
+      *opcode = Instruction::kNot;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns the instruction of the binary operator 'op', or false if 'op' is not
+// a binary operator of the stack machine. '&&' and '||' are compiled to jumps.
+bool FindBinaryOpCode(internal::OperatorId op,
+                      internal::Instruction::OpCode* opcode) {
+  using internal::Instruction;
+  switch (op) {
+    case internal::kMultiply:
+      *opcode = Instruction::kMultiply;
+      return true;
+    case internal::kDivide:
+      *opcode = Instruction::kDivide;
+      return true;
+    case internal::kPlus:
+      *opcode = Instruction::kAdd;
+      return true;
+    case internal::kMinus:
+      *opcode = Instruction::kSubtract;
+      return true;
+    case internal::kLess:
+      *opcode = Instruction::kLess;
+      return true;
+    case internal::kLessEqual:
+      *opcode = Instruction::kLessEqual;
+      return true;
+    case internal::kGreater:
+      *opcode = Instruction::kGreater;
+      return true;
+    case internal::kGreaterEqual:
+      *opcode = Instruction::kGreaterEqual;
+      return true;
+    case internal::kEqual:
+      *opcode = Instruction::kEqual;
+      return true;
+    case internal::kNotEqual:
+      *opcode = Instruction::kNotEqual;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if 'node' is an operation that always results in a boolean.
+bool IsBooleanOperation(const internal::ExpressionNode& node) {
+  if (node.type != internal::ExpressionNode::kUnaryOperation &&
+      node.type != internal::ExpressionNode::kBinaryOperation) {
+    return false;
+  }
+  switch (node.op_id) {
+    case internal::kNot:
+    case internal::kLess:
+    case internal::kLessEqual:
+    case internal::kGreater:
+    case internal::kGreaterEqual:
+    case internal::kEqual:
+    case internal::kNotEqual:
+    case internal::kAnd:
+    case internal::kOr:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Emits the instructions of a syntax tree in postfix order. '&&' and '||' are
+// emitted as conditional jumps over their right operand.
+class BytecodeEmitter {
+ public:
+  explicit BytecodeEmitter(internal::BytecodeProgram* program)
+      : program_(program) {}
+  BytecodeEmitter(const BytecodeEmitter&) = delete;
+  BytecodeEmitter& operator=(const BytecodeEmitter&) = delete;
+
+  // Returns false if 'node' contains an unknown operator.
+  bool Emit(const internal::ExpressionNode& node) {
+    using internal::ExpressionNode;
+    using internal::Instruction;
+    switch (node.type) {
+      case ExpressionNode::kLiteral:
+        program_->constants.push_back(node.value);
+        Push(Instruction::kPushConstant, program_->constants.size() - 1, 0, 1);
+        return true;
+      case ExpressionNode::kIdentifier:
+        Push(Instruction::kPushLocation, AddName(node.name, node.reference), 0,
+             1);
+        return true;
+      case ExpressionNode::kRandom:
+        Push(Instruction::kRandom, 0, 0, 1);
+        return true;
+      case ExpressionNode::kCall:
+        for (const auto& operand : node.operands) {
+          RETURN_FALSE_IF(!Emit(*operand));
+        }
+        Push(Instruction::kCall, AddName(node.name, internal::SlotReference()),
+             node.operands.size(),
+             1 - static_cast<int>(node.operands.size()));
+        return true;
+      case ExpressionNode::kElementAccess:
+        RETURN_FALSE_IF(!Emit(*node.operands[0]) || !Emit(*node.operands[1]));
+        Push(Instruction::kElementAccess, 0, 0, -1);
+        return true;
+      case ExpressionNode::kUnaryOperation: {
+        Instruction::OpCode opcode;
+        RETURN_FALSE_IF_MSG(!FindUnaryOpCode(node.op_id, &opcode),
+                            node.DebugString());
+        RETURN_FALSE_IF(!Emit(*node.operands[0]));
+        Push(opcode, 0, 0, 0);
+        return true;
+      }
+      case ExpressionNode::kBinaryOperation: {
+        if (node.op_id == internal::kAnd || node.op_id == internal::kOr) {
+          return EmitLogicalOperation(node);
+        }
+        Instruction::OpCode opcode;
+        RETURN_FALSE_IF_MSG(!FindBinaryOpCode(node.op_id, &opcode),
+                            node.DebugString());
+        RETURN_FALSE_IF(!Emit(*node.operands[0]) || !Emit(*node.operands[1]));
+        Push(opcode, 0, 0, -1);
+        return true;
+      }
+    }
+    LOG(DFATAL) << "Unknown expression node type: " << node.type;
+    return false;
+  }
+
+ private:
+  // Emits a '&&' or '||' operation that only runs the right operand if the
+  // left operand does not decide the result.
+  bool EmitLogicalOperation(const internal::ExpressionNode& node) {
+    using internal::ExpressionNode;
+    using internal::Instruction;
+    RETURN_FALSE_IF(!Emit(*node.operands[0]));
+    const ::std::size_t jump = program_->code.size();
+    Push(node.op_id == internal::kAnd ? Instruction::kJumpIfFalse
+                                      : Instruction::kJumpIfTrue,
+         0, 0, -1);
+    const ExpressionNode& rhs = *node.operands[1];
+    RETURN_FALSE_IF(!Emit(rhs));
+    if (!IsBooleanOperation(rhs)) {
+      Push(Instruction::kToBool, 0, 0, 0);
+    }
+    program_->code[jump].operand = program_->code.size();
+    return true;
+  }
+
+  // Appends an instruction that changes the stack size by 'stack_change'.
+  void Push(internal::Instruction::OpCode opcode, int operand,
+            int argument_count, int stack_change) {
+    program_->code.push_back({opcode, operand, argument_count});
+    stack_size_ += stack_change;
+    program_->max_stack_size =
+        std::max(program_->max_stack_size, stack_size_);
+  }
+
+  // Returns the index of 'name' in the names of the program. A name that is
+  // compiled to a slot keeps the first 'reference' that it is added with.
+  int AddName(const string& name, const internal::SlotReference& reference) {
+    auto& names = program_->names;
+    const auto it = std::find(names.begin(), names.end(), name);
+    if (it != names.end()) {
+      auto& existing = program_->references[it - names.begin()];
+      if (existing.slot == SymbolTable::kNoSlot) {
+        existing = reference;
+      }
+      return it - names.begin();
+    }
+    names.push_back(name);
+    program_->references.push_back(reference);
+    return names.size() - 1;
+  }
+
+  internal::BytecodeProgram* const program_;
+  int stack_size_ = 0;
+};
+
+}  // namespace
+
+std::shared_ptr<const CompiledExpression> LightWeightCompilerBase::Compile(
+    const string& expr) const {
+  return Compile(expr, nullptr);
+}
+
+std::shared_ptr<const CompiledExpression> LightWeightCompilerBase::Compile(
+    const string& expr, std::shared_ptr<const SymbolTable> symbols) const {
+  std::shared_ptr<const internal::ExpressionNode> tree =
+      internal::ParseExpression(expr, symbols.get());
+  if (tree == nullptr) {
+    VLOG(1) << "Expression left for evaluation from source: " << expr;
+    return nullptr;
+  }
+  return CompileTree(std::move(tree), std::move(symbols), nullptr);
+}
+
+std::shared_ptr<const CompiledExpression>
+LightWeightCompilerBase::CompileLocation(
+    const string& location, std::shared_ptr<const SymbolTable> symbols) const {
+  std::shared_ptr<const internal::ExpressionNode> tree =
+      internal::ParseExpression(location, symbols.get());
+  if (tree == nullptr) {
+    VLOG(1) << "Location left for evaluation from source: " << location;
+    return nullptr;
+  }
+  auto program = internal::CompileLocation(tree, symbols.get());
+  return CompileTree(std::move(tree), std::move(symbols), std::move(program));
+}
+
+bool LightWeightCompilerBase::GetReadVariables(
+    const string& expr, std::set<string>* variables) const {
+  auto tree = internal::ParseExpression(expr);
+  return tree != nullptr && internal::GetReadVariables(*tree, variables);
+}
+
+std::shared_ptr<const CompiledExpression>
+LightWeightExpressionCompiler::CompileTree(
+    std::shared_ptr<const internal::ExpressionNode> tree,
+    std::shared_ptr<const SymbolTable> symbols,
+    std::unique_ptr<const internal::LocationProgram> location) const {
+  return std::make_shared<internal::CompiledLightWeightExpression>(
+      std::move(tree), std::move(symbols), std::move(location));
+}
+
+std::shared_ptr<const CompiledExpression>
+LightWeightBytecodeCompiler::CompileTree(
+    std::shared_ptr<const internal::ExpressionNode> tree,
+    std::shared_ptr<const SymbolTable> symbols,
+    std::unique_ptr<const internal::LocationProgram> location) const {
+  auto program = internal::CompileSyntaxTree(*tree);
+  if (program == nullptr) {
+    return nullptr;
+  }
+  return std::make_shared<internal::CompiledLightWeightBytecode>(
+      std::move(program), std::move(symbols), std::move(location));
+}
+
+namespace internal {
+
+const char kLightWeightExpressionLanguage[] = "light_weight";
+const char kLightWeightBytecodeLanguage[] = "light_weight_bytecode";
+
+SlotReference MakeSlotReference(const string& name,
+                                const SymbolTable& symbols) {
+  SlotReference reference;
+  // Locations with placeholders or element access are left to Json::Path.
+  if (name.find_first_of("%[]") != string::npos) {
+    return reference;
+  }
+  std::vector<string> parts = absl::StrSplit(name, '.');
+  for (const string& part : parts) {
+    if (part.empty()) {
+      return reference;
+    }
+  }
+  reference.slot = symbols.FindSlot(parts.front());
+  if (reference.slot != SymbolTable::kNoSlot) {
+    reference.members.assign(parts.begin() + 1, parts.end());
+  }
+  return reference;
+}
+
+string ExpressionNode::DebugString() const {
+  switch (type) {
+    case kLiteral: {
+      return ToJsonText(value);
+    }
+    case kIdentifier:
+      return name;
+    case kRandom:
+      return "Math.random()";
+    default:
+      break;
+  }
+  std::vector<string> parts;
+  if (type == kCall) {
+    parts.push_back(absl::StrCat(name, "()"));
+  } else if (type == kElementAccess) {
+    parts.push_back("[]");
+  } else {
+    parts.push_back(OperatorName(op_id));
+  }
+  for (const auto& operand : operands) {
+    parts.push_back(operand->DebugString());
+  }
+  return absl::StrCat("(", absl::StrJoin(parts, " "), ")");
+}
+
+const ExpressionNode* GetSyntaxTree(const Expression& expr) {
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled == nullptr ||
+      strcmp(compiled->language(), kLightWeightExpressionLanguage) != 0) {
+    return nullptr;
+  }
+  return &static_cast<const CompiledLightWeightExpression*>(compiled)->root();
+}
+
+string BytecodeProgram::DebugString() const {
+  static const char* const kMnemonics[] = {
+      "PUSH", "LOAD", "CALL", "RANDOM", "INDEX", "NEG", "NOT",
+      "MUL",  "DIV",  "ADD",  "SUB",    "LT",    "LE",  "GT",
+      "GE",   "EQ",   "NE",   "JUMPF",  "JUMPT", "BOOL",
+  };
+  static_assert(ABSL_ARRAYSIZE(kMnemonics) == Instruction::kToBool + 1,
+                "A mnemonic is required for every opcode.");
+  std::vector<string> lines;
+  for (const Instruction& instruction : code) {
+    string line = kMnemonics[instruction.opcode];
+    if (instruction.opcode == Instruction::kPushConstant) {
+      absl::StrAppend(&line, " ");
+      AppendJsonText(constants[instruction.operand], &line);
+    } else if (instruction.opcode == Instruction::kPushLocation) {
+      absl::StrAppend(&line, " ", names[instruction.operand]);
+    } else if (instruction.opcode == Instruction::kJumpIfFalse ||
+               instruction.opcode == Instruction::kJumpIfTrue) {
+      absl::StrAppend(&line, " ", instruction.operand);
+    } else if (instruction.opcode == Instruction::kCall) {
+      absl::StrAppend(&line, " ", names[instruction.operand], "/",
+                      instruction.argument_count);
+    }
+    lines.push_back(line);
+  }
+  return absl::StrJoin(lines, "\n");
+}
+
+const BytecodeProgram* GetBytecodeProgram(const Expression& expr) {
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled == nullptr ||
+      strcmp(compiled->language(), kLightWeightBytecodeLanguage) != 0) {
+    return nullptr;
+  }
+  return &static_cast<const CompiledLightWeightBytecode*>(compiled)->program();
+}
+
+string LocationProgram::DebugString() const {
+  std::vector<string> parts = {root};
+  for (const Step& step : steps) {
+    if (step.key_expression != nullptr) {
+      parts.push_back(
+          absl::StrCat("[", step.key_expression->DebugString(), "]"));
+    } else if (step.key.isString()) {
+      parts.push_back(absl::StrCat(".", step.key.asString()));
+    } else {
+      parts.push_back(absl::StrCat("[", step.key.asInt(), "]"));
+    }
+  }
+  return absl::StrJoin(parts, " ");
+}
+
+const LocationProgram* GetLocationProgram(const Expression& expr) {
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled == nullptr) {
+    return nullptr;
+  }
+  if (strcmp(compiled->language(), kLightWeightExpressionLanguage) == 0) {
+    return static_cast<const CompiledLightWeightExpression*>(compiled)
+        ->location();
+  }
+  if (strcmp(compiled->language(), kLightWeightBytecodeLanguage) == 0) {
+    return static_cast<const CompiledLightWeightBytecode*>(compiled)
+        ->location();
+  }
+  return nullptr;
+}
+
+const SymbolTable* GetCompiledSymbolTable(const Expression& expr) {
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled == nullptr) {
+    return nullptr;
+  }
+  if (strcmp(compiled->language(), kLightWeightExpressionLanguage) == 0) {
+    return static_cast<const CompiledLightWeightExpression*>(compiled)
+        ->symbols();
+  }
+  if (strcmp(compiled->language(), kLightWeightBytecodeLanguage) == 0) {
+    return static_cast<const CompiledLightWeightBytecode*>(compiled)->symbols();
+  }
+  return nullptr;
+}
+
+std::unique_ptr<const LocationProgram> CompileLocation(
+    std::shared_ptr<const ExpressionNode> tree, const SymbolTable* symbols) {
+  if (tree == nullptr) {
+    return nullptr;
+  }
+  auto program = absl::make_unique<LocationProgram>();
+  // Collect the keys of the element accesses from the outermost inwards.
+  const ExpressionNode* root = tree.get();
+  std::vector<const ExpressionNode*> key_nodes;
+  while (root->type == ExpressionNode::kElementAccess) {
+    key_nodes.push_back(root->operands[1].get());
+    root = root->operands[0].get();
+  }
+  if (root->type != ExpressionNode::kIdentifier ||
+      root->name.find_first_of("%[]") != string::npos) {
+    return nullptr;
+  }
+  std::vector<string> members = absl::StrSplit(root->name, '.');
+  program->root = members.front();
+  program->paths.push_back(members.front());
+  for (std::size_t i = 0; i < members.size(); ++i) {
+    if (members[i].empty()) {
+      return nullptr;
+    }
+    if (i > 0) {
+      program->paths.push_back(
+          absl::StrCat(program->paths.back(), ".", members[i]));
+      program->steps.emplace_back();
+      program->steps.back().key = members[i];
+    }
+  }
+  if (symbols != nullptr) {
+    program->slot = symbols->FindSlot(program->root);
+  }
+  for (auto it = key_nodes.rbegin(); it != key_nodes.rend(); ++it) {
+    LocationProgram::Step step;
+    if ((*it)->type == ExpressionNode::kLiteral &&
+        ((*it)->value.isString() || (*it)->value.isIntegral())) {
+      step.key = (*it)->value;
+    } else {
+      step.key_expression = *it;
+    }
+    program->steps.push_back(step);
+  }
+  program->tree = std::move(tree);
+  return program;
+}
+
+std::unique_ptr<const BytecodeProgram> CompileSyntaxTree(
+    const ExpressionNode& tree) {
+  auto program = absl::make_unique<BytecodeProgram>();
+  if (!BytecodeEmitter(program.get()).Emit(tree)) {
+    return nullptr;
+  }
+  return program;
+}
+
+std::unique_ptr<const ExpressionNode> ParseExpression(const string& expr) {
+  return ParseExpression(expr, nullptr);
+}
+
+std::unique_ptr<const ExpressionNode> ParseExpression(
+    const string& expr, const SymbolTable* symbols) {
+  string expression = expr;
+  absl::StripAsciiWhitespace(&expression);
+  if (expression.empty()) {
+    return nullptr;
+  }
+  // The whole expression may be a single literal, e.g., a JSON object.
+  Json::Value value;
+  if (ParseLiteral(expression, &value)) {
+    auto node = absl::make_unique<ExpressionNode>(ExpressionNode::kLiteral);
+    node->value = value;
+    return node;
+  }
+  std::vector<absl::string_view> tokens;
+  TokenizeExpression(expression, &tokens);
+  return Parser(MakeLexemes(tokens), symbols).Parse();
+}
+
+bool GetReadVariables(const ExpressionNode& tree,
+                      std::set<string>* variables) {
+  switch (tree.type) {
+    case ExpressionNode::kLiteral:
+      return true;
+    case ExpressionNode::kIdentifier: {
+      const string root = tree.name.substr(0, tree.name.find_first_of(".["));
+      if (root.empty()) {
+        return false;
+      }
+      variables->insert(root);
+      return true;
+    }
+    case ExpressionNode::kCall:
+    case ExpressionNode::kRandom:
+      return false;
+    default:
+      for (const auto& operand : tree.operands) {
+        if (!GetReadVariables(*operand, variables)) {
+          return false;
+        }
+      }
+      return true;
+  }
+}
+
+bool ParseLiteral(const string& expr, Json::Value* value) {
+  int64 value_i = 0;
+  double value_d = 0;
+  if (expr.empty() || expr == "null") {
+    *value = Json::Value();
+  } else if (expr == "true") {
+    *value = Json::Value(true);
+  } else if (expr == "false") {
+    *value = Json::Value(false);
+  } else if (absl::SimpleAtoi(expr, &value_i)) {
+    *value = Json::Value(value_i);
+  } else if (absl::SimpleAtod(expr, &value_d)) {
+    *value = Json::Value(value_d);
+  } else if (IsQuotedString(expr)) {
+    *value = Json::Value(Unquote(expr));
+  } else if ((MaybeJSONArray(expr) || MaybeJSON(expr)) &&
+             ParseJsonText(expr, value)) {
+    // MaybeJSON*() is required as the reader will parse "1 + 1" as valid
+    // Json::Value string.
+  } else {
+    return false;
+  }
+  return true;
+}
+
+OperatorId FindOperatorId(absl::string_view op) {
+  for (int id = kComma; id <= kNot; ++id) {
+    if (op == kOperatorNames[id]) {
+      return static_cast<OperatorId>(id);
+    }
+  }
+  return kNoOperator;
+}
+
+const char* OperatorName(OperatorId op) { return kOperatorNames[op]; }
+
+bool IsOperator(const string& str) {
+  return FindOperatorId(str) != kNoOperator;
+}
+
+void TokenizeExpression(absl::string_view expr,
+                        std::vector<absl::string_view>* tokens) {
+  tokens->clear();
+  CharSet::Scanner special_chars(SpecialChars(), expr);
+  // Marks the start of an operand token (i.e. a non-operator token).
+  ::std::size_t token_start = 0;
+  for (::std::size_t i = 0; i < expr.size(); ++i) {
+    // Skip the characters of the operand.
+    i = special_chars.Next(i);
+    if (i == expr.size()) {
+      break;
+    }
+    if (expr[i] == '"' || expr[i] == '\'') {
+      // Skip to the closing quote of the same type that is not escaped. An
+      // unterminated string extends to the end of the expression.
+      ::std::size_t end = i;
+      do {
+        end = expr.find(expr[i], end + 1);
+      } while (end != absl::string_view::npos && expr[end - 1] == '\\');
+      if (end == absl::string_view::npos) {
+        break;
+      }
+      i = end;
+      continue;
+    }
+    const ::std::size_t op_size = OperatorSizeAt(expr, i);
+    if (op_size == 0) {
+      continue;
+    }
+    // Write out the current operand token.
+    AppendOperand(expr.substr(token_start, i - token_start), tokens);
+    // Write the operator.
+    tokens->push_back(expr.substr(i, op_size));
+    // Next operand comes after operator.
+    token_start = i + op_size;
+    i += op_size - 1;
+  }
+  // Store the final operand.
+  if (token_start < expr.size()) {
+    AppendOperand(expr.substr(token_start), tokens);
+  }
+}
+
+void TokenizeExpression(const string& expr, std::list<string>* tokens) {
+  std::vector<absl::string_view> token_views;
+  TokenizeExpression(expr, &token_views);
+  for (const absl::string_view token : token_views) {
+    tokens->emplace_back(token);
+  }
+}
+
+}  // namespace internal
+
+}  // namespace state_chart
@@ -0,0 +1,420 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Parsing and compilation of the expression language of the
+// LightWeightDatamodel.
+
+#ifndef STATE_CHART_INTERNAL_LIGHT_WEIGHT_EXPRESSION_H_
+#define STATE_CHART_INTERNAL_LIGHT_WEIGHT_EXPRESSION_H_
+
+#include <list>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+namespace internal {
+struct ExpressionNode;
+struct LocationProgram;
+}  // namespace internal
+
+// The common parts of the compilers of LightWeightDatamodel expressions.
+// Expressions are parsed into syntax trees, which subclasses compile into
+// their CompiledExpression.
+class LightWeightCompilerBase : public ExpressionCompiler {
+ public:
+  LightWeightCompilerBase(const LightWeightCompilerBase&) = delete;
+  LightWeightCompilerBase& operator=(const LightWeightCompilerBase&) = delete;
+  ~LightWeightCompilerBase() override = default;
+
+  // Returns nullptr for empty expressions and for expressions that the parser
+  // does not support. These are left to be evaluated from source.
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const override;
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr,
+      std::shared_ptr<const SymbolTable> symbols) const override;
+
+  // Locations are compiled together with their location programs.
+  std::shared_ptr<const CompiledExpression> CompileLocation(
+      const string& location,
+      std::shared_ptr<const SymbolTable> symbols) const override;
+
+  bool GetReadVariables(const string& expr,
+                        std::set<string>* variables) const override;
+
+ protected:
+  LightWeightCompilerBase() = default;
+
+  // Compiles the syntax 'tree' of an expression that was parsed with
+  // 'symbols'. 'location' is the location program of the tree if it was
+  // compiled as a location, otherwise nullptr. Returns nullptr if the tree
+  // cannot be compiled.
+  virtual std::shared_ptr<const CompiledExpression> CompileTree(
+      std::shared_ptr<const internal::ExpressionNode> tree,
+      std::shared_ptr<const SymbolTable> symbols,
+      std::unique_ptr<const internal::LocationProgram> location) const = 0;
+};
+
+// Compiles expressions of the LightWeightDatamodel into syntax trees.
+class LightWeightExpressionCompiler : public LightWeightCompilerBase {
+ public:
+  LightWeightExpressionCompiler() = default;
+  ~LightWeightExpressionCompiler() override = default;
+
+ protected:
+  std::shared_ptr<const CompiledExpression> CompileTree(
+      std::shared_ptr<const internal::ExpressionNode> tree,
+      std::shared_ptr<const SymbolTable> symbols,
+      std::unique_ptr<const internal::LocationProgram> location)
+      const override;
+};
+
+// Compiles expressions of the LightWeightDatamodel into bytecode programs that
+// run on a stack machine. The results are the same as those of evaluating the
+// syntax trees of LightWeightExpressionCompiler.
+class LightWeightBytecodeCompiler : public LightWeightCompilerBase {
+ public:
+  LightWeightBytecodeCompiler() = default;
+  ~LightWeightBytecodeCompiler() override = default;
+
+ protected:
+  std::shared_ptr<const CompiledExpression> CompileTree(
+      std::shared_ptr<const internal::ExpressionNode> tree,
+      std::shared_ptr<const SymbolTable> symbols,
+      std::unique_ptr<const internal::LocationProgram> location)
+      const override;
+};
+
+// Internal functions, do not use.
+namespace internal {
+
+// The language name of expressions compiled by LightWeightExpressionCompiler.
+extern const char kLightWeightExpressionLanguage[];
+
+// The language name of expressions compiled by LightWeightBytecodeCompiler.
+extern const char kLightWeightBytecodeLanguage[];
+
+// A location that is compiled to the 'slot' of its top-level variable in a
+// SymbolTable, followed by the dot separated 'members' under the variable,
+// e.g., "_event.data.x" is the member path {"data", "x"} of the slot of
+// "_event".
+struct SlotReference {
+  int slot = SymbolTable::kNoSlot;
+  std::vector<string> members;
+};
+
+// Returns the reference of the dot separated location 'name' in 'symbols'. The
+// slot is kNoSlot if the root of 'name' is not in 'symbols' or 'name' is not a
+// plain dot separated path.
+SlotReference MakeSlotReference(const string& name,
+                                const SymbolTable& symbols);
+
+// The operators of the expression language.
+enum OperatorId {
+  kNoOperator,
+  kComma,
+  kOpenParenthesis,
+  kCloseParenthesis,
+  kOpenBracket,
+  kCloseBracket,
+  kPlus,
+  kMinus,
+  kMultiply,
+  kDivide,
+  kLess,
+  kLessEqual,
+  kEqual,
+  kNotEqual,
+  kGreaterEqual,
+  kGreater,
+  kAnd,
+  kOr,
+  kNot,
+};
+
+// Returns the id of the operator 'op', or kNoOperator if 'op' is not an
+// operator.
+OperatorId FindOperatorId(absl::string_view op);
+
+// Returns the text of 'op', e.g., "&&" for kAnd.
+const char* OperatorName(OperatorId op);
+
+// A node in the syntax tree of an expression. The tree only depends on the
+// expression text and the SymbolTable it was compiled with. Names are resolved
+// against the store and the function dispatcher when the tree is evaluated, so
+// that a tree may be shared by many datamodels.
+struct ExpressionNode {
+  enum Type {
+    // A constant 'value'.
+    kLiteral,
+    // A dot separated store location 'name', e.g., "foo.bar".
+    kIdentifier,
+    // A call to the system function 'name' with 'operands' as arguments.
+    kCall,
+    // The built-in 'Math.random()'.
+    kRandom,
+    // Element access 'operands[0]' [ 'operands[1]' ].
+    kElementAccess,
+    // Unary operator 'op_id' applied on 'operands[0]'.
+    kUnaryOperation,
+    // Binary operator 'op_id' applied on 'operands[0]' and 'operands[1]'.
+    kBinaryOperation,
+  };
+
+  explicit ExpressionNode(Type type) : type(type) {}
+
+  // Prints the tree in prefix notation, e.g., "(+ 1 (* a 2))".
+  string DebugString() const;
+
+  const Type type;
+  Json::Value value;
+  string name;
+  // The slot of an identifier if the tree was compiled with a SymbolTable.
+  SlotReference reference;
+  // The operator of an operation, resolved when the tree is parsed.
+  OperatorId op_id = kNoOperator;
+  std::vector<std::unique_ptr<const ExpressionNode>> operands;
+};
+
+// A compiled location of the form "root.member1...memberN[key1]...[keyM]".
+// Values are assigned to the location by walking its steps from the
+// top-level variable 'root', without parsing the location.
+struct LocationProgram {
+  // A member name or an array index of the location.
+  struct Step {
+    // The constant key of the step, a string or an integer. Null if the key
+    // is computed by 'key_expression'.
+    Json::Value key;
+    // Points into 'tree'.
+    const ExpressionNode* key_expression = nullptr;
+  };
+
+  // Prints the root and the steps, e.g., "a .b [1] [(+ i 1)]".
+  string DebugString() const;
+
+  // The syntax tree of the location, which owns the key expressions. It is
+  // shared with the CompiledLightWeightExpression of the location.
+  std::shared_ptr<const ExpressionNode> tree;
+  string root;
+  // The slot of 'root' if the location was compiled with a SymbolTable.
+  int slot = SymbolTable::kNoSlot;
+  // The dot separated paths from 'root' to each member, e.g., "a" and "a.b"
+  // for "a.b[0]". None of them may be a function name.
+  std::vector<string> paths;
+  std::vector<Step> steps;
+};
+
+// The compiled form of a LightWeightDatamodel expression.
+class CompiledLightWeightExpression : public CompiledExpression {
+ public:
+  CompiledLightWeightExpression(
+      std::shared_ptr<const ExpressionNode> root,
+      std::shared_ptr<const SymbolTable> symbols,
+      std::unique_ptr<const LocationProgram> location = nullptr)
+      : root_(std::move(root)),
+        symbols_(std::move(symbols)),
+        location_(std::move(location)) {}
+  ~CompiledLightWeightExpression() override = default;
+
+  const char* language() const override {
+    return kLightWeightExpressionLanguage;
+  }
+
+  const ExpressionNode& root() const { return *root_; }
+
+  // The symbols that the slots of identifiers refer to, may be nullptr.
+  const SymbolTable* symbols() const { return symbols_.get(); }
+
+  // The program of the expression if it was compiled as a location, otherwise
+  // nullptr.
+  const LocationProgram* location() const { return location_.get(); }
+
+ private:
+  const std::shared_ptr<const ExpressionNode> root_;
+  const std::shared_ptr<const SymbolTable> symbols_;
+  const std::unique_ptr<const LocationProgram> location_;
+};
+
+// An instruction of the stack machine. Operands are popped from and results
+// are pushed onto the stack of the machine.
+struct Instruction {
+  enum OpCode {
+    // Pushes 'constants[operand]'.
+    kPushConstant,
+    // Pushes the store location 'names[operand]', which may be compiled to
+    // 'references[operand]'.
+    kPushLocation,
+    // Pops 'argument_count' arguments and pushes the result of calling the
+    // system function 'names[operand]'.
+    kCall,
+    // Pushes a random number in [0, 1).
+    kRandom,
+    // Pops a key and an array or object and pushes the element at the key.
+    kElementAccess,
+    // Unary operators, pop one operand.
+    kNegate,
+    kNot,
+    // Binary operators, pop two operands.
+    kMultiply,
+    kDivide,
+    kAdd,
+    kSubtract,
+    kLess,
+    kLessEqual,
+    kGreater,
+    kGreaterEqual,
+    kEqual,
+    kNotEqual,
+    // Logical operators. If the top of the stack converts to false (true),
+    // replaces it with false (true) and jumps to the instruction 'operand',
+    // otherwise pops it. This skips the right operand of '&&' ('||') when the
+    // left operand decides the result.
+    kJumpIfFalse,
+    kJumpIfTrue,
+    // Replaces the top of the stack with its boolean value.
+    kToBool,
+  };
+
+  OpCode opcode;
+  int operand;
+  int argument_count;
+};
+
+// A compiled bytecode program of an expression.
+struct BytecodeProgram {
+  // Prints one instruction per line, e.g., "LOAD a\nPUSH 1\nADD". Jumps are
+  // printed with the index of their target instruction, e.g., "JUMPF 3".
+  string DebugString() const;
+
+  std::vector<Instruction> code;
+  std::vector<Json::Value> constants;
+  std::vector<string> names;
+  // The slot references of 'names'.
+  std::vector<SlotReference> references;
+  // The maximum number of values on the stack while running 'code'.
+  int max_stack_size = 0;
+};
+
+// The compiled form of a LightWeightDatamodel expression as bytecode.
+class CompiledLightWeightBytecode : public CompiledExpression {
+ public:
+  CompiledLightWeightBytecode(
+      std::unique_ptr<const BytecodeProgram> program,
+      std::shared_ptr<const SymbolTable> symbols,
+      std::unique_ptr<const LocationProgram> location = nullptr)
+      : program_(std::move(program)),
+        symbols_(std::move(symbols)),
+        location_(std::move(location)) {}
+  ~CompiledLightWeightBytecode() override = default;
+
+  const char* language() const override {
+    return kLightWeightBytecodeLanguage;
+  }
+
+  const BytecodeProgram& program() const { return *program_; }
+
+  // The symbols that the slot references of the program refer to, may be
+  // nullptr.
+  const SymbolTable* symbols() const { return symbols_.get(); }
+
+  // The program of the expression if it was compiled as a location, otherwise
+  // nullptr.
+  const LocationProgram* location() const { return location_.get(); }
+
+ private:
+  const std::unique_ptr<const BytecodeProgram> program_;
+  const std::shared_ptr<const SymbolTable> symbols_;
+  const std::unique_ptr<const LocationProgram> location_;
+};
+
+// Returns the syntax tree of 'expr' if it was compiled by
+// LightWeightExpressionCompiler, otherwise nullptr.
+const ExpressionNode* GetSyntaxTree(const Expression& expr);
+
+// Returns the bytecode program of 'expr' if it was compiled by
+// LightWeightBytecodeCompiler, otherwise nullptr.
+const BytecodeProgram* GetBytecodeProgram(const Expression& expr);
+
+// Returns the SymbolTable that 'expr' was compiled with by
+// LightWeightExpressionCompiler or LightWeightBytecodeCompiler, otherwise
+// nullptr.
+const SymbolTable* GetCompiledSymbolTable(const Expression& expr);
+
+// Returns the location program of 'expr' if it was compiled as a location by
+// LightWeightExpressionCompiler or LightWeightBytecodeCompiler, otherwise
+// nullptr.
+const LocationProgram* GetLocationProgram(const Expression& expr);
+
+// Compiles the syntax tree of a location into a location program, which
+// shares 'tree'. Returns nullptr if 'tree' is not of the form
+// "root.member1...memberN[key1]...[keyM]". The root is compiled to its slot in
+// 'symbols' if 'symbols' is not nullptr.
+std::unique_ptr<const LocationProgram> CompileLocation(
+    std::shared_ptr<const ExpressionNode> tree, const SymbolTable* symbols);
+
+// Compiles a syntax tree into a bytecode program. Returns nullptr if the tree
+// contains an unknown operator.
+std::unique_ptr<const BytecodeProgram> CompileSyntaxTree(
+    const ExpressionNode& tree);
+
+// Parses an expression into a syntax tree. Returns nullptr if the expression
+// is empty or could not be parsed.
+std::unique_ptr<const ExpressionNode> ParseExpression(const string& expr);
+
+// Same as above, but identifiers are compiled to their slots in 'symbols' if
+// 'symbols' is not nullptr.
+std::unique_ptr<const ExpressionNode> ParseExpression(
+    const string& expr, const SymbolTable* symbols);
+
+// Adds the root variables of the identifiers in 'tree', e.g., "foo" for
+// "foo.bar", to 'variables'. Returns false if the value of 'tree' may depend on
+// anything else than these variables and literals, i.e., if it contains a
+// function call or 'Math.random()'.
+bool GetReadVariables(const ExpressionNode& tree, std::set<string>* variables);
+
+// Parses a literal value expression: null, true, false, a number, a quoted
+// string or a JSON object or array. An empty expression is a null value.
+// Returns false if 'expr' is not a literal.
+bool ParseLiteral(const string& expr, Json::Value* value);
+
+// Returns true if 'str' is an operator of the expression language.
+bool IsOperator(const string& str);
+
+// Converts an expression into a list of string tokens. Tokens are either
+// operators or operands. Excess trailing and leading whitespace for each token
+// are stripped.
+// The tokens are views into 'expr'. 'tokens' is cleared first, so that the same
+// buffer may be reused for tokenizing many expressions.
+void TokenizeExpression(absl::string_view expr,
+                        std::vector<absl::string_view>* tokens);
+
+// Same as above, but copies the tokens into strings.
+void TokenizeExpression(const string& expr, std::list<string>* tokens);
+
+}  // namespace internal
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_LIGHT_WEIGHT_EXPRESSION_H_
@@ -0,0 +1,102 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "statechart/internal/light_weight_expression.h"
+#include "statechart/platform/types.h"
+
+#include <benchmark/benchmark.h>
+
+namespace state_chart {
+namespace {
+
+// A guard with 'clauses' comparisons joined by '&&' and '||'.
+string LongExpression(int clauses) {
+  string expr;
+  for (int i = 0; i < clauses; ++i) {
+    absl::StrAppend(&expr, i == 0 ? "" : (i % 3 == 0 ? " || " : " && "),
+                    "_event.data.values[", i, "] >= ", i, " * 2");
+  }
+  return expr;
+}
+
+// A JSON literal with 'elements' objects that is embedded in an expression.
+string JsonLiteralExpression(int elements) {
+  string expr = "count([";
+  for (int i = 0; i < elements; ++i) {
+    absl::StrAppend(&expr, i == 0 ? "" : ", ", "{\"id\": ", i,
+                    ", \"name\": \"element ", i,
+                    "\", \"tags\": [\"a\", \"b\"]}");
+  }
+  absl::StrAppend(&expr, "]) > 0");
+  return expr;
+}
+
+// A JSON object with a 'size' character description that is compared to an
+// event field, so that operands are long and operators sparse.
+string LongOperandExpression(int size) {
+  return absl::StrCat("_event.data.description == {\"kind\": \"note\", ",
+                      "\"description\": \"", string(size, 'x'), "\"}");
+}
+
+void TokenizeToList(benchmark::State& state, const string& expr) {
+  for (auto _ : state) {
+    std::list<string> tokens;
+    internal::TokenizeExpression(expr, &tokens);
+    benchmark::DoNotOptimize(tokens);
+  }
+  state.SetBytesProcessed(state.iterations() * expr.size());
+}
+
+void TokenizeToViews(benchmark::State& state, const string& expr) {
+  std::vector<absl::string_view> tokens;
+  for (auto _ : state) {
+    internal::TokenizeExpression(expr, &tokens);
+    benchmark::DoNotOptimize(tokens);
+  }
+  state.SetBytesProcessed(state.iterations() * expr.size());
+}
+
+void BM_TokenizeLongExpressionToList(benchmark::State& state) {
+  TokenizeToList(state, LongExpression(state.range(0)));
+}
+BENCHMARK(BM_TokenizeLongExpressionToList)->Arg(1)->Arg(10)->Arg(100);
+
+void BM_TokenizeLongExpressionToViews(benchmark::State& state) {
+  TokenizeToViews(state, LongExpression(state.range(0)));
+}
+BENCHMARK(BM_TokenizeLongExpressionToViews)->Arg(1)->Arg(10)->Arg(100);
+
+void BM_TokenizeJsonLiteralToList(benchmark::State& state) {
+  TokenizeToList(state, JsonLiteralExpression(state.range(0)));
+}
+BENCHMARK(BM_TokenizeJsonLiteralToList)->Arg(10)->Arg(1000);
+
+void BM_TokenizeJsonLiteralToViews(benchmark::State& state) {
+  TokenizeToViews(state, JsonLiteralExpression(state.range(0)));
+}
+BENCHMARK(BM_TokenizeJsonLiteralToViews)->Arg(10)->Arg(1000);
+
+void BM_TokenizeLongOperandToViews(benchmark::State& state) {
+  TokenizeToViews(state, LongOperandExpression(state.range(0)));
+}
+BENCHMARK(BM_TokenizeLongOperandToViews)->Arg(100)->Arg(10000);
+
+}  // namespace
+}  // namespace state_chart
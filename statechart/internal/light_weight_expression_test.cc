@@ -0,0 +1,348 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/light_weight_expression.h"
+
+#include <list>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "absl/strings/string_view.h"
+#include "include/json/json.h"
+
+using testing::ElementsAre;
+using testing::ElementsAreArray;
+
+namespace state_chart {
+namespace {
+
+// Test that the tokenizer can tokenize the expressions we are supporting.
+TEST(InternalTokenizeExpression, TokenizeExpression) {
+  std::pair<string, std::vector<string>> cases[] = {
+      // Values that are numbers.
+      {"1", {"1"}},
+      {"1.2", {"1.2"}},
+      {" 1.2 ", {"1.2"}},
+      // String values.
+      {"\"ABC\"", {"\"ABC\""}},
+      {"\"A B C \" ", {"\"A B C \""}},
+      {"\"A \\\"B C\" ", {"\"A \\\"B C\""}},
+      {"\"A 'B' C\" ", {"\"A 'B' C\""}},
+      // Single quoted string values.
+      {"'ABC'", {"'ABC'"}},
+      {"'A B C ' ", {"'A B C '"}},
+      {"'A \'B C'", {"'A \'B C'"}},
+      {"'A \"B\" C'", {"'A \"B\" C'"}},
+      // Locations.
+      {"_foo.bar", {"_foo.bar"}},
+      {" foo.bar ", {"foo.bar"}},
+      {"foo ", {"foo"}},
+      // Unary or Binary operations.
+      {"\"A B\" + \" C D\"", {"\"A B\"", "+", "\" C D\""}},
+      {"\"A\" + foo.bar", {"\"A\"", "+", "foo.bar"}},
+      {"foo.bar / 0.34", {"foo.bar", "/", "0.34"}},
+      {"foo.bar != bar.foo", {"foo.bar", "!=", "bar.foo"}},
+      {"- 1", {"-", "1"}},
+      // Mixed string quotes expressions.
+      {"\"A B\" + 'C D'", {"\"A B\"", "+", "'C D'"}},
+      // Function call.
+      {" Math.Random() ", {"Math.Random", "(", ")"}},
+      {"binary_op( a +b, c -d  )",
+       {"binary_op", "(", "a", "+", "b", ",", "c", "-", "d", ")"}},
+      // Array addressing.
+      {"foo.bar[5]", {"foo.bar", "[", "5", "]"}},
+      {"foo.bar[i+1]", {"foo.bar", "[", "i", "+", "1", "]"}},
+      // Dictionary addressing.
+      {"foo[\"bar\"]", {"foo", "[", "\"bar\"", "]"}},
+      {"foo[\"bar\" + \"goo\"]", {"foo", "[", "\"bar\"", "+", "\"goo\"", "]"}},
+      {"foo[bar]", {"foo", "[", "bar", "]"}},
+      // Nested object addressing.
+      {"foo[1][2]", {"foo", "[", "1", "]", "[", "2", "]"}},
+      {"foo[\"bar\"][\"goo\"]",
+       {"foo", "[", "\"bar\"", "]", "[", "\"goo\"", "]"}},
+      {"foo[1][\"bar\"]", {"foo", "[", "1", "]", "[", "\"bar\"", "]"}},
+      {"foo[1].bar[2]", {"foo", "[", "1", "]", ".bar", "[", "2", "]"}},
+      {"foo[\"goo\"].bar[2]",
+       {"foo", "[", "\"goo\"", "]", ".bar", "[", "2", "]"}},
+      // Complex expressions.
+      {"1 *2   +  3", {"1", "*", "2", "+", "3"}},
+      {"A < B && ( C >= D || C <= E )",
+       {"A", "<", "B", "&&", "(", "C", ">=", "D", "||", "C", "<=", "E", ")"}},
+      {" - ( foo.bar - bar.foo )", {"-", "(", "foo.bar", "-", "bar.foo", ")"}},
+      {"binary_op( \"str\" + Math.random(), Math.random() * 2 )",
+       {"binary_op", "(", "\"str\"", "+", "Math.random", "(", ")", ",",
+        "Math.random", "(", ")", "*", "2", ")"}},
+      {"foo.op1(foo.op2(a - b()) + goo_op(foo.op4(bar)))",
+       {"foo.op1", "(", "foo.op2", "(", "a", "-", "b", "(", ")", ")", "+",
+        "goo_op", "(", "foo.op4", "(", "bar", ")", ")", ")"}},
+      // Characters that only form operators in pairs.
+      {"a = b & c | d", {"a = b & c | d"}},
+      {"a==b||!c", {"a", "==", "b", "||", "!", "c"}},
+      // Unterminated strings extend to the end.
+      {"1 + 'A + B", {"1", "+", "'A + B"}},
+      {"\"A\\\" + B", {"\"A\\\" + B"}},
+  };
+
+  // The buffer of string views is reused for all expressions.
+  std::vector<absl::string_view> token_views;
+  for (const auto& test_case : cases) {
+    std::list<string> tokens;
+    internal::TokenizeExpression(test_case.first, &tokens);
+    EXPECT_THAT(tokens, ElementsAreArray(test_case.second)) << test_case.first;
+
+    internal::TokenizeExpression(absl::string_view(test_case.first),
+                                 &token_views);
+    EXPECT_THAT(token_views, ElementsAreArray(test_case.second))
+        << test_case.first;
+  }
+}
+
+// Test that literals are parsed the same way as value tokens are created by the
+// evaluator.
+TEST(InternalParseLiteral, ParseLiteral) {
+  const std::pair<string, Json::Value> cases[] = {
+      {"", Json::Value()},
+      {"null", Json::Value()},
+      {"true", Json::Value(true)},
+      {"false", Json::Value(false)},
+      {"1", Json::Value(1)},
+      {"1.5", Json::Value(1.5)},
+      {"\"str\"", Json::Value("str")},
+      {"[1]", Json::Value(Json::arrayValue)},
+      {"{}", Json::Value(Json::objectValue)},
+  };
+  for (const auto& test_case : cases) {
+    Json::Value value(123);
+    EXPECT_TRUE(internal::ParseLiteral(test_case.first, &value))
+        << test_case.first;
+    EXPECT_EQ(test_case.second.type(), value.type()) << test_case.first;
+    if (!value.isArray()) {
+      EXPECT_EQ(test_case.second, value) << test_case.first;
+    }
+  }
+
+  for (const char* not_literal : {"foo", "1 + 1", "'str'", "foo.bar"}) {
+    Json::Value value;
+    EXPECT_FALSE(internal::ParseLiteral(not_literal, &value)) << not_literal;
+  }
+}
+
+// Test that expressions are parsed with the precedence and associativity of
+// the evaluator.
+TEST(InternalParseExpression, ParseExpression) {
+  const std::pair<string, string> cases[] = {
+      // Values and locations.
+      {"1", "1"},
+      {" 'A B' ", "\"A B\""},
+      {R"({"key":"value"})", R"({"key":"value"})"},
+      {"foo.bar", "foo.bar"},
+      // Arithmetic precedence and left associativity.
+      {"1 + 2 * 3", "(+ 1 (* 2 3))"},
+      {"1 - 2 - 3", "(- (- 1 2) 3)"},
+      {"(1 - 2) * 3", "(* (- 1 2) 3)"},
+      {"- 1 - -a", "(- (- 1) (- a))"},
+      {"!!a", "(! (! a))"},
+      // Comparisons and logical operators.
+      {"a < b == c >= d", "(== (< a b) (>= c d))"},
+      {"a || b && c || d", "(|| (|| a (&& b c)) d)"},
+      {"!a && -b < 2", "(&& (! a) (< (- b) 2))"},
+      {"a * b + c < d == e && f || g",
+       "(|| (&& (== (< (+ (* a b) c) d) e) f) g)"},
+      {"a || b && c == d < e + f * g",
+       "(|| a (&& b (== c (< d (+ e (* f g))))))"},
+      // Element access with subpaths.
+      {"foo[1].bar[i + 1]", "([] ([] ([] foo 1) \"bar\") (+ i 1))"},
+      {"-a[0]", "(- ([] a 0))"},
+      // Function calls.
+      {"f()", "(f())"},
+      {"f(a, g(1) + 2)", "(f() a (+ (g() 1) 2))"},
+      {"f().bar", "([] (f()) \"bar\")"},
+      {"Math.random() * 2", "(* Math.random() 2)"},
+      {"In('state')", "(In() \"state\")"},
+  };
+  for (const auto& test_case : cases) {
+    auto tree = internal::ParseExpression(test_case.first);
+    ASSERT_NE(nullptr, tree) << test_case.first;
+    EXPECT_EQ(test_case.second, tree->DebugString()) << test_case.first;
+  }
+
+  const string invalid_cases[] = {
+      "",   "  ", "1 +", "(1", "1)", ")0(", "a[1", "a[]", "f(1,", "f(,)",
+      "1 (2)", "*1",
+  };
+  for (const auto& invalid_case : invalid_cases) {
+    EXPECT_EQ(nullptr, internal::ParseExpression(invalid_case))
+        << invalid_case;
+  }
+}
+
+// Test that operators are resolved to their ids when the tree is parsed.
+TEST(InternalParseExpression, ParseExpressionResolvesOperatorIds) {
+  const auto tree = internal::ParseExpression("!a && b <= -c");
+  ASSERT_NE(nullptr, tree);
+  // (&& (! a) (<= b (- c)))
+  EXPECT_EQ(internal::kAnd, tree->op_id);
+  EXPECT_EQ(internal::kNot, tree->operands[0]->op_id);
+  EXPECT_EQ(internal::kLessEqual, tree->operands[1]->op_id);
+  EXPECT_EQ(internal::kMinus, tree->operands[1]->operands[1]->op_id);
+  EXPECT_EQ(internal::kNoOperator, tree->operands[1]->operands[0]->op_id);
+
+  EXPECT_EQ(internal::kNotEqual, internal::FindOperatorId("!="));
+  EXPECT_EQ(internal::kNoOperator, internal::FindOperatorId("!=="));
+  EXPECT_STREQ("||", internal::OperatorName(internal::kOr));
+}
+
+// Test that identifiers are compiled to the slots of their top-level variables.
+TEST(InternalParseExpression, ParseExpressionWithSymbols) {
+  SymbolTable symbols;
+  symbols.AddSymbol("_event");
+  symbols.AddSymbol("foo");
+
+  const auto tree =
+      internal::ParseExpression("_event.data.x + foo[1] + bar", &symbols);
+  ASSERT_NE(nullptr, tree);
+  // (+ (+ _event.data.x ([] foo 1)) bar)
+  const internal::ExpressionNode& event = *tree->operands[0]->operands[0];
+  EXPECT_EQ(0, event.reference.slot);
+  EXPECT_THAT(event.reference.members, ElementsAre("data", "x"));
+  const internal::ExpressionNode& foo =
+      *tree->operands[0]->operands[1]->operands[0];
+  EXPECT_EQ(1, foo.reference.slot);
+  EXPECT_TRUE(foo.reference.members.empty());
+  EXPECT_EQ(SymbolTable::kNoSlot, tree->operands[1]->reference.slot);
+
+  EXPECT_EQ(SymbolTable::kNoSlot,
+            internal::MakeSlotReference("foo..bar", symbols).slot);
+  EXPECT_EQ(SymbolTable::kNoSlot,
+            internal::MakeSlotReference("foo.%1", symbols).slot);
+  EXPECT_EQ(SymbolTable::kNoSlot,
+            internal::ParseExpression("foo")->reference.slot);
+}
+
+TEST(LightWeightExpressionCompiler, Compile) {
+  LightWeightExpressionCompiler compiler;
+
+  Expression expr("a + 1", compiler.Compile("a + 1"));
+  ASSERT_NE(nullptr, expr.compiled());
+  EXPECT_STREQ(internal::kLightWeightExpressionLanguage,
+               expr.compiled()->language());
+  const internal::ExpressionNode* tree = internal::GetSyntaxTree(expr);
+  ASSERT_NE(nullptr, tree);
+  EXPECT_EQ("(+ a 1)", tree->DebugString());
+
+  // Expressions that cannot be parsed are left uncompiled.
+  EXPECT_EQ(nullptr, compiler.Compile(""));
+  EXPECT_EQ(nullptr, compiler.Compile("1 +"));
+  EXPECT_EQ(nullptr, internal::GetSyntaxTree(Expression("a + 1")));
+  EXPECT_EQ(nullptr, internal::GetBytecodeProgram(expr));
+}
+
+TEST(LightWeightBytecodeCompiler, Compile) {
+  LightWeightBytecodeCompiler compiler;
+
+  const string source = "f(a[0], 'x') + -b.c * 2 || !In('s') && Math.random()";
+  Expression expr(source, compiler.Compile(source));
+  ASSERT_NE(nullptr, expr.compiled());
+  EXPECT_STREQ(internal::kLightWeightBytecodeLanguage,
+               expr.compiled()->language());
+  EXPECT_EQ(nullptr, internal::GetSyntaxTree(expr));
+  const internal::BytecodeProgram* program = internal::GetBytecodeProgram(expr);
+  ASSERT_NE(nullptr, program);
+  EXPECT_EQ(
+      "LOAD a\n"
+      "PUSH 0\n"
+      "INDEX\n"
+      "PUSH \"x\"\n"
+      "CALL f/2\n"
+      "LOAD b.c\n"
+      "NEG\n"
+      "PUSH 2\n"
+      "MUL\n"
+      "ADD\n"
+      "JUMPT 17\n"
+      "PUSH \"s\"\n"
+      "CALL In/1\n"
+      "NOT\n"
+      "JUMPF 17\n"
+      "RANDOM\n"
+      "BOOL",
+      program->DebugString());
+  EXPECT_EQ(3, program->max_stack_size);
+
+  EXPECT_EQ(nullptr, compiler.Compile(""));
+  EXPECT_EQ(nullptr, compiler.Compile("f(1,"));
+}
+
+TEST(LightWeightExpressionCompiler, CompileLocation) {
+  LightWeightExpressionCompiler compiler;
+  auto symbols = std::make_shared<SymbolTable>();
+  symbols->AddSymbol("b");
+  symbols->AddSymbol("a");
+
+  const string source = "a.b[i + 1][0]['c']";
+  const Expression location(source, compiler.CompileLocation(source, symbols));
+  ASSERT_NE(nullptr, internal::GetSyntaxTree(location));
+  const internal::LocationProgram* program =
+      internal::GetLocationProgram(location);
+  ASSERT_NE(nullptr, program);
+  EXPECT_EQ("a .b [(+ i 1)] [0] .c", program->DebugString());
+  EXPECT_EQ(1, program->slot);
+  EXPECT_THAT(program->paths, ElementsAre("a", "a.b"));
+  // The location is parsed once, the program shares the syntax tree.
+  EXPECT_EQ(internal::GetSyntaxTree(location), program->tree.get());
+
+  // Expressions that are not compiled as locations have no location program.
+  EXPECT_EQ(nullptr, internal::GetLocationProgram(
+                         Expression(source, compiler.Compile(source))));
+  for (const char* expr : {"f(a)", "1", "a + 1", "a[0] + 1"}) {
+    const Expression compiled(expr, compiler.CompileLocation(expr, nullptr));
+    EXPECT_EQ(nullptr, internal::GetLocationProgram(compiled)) << expr;
+  }
+
+  LightWeightBytecodeCompiler bytecode_compiler;
+  const Expression bytecode(
+      "x[1]", bytecode_compiler.CompileLocation("x[1]", nullptr));
+  ASSERT_NE(nullptr, internal::GetBytecodeProgram(bytecode));
+  ASSERT_NE(nullptr, internal::GetLocationProgram(bytecode));
+  EXPECT_EQ("x [1]", internal::GetLocationProgram(bytecode)->DebugString());
+  EXPECT_EQ(SymbolTable::kNoSlot,
+            internal::GetLocationProgram(bytecode)->slot);
+}
+
+TEST(LightWeightExpressionCompiler, GetReadVariables) {
+  LightWeightExpressionCompiler compiler;
+
+  std::set<string> variables;
+  EXPECT_TRUE(compiler.GetReadVariables(
+      "a.b[c] > 1 && !d || e[0] == 'f'", &variables));
+  EXPECT_THAT(variables, ElementsAre("a", "c", "d", "e"));
+
+  variables.clear();
+  EXPECT_TRUE(compiler.GetReadVariables("1 + 2 == 3", &variables));
+  EXPECT_THAT(variables, ElementsAre());
+
+  // The values of function calls are not known.
+  EXPECT_FALSE(compiler.GetReadVariables("a && In('s')", &variables));
+  EXPECT_FALSE(compiler.GetReadVariables("Math.random() < 0.5", &variables));
+  EXPECT_FALSE(compiler.GetReadVariables("1 +", &variables));
+  EXPECT_FALSE(
+      LightWeightBytecodeCompiler().GetReadVariables("f(a)", &variables));
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -17,6 +17,7 @@
 #ifndef STATE_CHART_INTERNAL_MODEL_H_
 #define STATE_CHART_INTERNAL_MODEL_H_
 
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -28,6 +29,7 @@
 
 namespace state_chart {
 class Runtime;
+class SymbolTable;
 namespace model {
 class ExecutableContent;
 class State;
@@ -71,6 +73,13 @@ class Model {
   virtual std::vector<const model::Transition*> GetTransitionsForEvent(
       Runtime* runtime, const string& event) const = 0;
 
+  // Returns true if any transition of the active states in 'runtime' or of
+  // their ancestors has an event specification that matches 'event'. Unlike
+  // GetTransitionsForEvent(), conditions are not evaluated, so the result
+  // does not depend on the datamodel.
+  virtual bool HasTransitionsForEvent(const Runtime* runtime,
+                                      const string& event) const = 0;
+
   // Returns the initial transition executed when a new runtime is started.
   virtual const model::Transition* GetInitialTransition() const = 0;
 
@@ -84,6 +93,11 @@ class Model {
   // Returns the top-level states.
   virtual std::vector<const model::State*> GetTopLevelStates() const = 0;
 
+  // Returns the top-level variables of the datamodel, i.e., the variables
+  // declared by <data> elements and the system variables. The expressions of
+  // the model may be compiled against this table. May be nullptr.
+  virtual std::shared_ptr<const SymbolTable> GetSymbolTable() const = 0;
+
   // Returns pointers to state(s) for a given tree of active states.
   virtual std::vector<const model::State*> GetActiveStates(
       const proto2::RepeatedPtrField<
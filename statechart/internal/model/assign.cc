@@ -26,14 +26,19 @@ namespace state_chart {
 namespace model {
 
 Assign::Assign(const string& location, const string& expr)
+    : Assign(Expression(location), Expression(expr)) {}
+
+Assign::Assign(const Expression& location, const Expression& expr)
     : location_(location), expr_(expr) {}
 
 // override
 bool Assign::Execute(Runtime* runtime) const {
-  VLOG(1) << absl::Substitute("Assign($0, $1)", location_, expr_);
+  VLOG(1) << absl::Substitute("Assign($0, $1)", location_.source(),
+                              expr_.source());
   if (!runtime->mutable_datamodel()->AssignExpression(location_, expr_)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'Assign' failure for: ", location_, " = ", expr_));
+        absl::StrCat("'Assign' failure for: ", location_.source(), " = ",
+                     expr_.source()));
     return false;
   }
   return true;
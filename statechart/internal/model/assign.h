@@ -23,6 +23,7 @@
 #include <string>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 
 namespace state_chart {
@@ -35,14 +36,15 @@ namespace model {
 class Assign : public ExecutableContent {
  public:
   Assign(const string& location, const string& expr);
+  Assign(const Expression& location, const Expression& expr);
   Assign(const Assign&) = delete;
   Assign& operator=(const Assign&) = delete;
 
   bool Execute(Runtime* runtime) const override;
 
  private:
-  const string location_;
-  const string expr_;
+  const Expression location_;
+  const Expression expr_;
 };
 
 }  // namespace model
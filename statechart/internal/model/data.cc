@@ -26,21 +26,26 @@ namespace state_chart {
 namespace model {
 
 Data::Data(const string& location, const string& expr)
+    : Data(Expression(location), Expression(expr)) {}
+
+Data::Data(const Expression& location, const Expression& expr)
     : location_(location), expr_(expr) {}
 
 // override
 bool Data::Execute(Runtime* runtime) const {
-  VLOG(1) << absl::Substitute("Data($0, $1)", location_, expr_);
+  VLOG(1) << absl::Substitute("Data($0, $1)", location_.source(),
+                              expr_.source());
   if (!runtime->mutable_datamodel()->Declare(location_)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'Data' declaration failure at location: ", location_));
+        absl::StrCat("'Data' declaration failure at location: ",
+                     location_.source()));
     return false;
   }
   if (!expr_.empty() &&
       !runtime->mutable_datamodel()->AssignExpression(location_, expr_)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'Data' assign failure: ", location_, " = ",
-                     expr_.empty() ? "[empty]" : expr_));
+        absl::StrCat("'Data' assign failure: ", location_.source(), " = ",
+                     expr_.empty() ? "[empty]" : expr_.source()));
     return false;
   }
   return true;
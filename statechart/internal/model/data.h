@@ -23,6 +23,7 @@
 #include <string>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 
 namespace state_chart {
@@ -38,14 +39,15 @@ namespace model {
 class Data : public ExecutableContent {
  public:
   Data(const string& location, const string& expr);
+  Data(const Expression& location, const Expression& expr);
   Data(const Data&) = delete;
   Data& operator=(const Data&) = delete;
 
   bool Execute(Runtime* runtime) const override;
 
  private:
-  string location_;
-  string expr_;
+  Expression location_;
+  Expression expr_;
 };
 
 }  // namespace model
@@ -28,54 +28,58 @@ namespace model {
 
 ForEach::ForEach(const string& array, const string& item, const string& index,
                  const ExecutableContent* body)
+    : ForEach(Expression(array), Expression(item), Expression(index), body) {}
+
+ForEach::ForEach(const Expression& array, const Expression& item,
+                 const Expression& index, const ExecutableContent* body)
     : array_(array), item_(item), index_(index), body_(body) {}
 
 // override
 bool ForEach::Execute(Runtime* runtime) const {
-  VLOG(1) << absl::Substitute("ForEach(<$0, $1> : $2)", index_, item_, array_);
+  VLOG(1) << absl::Substitute("ForEach(<$0, $1> : $2)", index_.source(),
+                              item_.source(), array_.source());
   auto* datamodel = runtime->mutable_datamodel();
   // Get the iterator.
   auto iterator = datamodel->EvaluateIterator(array_);
   if (iterator == nullptr) {
     runtime->EnqueueExecutionError(absl::StrCat(
-        "'ForEach' unable to get iterator for collection: ", array_));
+        "'ForEach' unable to get iterator for collection: ", array_.source()));
     return false;
   }
   // Create item variable if needed.
   if (!datamodel->IsDefined(item_) && !datamodel->Declare(item_)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'ForEach' unable to declare item variable at: ", item_));
+        absl::StrCat("'ForEach' unable to declare item variable at: ",
+                     item_.source()));
     return false;
   }
   // Create the index variable if specified.
   if (!index_.empty() && !datamodel->IsDefined(index_) &&
       !datamodel->Declare(index_)) {
     runtime->EnqueueExecutionError(absl::StrCat(
-        "'ForEach' unable to declare index variable at: ", index_));
+        "'ForEach' unable to declare index variable at: ", index_.source()));
     return false;
   }
 
-  // Execute the loop.
-  string value;
-  string index;
+  // Execute the loop. The datamodel binds the elements of its iterator
+  // directly to the item and index variables.
   for (; !iterator->AtEnd(); iterator->Next()) {
-    value = iterator->GetValue();
     // Assign the item.
-    if (!datamodel->AssignExpression(item_, value)) {
+    if (!datamodel->AssignIteratorValue(iterator.get(), item_)) {
       runtime->EnqueueExecutionError(
-          absl::StrCat("'ForEach' unable to assign item variable '", item_,
-                       "' with value: ", value));
+          absl::StrCat("'ForEach' unable to assign item variable '",
+                       item_.source(),
+                       "' at index: ", iterator->GetIndex()));
       return false;
     }
     // Assign the index if needed.
-    if (!index_.empty()) {
-      index = iterator->GetIndex();
-      if (!datamodel->AssignExpression(index_, index)) {
-        runtime->EnqueueExecutionError(
-            absl::StrCat("'ForEach' unable to assign index variable '", index_,
-                         "' with value: ", index));
-        return false;
-      }
+    if (!index_.empty() &&
+        !datamodel->AssignIteratorIndex(*iterator, index_)) {
+      runtime->EnqueueExecutionError(
+          absl::StrCat("'ForEach' unable to assign index variable '",
+                       index_.source(),
+                       "' with value: ", iterator->GetIndex()));
+      return false;
     }
     // Run the loop body, empty executable blocks are nullptr.
     if (body_ != nullptr && !body_->Execute(runtime)) {
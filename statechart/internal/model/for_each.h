@@ -21,6 +21,7 @@
 #define STATE_CHART_INTERNAL_MODEL_FOR_EACH_H_
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 
 namespace state_chart {
@@ -41,6 +42,9 @@ class ForEach : public ExecutableContent {
   //         ownership.
   ForEach(const string& array, const string& item, const string& index,
           const ExecutableContent* body);
+  // Same as above, with expressions that may carry their compiled forms.
+  ForEach(const Expression& array, const Expression& item,
+          const Expression& index, const ExecutableContent* body);
 
   ForEach(const ForEach&) = delete;
   ForEach& operator=(const ForEach&) = delete;
@@ -53,9 +57,9 @@ class ForEach : public ExecutableContent {
   bool Execute(Runtime* runtime) const override;
 
  private:
-  const string array_;
-  const string item_;
-  const string index_;
+  const Expression array_;
+  const Expression item_;
+  const Expression index_;
   const ExecutableContent* const body_;
 };
 
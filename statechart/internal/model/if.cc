@@ -29,14 +29,14 @@ namespace {
 struct KeyFormatter {
   template <typename Pair>
   void operator()(std::string* out, Pair pair) const {
-    out->append(pair.first);
+    out->append(pair.first.source());
   }
 };
 
 }  // namespace
 
 
-If::If(const std::vector<std::pair<string, const ExecutableContent*>>&
+If::If(const std::vector<std::pair<Expression, const ExecutableContent*>>&
            condition_executable)
     : condition_executable_(condition_executable) {}
 
@@ -52,14 +52,14 @@ bool If::Execute(Runtime* runtime) const {
     RETURN_FALSE_IF_MSG(saw_empty,
                         "Empty conditions in <if> executable must come last.");
 
-    const string& cond = cond_executable.first;
+    const Expression& cond = cond_executable.first;
     auto* executable = cond_executable.second;
 
     bool result = cond.empty();  // Empty cond evaluates to true.
     if (!result &&
         !runtime->datamodel().EvaluateBooleanExpression(cond, &result)) {
       runtime->EnqueueExecutionError(
-          absl::StrCat("'If' condition failed to evaluate: ", cond));
+          absl::StrCat("'If' condition failed to evaluate: ", cond.source()));
       no_error = false;
       continue;
     }
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 
 namespace state_chart {
@@ -38,15 +39,16 @@ class If : public ExecutableContent {
   // Accepts a list of pairs of condition, executable. The logic for If will
   // loop through the configuration, evaluate the condition and execute the
   // first executable for which the condition evaluates to true.
-  explicit If(const std::vector<std::pair<string, const ExecutableContent*>>&
-                  condition_executable);
+  explicit If(
+      const std::vector<std::pair<Expression, const ExecutableContent*>>&
+          condition_executable);
   If(const If&) = delete;
   If& operator=(const If&) = delete;
 
   bool Execute(Runtime* runtime) const override;
 
  private:
-  const std::vector<std::pair<string, const ExecutableContent*>>
+  const std::vector<std::pair<Expression, const ExecutableContent*>>
       condition_executable_;
 };
 
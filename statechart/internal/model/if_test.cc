@@ -38,7 +38,8 @@ class IfTest : public testing::Test {
     executable_content_storage_.emplace_back(new MockExecutableContent());
     auto* executable = executable_content_storage_.back().get();
 
-    condition_executable_.push_back(std::make_pair(expr, executable));
+    condition_executable_.push_back(
+        std::make_pair(Expression(expr), executable));
     return executable;
   }
 
@@ -52,7 +53,7 @@ class IfTest : public testing::Test {
 
   std::vector<std::unique_ptr<MockExecutableContent>>
       executable_content_storage_;
-  std::vector<std::pair<string, const ExecutableContent*>>
+  std::vector<std::pair<Expression, const ExecutableContent*>>
       condition_executable_;
 };
 
@@ -25,15 +25,19 @@ namespace state_chart {
 namespace model {
 
 Log::Log(const string& label, const string& expr)
+    : Log(label, Expression(expr)) {}
+
+Log::Log(const string& label, const Expression& expr)
     : label_(label), expr_(expr) {}
 
 // override
 bool Log::Execute(Runtime* runtime) const {
-  VLOG(1) << "Log: " << label_ << ": " << expr_;
+  VLOG(1) << "Log: " << label_ << ": " << expr_.source();
   string log_string;
   if (!runtime->datamodel().EvaluateStringExpression(expr_, &log_string)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'Log' expression failed to evaluate to string: ", expr_));
+        absl::StrCat("'Log' expression failed to evaluate to string: ",
+                     expr_.source()));
     return false;
   }
   LOG(INFO) << (label_.empty() ? "" : label_ + ": ") << log_string;
@@ -23,6 +23,7 @@
 #include <string>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 
 namespace state_chart {
@@ -35,6 +36,7 @@ namespace model {
 class Log : public ExecutableContent {
  public:
   Log(const string& label, const string& expr);
+  Log(const string& label, const Expression& expr);
   Log(const Log&) = delete;
   Log& operator=(const Log&) = delete;
 
@@ -42,7 +44,7 @@ class Log : public ExecutableContent {
 
  private:
   const string label_;
-  const string expr_;
+  const Expression expr_;
 };
 
 }  // namespace model
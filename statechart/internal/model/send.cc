@@ -14,6 +14,8 @@
 
 #include "statechart/internal/model/send.h"
 
+#include <vector>
+
 #include <glog/logging.h>
 
 #include "absl/strings/str_cat.h"
@@ -57,30 +59,29 @@ bool Send::Execute(Runtime* runtime) const {
   }
 
   // Evaluate expressions for send parameters.
-  std::map<string, string> evaluated_data;
-  string result;
-  bool no_error = true;
-  for (const auto& data : parameters_) {
-    result.clear();
-    // If there is an error, the specifications say to ignore the parameter.
-    // Hence we continue to process the rest.
-    if (!datamodel->EvaluateExpression(data.second, &result)) {
-      runtime->EnqueueExecutionError(
-          absl::StrCat("'Send' parameter '", data.first,
-                       "' failed to evaluate value: ", data.second));
-      no_error = false;
-    } else {
-      evaluated_data[data.first] = result;
-    }
+  // If there is an error, the specifications say to ignore the parameter.
+  // Hence the rest are still processed.
+  std::vector<string> failed;
+  const string encoded_data =
+      datamodel->EvaluateParameters(parameters_, &failed);
+  for (const string& name : failed) {
+    runtime->EnqueueExecutionError(
+        absl::StrCat("'Send' parameter '", name, "' failed to evaluate value: ",
+                     parameters_.at(name).source()));
   }
+  const bool no_error = failed.empty();
 
   runtime->GetEventDispatcher()->NotifySendEvent(
       runtime, string_attr_value[0], string_attr_value[1], string_attr_value[2],
-      string_attr_value[3], datamodel->EncodeParameters(evaluated_data));
+      string_attr_value[3], encoded_data);
   return no_error;
 }
 
 bool Send::AddParamByExpression(const string& key, const string& expr) {
+  return AddParamByExpression(key, Expression(expr));
+}
+
+bool Send::AddParamByExpression(const string& key, const Expression& expr) {
   RETURN_FALSE_IF(expr.empty());
   gtl::InsertIfNotPresent(&parameters_, key, expr);
   return true;
@@ -24,6 +24,7 @@
 #include <string>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/executable_content.h"
 #include "statechart/internal/model/str_or_expr.h"
 
@@ -62,6 +63,8 @@ class Send : public ExecutableContent {
   // specification allows duplicate parameters.
   // Returns false if an error occurred.
   bool AddParamByExpression(const string& key, const string& expr);
+  // Same as above, with an 'expr' that may carry its compiled form.
+  bool AddParamByExpression(const string& key, const Expression& expr);
 
   // Add a parameter based on a datamodel location name. The key of the
   // parameter is the name of the datamodel location and the expression is the
@@ -80,7 +83,7 @@ class Send : public ExecutableContent {
 
   // A map of parameter name to value expressions to be evaluated before being
   // passed to an external service when send is executed.
-  std::map<string, string> parameters_;
+  std::map<string, Expression> parameters_;
 };
 
 }  // namespace model
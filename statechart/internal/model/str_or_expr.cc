@@ -19,16 +19,19 @@
 namespace state_chart {
 namespace model {
 
-StrOrExpr::StrOrExpr(const string& str, const string& expr) {
+StrOrExpr::StrOrExpr(const string& str, const string& expr)
+    : StrOrExpr(str, Expression(expr)) {}
+
+StrOrExpr::StrOrExpr(const string& str, const Expression& expr) {
   is_expr_ = !expr.empty();
-  value_ = is_expr_ ? expr : str;
+  value_ = is_expr_ ? expr : Expression(str);
 }
 
 bool StrOrExpr::Evaluate(const Datamodel* datamodel, string* result) const {
   if (is_expr_) {
     return datamodel->EvaluateStringExpression(value_, result);
   }
-  *result = value_;
+  *result = value_.source();
   return true;
 }
 
@@ -22,10 +22,10 @@
 
 #include <string>
 
+#include "statechart/internal/datamodel.h"
 #include "statechart/platform/types.h"
 
 namespace state_chart {
-class Datamodel;
 namespace model {
 
 // A struct used to indicate to the compiler that a string is of an expression
@@ -58,17 +58,21 @@ class StrOrExpr {
   // should be non-empty.
   StrOrExpr(const string& str, const string& expr);
 
+  // Same as above, with an 'expr' that may carry its compiled form.
+  StrOrExpr(const string& str, const Expression& expr);
+
   // Sets 'result' to the string if this is a static string, or a string
   // result of the expression evaluated in the datamodel.
   // Returns false if evaluation failed in the datamodel.
   bool Evaluate(const Datamodel* datamodel, string* result) const;
 
   bool IsEmpty() const { return value_.empty(); }
-  const string& Value() const { return value_; }
+  const string& Value() const { return value_.source(); }
 
  private:
   bool is_expr_;
-  string value_;
+  // Holds the static string as an uncompiled source if !is_expr_.
+  Expression value_;
 };
 
 }  // namespace model
@@ -32,6 +32,14 @@ Transition::Transition(const State* source,
                        const std::vector<string>& events,
                        const string& cond_expr, bool is_internal,
                        const ExecutableContent* executable)
+    : Transition(source, targets, events, Expression(cond_expr), is_internal,
+                 executable) {}
+
+Transition::Transition(const State* source,
+                       const std::vector<const State*>& targets,
+                       const std::vector<string>& events,
+                       const Expression& cond_expr, bool is_internal,
+                       const ExecutableContent* executable)
     : source_(source),
       targets_(targets),
       events_(events),
@@ -47,7 +55,8 @@ bool Transition::EvaluateCondition(Runtime* runtime) const {
   bool result = false;
   if (!runtime->datamodel().EvaluateBooleanExpression(cond_expr_, &result)) {
     runtime->EnqueueExecutionError(
-        absl::StrCat("'Transition' condition evaluation failed: ", cond_expr_));
+        absl::StrCat("'Transition' condition evaluation failed: ",
+                     cond_expr_.source()));
     return false;
   }
   return result;
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "statechart/platform/types.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/model/model_element.h"
 
 namespace state_chart {
@@ -52,13 +53,18 @@ class Transition : public ModelElement {
              const std::vector<string>& events, const string& cond_expr,
              bool is_internal, const ExecutableContent* executable);
 
+  // Same as above, with a 'cond_expr' that may carry its compiled form.
+  Transition(const State* source, const std::vector<const State*>& targets,
+             const std::vector<string>& events, const Expression& cond_expr,
+             bool is_internal, const ExecutableContent* executable);
+
   Transition(const Transition&) = delete;
   Transition& operator=(const Transition&) = delete;
 
   const State* GetSourceState() const { return source_; }
   const std::vector<const State*>& GetTargetStates() const { return targets_; }
   const std::vector<string>& GetEvents() const { return events_; }
-  const string& GetCondition() const { return cond_expr_; }
+  const string& GetCondition() const { return cond_expr_.source(); }
   bool IsInternal() const { return is_internal_; }
   const ExecutableContent* GetExecutable() const { return executable_; }
 
@@ -77,7 +83,7 @@ class Transition : public ModelElement {
   const std::vector<const State*> targets_;
   const std::vector<string> events_;
   // The condition expression, empty string for none.
-  const string cond_expr_;
+  const Expression cond_expr_;
   const bool is_internal_;
   const ExecutableContent* executable_;
 };
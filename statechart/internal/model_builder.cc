@@ -14,8 +14,11 @@
 
 #include "statechart/internal/model_builder.h"
 
+#include <set>
 #include <vector>
 
+#include "absl/strings/ascii.h"
+#include "absl/strings/string_view.h"
 #include "statechart/internal/model_impl.h"
 #include "statechart/internal/model/model.h"
 #include "statechart/logging.h"
@@ -24,17 +27,91 @@
 
 
 namespace state_chart {
+namespace {
+
+// Returns the top-level variable of 'location', e.g., "foo" for "foo.bar[0]"
+// or for " foo .bar".
+string GetRootVariable(const string& location) {
+  const absl::string_view stripped = absl::StripAsciiWhitespace(location);
+  return string(absl::StripTrailingAsciiWhitespace(
+      stripped.substr(0, stripped.find_first_of(".["))));
+}
+
+// Adds the top-level variables that are written by the <assign>, <foreach> and
+// <send> elements anywhere in 'message' to 'variables'.
+void CollectWrittenVariables(const proto2::Message& message,
+                             std::set<string>* variables) {
+  const proto2::Descriptor* descriptor = message.GetDescriptor();
+  if (descriptor == config::Assign::descriptor()) {
+    const auto& assign = static_cast<const config::Assign&>(message);
+    variables->insert(GetRootVariable(assign.location()));
+  } else if (descriptor == config::ForEach::descriptor()) {
+    const auto& for_each = static_cast<const config::ForEach&>(message);
+    variables->insert(GetRootVariable(for_each.item()));
+    variables->insert(GetRootVariable(for_each.index()));
+  } else if (descriptor == config::Send::descriptor()) {
+    const auto& send = static_cast<const config::Send&>(message);
+    variables->insert(GetRootVariable(send.idlocation()));
+  }
+
+  const auto* reflection = message.GetReflection();
+  std::vector<const proto2::FieldDescriptor*> fields;
+  reflection->ListFields(message, &fields);
+  for (const auto* field : fields) {
+    if (field->cpp_type() != proto2::FieldDescriptor::CPPTYPE_MESSAGE) {
+      continue;
+    }
+    if (field->is_repeated()) {
+      for (int i = 0; i < reflection->FieldSize(message, field); ++i) {
+        CollectWrittenVariables(
+            reflection->GetRepeatedMessage(message, field, i), variables);
+      }
+    } else {
+      CollectWrittenVariables(reflection->GetMessage(message, field),
+                              variables);
+    }
+  }
+}
+
+// Appends the datamodels of 'state_element' and of its descendants in document
+// order, which is the order in which they are initialized with early binding.
+void CollectDataModels(const config::StateElement& state_element,
+                       std::vector<const config::DataModel*>* datamodels) {
+  if (state_element.has_state()) {
+    datamodels->push_back(&state_element.state().datamodel());
+    for (const auto& child : state_element.state().state()) {
+      CollectDataModels(child, datamodels);
+    }
+  } else if (state_element.has_parallel()) {
+    datamodels->push_back(&state_element.parallel().datamodel());
+    for (const auto& child : state_element.parallel().state()) {
+      CollectDataModels(child, datamodels);
+    }
+  }
+}
+
+}  // namespace
 
 // static
 // TODO(ufirst): change the name of the function at later CL.
 Model* ModelBuilder::CreateModelOrNull(const config::StateChart& state_chart) {
-  ModelBuilder builder(state_chart);
+  return CreateModelOrNull(state_chart, nullptr);
+}
+
+// static
+Model* ModelBuilder::CreateModelOrNull(const config::StateChart& state_chart,
+                                       const ExpressionCompiler* compiler) {
+  ModelBuilder builder(state_chart, compiler);
   builder.Build();
   return builder.CreateModelAndReset();
 }
 
 ModelBuilder::ModelBuilder(const config::StateChart& state_chart)
-    : state_chart_(state_chart) {}
+    : ModelBuilder(state_chart, nullptr) {}
+
+ModelBuilder::ModelBuilder(const config::StateChart& state_chart,
+                           const ExpressionCompiler* compiler)
+    : state_chart_(state_chart), compiler_(compiler) {}
 
 ModelBuilder::~ModelBuilder() { Reset(); }
 
@@ -43,6 +120,7 @@ void ModelBuilder::Reset() {
   datamodel_block_ = nullptr;
   top_level_states_.clear();
   states_map_.clear();
+  symbols_.reset();
 
   // Either the user must call CreateModelAndReset() which will perform memory
   // management by passing all_elements_ to ModelImpl and then clearing the
@@ -54,6 +132,9 @@ void ModelBuilder::Reset() {
 bool ModelBuilder::Build() {
   RETURN_FALSE_IF_MSG(state_chart_.state_size() <= 0,
                       "No states in StateChart.");
+  key_indexes_.clear();
+  BuildSymbolTable();
+  AnalyzeConstants();
   for (const auto& state_config : state_chart_.state()) {
     auto* state = BuildState(state_config);
     RETURN_FALSE_IF(state == nullptr);
@@ -102,7 +183,8 @@ Model* ModelBuilder::CreateModelAndReset() {
                                            top_level_states_.end());
   auto* model =
       new ModelImpl(state_chart_.name(), initial_transition_, const_states,
-                    state_chart_.binding(), datamodel_block_, all_elements_);
+                    state_chart_.binding(), datamodel_block_, all_elements_,
+                    symbols_);
 
   RETURN_NULL_IF(model == nullptr);
   // We passed ownership of everything in all_elements_ to ModelImpl, and thus
@@ -114,6 +196,141 @@ Model* ModelBuilder::CreateModelAndReset() {
   return model;
 }
 
+void ModelBuilder::EnableConstantFolding(
+    std::unique_ptr<Datamodel> datamodel) {
+  folding_datamodel_ = std::move(datamodel);
+}
+
+Expression ModelBuilder::CompileExpression(const string& expr) const {
+  if (compiler_ == nullptr || expr.empty()) {
+    return Expression(expr);
+  }
+  return Expression(expr, compiler_->Compile(expr, symbols_));
+}
+
+Expression ModelBuilder::CompileLocationExpression(
+    const string& location) const {
+  if (compiler_ == nullptr || location.empty()) {
+    return Expression(location);
+  }
+  return Expression(location, compiler_->CompileLocation(location, symbols_));
+}
+
+void ModelBuilder::BuildSymbolTable() {
+  symbols_ = std::make_shared<SymbolTable>();
+  // The system variables declared by the Executor.
+  for (const char* system_variable : {"_event", "_name", "_sessionid"}) {
+    symbols_->AddSymbol(system_variable);
+  }
+  AddDataModelSymbols(state_chart_.datamodel());
+  for (const auto& state_element : state_chart_.state()) {
+    AddStateSymbols(state_element);
+  }
+}
+
+void ModelBuilder::AddDataModelSymbols(const config::DataModel& datamodel) {
+  for (const auto& data : datamodel.data()) {
+    // Only the root of a location such as 'foo.bar' or 'foo[0]' is a
+    // top-level variable.
+    const string root = GetRootVariable(data.id());
+    if (!root.empty()) {
+      symbols_->AddSymbol(root);
+    }
+  }
+}
+
+void ModelBuilder::AddStateSymbols(const config::StateElement& state_element) {
+  if (state_element.has_state()) {
+    AddDataModelSymbols(state_element.state().datamodel());
+    for (const auto& child : state_element.state().state()) {
+      AddStateSymbols(child);
+    }
+  } else if (state_element.has_parallel()) {
+    AddDataModelSymbols(state_element.parallel().datamodel());
+    for (const auto& child : state_element.parallel().state()) {
+      AddStateSymbols(child);
+    }
+  }
+}
+
+void ModelBuilder::AnalyzeConstants() {
+  read_only_variables_.clear();
+  constant_variables_.clear();
+  folded_conditions_.clear();
+  if (folding_datamodel_ == nullptr || compiler_ == nullptr) {
+    return;
+  }
+  folding_datamodel_->Clear();
+
+  std::vector<const config::DataModel*> datamodels = {
+      &state_chart_.datamodel()};
+  for (const auto& state_element : state_chart_.state()) {
+    CollectDataModels(state_element, &datamodels);
+  }
+
+  // Variables that are declared more than once are assigned by each of their
+  // declarations.
+  std::map<string, int> declarations;
+  for (const auto* datamodel : datamodels) {
+    for (const auto& data : datamodel->data()) {
+      ++declarations[GetRootVariable(data.id())];
+    }
+  }
+  std::set<string> written = {"_event", "_name", "_sessionid"};
+  CollectWrittenVariables(state_chart_, &written);
+
+  for (const auto* datamodel : datamodels) {
+    for (const auto& data : datamodel->data()) {
+      // Locations such as 'foo.bar' write to their top-level variable, which
+      // has a different name.
+      if (declarations[data.id()] != 1 || written.count(data.id()) > 0) {
+        continue;
+      }
+      read_only_variables_.insert(data.id());
+
+      // Without early binding the datamodels of states are initialized on
+      // entry, so that the variables may be read before they have a value.
+      if (state_chart_.binding() != config::StateChart::BINDING_EARLY) {
+        continue;
+      }
+      std::set<string> variables;
+      if (!data.has_expr() ||
+          !compiler_->GetReadVariables(data.expr(), &variables)) {
+        continue;
+      }
+      bool is_constant = true;
+      for (const string& variable : variables) {
+        is_constant &= constant_variables_.count(variable) > 0;
+      }
+      string value;
+      if (is_constant && folding_datamodel_->Declare(data.id()) &&
+          folding_datamodel_->AssignExpression(data.id(), data.expr()) &&
+          folding_datamodel_->EvaluateExpression(data.id(), &value)) {
+        constant_variables_[data.id()] = value;
+      }
+    }
+  }
+}
+
+bool ModelBuilder::EvaluateConstantCondition(const string& cond,
+                                             bool* value) const {
+  if (folding_datamodel_ == nullptr || compiler_ == nullptr || cond.empty()) {
+    return false;
+  }
+  std::set<string> variables;
+  if (!compiler_->GetReadVariables(cond, &variables)) {
+    return false;
+  }
+  for (const string& variable : variables) {
+    if (constant_variables_.count(variable) == 0) {
+      return false;
+    }
+  }
+  // Conditions that fail to evaluate are left to raise their error at
+  // runtime.
+  return folding_datamodel_->EvaluateBooleanExpression(cond, value);
+}
+
 // virtual
 model::ExecutableContent* ModelBuilder::BuildExecutableBlock(
     const proto2::RepeatedPtrField<config::ExecutableElement>& elements) {
@@ -193,9 +410,13 @@ model::ExecutableContent* ModelBuilder::BuildDataModelBlock(
     RETURN_NULL_IF(!data.has_id());
 
     const string expr = data.has_expr() ? data.expr() : data.src();
-    auto* model_data = new model::Data(data.id(), expr);
+    auto* model_data = new model::Data(CompileLocationExpression(data.id()),
+                                       CompileExpression(expr));
     RETURN_NULL_IF(model_data == nullptr);
     executables.push_back(model_data);
+    for (const auto& key : data.index_key()) {
+      key_indexes_.emplace_back(data.id(), key);
+    }
     all_elements_.push_back(executables.back());
   }
 
@@ -212,12 +433,15 @@ model::Raise* ModelBuilder::BuildRaise(const config::Raise& raise_proto) {
 
 // virtual
 model::Log* ModelBuilder::BuildLog(const config::Log& log_proto) {
-  return new model::Log(log_proto.label(), log_proto.expr());
+  return new model::Log(log_proto.label(),
+                        CompileExpression(log_proto.expr()));
 }
 
 // virtual
 model::Assign* ModelBuilder::BuildAssign(const config::Assign& assign_proto) {
-  return new model::Assign(assign_proto.location(), assign_proto.expr());
+  return new model::Assign(
+      CompileLocationExpression(assign_proto.location()),
+      CompileExpression(assign_proto.expr()));
 }
 
 // virtual
@@ -233,11 +457,12 @@ model::Send* ModelBuilder::BuildSend(const config::Send& send_proto) {
       send_proto.id().empty() || send_proto.idlocation().empty()));
   RETURN_NULL_IF(!(
       send_proto.type().empty() || send_proto.typeexpr().empty()));
-  auto* send =
-      new model::Send(StrOrExpr(send_proto.event(), send_proto.eventexpr()),
-                      StrOrExpr(send_proto.target(), send_proto.targetexpr()),
-                      StrOrExpr(send_proto.id(), send_proto.idlocation()),
-                      StrOrExpr(send_proto.type(), send_proto.typeexpr()));
+  auto* send = new model::Send(
+      StrOrExpr(send_proto.event(), CompileExpression(send_proto.eventexpr())),
+      StrOrExpr(send_proto.target(),
+                CompileExpression(send_proto.targetexpr())),
+      StrOrExpr(send_proto.id(), CompileExpression(send_proto.idlocation())),
+      StrOrExpr(send_proto.type(), CompileExpression(send_proto.typeexpr())));
   RETURN_NULL_IF(send == nullptr);
 
   // Note that the parameters differ from the state chart specification in that
@@ -245,26 +470,41 @@ model::Send* ModelBuilder::BuildSend(const config::Send& send_proto) {
   // to Send. The 'namelist' attribute will take precedence over 'param'
   // children.
   for (const string& id : send_proto.namelist()) {
-    send->AddParamById(id);
+    send->AddParamByExpression(id, CompileExpression(id));
   }
   for (const auto& param : send_proto.param()) {
     RETURN_NULL_IF_MSG(param.has_expr() && param.has_location(),
                        param.DebugString());
     string expr = param.has_expr() ? param.expr() : param.location();
     RETURN_NULL_IF(expr.empty());
-    send->AddParamByExpression(param.name(), expr);
+    send->AddParamByExpression(param.name(), CompileExpression(expr));
   }
   return send;
 }
 
 // virtual
 model::If* ModelBuilder::BuildIf(const config::If& if_proto) {
-  std::vector<std::pair<string, const model::ExecutableContent*>>
+  std::vector<std::pair<Expression, const model::ExecutableContent*>>
       cond_executable;
   for (const auto& cond_config : if_proto.cond_executable()) {
+    bool value = false;
+    if (EvaluateConstantCondition(cond_config.cond(), &value)) {
+      folded_conditions_.push_back(
+          {FoldedCondition::kIf, "", cond_config.cond(), value});
+      if (!value) {
+        // The branch is never taken.
+        continue;
+      }
+      // The branch is always taken if it is reached, so that the branches
+      // after it are never taken.
+      cond_executable.push_back(std::make_pair(
+          Expression(), BuildExecutableBlock(cond_config.executable())));
+      break;
+    }
     const auto* executable = BuildExecutableBlock(cond_config.executable());
     // TODO(ufirst): Add check: RETURN_NULL_IF(executable == nullptr);
-    cond_executable.push_back(std::make_pair(cond_config.cond(), executable));
+    cond_executable.push_back(
+        std::make_pair(CompileExpression(cond_config.cond()), executable));
   }
   return new model::If(cond_executable);
 }
@@ -272,10 +512,11 @@ model::If* ModelBuilder::BuildIf(const config::If& if_proto) {
 // virtual
 model::ForEach* ModelBuilder::BuildForEach(
     const config::ForEach& for_each_proto) {
-  return new model::ForEach(for_each_proto.array(),
-                            for_each_proto.item(),
-                            for_each_proto.index(),
-                            BuildExecutableBlock(for_each_proto.executable()));
+  return new model::ForEach(
+      CompileExpression(for_each_proto.array()),
+      CompileLocationExpression(for_each_proto.item()),
+      CompileLocationExpression(for_each_proto.index()),
+      BuildExecutableBlock(for_each_proto.executable()));
 }
 
 // virtual
@@ -426,8 +667,20 @@ bool ModelBuilder::BuildTransitionsForState(model::State* state) {
                           "Target State ID " << target << " does not exist.");
       targets.push_back(*target_state);
     }
+
+    string cond = transition_config->cond();
+    bool value = false;
+    if (EvaluateConstantCondition(cond, &value)) {
+      folded_conditions_.push_back(
+          {FoldedCondition::kTransition, state->id(), cond, value});
+      if (!value) {
+        // The transition is never enabled.
+        continue;
+      }
+      cond.clear();
+    }
     auto* transition = new model::Transition(
-        state, targets, events, transition_config->cond(),
+        state, targets, events, CompileExpression(cond),
         transition_config->type() == config::Transition::TYPE_INTERNAL,
         BuildExecutableBlock(transition_config->executable()));
     RETURN_FALSE_IF(!transition);
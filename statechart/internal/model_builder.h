@@ -18,8 +18,12 @@
 #define STATE_CHART_INTERNAL_MODEL_BUILDER_H_
 
 #include <map>
+#include <memory>
+#include <set>
+#include <utility>
 #include <vector>
 
+#include "statechart/internal/datamodel.h"
 #include "statechart/platform/protobuf.h"
 #include "statechart/platform/types.h"
 #include "statechart/proto/state_chart.pb.h"
@@ -57,11 +61,36 @@ class Transition;
 // TODO(thatguy): Add error checking ability after Build().
 class ModelBuilder {
  public:
+  // A condition of an <if> branch or of a transition that was found to be
+  // constant by constant folding.
+  struct FoldedCondition {
+    enum Kind {
+      kIf,
+      kTransition,
+    };
+
+    Kind kind;
+    // The source state of a transition, empty for <if> branches.
+    string state_id;
+    string condition;
+    bool value;
+  };
+
   // Returns a new model instance. Caller takes ownership.
   // Returns nullptr if error occurred when building model.
   static Model* CreateModelOrNull(const config::StateChart& state_chart);
 
+  // Same as above, but the expressions of the model are compiled once with
+  // 'compiler'. Does not take ownership of 'compiler'.
+  static Model* CreateModelOrNull(const config::StateChart& state_chart,
+                                  const ExpressionCompiler* compiler);
+
   explicit ModelBuilder(const config::StateChart& state_chart);
+
+  // Expressions are compiled with 'compiler' if it is not nullptr. Does not
+  // take ownership of 'compiler', which must outlive this builder.
+  ModelBuilder(const config::StateChart& state_chart,
+               const ExpressionCompiler* compiler);
   virtual ~ModelBuilder();
 
   // Parses and validates 'state_chart' and creates all model objects. Must be
@@ -71,10 +100,64 @@ class ModelBuilder {
   // Returns a new Model instance. Caller takes ownership.
   Model* CreateModelAndReset();
 
+  // Enables constant folding in Build(), which requires a compiler.
+  //
+  // <data> variables that are declared once and never written by <assign>,
+  // <foreach> or the 'idlocation' of <send> are read-only. With early binding,
+  // the read-only variables whose values only depend on literals and on
+  // earlier such variables are constants, and are evaluated in 'datamodel'.
+  //
+  // Conditions of <if> branches and transitions that only depend on literals
+  // and constants are evaluated in 'datamodel' as well: branches and
+  // transitions whose conditions are always false are dropped, and conditions
+  // that are always true are removed.
+  void EnableConstantFolding(std::unique_ptr<Datamodel> datamodel);
+
+  // The read-only variables and the folded conditions of the last Build().
+  const std::set<string>& read_only_variables() const {
+    return read_only_variables_;
+  }
+  // The constant variables of the last Build() with the values that the
+  // conditions were folded with, as datamodel value expressions.
+  const std::map<string, string>& constant_variables() const {
+    return constant_variables_;
+  }
+  const std::vector<FoldedCondition>& folded_conditions() const {
+    return folded_conditions_;
+  }
+
+  // The pairs of a <data> variable and a key that its array is indexed by, see
+  // Datamodel::AddKeyIndex(), of the last Build().
+  const std::vector<std::pair<string, string>>& key_indexes() const {
+    return key_indexes_;
+  }
+
  protected:
   // Returns the internal state of this object to that at instantiation time.
   void Reset();
 
+  // Returns 'expr' together with its compiled form, if there is a compiler and
+  // it is able to compile 'expr'. References to the variables in 'symbols_'
+  // may be compiled to their slots.
+  Expression CompileExpression(const string& expr) const;
+
+  // Same as above, but 'location' is compiled as a location that values are
+  // assigned to.
+  Expression CompileLocationExpression(const string& location) const;
+
+  // Collects the system variables and the variables declared by the <data>
+  // elements of the top-level datamodel and of all states into 'symbols_'.
+  void BuildSymbolTable();
+  void AddDataModelSymbols(const config::DataModel& datamodel);
+  void AddStateSymbols(const config::StateElement& state_element);
+
+  // Finds the read-only and the constant variables for constant folding.
+  void AnalyzeConstants();
+
+  // Returns true if constant folding is enabled and 'cond' only depends on
+  // literals and constants, in which case 'value' is set to its value.
+  bool EvaluateConstantCondition(const string& cond, bool* value) const;
+
   // Build various instances of ExecutableContent.
 
   // Returns nullptr when 'elements.size() == 0', i.e., empty executable blocks
@@ -103,6 +186,8 @@ class ModelBuilder {
 
   // Member variables.
   const config::StateChart state_chart_;
+  // Not owned, may be nullptr.
+  const ExpressionCompiler* const compiler_;
 
   const model::Transition* initial_transition_ = nullptr;
   model::ExecutableContent* datamodel_block_ = nullptr;
@@ -111,6 +196,14 @@ class ModelBuilder {
   std::map<string, model::State*> states_map_;
   std::map<string, const config::StateElement*> states_config_map_;
   std::vector<const model::ModelElement*> all_elements_;
+  std::shared_ptr<SymbolTable> symbols_;
+
+  // Constant folding is enabled if not nullptr.
+  std::unique_ptr<Datamodel> folding_datamodel_;
+  std::set<string> read_only_variables_;
+  std::map<string, string> constant_variables_;
+  std::vector<FoldedCondition> folded_conditions_;
+  std::vector<std::pair<string, string>> key_indexes_;
 };
 
 }  // namespace state_chart
@@ -19,9 +19,12 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/light_weight_datamodel.h"
 #include "statechart/internal/model.h"
 #include "statechart/internal/model/model.h"
 #include "statechart/internal/testing/mock_executable_content.h"
+#include "statechart/internal/testing/mock_function_dispatcher.h"
 #include "statechart/internal/testing/mock_runtime.h"
 #include "statechart/internal/testing/mock_state.h"
 #include "statechart/internal/testing/mock_transition.h"
@@ -49,9 +52,11 @@ using ::gtl::InsertOrUpdate;
 using ::testing::_;
 using ::testing::DoAll;
 using ::testing::ElementsAre;
+using ::testing::Eq;
 using ::testing::EqualsProtobuf;
 using ::testing::InSequence;
 using ::testing::NiceMock;
+using ::testing::Property;
 using ::testing::Return;
 using ::testing::SetArgPointee;
 
@@ -65,7 +70,11 @@ using ::testing::SetArgPointee;
 class TestModelBuilder : public ModelBuilder {
  public:
   explicit TestModelBuilder(const config::StateChart& state_chart)
-      : ModelBuilder(state_chart) {
+      : TestModelBuilder(state_chart, nullptr) {}
+
+  TestModelBuilder(const config::StateChart& state_chart,
+                   const ExpressionCompiler* compiler)
+      : ModelBuilder(state_chart, compiler) {
     TEST_MODEL_BUILDER_DEFAULT(BuildExecutableContent);
     TEST_MODEL_BUILDER_DEFAULT(BuildExecutableBlock);
     TEST_MODEL_BUILDER_DEFAULT(BuildDataModelBlock);
@@ -713,6 +722,179 @@ TEST_F(ModelBuilderTest, CreateModelAndReset) {
               ElementsAre(&state_A));
 }
 
+// Test that the symbol table of the model holds the system variables and the
+// top-level variables declared in the datamodels of the state chart and of
+// all states.
+TEST_F(ModelBuilderTest, BuildSymbolTable) {
+  config::StateChartBuilder sc_builder(&state_chart_, "test");
+  sc_builder.DataModel().AddDataFromExpr("a", "1").AddDataFromExpr("b.c", "2");
+  auto state_A = sc_builder.AddState("A");
+  state_A.DataModel().AddDataFromExpr("a", "3");
+  state_A.AddState("A1").DataModel().AddDataFromExpr("d[0]", "4");
+
+  std::unique_ptr<Model> model(ModelBuilder::CreateModelOrNull(state_chart_));
+  ASSERT_NE(nullptr, model);
+  const auto symbols = model->GetSymbolTable();
+  ASSERT_NE(nullptr, symbols);
+  EXPECT_EQ(6, symbols->size());
+  EXPECT_EQ(0, symbols->FindSlot("_event"));
+  EXPECT_EQ(1, symbols->FindSlot("_name"));
+  EXPECT_EQ(2, symbols->FindSlot("_sessionid"));
+  EXPECT_EQ(3, symbols->FindSlot("a"));
+  EXPECT_EQ(4, symbols->FindSlot("b"));
+  EXPECT_EQ(5, symbols->FindSlot("d"));
+  EXPECT_EQ("b", symbols->GetName(4));
+  EXPECT_EQ(SymbolTable::kNoSlot, symbols->FindSlot("b.c"));
+}
+
+// Returns a description of 'folded' for comparison in tests.
+string FoldedConditionString(const ModelBuilder::FoldedCondition& folded) {
+  return (folded.kind == ModelBuilder::FoldedCondition::kIf
+              ? "if "
+              : "transition " + folded.state_id + " ") +
+         folded.condition + (folded.value ? " = true" : " = false");
+}
+
+// Test that branches of <if> elements with constant conditions are dropped,
+// and that the branches after an always true branch are not built.
+TEST_F(ModelBuilderTest, FoldConstantConditionsOfIf) {
+  config::StateChartBuilder sc_builder(&state_chart_, "test");
+  sc_builder.DataModel()
+      .AddDataFromExpr("debug", "false")
+      .AddDataFromExpr("limit", "10")
+      .AddDataFromExpr("n", "0");
+  auto state_A = sc_builder.AddState("A");
+  state_A.OnEntry()
+      .AddAssign("n", "n + 1")
+      .AddIf("debug")
+      .AddRaise("debug")
+      .ElseIf("n > 1")
+      .AddRaise("many")
+      .ElseIf("limit >= 10")
+      .AddRaise("limit")
+      .Else()
+      .AddRaise("else")
+      .EndIf();
+
+  NiceMock<MockFunctionDispatcher> function_dispatcher;
+  NiceMock<TestModelBuilder> builder(
+      state_chart_, LightWeightDatamodel::GetExpressionCompiler());
+  builder.EnableConstantFolding(
+      LightWeightDatamodel::Create(&function_dispatcher));
+  EXPECT_CALL(builder, BuildRaise(Property(&config::Raise::event, Eq("many"))))
+      .Times(1);
+  EXPECT_CALL(builder,
+              BuildRaise(Property(&config::Raise::event, Eq("limit"))))
+      .Times(1);
+  EXPECT_CALL(builder,
+              BuildRaise(Property(&config::Raise::event, Eq("debug"))))
+      .Times(0);
+  EXPECT_CALL(builder, BuildRaise(Property(&config::Raise::event, Eq("else"))))
+      .Times(0);
+  ASSERT_TRUE(builder.Build());
+
+  EXPECT_THAT(builder.read_only_variables(), ElementsAre("debug", "limit"));
+  std::vector<string> folded;
+  for (const auto& folded_condition : builder.folded_conditions()) {
+    folded.push_back(FoldedConditionString(folded_condition));
+  }
+  EXPECT_THAT(folded,
+              ElementsAre("if debug = false", "if limit >= 10 = true"));
+}
+
+// Test that transitions with constant false conditions are dropped and that
+// constant true conditions are removed. Variables that are written are not
+// constant, and neither are function calls.
+TEST_F(ModelBuilderTest, FoldConstantConditionsOfTransitions) {
+  config::StateChartBuilder sc_builder(&state_chart_, "test");
+  sc_builder.DataModel().AddDataFromExpr("mode", "'fast'");
+  auto state_A = sc_builder.AddState("A");
+  state_A.DataModel().AddDataFromExpr("fast", "mode == 'fast'");
+  state_A.DataModel().AddDataFromExpr("count", "0");
+  state_A.AddTransition({"e1"}, {"B"}, "mode == 'slow'");
+  state_A.AddTransition({"e2"}, {"B"}, "fast && 1 < 2");
+  state_A.AddTransition({"e3"}, {"B"}, "count > 0");
+  state_A.AddTransition({"e4"}, {"B"}, "In('B') || true");
+  sc_builder.AddState("B")
+      .OnEntry()
+      .AddForEach("[1, 2]", "count", "")
+      .EndForEach();
+
+  NiceMock<MockFunctionDispatcher> function_dispatcher;
+  NiceMock<TestModelBuilder> builder(
+      state_chart_, LightWeightDatamodel::GetBytecodeCompiler());
+  builder.EnableConstantFolding(
+      LightWeightDatamodel::Create(&function_dispatcher));
+  ASSERT_TRUE(builder.Build());
+
+  EXPECT_THAT(builder.read_only_variables(), ElementsAre("fast", "mode"));
+  std::vector<string> folded;
+  for (const auto& folded_condition : builder.folded_conditions()) {
+    folded.push_back(FoldedConditionString(folded_condition));
+  }
+  EXPECT_THAT(folded, ElementsAre("transition A mode == 'slow' = false",
+                                  "transition A fast && 1 < 2 = true"));
+
+  const auto& transitions = builder.states_map_.at("A")->GetTransitions();
+  ASSERT_EQ(3, transitions.size());
+  EXPECT_THAT(transitions[0]->GetEvents(), ElementsAre("e2"));
+  EXPECT_EQ("", transitions[0]->GetCondition());
+  EXPECT_EQ("count > 0", transitions[1]->GetCondition());
+  EXPECT_EQ("In('B') || true", transitions[2]->GetCondition());
+}
+
+// Test that without early binding only conditions of literals are folded.
+TEST_F(ModelBuilderTest, FoldConstantConditionsWithLateBinding) {
+  config::StateChartBuilder sc_builder(&state_chart_, "test");
+  sc_builder.SetBinding(config::StateChart::BINDING_LATE);
+  sc_builder.DataModel().AddDataFromExpr("a", "1");
+  auto state_A = sc_builder.AddState("A");
+  state_A.AddTransition({"e1"}, {"A"}, "a == 1");
+  state_A.AddTransition({"e2"}, {"A"}, "1 > 2");
+
+  NiceMock<MockFunctionDispatcher> function_dispatcher;
+  NiceMock<TestModelBuilder> builder(
+      state_chart_, LightWeightDatamodel::GetExpressionCompiler());
+  builder.EnableConstantFolding(
+      LightWeightDatamodel::Create(&function_dispatcher));
+  ASSERT_TRUE(builder.Build());
+
+  EXPECT_THAT(builder.read_only_variables(), ElementsAre("a"));
+  ASSERT_EQ(1, builder.folded_conditions().size());
+  EXPECT_EQ("1 > 2", builder.folded_conditions()[0].condition);
+  const auto& transitions = builder.states_map_.at("A")->GetTransitions();
+  ASSERT_EQ(1, transitions.size());
+  EXPECT_EQ("a == 1", transitions[0]->GetCondition());
+}
+
+// Test that locations are written to their top-level variable regardless of
+// surrounding whitespace, so that such variables are not constant.
+TEST_F(ModelBuilderTest, FoldConstantConditionsWithSpacedLocations) {
+  config::StateChartBuilder sc_builder(&state_chart_, "test");
+  sc_builder.DataModel()
+      .AddDataFromExpr("a", "1")
+      .AddDataFromExpr("b", "{}")
+      .AddDataFromExpr("c", "3");
+  auto state_A = sc_builder.AddState("A");
+  state_A.OnEntry().AddAssign(" a ", "2").AddAssign(" b .x", "1");
+  state_A.AddTransition({"e1"}, {"A"}, "a == 1");
+  state_A.AddTransition({"e2"}, {"A"}, "c == 1");
+
+  NiceMock<MockFunctionDispatcher> function_dispatcher;
+  NiceMock<TestModelBuilder> builder(
+      state_chart_, LightWeightDatamodel::GetExpressionCompiler());
+  builder.EnableConstantFolding(
+      LightWeightDatamodel::Create(&function_dispatcher));
+  ASSERT_TRUE(builder.Build());
+
+  EXPECT_THAT(builder.read_only_variables(), ElementsAre("c"));
+  ASSERT_EQ(1, builder.folded_conditions().size());
+  EXPECT_EQ("c == 1", builder.folded_conditions()[0].condition);
+  const auto& transitions = builder.states_map_.at("A")->GetTransitions();
+  ASSERT_EQ(1, transitions.size());
+  EXPECT_EQ("a == 1", transitions[0]->GetCondition());
+}
+
 TEST_F(ModelBuilderTest, BuildParallelState) {
   config::StateElement e;
   config::ParallelBuilder s_builder(e.mutable_parallel(), "A");
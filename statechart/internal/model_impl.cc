@@ -322,13 +322,15 @@ ModelImpl::ModelImpl(
     const std::vector<const model::State*>& top_level_states,
     config::StateChart::Binding datamodel_binding,
     const model::ExecutableContent* datamodel,
-    const std::vector<const model::ModelElement*>& model_elements)
+    const std::vector<const model::ModelElement*>& model_elements,
+    std::shared_ptr<const SymbolTable> symbols)
     : name_(name),
       initial_transition_(initial_transition),
       top_level_states_(top_level_states),
       datamodel_binding_(datamodel_binding),
       datamodel_(datamodel),
-      model_elements_(model_elements.begin(), model_elements.end()) {}
+      model_elements_(model_elements.begin(), model_elements.end()),
+      symbols_(std::move(symbols)) {}
 
 // virtual
 bool ModelImpl::StateDocumentOrderLessThan(const model::State* state1,
@@ -454,6 +456,25 @@ std::vector<const model::Transition*> ModelImpl::SelectTransitions(
   return RemoveConflictingTransitions(runtime, enabled_transitions);
 }
 
+bool ModelImpl::HasTransitionsForEvent(const Runtime* runtime,
+                                       const string& event) const {
+  RETURN_FALSE_IF(runtime == nullptr);
+  for (const model::State* state : runtime->GetActiveStates()) {
+    if (!state->IsAtomic()) {
+      continue;
+    }
+    for (; state != nullptr; state = state->GetParent()) {
+      for (const model::Transition* transition : state->GetTransitions()) {
+        if (!transition->GetEvents().empty() &&
+            Model::EventMatches(event, transition->GetEvents())) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
 // Note that this differs from the SCXML pseudo-code's 'computeEntrySet' in that
 // 'states_to_enter' is sorted in entry order.
 // Note that the runtime is needed for the 'historyValue[state.id()]' global
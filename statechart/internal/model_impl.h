@@ -30,6 +30,7 @@
 
 namespace state_chart {
 class Runtime;
+class SymbolTable;
 namespace model {
 class ExecutableContent;
 class ModelElement;
@@ -52,11 +53,14 @@ class ModelImpl : public Model {
   //  datamodel_binding  Late or early binding.
   //  datamodel          Executable content, i.e., <data> declarations.
   //  model_elements     All model objects to take ownership of.
+  //  symbols            The top-level variables of the datamodel, may be
+  //                     nullptr.
   ModelImpl(const string& name, const model::Transition* initial_transition,
             const std::vector<const model::State*>& top_level_states,
             config::StateChart::Binding datamodel_binding,
             const model::ExecutableContent* datamodel,
-            const std::vector<const model::ModelElement*>& model_elements);
+            const std::vector<const model::ModelElement*>& model_elements,
+            std::shared_ptr<const SymbolTable> symbols = nullptr);
 
   ModelImpl(const ModelImpl&) = delete;
   ModelImpl& operator=(const ModelImpl&) = delete;
@@ -73,6 +77,9 @@ class ModelImpl : public Model {
     return SelectTransitions(runtime, &event);
   }
 
+  bool HasTransitionsForEvent(const Runtime* runtime,
+                              const string& event) const override;
+
   const model::Transition* GetInitialTransition() const override {
     return initial_transition_;
   }
@@ -89,6 +96,10 @@ class ModelImpl : public Model {
     return top_level_states_;
   }
 
+  std::shared_ptr<const SymbolTable> GetSymbolTable() const override {
+    return symbols_;
+  }
+
   // Returns pointers to state(s) for a given tree of active states.
   std::vector<const model::State*> GetActiveStates(
       const proto2::RepeatedPtrField<
@@ -144,6 +155,8 @@ class ModelImpl : public Model {
   // This contains all ModelElements reacheable from 'top_level_states' for
   // memory management.
   std::vector<std::unique_ptr<const model::ModelElement>> model_elements_;
+  // The top-level variables of the datamodel.
+  const std::shared_ptr<const SymbolTable> symbols_;
 };
 
 }  // namespace state_chart
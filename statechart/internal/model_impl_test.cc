@@ -330,6 +330,39 @@ TEST_F(ModelImplTest, SelectTransitionInCompoundStates) {
   EXPECT_THAT(SelectTransitions(&event), ElementsAre(&transition_BD));
 }
 
+// Test matching events with the transitions of active states and their
+// ancestors.
+TEST_F(ModelImplTest, HasTransitionsForEvent) {
+  MockState state_A("A");
+  MockState state_B("B");
+  state_A.AddChild(&state_B);
+  MockState state_C("C");
+
+  MockTransition transition_AC(&state_A, &state_C, {"event1"});
+  MockTransition transition_BC(&state_B, &state_C, {"event2.sub", "event3"});
+  MockTransition transition_CA(&state_C, &state_A, {"*"});
+  MockTransition eventless_BC(&state_B, &state_C);
+  state_A.mutable_transitions()->push_back(&transition_AC);
+  state_B.mutable_transitions()->assign({&eventless_BC, &transition_BC});
+  state_C.mutable_transitions()->push_back(&transition_CA);
+
+  Reset({&state_A, &state_C});
+
+  ON_CALL(runtime_, GetActiveStates())
+      .WillByDefault(Return(StateSet{&state_A, &state_B}));
+
+  EXPECT_TRUE(model_->HasTransitionsForEvent(&runtime_, "event1"));
+  EXPECT_TRUE(model_->HasTransitionsForEvent(&runtime_, "event1.sub"));
+  EXPECT_TRUE(model_->HasTransitionsForEvent(&runtime_, "event2.sub"));
+  EXPECT_TRUE(model_->HasTransitionsForEvent(&runtime_, "event3"));
+  EXPECT_FALSE(model_->HasTransitionsForEvent(&runtime_, "event2"));
+  EXPECT_FALSE(model_->HasTransitionsForEvent(&runtime_, "event"));
+
+  ON_CALL(runtime_, GetActiveStates())
+      .WillByDefault(Return(StateSet{&state_C}));
+  EXPECT_TRUE(model_->HasTransitionsForEvent(&runtime_, "event"));
+}
+
 // Test compute entry order for initial transition.
 TEST_F(ModelImplTest, ComputeEntryOrderForInitialTransition) {
   MockState state_A("A");
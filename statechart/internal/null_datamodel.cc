@@ -0,0 +1,140 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "statechart/internal/null_datamodel.h"
+
+#include <cstring>
+#include <memory>
+#include <set>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/strip.h"
+#include "absl/strings/string_view.h"
+#include "statechart/internal/runtime.h"
+
+namespace state_chart {
+namespace {
+
+constexpr char kNullExpressionLanguage[] = "null";
+
+// An In() condition compiled to the id of the state that it tests.
+class CompiledInCondition : public CompiledExpression {
+ public:
+  explicit CompiledInCondition(string state_id)
+      : state_id_(std::move(state_id)) {}
+
+  const char* language() const override { return kNullExpressionLanguage; }
+
+  const string& state_id() const { return state_id_; }
+
+ private:
+  const string state_id_;
+};
+
+// Sets 'state_id' to the argument of a condition of the form In('state_id')
+// or In("state_id"). Returns false if 'expr' is not of this form.
+bool ParseInCondition(absl::string_view expr, string* state_id) {
+  expr = absl::StripAsciiWhitespace(expr);
+  if (!absl::ConsumePrefix(&expr, "In(") ||
+      !absl::ConsumeSuffix(&expr, ")")) {
+    return false;
+  }
+  expr = absl::StripAsciiWhitespace(expr);
+  if (expr.size() < 2 || (expr.front() != '\'' && expr.front() != '"') ||
+      expr.back() != expr.front()) {
+    return false;
+  }
+  expr = expr.substr(1, expr.size() - 2);
+  if (expr.find_first_of("'\"\\") != absl::string_view::npos) {
+    return false;
+  }
+  *state_id = string(expr);
+  return true;
+}
+
+class NullExpressionCompiler : public ExpressionCompiler {
+ public:
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const override {
+    string state_id;
+    if (!ParseInCondition(expr, &state_id)) {
+      return nullptr;
+    }
+    return std::make_shared<CompiledInCondition>(std::move(state_id));
+  }
+
+  // In() conditions depend on the runtime, not on variables.
+  bool GetReadVariables(const string& expr,
+                        std::set<string>* variables) const override {
+    return false;
+  }
+};
+
+}  // namespace
+
+// static
+std::unique_ptr<NullDatamodel> NullDatamodel::Create() {
+  return absl::WrapUnique(new NullDatamodel());
+}
+
+// static
+const ExpressionCompiler* NullDatamodel::GetExpressionCompiler() {
+  static const auto* const kCompiler = new NullExpressionCompiler();
+  return kCompiler;
+}
+
+// override
+bool NullDatamodel::EvaluateBooleanExpression(const string& expr,
+                                              bool* result) const {
+  string state_id;
+  if (!ParseInCondition(expr, &state_id)) {
+    VLOG(1) << "The null datamodel only evaluates In() conditions: " << expr;
+    return false;
+  }
+  return EvaluateIn(state_id, result);
+}
+
+// override
+bool NullDatamodel::EvaluateBooleanExpression(const Expression& expr,
+                                              bool* result) const {
+  if (expr.compiled() != nullptr &&
+      strcmp(expr.compiled()->language(), kNullExpressionLanguage) == 0) {
+    return EvaluateIn(
+        static_cast<const CompiledInCondition*>(expr.compiled())->state_id(),
+        result);
+  }
+  return EvaluateBooleanExpression(expr.source(), result);
+}
+
+// override
+std::unique_ptr<Datamodel> NullDatamodel::Clone() const {
+  auto datamodel = Create();
+  datamodel->runtime_ = runtime_;
+  return datamodel;
+}
+
+bool NullDatamodel::EvaluateIn(const string& state_id, bool* result) const {
+  if (runtime_ == nullptr) {
+    return false;
+  }
+  *result = runtime_->IsActiveState(state_id);
+  return true;
+}
+
+}  // namespace state_chart
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_NULL_DATAMODEL_H_
+#define STATE_CHART_INTERNAL_NULL_DATAMODEL_H_
+
+#include <memory>
+#include <string>
+
+#include "statechart/internal/datamodel.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+// The SCXML 'null' datamodel. It has no data, so it does not bind system
+// variables, and the only expressions are conditions of the form In('id'),
+// which are true iff the state 'id' is active in the runtime. Locations cannot
+// be declared or assigned, and all other expressions are evaluation errors.
+class NullDatamodel : public Datamodel {
+ public:
+  static std::unique_ptr<NullDatamodel> Create();
+
+  // Returns the compiler of In() conditions to the state id they test.
+  static const ExpressionCompiler* GetExpressionCompiler();
+
+  NullDatamodel(const NullDatamodel&) = delete;
+  NullDatamodel& operator=(const NullDatamodel&) = delete;
+  ~NullDatamodel() override = default;
+
+  bool IsDefined(const string& location) const override { return false; }
+  bool Declare(const string& location) override { return false; }
+  bool AssignExpression(const string& location, const string& expr) override {
+    return false;
+  }
+  bool AssignString(const string& location, const string& str) override {
+    return false;
+  }
+
+  bool EvaluateBooleanExpression(const string& expr,
+                                 bool* result) const override;
+  bool EvaluateBooleanExpression(const Expression& expr,
+                                 bool* result) const override;
+  bool EvaluateStringExpression(const string& expr,
+                                string* result) const override {
+    return false;
+  }
+  bool EvaluateExpression(const string& expr, string* result) const override {
+    return false;
+  }
+
+  string EncodeParameters(
+      const std::map<string, string>& parameters) const override {
+    return "";
+  }
+  string DebugString() const override { return "null"; }
+  void Clear() override {}
+  std::unique_ptr<Datamodel> Clone() const override;
+  string SerializeAsString() const override { return ""; }
+
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const string& location) const override {
+    return nullptr;
+  }
+
+  const Runtime* GetRuntime() const override { return runtime_; }
+  void SetRuntime(Runtime* runtime) override { runtime_ = runtime; }
+
+  bool HasSystemVariables() const override { return false; }
+
+ protected:
+  // Only the empty serialized representation is valid.
+  bool ParseFromString(const string& data) override { return data.empty(); }
+
+ private:
+  NullDatamodel() = default;
+
+  // Evaluates In('state_id') to 'result'.
+  bool EvaluateIn(const string& state_id, bool* result) const;
+
+  // The runtime whose active states In() tests, not owned.
+  const Runtime* runtime_ = nullptr;
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_NULL_DATAMODEL_H_
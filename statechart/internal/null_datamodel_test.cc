@@ -0,0 +1,83 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "statechart/internal/null_datamodel.h"
+
+#include <memory>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/testing/mock_runtime.h"
+
+namespace state_chart {
+namespace {
+
+using ::testing::Return;
+
+class NullDatamodelTest : public ::testing::Test {
+ protected:
+  NullDatamodelTest() : datamodel_(NullDatamodel::Create()) {
+    datamodel_->SetRuntime(&runtime_);
+    ON_CALL(runtime_, IsActiveState("A")).WillByDefault(Return(true));
+    ON_CALL(runtime_, IsActiveState("B")).WillByDefault(Return(false));
+  }
+
+  MockRuntime runtime_;
+  std::unique_ptr<Datamodel> datamodel_;
+};
+
+TEST_F(NullDatamodelTest, EvaluatesInConditions) {
+  bool result = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression("In('A')", &result));
+  EXPECT_TRUE(result);
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(" In( \"B\" ) ", &result));
+  EXPECT_FALSE(result);
+
+  for (const char* expr :
+       {"In(A)", "In('A\")", "true", "x == 1", "In('A') && true"}) {
+    EXPECT_FALSE(datamodel_->EvaluateBooleanExpression(expr, &result)) << expr;
+  }
+}
+
+TEST_F(NullDatamodelTest, EvaluatesCompiledInConditions) {
+  const ExpressionCompiler* compiler = NullDatamodel::GetExpressionCompiler();
+  EXPECT_EQ(nullptr, compiler->Compile("x"));
+  const Expression in_a("In('A')", compiler->Compile("In('A')"));
+  ASSERT_NE(nullptr, in_a.compiled());
+  bool result = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(in_a, &result));
+  EXPECT_TRUE(result);
+
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(clone->EvaluateBooleanExpression(
+      Expression("In('B')", compiler->Compile("In('B')")), &result));
+  EXPECT_FALSE(result);
+}
+
+TEST_F(NullDatamodelTest, HasNoData) {
+  EXPECT_FALSE(datamodel_->HasSystemVariables());
+  EXPECT_FALSE(datamodel_->Declare("x"));
+  EXPECT_FALSE(datamodel_->AssignExpression("x", "1"));
+  EXPECT_FALSE(datamodel_->IsDefined("x"));
+  string result;
+  EXPECT_FALSE(datamodel_->EvaluateExpression("1", &result));
+  EXPECT_EQ(nullptr, datamodel_->EvaluateIterator("[1]"));
+  EXPECT_EQ("", datamodel_->SerializeAsString());
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -0,0 +1,1612 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "statechart/internal/proto_datamodel.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "include/json/json.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/light_weight_expression.h"
+#include "statechart/internal/runtime.h"
+#include "statechart/logging.h"
+
+namespace state_chart {
+namespace internal {
+
+// A field of a message along a path, or an element of a repeated field.
+struct ProtoPathStep {
+  static constexpr int kNoIndex = -1;
+
+  const proto2::FieldDescriptor* field;
+  int index;
+};
+
+// A location of a ProtoDatamodel expression, resolved when the expression is
+// parsed.
+struct ProtoLocation {
+  // The fields of a location in the store from the root message.
+  std::vector<ProtoPathStep> path;
+  // The member names and array indices of a location in the system variables
+  // from their object, e.g., "_event", "data", 0. Empty for fields.
+  std::vector<Json::Value> system_path;
+};
+
+// The syntax tree of a ProtoDatamodel expression, as parsed for the
+// LightWeightDatamodel. Identifiers and the element accesses with literal keys
+// under them are locations, which are resolved in the fields of the message.
+struct ProtoSyntaxTree {
+  std::unique_ptr<const ExpressionNode> root;
+  // The nodes of 'root' that are locations.
+  std::map<const ExpressionNode*, ProtoLocation> locations;
+  // The identifiers of 'root' that stand for the JSON objects and arrays of
+  // the expression, with their values.
+  std::map<const ExpressionNode*, Json::Value> literals;
+};
+
+// What the expressions of a ProtoDatamodel read.
+struct ProtoScope {
+  const proto2::Message* store;
+  const Json::Value* system_variables;
+  // The message of '_event.data' if it was assigned a message, or nullptr.
+  const proto2::Message* event_data;
+  // May be nullptr.
+  const Runtime* runtime;
+  // May be nullptr.
+  FunctionDispatcher* dispatcher;
+};
+
+// The value of an expression: a message, all elements of a repeated field of
+// 'message', or a scalar.
+struct ProtoValue {
+  const proto2::Message* message = nullptr;
+  const proto2::FieldDescriptor* repeated_field = nullptr;
+  Json::Value scalar;
+};
+
+}  // namespace internal
+
+namespace {
+
+using internal::ExpressionNode;
+using internal::ProtoLocation;
+using internal::ProtoPathStep;
+using internal::ProtoScope;
+using internal::ProtoSyntaxTree;
+using internal::ProtoValue;
+
+constexpr char kProtoExpressionLanguage[] = "proto";
+
+// The prefix of the identifiers that stand for JSON objects and arrays while an
+// expression is parsed. Field names cannot contain '$'.
+constexpr char kJsonLiteralPrefix[] = "$json";
+
+// Returns true for the variables that the Executor binds.
+bool IsSystemVariable(absl::string_view identifier) {
+  return identifier == "_event" || identifier == "_name" ||
+         identifier == "_sessionid";
+}
+
+// Returns true if 'key' is an index of a repeated field or of an array.
+bool IsIndex(const Json::Value& key) {
+  return (key.type() == Json::intValue || key.type() == Json::uintValue) &&
+         key.isInt() && key.asInt() >= 0;
+}
+
+// Returns the position of the brace or bracket that closes the JSON object or
+// array at position 'start' of 'expr', or npos if it is not closed. Braces and
+// brackets in strings are skipped.
+size_t ClosingBracket(absl::string_view expr, size_t start) {
+  int depth = 0;
+  bool in_string = false;
+  for (size_t i = start; i < expr.size(); ++i) {
+    const char c = expr[i];
+    if (in_string) {
+      if (c == '\\') {
+        ++i;
+      } else if (c == '"') {
+        in_string = false;
+      }
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      return i;
+    }
+  }
+  return absl::string_view::npos;
+}
+
+// Returns true if an operand starts after 'prefix', so that a bracket after it
+// starts an array rather than an element access.
+bool AtOperandStart(absl::string_view prefix) {
+  prefix = absl::StripTrailingAsciiWhitespace(prefix);
+  return prefix.empty() ||
+         absl::string_view("([,+-*/<>=!&|").find(prefix.back()) !=
+             absl::string_view::npos;
+}
+
+// The parser of the LightWeightDatamodel reads neither JSON objects nor arrays
+// inside larger expressions. Sets 'parsed' to 'expr' with each of them replaced
+// by kJsonLiteralPrefix and its index in 'literals', which is set to their
+// values. Returns false if one is not strict JSON.
+bool ExtractJsonLiterals(absl::string_view expr, string* parsed,
+                         std::vector<Json::Value>* literals) {
+  size_t copied = 0;
+  for (size_t i = 0; i < expr.size(); ++i) {
+    const char c = expr[i];
+    if (c == '"' || c == '\'') {
+      // Skip to the closing quote that is not escaped, as the tokenizer does.
+      size_t end = i;
+      do {
+        end = expr.find(c, end + 1);
+      } while (end != absl::string_view::npos && expr[end - 1] == '\\');
+      if (end == absl::string_view::npos) {
+        break;
+      }
+      i = end;
+      continue;
+    }
+    if (c != '{' && (c != '[' || !AtOperandStart(expr.substr(0, i)))) {
+      continue;
+    }
+    const size_t end = ClosingBracket(expr, i);
+    Json::Value value;
+    if (end == absl::string_view::npos ||
+        !ParseJsonText(expr.substr(i, end + 1 - i),
+                       Json::Features::strictMode(), &value, nullptr)) {
+      return false;
+    }
+    absl::StrAppend(parsed, expr.substr(copied, i - copied),
+                    kJsonLiteralPrefix, literals->size());
+    literals->push_back(std::move(value));
+    copied = end + 1;
+    i = end;
+  }
+  absl::StrAppend(parsed, expr.substr(copied));
+  return true;
+}
+
+// Returns the index in the JSON literals of an expression that 'node' stands
+// for, or -1 if it does not stand for one.
+int JsonLiteralIndex(const ExpressionNode& node) {
+  int index = -1;
+  if (node.type != ExpressionNode::kIdentifier ||
+      !absl::StartsWith(node.name, kJsonLiteralPrefix) ||
+      !absl::SimpleAtoi(
+          absl::string_view(node.name).substr(strlen(kJsonLiteralPrefix)),
+          &index)) {
+    return -1;
+  }
+  return index;
+}
+
+// Appends the keys of 'node' to 'keys' if it is a location, i.e., an
+// identifier followed by element accesses with literal member names or
+// indices. E.g., the keys of "a.b[2].c" are "a", "b", 2 and "c".
+bool GetLocationKeys(const ExpressionNode& node,
+                     std::vector<Json::Value>* keys) {
+  if (JsonLiteralIndex(node) >= 0) {
+    return false;
+  }
+  if (node.type == ExpressionNode::kIdentifier) {
+    for (absl::string_view member : absl::StrSplit(node.name, '.')) {
+      if (member.empty()) {
+        return false;
+      }
+      keys->emplace_back(string(member));
+    }
+    return true;
+  }
+  if (node.type != ExpressionNode::kElementAccess ||
+      node.operands[1]->type != ExpressionNode::kLiteral) {
+    return false;
+  }
+  const Json::Value& key = node.operands[1]->value;
+  if ((!key.isString() && !IsIndex(key)) ||
+      !GetLocationKeys(*node.operands[0], keys)) {
+    return false;
+  }
+  keys->push_back(key);
+  return true;
+}
+
+// Resolves the location 'keys' in the fields of 'descriptor', or in the system
+// variables if it starts with one. Their members are not known, so they are
+// not resolved. Returns false if a field does not exist.
+bool ResolveLocation(const std::vector<Json::Value>& keys,
+                     const proto2::Descriptor* descriptor,
+                     ProtoLocation* location) {
+  if (IsSystemVariable(keys[0].asString())) {
+    location->system_path = keys;
+    return true;
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (descriptor == nullptr || !keys[i].isString()) {
+      return false;
+    }
+    const proto2::FieldDescriptor* field =
+        descriptor->FindFieldByName(keys[i].asString());
+    if (field == nullptr) {
+      return false;
+    }
+    ProtoPathStep step = {field, ProtoPathStep::kNoIndex};
+    if (i + 1 < keys.size() && IsIndex(keys[i + 1])) {
+      if (!field->is_repeated()) {
+        return false;
+      }
+      step.index = keys[++i].asInt();
+    }
+    location->path.push_back(step);
+    // Only singular messages and elements of messages have fields.
+    const bool is_message =
+        field->cpp_type() == proto2::FieldDescriptor::CPPTYPE_MESSAGE;
+    descriptor = is_message && (!field->is_repeated() ||
+                                step.index != ProtoPathStep::kNoIndex)
+                     ? field->message_type()
+                     : nullptr;
+  }
+  return true;
+}
+
+// Resolves the locations in 'node' and in its operands into 'tree', and the
+// identifiers that stand for 'literals' into their values. Returns false if an
+// identifier is neither a field, a system variable nor a literal.
+bool ResolveLocations(const ExpressionNode& node,
+                      const proto2::Descriptor* descriptor,
+                      const std::vector<Json::Value>& literals,
+                      ProtoSyntaxTree* tree) {
+  const int literal = JsonLiteralIndex(node);
+  if (literal >= 0) {
+    if (literal >= static_cast<int>(literals.size())) {
+      return false;
+    }
+    tree->literals[&node] = literals[literal];
+    return true;
+  }
+  std::vector<Json::Value> keys;
+  if (GetLocationKeys(node, &keys)) {
+    return ResolveLocation(keys, descriptor, &tree->locations[&node]);
+  }
+  if (node.type == ExpressionNode::kIdentifier) {
+    return false;
+  }
+  for (const auto& operand : node.operands) {
+    if (!ResolveLocations(*operand, descriptor, literals, tree)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parses 'expr' with the parser of the LightWeightDatamodel and resolves its
+// locations in 'descriptor'. JSON objects and arrays are parsed here, since
+// that parser reads them only as whole expressions. Returns nullptr on errors.
+std::unique_ptr<ProtoSyntaxTree> ParseProtoExpression(
+    const string& expr, const proto2::Descriptor* descriptor) {
+  string parsed;
+  std::vector<Json::Value> literals;
+  if (!ExtractJsonLiterals(expr, &parsed, &literals)) {
+    return nullptr;
+  }
+  auto tree = absl::make_unique<ProtoSyntaxTree>();
+  tree->root = internal::ParseExpression(parsed);
+  if (tree->root == nullptr ||
+      !ResolveLocations(*tree->root, descriptor, literals, tree.get())) {
+    return nullptr;
+  }
+  return tree;
+}
+
+// Returns the location of 'node' in 'tree', or nullptr if it is not a
+// location.
+const ProtoLocation* FindLocation(const ProtoSyntaxTree& tree,
+                                  const ExpressionNode& node) {
+  const auto it = tree.locations.find(&node);
+  return it == tree.locations.end() ? nullptr : &it->second;
+}
+
+// Returns the location of the whole 'tree', or nullptr if it is not a
+// location.
+const ProtoLocation* RootLocation(const ProtoSyntaxTree& tree) {
+  return FindLocation(tree, *tree.root);
+}
+
+// An expression compiled for the messages of 'descriptor'.
+class CompiledProtoExpression : public CompiledExpression {
+ public:
+  CompiledProtoExpression(const proto2::Descriptor* descriptor,
+                          std::unique_ptr<ProtoSyntaxTree> tree)
+      : descriptor_(descriptor), tree_(std::move(tree)) {}
+
+  const char* language() const override { return kProtoExpressionLanguage; }
+
+  const proto2::Descriptor* descriptor() const { return descriptor_; }
+  const ProtoSyntaxTree& tree() const { return *tree_; }
+
+ private:
+  const proto2::Descriptor* const descriptor_;
+  const std::unique_ptr<const ProtoSyntaxTree> tree_;
+};
+
+class ProtoExpressionCompiler : public ExpressionCompiler {
+ public:
+  explicit ProtoExpressionCompiler(const proto2::Descriptor* descriptor)
+      : descriptor_(descriptor) {}
+
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const override {
+    auto tree = ParseProtoExpression(expr, descriptor_);
+    if (tree == nullptr) {
+      return nullptr;
+    }
+    return std::make_shared<CompiledProtoExpression>(descriptor_,
+                                                     std::move(tree));
+  }
+
+  // The host may write any field of the message, so no expression is constant.
+  bool GetReadVariables(const string& expr,
+                        std::set<string>* variables) const override {
+    return false;
+  }
+
+ private:
+  const proto2::Descriptor* const descriptor_;
+};
+
+class ProtoDatamodelFactory : public DatamodelFactory {
+ public:
+  explicit ProtoDatamodelFactory(const proto2::Descriptor* descriptor)
+      : descriptor_(descriptor), compiler_(descriptor) {}
+
+  const ExpressionCompiler* GetExpressionCompiler() const override {
+    return &compiler_;
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const override {
+    return ProtoDatamodel::Create(descriptor_, dispatcher);
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const override {
+    RETURN_NULL_IF(!modifications.empty());
+    return ProtoDatamodel::Create(descriptor_, serialized_data, dispatcher);
+  }
+
+ private:
+  const proto2::Descriptor* const descriptor_;
+  const ProtoExpressionCompiler compiler_;
+};
+
+// Returns the scalar 'field' of 'message', or its element 'index' if it is
+// repeated. Enums are their names.
+Json::Value ScalarToJson(const proto2::Message& message,
+                         const proto2::FieldDescriptor* field, int index) {
+  using proto2::FieldDescriptor;
+  const proto2::Reflection* reflection = message.GetReflection();
+  const bool repeated = index != ProtoPathStep::kNoIndex;
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return repeated ? reflection->GetRepeatedInt32(message, field, index)
+                      : reflection->GetInt32(message, field);
+    case FieldDescriptor::CPPTYPE_INT64:
+      return Json::Value(static_cast<Json::Int64>(
+          repeated ? reflection->GetRepeatedInt64(message, field, index)
+                   : reflection->GetInt64(message, field)));
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return repeated ? reflection->GetRepeatedUInt32(message, field, index)
+                      : reflection->GetUInt32(message, field);
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return Json::Value(static_cast<Json::UInt64>(
+          repeated ? reflection->GetRepeatedUInt64(message, field, index)
+                   : reflection->GetUInt64(message, field)));
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return repeated ? reflection->GetRepeatedDouble(message, field, index)
+                      : reflection->GetDouble(message, field);
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return repeated ? reflection->GetRepeatedFloat(message, field, index)
+                      : reflection->GetFloat(message, field);
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return repeated ? reflection->GetRepeatedBool(message, field, index)
+                      : reflection->GetBool(message, field);
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return (repeated ? reflection->GetRepeatedEnum(message, field, index)
+                       : reflection->GetEnum(message, field))
+          ->name();
+    case FieldDescriptor::CPPTYPE_STRING:
+      return repeated ? reflection->GetRepeatedString(message, field, index)
+                      : reflection->GetString(message, field);
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      break;
+  }
+  return Json::Value();
+}
+
+bool IsNumber(const Json::Value& value) {
+  return value.type() == Json::intValue || value.type() == Json::uintValue ||
+         value.type() == Json::realValue;
+}
+
+// Sets the scalar 'field' of 'message' to 'value', or its element 'index' if
+// it is repeated. 'index' may be the size of the field to add an element.
+// Returns false if 'value' does not convert to the type of 'field'.
+bool SetScalar(const Json::Value& value, const proto2::FieldDescriptor* field,
+               int index, proto2::Message* message) {
+  using proto2::FieldDescriptor;
+  const proto2::Reflection* reflection = message->GetReflection();
+  const bool repeated = index != ProtoPathStep::kNoIndex;
+  const bool add = repeated && index == reflection->FieldSize(*message, field);
+#define STATE_CHART_SET_FIELD(Type, field_value)                      \
+  do {                                                                \
+    if (add) {                                                        \
+      reflection->Add##Type(message, field, field_value);             \
+    } else if (repeated) {                                            \
+      reflection->SetRepeated##Type(message, field, index, field_value); \
+    } else {                                                          \
+      reflection->Set##Type(message, field, field_value);             \
+    }                                                                 \
+    return true;                                                      \
+  } while (false)
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      if (IsNumber(value) && value.isInt()) {
+        STATE_CHART_SET_FIELD(Int32, value.asInt());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_INT64:
+      if (IsNumber(value) && value.isInt64()) {
+        STATE_CHART_SET_FIELD(Int64, value.asInt64());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+      if (IsNumber(value) && value.isUInt()) {
+        STATE_CHART_SET_FIELD(UInt32, value.asUInt());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_UINT64:
+      if (IsNumber(value) && value.isUInt64()) {
+        STATE_CHART_SET_FIELD(UInt64, value.asUInt64());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      if (IsNumber(value)) {
+        STATE_CHART_SET_FIELD(Double, value.asDouble());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      if (IsNumber(value)) {
+        STATE_CHART_SET_FIELD(Float, value.asFloat());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_BOOL:
+      if (value.isBool()) {
+        STATE_CHART_SET_FIELD(Bool, value.asBool());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_STRING:
+      if (value.isString()) {
+        STATE_CHART_SET_FIELD(String, value.asString());
+      }
+      break;
+    case FieldDescriptor::CPPTYPE_ENUM: {
+      const proto2::EnumValueDescriptor* enum_value =
+          value.isString()
+              ? field->enum_type()->FindValueByName(value.asString())
+              : IsNumber(value) && value.isInt()
+                    ? field->enum_type()->FindValueByNumber(value.asInt())
+                    : nullptr;
+      if (enum_value != nullptr) {
+        STATE_CHART_SET_FIELD(Enum, enum_value);
+      }
+      break;
+    }
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      break;
+  }
+#undef STATE_CHART_SET_FIELD
+  return false;
+}
+
+// Returns the message 'field' of 'message' for writing, or its element
+// 'index' if it is repeated. 'index' may be the size of the field to add an
+// element.
+proto2::Message* MutableMessage(const proto2::FieldDescriptor* field,
+                                int index, proto2::Message* message) {
+  const proto2::Reflection* reflection = message->GetReflection();
+  if (index == ProtoPathStep::kNoIndex) {
+    return reflection->MutableMessage(message, field);
+  }
+  if (index == reflection->FieldSize(*message, field)) {
+    return reflection->AddMessage(message, field);
+  }
+  return reflection->MutableRepeatedMessage(message, field, index);
+}
+
+// Sets 'message' to the proto3 JSON representation 'json'.
+bool SetMessageFromJson(const Json::Value& json, proto2::Message* message) {
+  if (!json.isObject()) {
+    return false;
+  }
+  std::unique_ptr<proto2::Message> parsed(message->New());
+  if (!proto2::util::JsonStringToMessage(ToJsonText(json),
+                                         parsed.get())
+           .ok()) {
+    return false;
+  }
+  message->GetReflection()->Swap(message, parsed.get());
+  return true;
+}
+
+// Returns the proto3 JSON representation of 'message' with the field names of
+// the proto, i.e., the names of the paths that access them.
+string MessageToJson(const proto2::Message& message) {
+  proto2::util::JsonPrintOptions options;
+  options.preserve_proto_field_names = true;
+  string json;
+  proto2::util::MessageToJsonString(message, &json, options);
+  return json;
+}
+
+// Formats a scalar as a JSON value expression.
+string ScalarToString(const Json::Value& value) {
+  return ToJsonText(value);
+}
+
+// Formats 'value' as an expression that evaluates to it.
+string ValueToString(const ProtoValue& value) {
+  if (value.repeated_field != nullptr) {
+    const proto2::Message& message = *value.message;
+    const int size =
+        message.GetReflection()->FieldSize(message, value.repeated_field);
+    string result = "[";
+    for (int i = 0; i < size; ++i) {
+      absl::StrAppend(
+          &result, i == 0 ? "" : ",",
+          value.repeated_field->cpp_type() ==
+                  proto2::FieldDescriptor::CPPTYPE_MESSAGE
+              ? MessageToJson(message.GetReflection()->GetRepeatedMessage(
+                    message, value.repeated_field, i))
+              : ScalarToString(
+                    ScalarToJson(message, value.repeated_field, i)));
+    }
+    return absl::StrCat(result, "]");
+  }
+  if (value.message != nullptr) {
+    return MessageToJson(*value.message);
+  }
+  return ScalarToString(value.scalar);
+}
+
+// Converts 'value' to JSON, with messages in the proto3 JSON format. Returns
+// false if the JSON of a message does not parse.
+bool ValueToJson(const ProtoValue& value, Json::Value* json) {
+  if (value.message == nullptr) {
+    *json = value.scalar;
+    return true;
+  }
+  return ParseJsonText(ValueToString(value), json);
+}
+
+// Compares two scalars with the comparison operator 'op'. Numbers compare by
+// value, and strings and booleans with values of their type. JSON objects and
+// arrays, e.g., of event payloads, are only equal to equal values. Sets
+// 'result' and returns true if the scalars are comparable.
+bool CompareScalars(const Json::Value& left, internal::OperatorId op,
+                    const Json::Value& right, bool* result) {
+  const bool is_equality = op == internal::kEqual || op == internal::kNotEqual;
+  int order = 0;
+  if (IsNumber(left) && IsNumber(right)) {
+    const double left_number = left.asDouble();
+    const double right_number = right.asDouble();
+    order = left_number < right_number ? -1 : left_number > right_number;
+  } else if (left.type() == right.type() &&
+             (left.isString() || left.isBool() || left.isNull())) {
+    order = left < right ? -1 : right < left;
+  } else if (is_equality) {
+    order = left.type() == right.type() && left == right ? 0 : 1;
+  } else {
+    return false;
+  }
+  switch (op) {
+    case internal::kEqual:
+      *result = order == 0;
+      return true;
+    case internal::kNotEqual:
+      *result = order != 0;
+      return true;
+    case internal::kLess:
+      *result = order < 0;
+      return true;
+    case internal::kLessEqual:
+      *result = order <= 0;
+      return true;
+    case internal::kGreater:
+      *result = order > 0;
+      return true;
+    case internal::kGreaterEqual:
+      *result = order >= 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Compares two values with the comparison operator 'op'. Messages and repeated
+// fields only compare for equality by value.
+bool Compare(const ProtoValue& left, internal::OperatorId op,
+             const ProtoValue& right, Json::Value* result) {
+  if (left.message != nullptr || right.message != nullptr) {
+    if (op != internal::kEqual && op != internal::kNotEqual) {
+      return false;
+    }
+    *result = (op == internal::kEqual) ==
+              (ValueToString(left) == ValueToString(right));
+    return true;
+  }
+  bool compared = false;
+  if (!CompareScalars(left.scalar, op, right.scalar, &compared)) {
+    return false;
+  }
+  *result = compared;
+  return true;
+}
+
+// Returns true if 'value' is a number that fits in an int64.
+bool IsInt64(const Json::Value& value) {
+  return (value.type() == Json::intValue || value.type() == Json::uintValue) &&
+         value.isInt64();
+}
+
+// Applies the arithmetic operator 'op' to two scalars like the
+// LightWeightDatamodel: '+' concatenates if an operand is a string, integers
+// stay integers, and division of integers truncates. Integers wrap around on
+// overflow. Returns false if an operand is not a number, or on division by
+// zero.
+bool ApplyArithmetic(const Json::Value& left, internal::OperatorId op,
+                     const Json::Value& right, Json::Value* result) {
+  if (op == internal::kPlus && (left.isString() || right.isString())) {
+    *result = absl::StrCat(left.isString() ? left.asString() : ToJsonText(left),
+                           right.isString() ? right.asString()
+                                            : ToJsonText(right));
+    return true;
+  }
+  if (!IsNumber(left) || !IsNumber(right) ||
+      (op == internal::kDivide && right.asDouble() == 0)) {
+    return false;
+  }
+  if (IsInt64(left) && IsInt64(right)) {
+    const Json::UInt64 a = left.asInt64();
+    const Json::UInt64 b = right.asInt64();
+    Json::UInt64 wrapped = 0;
+    switch (op) {
+      case internal::kPlus:
+        wrapped = a + b;
+        break;
+      case internal::kMinus:
+        wrapped = a - b;
+        break;
+      case internal::kMultiply:
+        wrapped = a * b;
+        break;
+      case internal::kDivide:
+        wrapped = right.asInt64() == -1
+                      ? 0 - a
+                      : static_cast<Json::UInt64>(left.asInt64() /
+                                                  right.asInt64());
+        break;
+      default:
+        return false;
+    }
+    *result = Json::Value(static_cast<Json::Int64>(wrapped));
+    return true;
+  }
+  const double a = left.asDouble();
+  const double b = right.asDouble();
+  switch (op) {
+    case internal::kPlus:
+      *result = a + b;
+      return true;
+    case internal::kMinus:
+      *result = a - b;
+      return true;
+    case internal::kMultiply:
+      *result = a * b;
+      return true;
+    case internal::kDivide:
+      *result = a / b;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Negates the number 'value'. Integers wrap around on overflow.
+bool Negate(const Json::Value& value, Json::Value* result) {
+  if (IsInt64(value)) {
+    *result = Json::Value(static_cast<Json::Int64>(
+        0 - static_cast<Json::UInt64>(value.asInt64())));
+    return true;
+  }
+  if (!IsNumber(value)) {
+    return false;
+  }
+  *result = -value.asDouble();
+  return true;
+}
+
+// An iterator over the elements of a repeated field of a message.
+class RepeatedFieldIterator : public Iterator {
+ public:
+  RepeatedFieldIterator(const proto2::Message* message,
+                        const proto2::FieldDescriptor* field)
+      : message_(message),
+        field_(field),
+        size_(message->GetReflection()->FieldSize(*message, field)) {}
+
+  bool AtEnd() const override { return index_ >= size_; }
+
+  bool Next() override {
+    if (AtEnd()) {
+      return false;
+    }
+    ++index_;
+    return !AtEnd();
+  }
+
+  string GetValue() const override {
+    ProtoValue value;
+    if (field_->cpp_type() == proto2::FieldDescriptor::CPPTYPE_MESSAGE) {
+      value.message =
+          &message_->GetReflection()->GetRepeatedMessage(*message_, field_,
+                                                         index_);
+    } else {
+      value.scalar = ScalarToJson(*message_, field_, index_);
+    }
+    return ValueToString(value);
+  }
+
+  string GetIndex() const override { return absl::StrCat(index_); }
+
+ private:
+  const proto2::Message* const message_;
+  const proto2::FieldDescriptor* const field_;
+  const int size_;
+  int index_ = 0;
+};
+
+// An iterator over the elements of a JSON array, e.g., of an event payload.
+class JsonArrayIterator : public Iterator {
+ public:
+  explicit JsonArrayIterator(Json::Value array) : array_(std::move(array)) {}
+
+  bool AtEnd() const override { return index_ >= array_.size(); }
+
+  bool Next() override {
+    if (AtEnd()) {
+      return false;
+    }
+    ++index_;
+    return !AtEnd();
+  }
+
+  string GetValue() const override { return ToJsonText(array_[index_]); }
+
+  string GetIndex() const override { return absl::StrCat(index_); }
+
+ private:
+  const Json::Value array_;
+  Json::ArrayIndex index_ = 0;
+};
+
+// Resolves all but the last step of 'path' in 'root' to 'parent'. Returns
+// false if an element does not exist.
+bool ResolveParent(const proto2::Message& root,
+                   const std::vector<ProtoPathStep>& path,
+                   const proto2::Message** parent) {
+  const proto2::Message* message = &root;
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    const proto2::Reflection* reflection = message->GetReflection();
+    const ProtoPathStep& step = path[i];
+    if (step.index == ProtoPathStep::kNoIndex) {
+      message = &reflection->GetMessage(*message, step.field);
+    } else if (step.index < reflection->FieldSize(*message, step.field)) {
+      message = &reflection->GetRepeatedMessage(*message, step.field,
+                                                step.index);
+    } else {
+      return false;
+    }
+  }
+  *parent = message;
+  return true;
+}
+
+// Same as above for writing. Elements after the last element of repeated
+// fields are added.
+bool ResolveMutableParent(const std::vector<ProtoPathStep>& path,
+                          proto2::Message* root, proto2::Message** parent) {
+  proto2::Message* message = root;
+  for (size_t i = 0; i + 1 < path.size(); ++i) {
+    const ProtoPathStep& step = path[i];
+    if (step.index != ProtoPathStep::kNoIndex &&
+        step.index >
+            message->GetReflection()->FieldSize(*message, step.field)) {
+      return false;
+    }
+    message = MutableMessage(step.field, step.index, message);
+  }
+  *parent = message;
+  return true;
+}
+
+// Returns the member of 'system_variables' at 'path', or nullptr if it does not
+// exist.
+const Json::Value* ResolveSystemPath(const Json::Value& system_variables,
+                                     const std::vector<Json::Value>& path) {
+  const Json::Value* value = &system_variables;
+  for (const Json::Value& step : path) {
+    if (step.isString()) {
+      if (!value->isObject() || !value->isMember(step.asString())) {
+        return nullptr;
+      }
+      value = &(*value)[step.asString()];
+    } else {
+      if (!value->isArray() || step.asUInt() >= value->size()) {
+        return nullptr;
+      }
+      value = &(*value)[step.asUInt()];
+    }
+  }
+  return value;
+}
+
+// Same as above for writing. Missing members are added, as are elements right
+// after the last element of arrays. Returns nullptr if a value along 'path' is
+// neither null nor of the type of the step.
+Json::Value* MutableSystemPath(const std::vector<Json::Value>& path,
+                               Json::Value* system_variables) {
+  Json::Value* value = system_variables;
+  for (const Json::Value& step : path) {
+    if (step.isString()) {
+      if (!value->isObject() && !value->isNull()) {
+        return nullptr;
+      }
+      value = &(*value)[step.asString()];
+    } else {
+      if ((!value->isArray() && !value->isNull()) ||
+          step.asUInt() > value->size()) {
+        return nullptr;
+      }
+      value = &(*value)[step.asUInt()];
+    }
+  }
+  return value;
+}
+
+// Returns true if 'path' is '_event.data' or a path into it.
+bool IsEventDataPath(const std::vector<Json::Value>& path) {
+  return path.size() >= 2 && path[0] == "_event" && path[1] == "data";
+}
+
+// Accesses the element at 'key' of 'container': an element of a repeated
+// field or a field of a message, read with reflection, or an element or a
+// member of a JSON value. Returns false if the element does not exist.
+bool AccessElement(const ProtoValue& container, const Json::Value& key,
+                   ProtoValue* value) {
+  using proto2::FieldDescriptor;
+  if (container.repeated_field != nullptr) {
+    const proto2::Message& message = *container.message;
+    const FieldDescriptor* field = container.repeated_field;
+    if (!IsIndex(key) ||
+        key.asInt() >= message.GetReflection()->FieldSize(message, field)) {
+      return false;
+    }
+    if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      value->message = &message.GetReflection()->GetRepeatedMessage(
+          message, field, key.asInt());
+    } else {
+      value->scalar = ScalarToJson(message, field, key.asInt());
+    }
+    return true;
+  }
+  if (container.message != nullptr) {
+    const proto2::Message& message = *container.message;
+    const FieldDescriptor* field =
+        key.isString()
+            ? message.GetDescriptor()->FindFieldByName(key.asString())
+            : nullptr;
+    if (field == nullptr) {
+      return false;
+    }
+    if (field->is_repeated()) {
+      value->message = &message;
+      value->repeated_field = field;
+    } else if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE) {
+      value->message = &message.GetReflection()->GetMessage(message, field);
+    } else {
+      value->scalar = ScalarToJson(message, field, ProtoPathStep::kNoIndex);
+    }
+    return true;
+  }
+  const Json::Value& json = container.scalar;
+  if (json.isArray() && IsIndex(key) && key.asUInt() < json.size()) {
+    value->scalar = json[key.asUInt()];
+    return true;
+  }
+  if (json.isObject() && key.isString() && json.isMember(key.asString())) {
+    value->scalar = json[key.asString()];
+    return true;
+  }
+  return false;
+}
+
+// Evaluates the field or the system variable at 'location' in 'scope' to
+// 'value'. Returns false if it does not exist.
+bool EvaluateLocation(const ProtoScope& scope, const ProtoLocation& location,
+                      ProtoValue* value) {
+  if (location.system_path.empty()) {
+    const proto2::Message* parent = nullptr;
+    if (!ResolveParent(*scope.store, location.path, &parent)) {
+      return false;
+    }
+    const proto2::Reflection* reflection = parent->GetReflection();
+    const ProtoPathStep& step = location.path.back();
+    if (step.field->is_repeated()) {
+      if (step.index == ProtoPathStep::kNoIndex) {
+        value->message = parent;
+        value->repeated_field = step.field;
+        return true;
+      }
+      if (step.index >= reflection->FieldSize(*parent, step.field)) {
+        return false;
+      }
+    }
+    if (step.field->cpp_type() == proto2::FieldDescriptor::CPPTYPE_MESSAGE) {
+      value->message =
+          step.index == ProtoPathStep::kNoIndex
+              ? &reflection->GetMessage(*parent, step.field)
+              : &reflection->GetRepeatedMessage(*parent, step.field,
+                                                step.index);
+    } else {
+      value->scalar = ScalarToJson(*parent, step.field, step.index);
+    }
+    return true;
+  }
+  const std::vector<Json::Value>& path = location.system_path;
+  if (scope.event_data != nullptr && IsEventDataPath(path)) {
+    // The paths into the message of '_event.data' are its fields.
+    value->message = scope.event_data;
+    for (size_t i = 2; i < path.size(); ++i) {
+      ProtoValue element;
+      if (!AccessElement(*value, path[i], &element)) {
+        return false;
+      }
+      *value = std::move(element);
+    }
+    return true;
+  }
+  const Json::Value* member = ResolveSystemPath(*scope.system_variables, path);
+  if (member == nullptr) {
+    return false;
+  }
+  value->scalar = *member;
+  if (scope.event_data != nullptr && path.size() == 1 && path[0] == "_event") {
+    // '_event' as a whole holds the JSON of its message.
+    ProtoValue data;
+    data.message = scope.event_data;
+    return ValueToJson(data, &value->scalar["data"]);
+  }
+  return true;
+}
+
+// Evaluates 'node' of 'tree' in 'scope' to 'value'. Returns false on errors.
+bool Evaluate(const ProtoScope& scope, const ProtoSyntaxTree& tree,
+              const ExpressionNode& node, ProtoValue* value) {
+  const ProtoLocation* location = FindLocation(tree, node);
+  if (location != nullptr) {
+    return EvaluateLocation(scope, *location, value);
+  }
+  switch (node.type) {
+    case ExpressionNode::kLiteral:
+      value->scalar = node.value;
+      return true;
+    case ExpressionNode::kIdentifier: {
+      // Identifiers that are not locations stand for JSON objects and arrays.
+      const auto it = tree.literals.find(&node);
+      if (it == tree.literals.end()) {
+        return false;
+      }
+      value->scalar = it->second;
+      return true;
+    }
+    case ExpressionNode::kRandom:
+      // There is no random generator for the datamodel to read.
+      return false;
+    case ExpressionNode::kElementAccess: {
+      // An element whose key is computed, e.g., "a[i]".
+      ProtoValue container;
+      ProtoValue key;
+      return Evaluate(scope, tree, *node.operands[0], &container) &&
+             Evaluate(scope, tree, *node.operands[1], &key) &&
+             AccessElement(container, key.scalar, value);
+    }
+    case ExpressionNode::kCall: {
+      std::vector<Json::Value> arguments(node.operands.size());
+      std::vector<const Json::Value*> inputs;
+      for (size_t i = 0; i < node.operands.size(); ++i) {
+        ProtoValue argument;
+        if (!Evaluate(scope, tree, *node.operands[i], &argument) ||
+            !ValueToJson(argument, &arguments[i])) {
+          return false;
+        }
+        inputs.push_back(&arguments[i]);
+      }
+      if (node.name == "In") {
+        if (scope.runtime == nullptr || arguments.size() != 1 ||
+            !arguments[0].isString()) {
+          return false;
+        }
+        value->scalar = scope.runtime->IsActiveState(arguments[0].asString());
+        return true;
+      }
+      if (scope.dispatcher == nullptr) {
+        return false;
+      }
+      return scope.dispatcher->Execute(node.name, inputs, &value->scalar);
+    }
+    case ExpressionNode::kUnaryOperation: {
+      // The scalar of a message is null, so messages are not operands.
+      ProtoValue operand;
+      if (!Evaluate(scope, tree, *node.operands[0], &operand)) {
+        return false;
+      }
+      if (node.op_id == internal::kMinus) {
+        return Negate(operand.scalar, &value->scalar);
+      }
+      if (node.op_id != internal::kNot || !operand.scalar.isBool()) {
+        return false;
+      }
+      value->scalar = !operand.scalar.asBool();
+      return true;
+    }
+    case ExpressionNode::kBinaryOperation: {
+      ProtoValue left;
+      if (!Evaluate(scope, tree, *node.operands[0], &left)) {
+        return false;
+      }
+      if (node.op_id == internal::kAnd || node.op_id == internal::kOr) {
+        if (!left.scalar.isBool()) {
+          return false;
+        }
+        // && and || short-circuit.
+        if (left.scalar.asBool() == (node.op_id == internal::kOr)) {
+          value->scalar = left.scalar;
+          return true;
+        }
+      }
+      ProtoValue right;
+      if (!Evaluate(scope, tree, *node.operands[1], &right)) {
+        return false;
+      }
+      switch (node.op_id) {
+        case internal::kAnd:
+        case internal::kOr:
+          if (!right.scalar.isBool()) {
+            return false;
+          }
+          value->scalar = right.scalar;
+          return true;
+        case internal::kPlus:
+        case internal::kMinus:
+        case internal::kMultiply:
+        case internal::kDivide:
+          return left.message == nullptr && right.message == nullptr &&
+                 ApplyArithmetic(left.scalar, node.op_id, right.scalar,
+                                 &value->scalar);
+        default:
+          return Compare(left, node.op_id, right, &value->scalar);
+      }
+    }
+  }
+  return false;
+}
+
+// Evaluates the whole 'tree' in 'scope' to 'value'. Returns false on errors.
+bool Evaluate(const ProtoScope& scope, const ProtoSyntaxTree& tree,
+              ProtoValue* value) {
+  return Evaluate(scope, tree, *tree.root, value);
+}
+
+// Assigns 'value' to 'field' of 'parent', or to its element 'index'.
+bool Assign(const ProtoValue& value, const proto2::FieldDescriptor* field,
+            int index, proto2::Message* parent) {
+  const proto2::Reflection* reflection = parent->GetReflection();
+  const bool is_message =
+      field->cpp_type() == proto2::FieldDescriptor::CPPTYPE_MESSAGE;
+  if (field->is_repeated() && index == ProtoPathStep::kNoIndex) {
+    // Assigns all elements from a repeated field or a JSON array.
+    if (value.repeated_field != nullptr) {
+      const proto2::FieldDescriptor* source = value.repeated_field;
+      if (is_message != (source->cpp_type() ==
+                         proto2::FieldDescriptor::CPPTYPE_MESSAGE)) {
+        return false;
+      }
+      const proto2::Reflection* source_reflection =
+          value.message->GetReflection();
+      reflection->ClearField(parent, field);
+      const int size = source_reflection->FieldSize(*value.message, source);
+      for (int i = 0; i < size; ++i) {
+        ProtoValue element;
+        if (is_message) {
+          element.message =
+              &source_reflection->GetRepeatedMessage(*value.message, source, i);
+        } else {
+          element.scalar = ScalarToJson(*value.message, source, i);
+        }
+        if (!Assign(element, field, i, parent)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    if (!value.scalar.isArray() && !value.scalar.isNull()) {
+      return false;
+    }
+    reflection->ClearField(parent, field);
+    for (Json::ArrayIndex i = 0; i < value.scalar.size(); ++i) {
+      ProtoValue element;
+      element.scalar = value.scalar[i];
+      if (!Assign(element, field, i, parent)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (!is_message) {
+    return value.message == nullptr && SetScalar(value.scalar, field, index,
+                                                 parent);
+  }
+  if (value.repeated_field != nullptr) {
+    return false;
+  }
+  if (value.message != nullptr) {
+    if (value.message->GetDescriptor() != field->message_type()) {
+      return false;
+    }
+    // Copies first as the value may be part of the assigned message.
+    std::unique_ptr<proto2::Message> copy(value.message->New());
+    copy->CopyFrom(*value.message);
+    proto2::Message* message = MutableMessage(field, index, parent);
+    message->GetReflection()->Swap(message, copy.get());
+    return true;
+  }
+  if (value.scalar.isNull() && index == ProtoPathStep::kNoIndex) {
+    reflection->ClearField(parent, field);
+    return true;
+  }
+  if (!value.scalar.isObject()) {
+    return false;
+  }
+  std::unique_ptr<proto2::Message> message(
+      reflection->GetMessageFactory()
+          ->GetPrototype(field->message_type())
+          ->New());
+  if (!SetMessageFromJson(value.scalar, message.get())) {
+    return false;
+  }
+  proto2::Message* target = MutableMessage(field, index, parent);
+  target->GetReflection()->Swap(target, message.get());
+  return true;
+}
+
+// Assigns 'value' to the field at 'location'.
+bool AssignToField(const ProtoLocation& location, ProtoValue value,
+                   proto2::Message* store) {
+  std::unique_ptr<proto2::Message> repeated_copy;
+  if (value.repeated_field != nullptr) {
+    // Copies first as the elements may be part of the assigned message.
+    repeated_copy.reset(value.message->New());
+    repeated_copy->CopyFrom(*value.message);
+    value.message = repeated_copy.get();
+  }
+  const ProtoPathStep& step = location.path.back();
+  proto2::Message* parent = nullptr;
+  if (!ResolveMutableParent(location.path, store, &parent) ||
+      (step.index != ProtoPathStep::kNoIndex &&
+       step.index > parent->GetReflection()->FieldSize(*parent, step.field))) {
+    return false;
+  }
+  return Assign(value, step.field, step.index, parent);
+}
+
+}  // namespace
+
+// static
+std::unique_ptr<ProtoDatamodel> ProtoDatamodel::Create(
+    const proto2::Descriptor* descriptor, FunctionDispatcher* dispatcher) {
+  RETURN_NULL_IF(descriptor == nullptr);
+  const proto2::Message* prototype =
+      proto2::MessageFactory::generated_factory()->GetPrototype(descriptor);
+  RETURN_NULL_IF_MSG(prototype == nullptr,
+                     "No generated message for " << descriptor->full_name());
+  return absl::WrapUnique(new ProtoDatamodel(
+      std::unique_ptr<proto2::Message>(prototype->New()), dispatcher));
+}
+
+// static
+std::unique_ptr<ProtoDatamodel> ProtoDatamodel::Create(
+    const proto2::Descriptor* descriptor, const string& serialized_data,
+    FunctionDispatcher* dispatcher) {
+  auto datamodel = Create(descriptor, dispatcher);
+  if (datamodel == nullptr || !datamodel->ParseFromString(serialized_data)) {
+    return nullptr;
+  }
+  return datamodel;
+}
+
+// static
+std::unique_ptr<DatamodelFactory> ProtoDatamodel::CreateFactory(
+    const proto2::Descriptor* descriptor) {
+  RETURN_NULL_IF(descriptor == nullptr ||
+                 proto2::MessageFactory::generated_factory()->GetPrototype(
+                     descriptor) == nullptr);
+  return absl::make_unique<ProtoDatamodelFactory>(descriptor);
+}
+
+ProtoDatamodel::ProtoDatamodel(std::unique_ptr<proto2::Message> store,
+                               FunctionDispatcher* dispatcher)
+    : store_(std::move(store)),
+      system_variables_(Json::objectValue),
+      dispatcher_(dispatcher) {}
+
+ProtoDatamodel::~ProtoDatamodel() = default;
+
+ProtoScope ProtoDatamodel::Scope() const {
+  return {store_.get(), &system_variables_, event_data_.get(), runtime_,
+          dispatcher_};
+}
+
+bool ProtoDatamodel::AssignToLocation(const ProtoLocation& location,
+                                      ProtoValue value) {
+  if (location.system_path.empty()) {
+    return AssignToField(location, std::move(value), store_.get());
+  }
+  // Converts first as the value may be part of the message of '_event.data'.
+  Json::Value json;
+  if (!ValueToJson(value, &json)) {
+    return false;
+  }
+  const std::vector<Json::Value>& path = location.system_path;
+  if (event_data_ != nullptr && path[0] == "_event" &&
+      (path.size() == 1 || path[1] == "data")) {
+    // '_event.data' holds JSON from now on. It is replaced, or its message is
+    // converted if a path into it is assigned.
+    if (path.size() > 2) {
+      ProtoValue data;
+      data.message = event_data_.get();
+      if (!ValueToJson(data, &system_variables_["_event"]["data"])) {
+        return false;
+      }
+    }
+    event_data_.reset();
+  }
+  Json::Value* member = MutableSystemPath(path, &system_variables_);
+  if (member == nullptr) {
+    return false;
+  }
+  *member = std::move(json);
+  return true;
+}
+
+const internal::ProtoSyntaxTree* ProtoDatamodel::GetSyntaxTree(
+    const Expression& expr,
+    std::unique_ptr<internal::ProtoSyntaxTree>* parsed) const {
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled != nullptr &&
+      strcmp(compiled->language(), kProtoExpressionLanguage) == 0) {
+    const auto* proto_expression =
+        static_cast<const CompiledProtoExpression*>(compiled);
+    if (proto_expression->descriptor() == store_->GetDescriptor()) {
+      return &proto_expression->tree();
+    }
+  }
+  *parsed = ParseProtoExpression(expr.source(), store_->GetDescriptor());
+  if (*parsed == nullptr) {
+    VLOG(1) << "Failed to parse expression: " << expr.source();
+  }
+  return parsed->get();
+}
+
+// override
+bool ProtoDatamodel::IsDefined(const string& location) const {
+  return IsDefined(Expression(location));
+}
+
+// override
+bool ProtoDatamodel::IsDefined(const Expression& location) const {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(location, &parsed);
+  ProtoValue value;
+  return tree != nullptr && RootLocation(*tree) != nullptr &&
+         Evaluate(Scope(), *tree, &value);
+}
+
+// override
+bool ProtoDatamodel::Declare(const string& location) {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree =
+      GetSyntaxTree(Expression(location), &parsed);
+  const ProtoLocation* declared =
+      tree == nullptr ? nullptr : RootLocation(*tree);
+  if (declared != nullptr && declared->system_path.size() == 1) {
+    // Keeps the value of a system variable that is declared again.
+    system_variables_[location];
+    return true;
+  }
+  return IsDefined(location);
+}
+
+// override
+bool ProtoDatamodel::AssignExpression(const string& location,
+                                      const string& expr) {
+  return AssignExpression(Expression(location), Expression(expr));
+}
+
+// override
+bool ProtoDatamodel::AssignExpression(const Expression& location,
+                                      const Expression& expr) {
+  std::unique_ptr<ProtoSyntaxTree> parsed_location;
+  std::unique_ptr<ProtoSyntaxTree> parsed_expr;
+  const ProtoSyntaxTree* location_tree =
+      GetSyntaxTree(location, &parsed_location);
+  const ProtoSyntaxTree* expr_tree = GetSyntaxTree(expr, &parsed_expr);
+  const ProtoLocation* target =
+      location_tree == nullptr ? nullptr : RootLocation(*location_tree);
+  ProtoValue value;
+  if (target == nullptr || expr_tree == nullptr ||
+      !Evaluate(Scope(), *expr_tree, &value)) {
+    return false;
+  }
+  return AssignToLocation(*target, std::move(value));
+}
+
+// override
+bool ProtoDatamodel::AssignString(const string& location, const string& str) {
+  return AssignValue(Expression(location), Json::Value(str));
+}
+
+// override
+bool ProtoDatamodel::AssignValue(const Expression& location,
+                                 Json::Value value) {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(location, &parsed);
+  if (tree == nullptr || RootLocation(*tree) == nullptr) {
+    return false;
+  }
+  ProtoValue proto_value;
+  proto_value.scalar = std::move(value);
+  return AssignToLocation(*RootLocation(*tree), std::move(proto_value));
+}
+
+// override
+bool ProtoDatamodel::EvaluateBooleanExpression(const string& expr,
+                                               bool* result) const {
+  return EvaluateBooleanExpression(Expression(expr), result);
+}
+
+// override
+bool ProtoDatamodel::EvaluateBooleanExpression(const Expression& expr,
+                                               bool* result) const {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(expr, &parsed);
+  ProtoValue value;
+  if (tree == nullptr || !Evaluate(Scope(), *tree, &value) ||
+      value.message != nullptr || !value.scalar.isBool()) {
+    return false;
+  }
+  *result = value.scalar.asBool();
+  return true;
+}
+
+// override
+bool ProtoDatamodel::EvaluateStringExpression(const string& expr,
+                                              string* result) const {
+  return EvaluateStringExpression(Expression(expr), result);
+}
+
+// override
+bool ProtoDatamodel::EvaluateStringExpression(const Expression& expr,
+                                              string* result) const {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(expr, &parsed);
+  ProtoValue value;
+  if (tree == nullptr || !Evaluate(Scope(), *tree, &value)) {
+    return false;
+  }
+  *result = value.message == nullptr && value.scalar.isString()
+                ? value.scalar.asString()
+                : ValueToString(value);
+  return true;
+}
+
+// override
+bool ProtoDatamodel::EvaluateExpression(const string& expr,
+                                        string* result) const {
+  return EvaluateExpression(Expression(expr), result);
+}
+
+// override
+bool ProtoDatamodel::EvaluateExpression(const Expression& expr,
+                                        string* result) const {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(expr, &parsed);
+  ProtoValue value;
+  if (tree == nullptr || !Evaluate(Scope(), *tree, &value)) {
+    return false;
+  }
+  *result = ValueToString(value);
+  return true;
+}
+
+// override
+string ProtoDatamodel::EncodeParameters(
+    const std::map<string, string>& parameters) const {
+  string result = "{";
+  for (const auto& parameter : parameters) {
+    absl::StrAppend(&result, result.size() > 1 ? "," : "",
+                    ScalarToString(Json::Value(parameter.first)), ":",
+                    parameter.second);
+  }
+  return absl::StrCat(result, "}");
+}
+
+// override
+string ProtoDatamodel::DebugString() const {
+  return absl::StrCat(
+      store_->DebugString(), ToJsonText(system_variables_),
+      event_data_ == nullptr
+          ? ""
+          : absl::StrCat("\n_event.data: ", event_data_->ShortDebugString()));
+}
+
+// override
+void ProtoDatamodel::Clear() {
+  store_->Clear();
+  system_variables_ = Json::Value(Json::objectValue);
+  event_data_.reset();
+}
+
+// override
+std::unique_ptr<Datamodel> ProtoDatamodel::Clone() const {
+  std::unique_ptr<proto2::Message> store(store_->New());
+  store->CopyFrom(*store_);
+  std::unique_ptr<ProtoDatamodel> datamodel(
+      new ProtoDatamodel(std::move(store), dispatcher_));
+  datamodel->system_variables_ = system_variables_;
+  if (event_data_ != nullptr) {
+    datamodel->event_data_.reset(event_data_->New());
+    datamodel->event_data_->CopyFrom(*event_data_);
+  }
+  datamodel->runtime_ = runtime_;
+  return datamodel;
+}
+
+// override
+string ProtoDatamodel::SerializeAsString() const {
+  return store_->SerializeAsString();
+}
+
+// override
+bool ProtoDatamodel::ParseFromString(const string& data) {
+  return store_->ParseFromString(data);
+}
+
+// override
+std::unique_ptr<Iterator> ProtoDatamodel::EvaluateIterator(
+    const string& location) const {
+  return EvaluateIterator(Expression(location));
+}
+
+// override
+std::unique_ptr<Iterator> ProtoDatamodel::EvaluateIterator(
+    const Expression& location) const {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(location, &parsed);
+  ProtoValue value;
+  if (tree == nullptr || !Evaluate(Scope(), *tree, &value)) {
+    return nullptr;
+  }
+  if (value.repeated_field == nullptr) {
+    if (value.message != nullptr || !value.scalar.isArray()) {
+      return nullptr;
+    }
+    return absl::make_unique<JsonArrayIterator>(std::move(value.scalar));
+  }
+  return absl::make_unique<RepeatedFieldIterator>(value.message,
+                                                  value.repeated_field);
+}
+
+// override
+bool ProtoDatamodel::EvaluateMessage(const string& location,
+                                     proto2::Message* message) const {
+  ProtoValue value;
+  if (location.empty()) {
+    value.message = store_.get();
+  } else {
+    std::unique_ptr<ProtoSyntaxTree> parsed;
+    const ProtoSyntaxTree* tree =
+        GetSyntaxTree(Expression(location), &parsed);
+    if (tree == nullptr || RootLocation(*tree) == nullptr ||
+        !Evaluate(Scope(), *tree, &value)) {
+      return false;
+    }
+  }
+  if (value.message == nullptr || value.repeated_field != nullptr ||
+      value.message->GetDescriptor() != message->GetDescriptor()) {
+    return false;
+  }
+  message->CopyFrom(*value.message);
+  return true;
+}
+
+// override
+bool ProtoDatamodel::AssignMessage(const Expression& location,
+                                   const proto2::Message& message) {
+  std::unique_ptr<ProtoSyntaxTree> parsed;
+  const ProtoSyntaxTree* tree = GetSyntaxTree(location, &parsed);
+  const ProtoLocation* target = tree == nullptr ? nullptr : RootLocation(*tree);
+  if (target == nullptr) {
+    return false;
+  }
+  if (target->system_path.size() == 2 && IsEventDataPath(target->system_path)) {
+    Json::Value& event = system_variables_["_event"];
+    if (!event.isObject() && !event.isNull()) {
+      return false;
+    }
+    // Keeps a copy of the message, whose fields are read with reflection.
+    std::unique_ptr<proto2::Message> copy(message.New());
+    copy->CopyFrom(message);
+    event_data_ = std::move(copy);
+    if (event.isNull()) {
+      event = Json::Value(Json::objectValue);
+    }
+    event.removeMember("data");
+    return true;
+  }
+  ProtoValue value;
+  value.message = &message;
+  return AssignToLocation(*target, std::move(value));
+}
+
+}  // namespace state_chart
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_PROTO_DATAMODEL_H_
+#define STATE_CHART_INTERNAL_PROTO_DATAMODEL_H_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/datamodel_factory.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/platform/protobuf.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+namespace internal {
+struct ProtoLocation;
+struct ProtoScope;
+struct ProtoSyntaxTree;
+struct ProtoValue;
+}  // namespace internal
+
+// A datamodel whose store is a protocol message. The top-level variables are
+// the fields of the message, so <data> elements must name fields, and values
+// are read and written with reflection instead of being converted to JSON.
+// SerializeAsString() is the binary encoding of the message.
+//
+// Expressions are parsed like those of the LightWeightDatamodel, and are:
+// - Locations, i.e., field paths like "a.b[2].c" where the index of repeated
+//   fields is an integer literal. Assigning to the index after the last element
+//   appends an element. Elements at computed indices, like "a.b[i]", are only
+//   read.
+// - JSON literals, where strings may also be single quoted. Objects and
+//   arrays are strict JSON, and objects are messages in the proto3 JSON format.
+// - In('state_id').
+// - The system variables '_event', '_name' and '_sessionid', and paths into
+//   them like "_event.data.items[0]". They hold JSON values next to the
+//   message, so '_event.data' is the JSON event payload. Object values assign
+//   to message fields in the proto3 JSON format. A message passed to
+//   StateMachine::SendEvent() is kept as '_event.data' instead, and the paths
+//   into it are its fields, read with reflection like those of the store.
+// - Calls "f(a, b)" of the functions of the FunctionDispatcher, which are
+//   passed the JSON values of their arguments.
+// - Arithmetic with +, -, * and / as in the LightWeightDatamodel, where '+'
+//   also concatenates strings.
+// - Conditions that combine the above with ==, !=, <, <=, >, >=, !, && and ||.
+//   Enums compare by their names.
+// Expressions compiled by GetExpressionCompiler() refer to the field
+// descriptors of their paths, so they are resolved without looking up names.
+class ProtoDatamodel : public Datamodel {
+ public:
+  // Returns a new datamodel that stores a default message of 'descriptor', or
+  // nullptr if 'descriptor' has no generated message type. Expressions call
+  // the functions of 'dispatcher', which is not owned and may be nullptr, in
+  // which case calls fail.
+  static std::unique_ptr<ProtoDatamodel> Create(
+      const proto2::Descriptor* descriptor, FunctionDispatcher* dispatcher);
+
+  // Returns a datamodel initialized from the SerializeAsString()
+  // representation 'serialized_data', or nullptr if parsing fails.
+  static std::unique_ptr<ProtoDatamodel> Create(
+      const proto2::Descriptor* descriptor, const string& serialized_data,
+      FunctionDispatcher* dispatcher);
+
+  // Returns a factory of datamodels of messages of 'descriptor', for
+  // StateMachineFactory::Options::datamodel_factories. Returns nullptr if
+  // 'descriptor' has no generated message type.
+  static std::unique_ptr<DatamodelFactory> CreateFactory(
+      const proto2::Descriptor* descriptor);
+
+  ProtoDatamodel(const ProtoDatamodel&) = delete;
+  ProtoDatamodel& operator=(const ProtoDatamodel&) = delete;
+  ~ProtoDatamodel() override;
+
+  bool IsDefined(const string& location) const override;
+  bool IsDefined(const Expression& location) const override;
+  // Fields always exist, so declaring only checks that 'location' does.
+  // System variables are declared as null.
+  bool Declare(const string& location) override;
+  bool AssignExpression(const string& location, const string& expr) override;
+  bool AssignExpression(const Expression& location,
+                        const Expression& expr) override;
+  bool AssignString(const string& location, const string& str) override;
+  // Assigns system variables without formatting 'value' as an expression.
+  bool AssignValue(const Expression& location, Json::Value value) override;
+
+  bool EvaluateBooleanExpression(const string& expr,
+                                 bool* result) const override;
+  bool EvaluateBooleanExpression(const Expression& expr,
+                                 bool* result) const override;
+  bool EvaluateStringExpression(const string& expr,
+                                string* result) const override;
+  bool EvaluateStringExpression(const Expression& expr,
+                                string* result) const override;
+  bool EvaluateExpression(const string& expr, string* result) const override;
+  bool EvaluateExpression(const Expression& expr,
+                          string* result) const override;
+
+  string EncodeParameters(
+      const std::map<string, string>& parameters) const override;
+  string DebugString() const override;
+  void Clear() override;
+  std::unique_ptr<Datamodel> Clone() const override;
+  // The system variables are not serialized. StateMachineFactory binds them
+  // again when it restores a state machine, with a new '_sessionid' and an
+  // empty '_event'.
+  string SerializeAsString() const override;
+
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const string& location) const override;
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const Expression& location) const override;
+
+  const Runtime* GetRuntime() const override { return runtime_; }
+  void SetRuntime(Runtime* runtime) override { runtime_ = runtime; }
+
+  // Copies the message field at 'location' if it has the type of 'message'.
+  // The root message is at the empty location.
+  bool EvaluateMessage(const string& location,
+                       proto2::Message* message) const override;
+
+  bool StoresMessages() const override { return true; }
+  // Copies 'message' to the message field at 'location', or keeps a copy as
+  // '_event.data'.
+  bool AssignMessage(const Expression& location,
+                     const proto2::Message& message) override;
+
+  // The store.
+  const proto2::Message& message() const { return *store_; }
+  proto2::Message* mutable_message() { return store_.get(); }
+
+ protected:
+  // Parses the binary encoding of the message.
+  bool ParseFromString(const string& data) override;
+
+ private:
+  ProtoDatamodel(std::unique_ptr<proto2::Message> store,
+                 FunctionDispatcher* dispatcher);
+
+  // Returns the syntax tree of 'expr', compiled or parsed into 'parsed'.
+  // Returns nullptr if 'expr' cannot be parsed.
+  const internal::ProtoSyntaxTree* GetSyntaxTree(
+      const Expression& expr,
+      std::unique_ptr<internal::ProtoSyntaxTree>* parsed) const;
+
+  // Returns what expressions read.
+  internal::ProtoScope Scope() const;
+
+  // Assigns 'value' to the field or the system variable at 'location'.
+  bool AssignToLocation(const internal::ProtoLocation& location,
+                        internal::ProtoValue value);
+
+  std::unique_ptr<proto2::Message> store_;
+
+  // The object of the system variables.
+  Json::Value system_variables_;
+
+  // The message assigned to '_event.data' by AssignMessage(), or nullptr. The
+  // member "data" of '_event' is then not set.
+  std::unique_ptr<proto2::Message> event_data_;
+
+  // The dispatcher of function calls, not owned. May be nullptr.
+  FunctionDispatcher* const dispatcher_;
+
+  // The runtime whose active states In() tests, not owned.
+  const Runtime* runtime_ = nullptr;
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_PROTO_DATAMODEL_H_
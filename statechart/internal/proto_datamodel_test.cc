@@ -0,0 +1,456 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/proto_datamodel.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/datamodel_factory.h"
+#include "statechart/internal/testing/mock_function_dispatcher.h"
+#include "statechart/internal/testing/mock_runtime.h"
+#include "statechart/platform/protobuf.h"
+#include "statechart/proto/state_machine_context.pb.h"
+
+namespace state_chart {
+namespace {
+
+using ::testing::_;
+using ::testing::DoAll;
+using ::testing::ElementsAre;
+using ::testing::Pointee;
+using ::testing::Return;
+using ::testing::SetArgPointee;
+
+class ProtoDatamodelTest : public ::testing::Test {
+ protected:
+  ProtoDatamodelTest()
+      : datamodel_(ProtoDatamodel::Create(StateMachineContext::descriptor(),
+                                          &dispatcher_)) {
+    datamodel_->SetRuntime(&runtime_);
+    ON_CALL(runtime_, IsActiveState("A")).WillByDefault(Return(true));
+    ON_CALL(runtime_, IsActiveState("B")).WillByDefault(Return(false));
+  }
+
+  // Returns the store of the datamodel.
+  StateMachineContext GetContext() const {
+    StateMachineContext context;
+    EXPECT_TRUE(datamodel_->EvaluateMessage("", &context));
+    return context;
+  }
+
+  MockRuntime runtime_;
+  MockFunctionDispatcher dispatcher_;
+  std::unique_ptr<ProtoDatamodel> datamodel_;
+};
+
+TEST_F(ProtoDatamodelTest, AssignsFields) {
+  EXPECT_TRUE(datamodel_->Declare("datamodel_version"));
+  EXPECT_FALSE(datamodel_->Declare("x"));
+
+  EXPECT_TRUE(datamodel_->AssignExpression("datamodel_version", "42"));
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime.running", "true"));
+  EXPECT_TRUE(datamodel_->AssignString("datamodel", "data"));
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime.random_state", "[1, 2]"));
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime.random_state[2]", "3"));
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime.active_state[0].id",
+                                           "'A'"));
+
+  const StateMachineContext context = GetContext();
+  EXPECT_EQ(42, context.datamodel_version());
+  EXPECT_TRUE(context.runtime().running());
+  EXPECT_EQ("data", context.datamodel());
+  ASSERT_EQ(3, context.runtime().random_state_size());
+  EXPECT_EQ(3, context.runtime().random_state(2));
+  ASSERT_EQ(1, context.runtime().active_state_size());
+  EXPECT_EQ("A", context.runtime().active_state(0).id());
+
+  // Values must convert to the types of the fields, and indices must be at
+  // most the size of repeated fields.
+  for (const char* expr : {"'x'", "-1", "1.5", "true", "{}"}) {
+    EXPECT_FALSE(datamodel_->AssignExpression("datamodel_version", expr))
+        << expr;
+  }
+  EXPECT_FALSE(datamodel_->AssignExpression("runtime.random_state[4]", "1"));
+  EXPECT_FALSE(datamodel_->AssignExpression("runtime.x", "1"));
+  EXPECT_FALSE(datamodel_->AssignExpression("runtime", "1"));
+  EXPECT_EQ(42, GetContext().datamodel_version());
+}
+
+TEST_F(ProtoDatamodelTest, AssignsMessages) {
+  EXPECT_TRUE(datamodel_->AssignExpression(
+      "runtime", "{\"running\": true, \"active_state\": [{\"id\": \"A\"}]}"));
+  EXPECT_TRUE(
+      datamodel_->AssignExpression("runtime.active_state[1]",
+                                   "runtime.active_state[0]"));
+  EXPECT_TRUE(datamodel_->AssignExpression(
+      "runtime.active_state[0].active_child", "runtime.active_state"));
+  StateMachineContext context = GetContext();
+  EXPECT_TRUE(context.runtime().running());
+  ASSERT_EQ(2, context.runtime().active_state_size());
+  EXPECT_EQ("A", context.runtime().active_state(1).id());
+  EXPECT_EQ(2, context.runtime().active_state(0).active_child_size());
+
+  StateMachineContext::Runtime runtime;
+  EXPECT_TRUE(datamodel_->EvaluateMessage("runtime", &runtime));
+  EXPECT_EQ(2, runtime.active_state_size());
+  EXPECT_FALSE(datamodel_->EvaluateMessage("runtime.active_state", &runtime));
+
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime", "null"));
+  EXPECT_FALSE(GetContext().has_runtime());
+}
+
+TEST_F(ProtoDatamodelTest, EvaluatesConditions) {
+  ASSERT_TRUE(datamodel_->AssignExpression("datamodel_version", "3"));
+  ASSERT_TRUE(datamodel_->AssignString("datamodel", "data"));
+  bool result = false;
+  for (const char* expr :
+       {"datamodel_version == 3", "datamodel_version >= 2.5",
+        "datamodel == 'data' && !runtime.running", "In('A') || In('B')",
+        "!(datamodel_version < 3)", "runtime.active_state == []",
+        "runtime.random_state != [1]"}) {
+    EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(expr, &result)) << expr;
+    EXPECT_TRUE(result) << expr;
+  }
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression("In('B')", &result));
+  EXPECT_FALSE(result);
+
+  for (const char* expr : {"datamodel_version", "datamodel < 3", "x == 1",
+                           "runtime.active_state[0].id == 'A'",
+                           "datamodel_version == 3 &&", "1 + 2"}) {
+    EXPECT_FALSE(datamodel_->EvaluateBooleanExpression(expr, &result)) << expr;
+  }
+}
+
+TEST_F(ProtoDatamodelTest, EvaluatesExpressions) {
+  ASSERT_TRUE(datamodel_->AssignExpression("runtime.random_state", "[1, 2]"));
+  ASSERT_TRUE(datamodel_->AssignString("datamodel", "data"));
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("runtime.random_state", &result));
+  EXPECT_EQ("[1,2]", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("datamodel", &result));
+  EXPECT_EQ("\"data\"", result);
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("datamodel", &result));
+  EXPECT_EQ("data", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("runtime", &result));
+  EXPECT_EQ("{\"random_state\":[\"1\",\"2\"]}", result);
+
+  auto iterator = datamodel_->EvaluateIterator("runtime.random_state");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ("1", iterator->GetValue());
+  EXPECT_EQ("0", iterator->GetIndex());
+  EXPECT_TRUE(iterator->Next());
+  EXPECT_EQ("2", iterator->GetValue());
+  EXPECT_FALSE(iterator->Next());
+  EXPECT_TRUE(iterator->AtEnd());
+  EXPECT_EQ(nullptr, datamodel_->EvaluateIterator("datamodel"));
+}
+
+TEST_F(ProtoDatamodelTest, EvaluatesArithmetic) {
+  ASSERT_TRUE(datamodel_->AssignExpression("datamodel_version", "3"));
+  ASSERT_TRUE(datamodel_->AssignString("datamodel", "data"));
+  ASSERT_TRUE(datamodel_->AssignExpression("runtime.random_state", "[5, 7]"));
+  EXPECT_TRUE(datamodel_->AssignExpression("datamodel_version",
+                                           "datamodel_version + 1"));
+  EXPECT_EQ(4, GetContext().datamodel_version());
+
+  const std::pair<const char*, const char*> cases[] = {
+      {"datamodel_version * 2 - 1", "7"},
+      {"-datamodel_version / 3", "-1"},
+      {"datamodel_version / 8.0", "0.5"},
+      {"datamodel + '!' + datamodel_version", "\"data!4\""},
+      {"runtime.random_state[datamodel_version - 3]", "7"},
+      {"[1, 2] == runtime.random_state", "false"},
+  };
+  string result;
+  for (const auto& test_case : cases) {
+    EXPECT_TRUE(datamodel_->EvaluateExpression(test_case.first, &result))
+        << test_case.first;
+    EXPECT_EQ(test_case.second, result) << test_case.first;
+  }
+
+  for (const char* expr : {"datamodel - 1", "datamodel_version / 0",
+                           "runtime * 2", "runtime.random_state[2 + 1]"}) {
+    EXPECT_FALSE(datamodel_->EvaluateExpression(expr, &result)) << expr;
+  }
+  EXPECT_FALSE(datamodel_->AssignExpression(
+      "runtime.random_state[datamodel_version - 3]", "1"));
+}
+
+TEST_F(ProtoDatamodelTest, EvaluatesJsonLiterals) {
+  ASSERT_TRUE(datamodel_->AssignExpression("runtime.random_state", "[5, 7]"));
+  ASSERT_TRUE(datamodel_->AssignString("datamodel", "data"));
+  const std::pair<const char*, const char*> cases[] = {
+      {R"({"a": [1, 2], "b": "}"})", R"({"a":[1,2],"b":"}"})"},
+      {"runtime.random_state == [5, 7]", "true"},
+      {R"([[1], {"a": "]"}] != [[1], {"a": "]"}])", "false"},
+      {"[1, 2][1] + 1", "3"},
+      {R"({"a": 1}["a"])", "1"},
+      {"'[' + datamodel", R"("[data")"},
+  };
+  string result;
+  for (const auto& test_case : cases) {
+    EXPECT_TRUE(datamodel_->EvaluateExpression(test_case.first, &result))
+        << test_case.first;
+    EXPECT_EQ(test_case.second, result) << test_case.first;
+  }
+
+  const Json::Value empty_object(Json::objectValue);
+  EXPECT_CALL(dispatcher_, Execute("Keys",
+                                   ElementsAre(Pointee(empty_object),
+                                               Pointee(Json::Value(1))),
+                                   _))
+      .WillOnce(DoAll(SetArgPointee<2>(Json::Value(0)), Return(true)));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("Keys({}, 1)", &result));
+  EXPECT_EQ("0", result);
+
+  // Objects and arrays are strict JSON, and must be closed.
+  for (const char* expr :
+       {"[1, 2", R"({"a": 1)", R"({"a": 1}})", "[datamodel]", "['a']",
+        "[1,]", "$json0"}) {
+    EXPECT_FALSE(datamodel_->EvaluateExpression(expr, &result)) << expr;
+  }
+}
+
+TEST_F(ProtoDatamodelTest, AssignsSystemVariables) {
+  EXPECT_TRUE(datamodel_->HasSystemVariables());
+  EXPECT_FALSE(datamodel_->IsDefined("_event"));
+  EXPECT_TRUE(datamodel_->Declare("_event"));
+  EXPECT_TRUE(datamodel_->IsDefined("_event"));
+  EXPECT_TRUE(datamodel_->AssignValue(Expression("_event"),
+                                      Json::Value(Json::objectValue)));
+  EXPECT_TRUE(datamodel_->AssignString("_event.name", "E"));
+  EXPECT_TRUE(datamodel_->AssignValueLazily(
+      Expression("_event.data"),
+      R"({"version": 3, "runtime": {"running": true}, "ids": ["a", "b"]})"));
+  EXPECT_TRUE(datamodel_->IsDefined("_event.data.ids[1]"));
+  EXPECT_FALSE(datamodel_->IsDefined("_event.data.ids[2]"));
+  EXPECT_FALSE(datamodel_->IsDefined("_event.type"));
+
+  bool result = false;
+  for (const char* expr :
+       {"_event.name == 'E' && _event.data.version > 2",
+        R"(_event.data.ids == ["a", "b"])", "_event.data.runtime != {}"}) {
+    EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(expr, &result)) << expr;
+    EXPECT_TRUE(result) << expr;
+  }
+  string str;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data.ids", &str));
+  EXPECT_EQ(R"(["a","b"])", str);
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("_event.name", &str));
+  EXPECT_EQ("E", str);
+  auto iterator = datamodel_->EvaluateIterator("_event.data.ids");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ(R"("a")", iterator->GetValue());
+  EXPECT_TRUE(iterator->Next());
+  EXPECT_EQ("1", iterator->GetIndex());
+  EXPECT_FALSE(iterator->Next());
+
+  // The payload assigns to fields, and fields to system variables.
+  EXPECT_TRUE(datamodel_->AssignExpression("datamodel_version",
+                                           "_event.data.version"));
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime", "_event.data.runtime"));
+  EXPECT_EQ(3, GetContext().datamodel_version());
+  EXPECT_TRUE(GetContext().runtime().running());
+  EXPECT_TRUE(datamodel_->AssignExpression("_event.data.ids[2]", "runtime"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data.ids[2]", &str));
+  EXPECT_EQ(R"({"running":true})", str);
+  EXPECT_FALSE(datamodel_->AssignExpression("_event.name.x", "1"));
+  EXPECT_FALSE(datamodel_->AssignExpression("_event.data.ids[4]", "1"));
+  EXPECT_FALSE(datamodel_->AssignExpression("_x", "1"));
+
+  // Clones copy the system variables, which are not serialized.
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(clone->EvaluateStringExpression("_event.name", &str));
+  EXPECT_EQ("E", str);
+  auto restored = ProtoDatamodel::Create(StateMachineContext::descriptor(),
+                                         datamodel_->SerializeAsString(),
+                                         nullptr);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_FALSE(restored->IsDefined("_event"));
+
+  datamodel_->Clear();
+  EXPECT_FALSE(datamodel_->IsDefined("_event"));
+}
+
+TEST_F(ProtoDatamodelTest, AssignsMessageEventData) {
+  EXPECT_TRUE(datamodel_->StoresMessages());
+  StateMachineContext payload;
+  payload.set_datamodel_version(3);
+  payload.mutable_runtime()->set_running(true);
+  payload.mutable_runtime()->add_active_state()->set_id("A");
+  payload.mutable_runtime()->add_random_state(7);
+  ASSERT_TRUE(datamodel_->Declare("_event"));
+  EXPECT_TRUE(datamodel_->AssignMessage(Expression("_event.data"), payload));
+  EXPECT_TRUE(datamodel_->AssignString("_event.name", "E"));
+  payload.Clear();
+
+  // The fields of the payload are read with reflection.
+  EXPECT_TRUE(datamodel_->IsDefined("_event.data.runtime.active_state[0]"));
+  EXPECT_FALSE(datamodel_->IsDefined("_event.data.runtime.active_state[1]"));
+  EXPECT_FALSE(datamodel_->IsDefined("_event.data.x"));
+  bool result = false;
+  for (const char* expr :
+       {"_event.name == 'E' && _event.data.datamodel_version > 2",
+        "_event.data.runtime.running",
+        "_event.data.runtime.active_state[0].id == 'A'",
+        "_event.data.runtime.random_state == [7]",
+        "_event.data.datamodel == ''"}) {
+    EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(expr, &result)) << expr;
+    EXPECT_TRUE(result) << expr;
+  }
+  string str;
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event", &str));
+  EXPECT_EQ(R"({"data":{"datamodel_version":"3","runtime":{"active_state":)"
+            R"([{"id":"A"}],"random_state":["7"],"running":true}},"name":"E"})",
+            str);
+  auto iterator =
+      datamodel_->EvaluateIterator("_event.data.runtime.active_state");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ(R"({"id":"A"})", iterator->GetValue());
+  EXPECT_TRUE(datamodel_->EvaluateMessage("_event.data", &payload));
+  EXPECT_EQ(3, payload.datamodel_version());
+
+  // Messages assign to fields of their type without JSON.
+  EXPECT_TRUE(datamodel_->AssignExpression("runtime", "_event.data.runtime"));
+  EXPECT_EQ("A", GetContext().runtime().active_state(0).id());
+  EXPECT_TRUE(datamodel_->AssignMessage(Expression("runtime"),
+                                        payload.runtime()));
+  EXPECT_FALSE(datamodel_->AssignMessage(Expression("runtime"), payload));
+  EXPECT_FALSE(datamodel_->AssignMessage(Expression("datamodel"), payload));
+
+  // Clones copy the payload.
+  auto clone = datamodel_->Clone();
+  EXPECT_TRUE(
+      clone->EvaluateBooleanExpression("_event.data.runtime.running", &result));
+  EXPECT_TRUE(result);
+
+  // Paths into the payload are assigned to its JSON.
+  EXPECT_TRUE(datamodel_->AssignExpression("_event.data.runtime.running",
+                                           "false"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("_event.data.runtime", &str));
+  EXPECT_EQ(R"({"active_state":[{"id":"A"}],"random_state":["7"],)"
+            R"("running":false})",
+            str);
+  EXPECT_TRUE(datamodel_->AssignMessage(Expression("_event.data"), payload));
+  EXPECT_TRUE(datamodel_->AssignValueLazily(Expression("_event.data"),
+                                            R"({"version": 4})"));
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(
+      "_event.data.version == 4 && _event.name == 'E'", &result));
+  EXPECT_TRUE(result);
+  EXPECT_FALSE(datamodel_->IsDefined("_event.data.runtime"));
+
+  datamodel_->Clear();
+  EXPECT_FALSE(datamodel_->IsDefined("_event.data"));
+}
+
+TEST_F(ProtoDatamodelTest, CallsFunctions) {
+  ASSERT_TRUE(datamodel_->AssignExpression("datamodel_version", "3"));
+  EXPECT_CALL(dispatcher_,
+              Execute("Twice", ElementsAre(Pointee(Json::Value(3u))), _))
+      .WillRepeatedly(DoAll(SetArgPointee<2>(Json::Value(6)), Return(true)));
+  string result;
+  EXPECT_TRUE(
+      datamodel_->EvaluateExpression("Twice(datamodel_version)", &result));
+  EXPECT_EQ("6", result);
+  bool condition = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(
+      "Twice( datamodel_version ) == 6", &condition));
+  EXPECT_TRUE(condition);
+
+  // Messages are passed as their proto3 JSON.
+  ASSERT_TRUE(datamodel_->AssignExpression("runtime.running", "true"));
+  Json::Value runtime;
+  runtime["running"] = true;
+  EXPECT_CALL(dispatcher_, Execute("Size", ElementsAre(Pointee(runtime),
+                                                       Pointee(Json::Value())),
+                                   _))
+      .WillOnce(DoAll(SetArgPointee<2>(Json::Value(1)), Return(true)));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("Size(runtime, null)", &result));
+  EXPECT_EQ("1", result);
+
+  EXPECT_CALL(dispatcher_, Execute("Unknown", ElementsAre(), _))
+      .WillOnce(Return(false));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("Unknown()", &result));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("Twice(1", &result));
+  auto without_dispatcher =
+      ProtoDatamodel::Create(StateMachineContext::descriptor(), nullptr);
+  EXPECT_FALSE(without_dispatcher->EvaluateExpression("Twice(3)", &result));
+}
+
+TEST_F(ProtoDatamodelTest, EvaluatesCompiledExpressions) {
+  auto factory = ProtoDatamodel::CreateFactory(
+      StateMachineContext::descriptor());
+  ASSERT_NE(nullptr, factory);
+  const ExpressionCompiler* compiler = factory->GetExpressionCompiler();
+  EXPECT_EQ(nullptr, compiler->Compile("x"));
+  EXPECT_EQ(nullptr, compiler->Compile("runtime.running ||"));
+
+  const Expression location("runtime.random_state[0]",
+                            compiler->Compile("runtime.random_state[0]"));
+  const Expression value("7", compiler->Compile("7"));
+  const Expression guard("runtime.random_state[0] > 5 && In('A')",
+                         compiler->Compile(
+                             "runtime.random_state[0] > 5 && In('A')"));
+  ASSERT_NE(nullptr, location.compiled());
+  ASSERT_NE(nullptr, guard.compiled());
+  EXPECT_TRUE(datamodel_->AssignExpression(location, value));
+  bool result = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(guard, &result));
+  EXPECT_TRUE(result);
+
+  // Datamodels of other message types parse the source instead of using
+  // the fields of the compiled expression.
+  auto runtime_datamodel =
+      ProtoDatamodel::Create(StateMachineContext::Runtime::descriptor(),
+                             nullptr);
+  EXPECT_FALSE(runtime_datamodel->AssignExpression(location, value));
+  const Expression running("running", compiler->Compile("runtime"));
+  EXPECT_TRUE(runtime_datamodel->AssignExpression(
+      running, Expression("true", compiler->Compile("true"))));
+}
+
+TEST_F(ProtoDatamodelTest, SerializesAsBinaryProto) {
+  ASSERT_TRUE(datamodel_->AssignExpression("datamodel_version", "5"));
+  ASSERT_TRUE(datamodel_->AssignExpression("runtime.running", "true"));
+  const string serialized = datamodel_->SerializeAsString();
+  StateMachineContext context;
+  ASSERT_TRUE(context.ParseFromString(serialized));
+  EXPECT_EQ(5, context.datamodel_version());
+
+  auto factory = ProtoDatamodel::CreateFactory(
+      StateMachineContext::descriptor());
+  auto restored = factory->Create(nullptr, serialized, {}, 0, nullptr);
+  ASSERT_NE(nullptr, restored);
+  string result;
+  EXPECT_TRUE(restored->EvaluateExpression("datamodel_version", &result));
+  EXPECT_EQ("5", result);
+
+  auto clone = datamodel_->Clone();
+  ASSERT_TRUE(clone->AssignExpression("datamodel_version", "6"));
+  EXPECT_EQ(5, GetContext().datamodel_version());
+  EXPECT_TRUE(clone->EvaluateExpression("datamodel_version", &result));
+  EXPECT_EQ("6", result);
+
+  datamodel_->Clear();
+  EXPECT_EQ("", datamodel_->SerializeAsString());
+}
+
+}  // namespace
+}  // namespace state_chart
@@ -0,0 +1,981 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/quickjs_datamodel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "absl/memory/memory.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "include/json/json.h"
+#include "quickjs.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/json_text.h"
+#include "statechart/internal/random_generator.h"
+#include "statechart/internal/runtime.h"
+#include "statechart/internal/utility.h"
+#include "statechart/logging.h"
+
+namespace state_chart {
+
+namespace {
+
+constexpr char kQuickJsLanguage[] = "quickjs";
+
+// The file name of expressions in QuickJS error messages.
+constexpr char kFileName[] = "<expression>";
+
+// The parameter of the functions that assign to locations.
+constexpr char kSetterParameter[] = "__statechart_value";
+
+// Owns a JSValue of a context.
+class ScopedValue {
+ public:
+  ScopedValue(JSContext* context, JSValue value)
+      : context_(context), value_(value) {}
+  ScopedValue(const ScopedValue&) = delete;
+  ScopedValue& operator=(const ScopedValue&) = delete;
+  ~ScopedValue() { JS_FreeValue(context_, value_); }
+
+  JSValueConst get() const { return value_; }
+  bool is_exception() const { return JS_IsException(value_); }
+
+ private:
+  JSContext* const context_;
+  const JSValue value_;
+};
+
+// Sets 'result' to the string conversion of 'value'. Returns false, with an
+// exception pending, if the conversion throws.
+bool ToString(JSContext* context, JSValueConst value, string* result) {
+  size_t size = 0;
+  const char* chars = JS_ToCStringLen(context, &size, value);
+  if (chars == nullptr) {
+    return false;
+  }
+  result->assign(chars, size);
+  JS_FreeCString(context, chars);
+  return true;
+}
+
+// Clears the pending exception and returns its message.
+string TakeException(JSContext* context) {
+  ScopedValue exception(context, JS_GetException(context));
+  string message;
+  if (!ToString(context, exception.get(), &message)) {
+    JS_FreeValue(context, JS_GetException(context));
+    message = "exception";
+  }
+  return message;
+}
+
+// Sets 'text' to the JSON text of 'value', or to 'undefined' if it has none,
+// e.g., if it is undefined or a function. Returns false, with an exception
+// pending, if JSON.stringify() throws.
+bool Stringify(JSContext* context, JSValueConst value, string* text) {
+  ScopedValue json(
+      context, JS_JSONStringify(context, value, JS_UNDEFINED, JS_UNDEFINED));
+  if (json.is_exception()) {
+    return false;
+  }
+  if (JS_IsUndefined(json.get())) {
+    *text = "undefined";
+    return true;
+  }
+  return ToString(context, json.get(), text);
+}
+
+// Converts 'value' to JSON. Values without JSON text are null. Returns false,
+// with an exception pending, on error.
+bool ToJson(JSContext* context, JSValueConst value, Json::Value* result) {
+  string text;
+  if (!Stringify(context, value, &text)) {
+    return false;
+  }
+  if (text == "undefined") {
+    *result = Json::Value();
+    return true;
+  }
+  if (!ParseJsonText(text, result)) {
+    JS_ThrowInternalError(context, "cannot parse JSON text");
+    return false;
+  }
+  return true;
+}
+
+// Returns the value of 'value' in 'context', or JS_EXCEPTION.
+JSValue FromJson(JSContext* context, const Json::Value& value) {
+  switch (value.type()) {
+    case Json::nullValue:
+      return JS_NULL;
+    case Json::booleanValue:
+      return JS_NewBool(context, value.asBool());
+    case Json::intValue:
+    case Json::uintValue:
+    case Json::realValue:
+      return JS_NewFloat64(context, value.asDouble());
+    case Json::stringValue: {
+      const char* begin = nullptr;
+      const char* end = nullptr;
+      value.getString(&begin, &end);
+      return JS_NewStringLen(context, begin, end - begin);
+    }
+    default: {
+      const string text = ToJsonText(value);
+      return JS_ParseJSON(context, text.c_str(), text.size(), kFileName);
+    }
+  }
+}
+
+bool IsIdentifierChar(char c) {
+  return absl::ascii_isalnum(c) || c == '_' || c == '$';
+}
+
+// Returns the identifier at the start of 'location', which is empty if
+// 'location' does not start with one.
+string TopLevelVariable(absl::string_view location) {
+  location = absl::StripLeadingAsciiWhitespace(location);
+  if (location.empty() || absl::ascii_isdigit(location[0])) {
+    return "";
+  }
+  size_t end = 0;
+  while (end < location.size() && IsIdentifierChar(location[end])) {
+    ++end;
+  }
+  return string(location.substr(0, end));
+}
+
+// Returns the names of the functions that 'expr' calls by name, e.g., 'f' in
+// "f(x)" but not 'g' in "a.g(x)". Names in string literals are skipped.
+std::vector<string> CalledNames(absl::string_view expr) {
+  std::vector<string> names;
+  // The last character before the current one that is not a space.
+  char previous = ' ';
+  size_t i = 0;
+  while (i < expr.size()) {
+    const char c = expr[i];
+    if (c == '"' || c == '\'' || c == '`') {
+      for (++i; i < expr.size() && expr[i] != c; ++i) {
+        if (expr[i] == '\\') {
+          ++i;
+        }
+      }
+      ++i;
+      previous = c;
+    } else if (IsIdentifierChar(c)) {
+      size_t end = i;
+      while (end < expr.size() && IsIdentifierChar(expr[end])) {
+        ++end;
+      }
+      size_t next = end;
+      while (next < expr.size() && absl::ascii_isspace(expr[next])) {
+        ++next;
+      }
+      if (!absl::ascii_isdigit(c) && previous != '.' && next < expr.size() &&
+          expr[next] == '(') {
+        names.emplace_back(expr.substr(i, end - i));
+      }
+      previous = expr[end - 1];
+      i = end;
+    } else {
+      if (!absl::ascii_isspace(c)) {
+        previous = c;
+      }
+      ++i;
+    }
+  }
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  return names;
+}
+
+// The source of a function that returns the value of 'expr'. The line breaks
+// end comments at the end of 'expr'.
+string ValueFunctionSource(absl::string_view expr) {
+  return absl::StrCat("(function () { return (\n", expr, "\n); })");
+}
+
+// The source of a function that assigns its argument to 'location'.
+string SetterFunctionSource(absl::string_view location) {
+  return absl::StrCat("(function (", kSetterParameter, ") { (\n", location,
+                      "\n) = ", kSetterParameter, "; })");
+}
+
+// Compiles the script 'source' in 'context' and sets 'bytecode' to its
+// serialized form. Returns false if 'source' does not compile.
+bool CompileToBytecode(JSContext* context, const string& source,
+                       string* bytecode) {
+  ScopedValue script(
+      context, JS_Eval(context, source.c_str(), source.size(), kFileName,
+                       JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_STRICT |
+                           JS_EVAL_FLAG_COMPILE_ONLY));
+  if (script.is_exception()) {
+    VLOG(1) << "Expression left to evaluate from source: "
+            << TakeException(context) << ": " << source;
+    return false;
+  }
+  size_t size = 0;
+  uint8_t* data =
+      JS_WriteObject(context, &size, script.get(), JS_WRITE_OBJ_BYTECODE);
+  RETURN_FALSE_IF(data == nullptr);
+  bytecode->assign(reinterpret_cast<const char*>(data), size);
+  js_free(context, data);
+  return true;
+}
+
+// An expression compiled to the bytecode of a function that returns its value
+// and, for locations, of one that assigns to it.
+class CompiledQuickJsExpression : public CompiledExpression {
+ public:
+  CompiledQuickJsExpression(string value_bytecode, string setter_bytecode,
+                            std::vector<string> called_names)
+      : id_(NextId()),
+        value_bytecode_(std::move(value_bytecode)),
+        setter_bytecode_(std::move(setter_bytecode)),
+        called_names_(std::move(called_names)) {}
+
+  const char* language() const override { return kQuickJsLanguage; }
+
+  // Identifies the expression in the contexts that loaded it.
+  uint64_t id() const { return id_; }
+  const string& value_bytecode() const { return value_bytecode_; }
+  // Empty if the expression was not compiled as a location.
+  const string& setter_bytecode() const { return setter_bytecode_; }
+  // The functions to bind before the expression is loaded.
+  const std::vector<string>& called_names() const { return called_names_; }
+
+ private:
+  static uint64_t NextId() {
+    static std::atomic<uint64_t> next_id(0);
+    return next_id++;
+  }
+
+  const uint64_t id_;
+  const string value_bytecode_;
+  const string setter_bytecode_;
+  const std::vector<string> called_names_;
+};
+
+// Compiles expressions in a context of its own, which holds nothing else.
+class QuickJsExpressionCompiler : public ExpressionCompiler {
+ public:
+  QuickJsExpressionCompiler()
+      : runtime_(JS_NewRuntime()),
+        context_(runtime_ == nullptr ? nullptr : JS_NewContext(runtime_)) {}
+
+  std::shared_ptr<const CompiledExpression> Compile(
+      const string& expr) const override {
+    return Compile(expr, false);
+  }
+
+  std::shared_ptr<const CompiledExpression> CompileLocation(
+      const string& location,
+      std::shared_ptr<const SymbolTable> symbols) const override {
+    return Compile(location, true);
+  }
+
+ private:
+  std::shared_ptr<const CompiledExpression> Compile(const string& expr,
+                                                    bool location) const {
+    absl::MutexLock lock(&mutex_);
+    RETURN_NULL_IF(context_ == nullptr);
+    // Models may be added on any thread.
+    JS_UpdateStackTop(runtime_);
+    string value_bytecode;
+    string setter_bytecode;
+    if (!CompileToBytecode(context_, ValueFunctionSource(expr),
+                           &value_bytecode) ||
+        (location && !CompileToBytecode(context_, SetterFunctionSource(expr),
+                                        &setter_bytecode))) {
+      return nullptr;
+    }
+    return std::make_shared<CompiledQuickJsExpression>(
+        std::move(value_bytecode), std::move(setter_bytecode),
+        CalledNames(expr));
+  }
+
+  mutable absl::Mutex mutex_;
+  JSRuntime* const runtime_;
+  JSContext* const context_;
+};
+
+class QuickJsDatamodelFactory : public DatamodelFactory {
+ public:
+  const ExpressionCompiler* GetExpressionCompiler() const override {
+    return QuickJsDatamodel::GetExpressionCompiler();
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const override {
+    return QuickJsDatamodel::Create(dispatcher);
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const override {
+    RETURN_NULL_IF(!modifications.empty());
+    return QuickJsDatamodel::Create(serialized_data, dispatcher);
+  }
+};
+
+// Iterates over a JSON array that was copied out of a context.
+class QuickJsArrayIterator : public Iterator {
+ public:
+  explicit QuickJsArrayIterator(Json::Value array) : array_(std::move(array)) {}
+
+  bool AtEnd() const override { return index_ >= array_.size(); }
+
+  bool Next() override {
+    if (AtEnd()) {
+      return false;
+    }
+    ++index_;
+    return !AtEnd();
+  }
+
+  string GetValue() const override {
+    return AtEnd() ? "" : ToJsonText(array_[index_]);
+  }
+
+  string GetIndex() const override { return absl::StrCat(index_); }
+
+  const char* language() const override { return kQuickJsLanguage; }
+
+  const Json::Value& value() const { return array_[index_]; }
+  Json::ArrayIndex index() const { return index_; }
+
+ private:
+  const Json::Value array_;
+  Json::ArrayIndex index_ = 0;
+};
+
+}  // namespace
+
+namespace internal {
+
+// The QuickJS runtime and context of a QuickJsDatamodel, with the functions of
+// the expressions that were loaded into the context.
+class QuickJsContext {
+ public:
+  // Returns nullptr if the runtime or the context cannot be created.
+  static std::unique_ptr<QuickJsContext> Create(FunctionDispatcher* dispatcher);
+
+  QuickJsContext(const QuickJsContext&) = delete;
+  QuickJsContext& operator=(const QuickJsContext&) = delete;
+  ~QuickJsContext();
+
+  // Returns the context, ready to run on the calling thread.
+  JSContext* Enter();
+
+  // Replaces the context by a new one. Returns false if it cannot be created.
+  bool Reset();
+
+  // Returns the value of 'expr', or JS_EXCEPTION with the exception pending.
+  JSValue Evaluate(const Expression& expr);
+
+  // Assigns 'value' to 'location'. Returns false, with the exception pending,
+  // if the assignment throws.
+  bool Assign(const Expression& location, JSValueConst value);
+
+  FunctionDispatcher* dispatcher() const { return dispatcher_; }
+  Runtime* runtime() const { return runtime_; }
+  void set_runtime(Runtime* runtime) { runtime_ = runtime; }
+
+ private:
+  // Expressions compiled from source are dropped when there are more.
+  static constexpr size_t kMaxSourceFunctions = 256;
+
+  // The functions that were loaded for expressions, owned by the context.
+  struct Functions {
+    // By the ids of compiled expressions.
+    std::unordered_map<uint64_t, JSValue> compiled;
+    // By the sources of expressions that were not compiled.
+    std::unordered_map<string, JSValue> sources;
+  };
+
+  QuickJsContext(FunctionDispatcher* dispatcher, JSRuntime* js_runtime)
+      : dispatcher_(dispatcher), js_runtime_(js_runtime) {}
+
+  // Frees the context and everything loaded into it.
+  void FreeContext();
+
+  // Returns the function of 'expr' that returns its value, or if 'setter' is
+  // true, assigns its argument to it. Returns JS_EXCEPTION, with the exception
+  // pending, if 'expr' does not compile.
+  JSValue GetFunction(const Expression& expr, bool setter);
+
+  // Binds the functions of the dispatcher among 'names' to the global object.
+  // Names of other global properties are skipped.
+  void BindFunctions(const std::vector<string>& names);
+
+  FunctionDispatcher* const dispatcher_;
+  Runtime* runtime_ = nullptr;
+  JSRuntime* const js_runtime_;
+  JSContext* context_ = nullptr;
+  Functions values_;
+  Functions setters_;
+  // The names BindFunctions() has seen, bound or not.
+  std::set<string> checked_names_;
+};
+
+}  // namespace internal
+
+namespace {
+
+internal::QuickJsContext* GetQuickJsContext(JSContext* context) {
+  return static_cast<internal::QuickJsContext*>(JS_GetContextOpaque(context));
+}
+
+// In(state_id): Whether the state is active in the runtime of the context.
+JSValue CallIn(JSContext* context, JSValueConst this_value, int argc,
+               JSValueConst* argv) {
+  string state_id;
+  if (argc != 1 || !JS_IsString(argv[0]) ||
+      !ToString(context, argv[0], &state_id)) {
+    return JS_ThrowTypeError(context, "In() takes a state id");
+  }
+  const Runtime* runtime = GetQuickJsContext(context)->runtime();
+  return JS_NewBool(context,
+                    runtime != nullptr && runtime->IsActiveState(state_id));
+}
+
+// Math.random(), drawn from the random generator of the runtime.
+JSValue CallRandom(JSContext* context, JSValueConst this_value, int argc,
+                   JSValueConst* argv) {
+  Runtime* runtime = GetQuickJsContext(context)->runtime();
+  if (runtime != nullptr) {
+    return JS_NewFloat64(context,
+                         runtime->GetRandomGenerator()->NextDouble());
+  }
+  thread_local RandomGenerator generator;
+  return JS_NewFloat64(context, generator.NextDouble());
+}
+
+// Calls the dispatcher function named 'data[0]' with the JSON values of the
+// arguments.
+JSValue CallFunction(JSContext* context, JSValueConst this_value, int argc,
+                     JSValueConst* argv, int magic, JSValue* data) {
+  string name;
+  if (!ToString(context, data[0], &name)) {
+    return JS_EXCEPTION;
+  }
+  std::vector<Json::Value> values(argc);
+  std::vector<const Json::Value*> arguments;
+  for (int i = 0; i < argc; ++i) {
+    if (!ToJson(context, argv[i], &values[i])) {
+      return JS_EXCEPTION;
+    }
+    arguments.push_back(&values[i]);
+  }
+  FunctionDispatcher* dispatcher = GetQuickJsContext(context)->dispatcher();
+  Json::Value result;
+  if (dispatcher == nullptr ||
+      !dispatcher->Execute(name, arguments, &result)) {
+    return JS_ThrowInternalError(context, "%s() failed", name.c_str());
+  }
+  return FromJson(context, result);
+}
+
+}  // namespace
+
+namespace internal {
+
+// static
+std::unique_ptr<QuickJsContext> QuickJsContext::Create(
+    FunctionDispatcher* dispatcher) {
+  JSRuntime* js_runtime = JS_NewRuntime();
+  RETURN_NULL_IF(js_runtime == nullptr);
+  auto context = absl::WrapUnique(new QuickJsContext(dispatcher, js_runtime));
+  RETURN_NULL_IF(!context->Reset());
+  return context;
+}
+
+QuickJsContext::~QuickJsContext() {
+  FreeContext();
+  JS_FreeRuntime(js_runtime_);
+}
+
+JSContext* QuickJsContext::Enter() {
+  // The stack limit is measured from the thread that last entered.
+  JS_UpdateStackTop(js_runtime_);
+  return context_;
+}
+
+bool QuickJsContext::Reset() {
+  FreeContext();
+  context_ = JS_NewContext(js_runtime_);
+  RETURN_FALSE_IF(context_ == nullptr);
+  JS_SetContextOpaque(context_, this);
+  ScopedValue global(context_, JS_GetGlobalObject(context_));
+  ScopedValue math(context_, JS_GetPropertyStr(context_, global.get(), "Math"));
+  return JS_SetPropertyStr(context_, global.get(), "In",
+                           JS_NewCFunction(context_, &CallIn, "In", 1)) >= 0 &&
+         JS_SetPropertyStr(
+             context_, math.get(), "random",
+             JS_NewCFunction(context_, &CallRandom, "random", 0)) >= 0;
+}
+
+void QuickJsContext::FreeContext() {
+  if (context_ == nullptr) {
+    return;
+  }
+  for (Functions* functions : {&values_, &setters_}) {
+    for (const auto& function : functions->compiled) {
+      JS_FreeValue(context_, function.second);
+    }
+    for (const auto& function : functions->sources) {
+      JS_FreeValue(context_, function.second);
+    }
+    functions->compiled.clear();
+    functions->sources.clear();
+  }
+  checked_names_.clear();
+  JS_FreeContext(context_);
+  context_ = nullptr;
+}
+
+JSValue QuickJsContext::Evaluate(const Expression& expr) {
+  // Held during the call, which may drop functions compiled from source.
+  ScopedValue function(context_,
+                       JS_DupValue(context_, GetFunction(expr, false)));
+  if (function.is_exception()) {
+    return JS_EXCEPTION;
+  }
+  return JS_Call(context_, function.get(), JS_UNDEFINED, 0, nullptr);
+}
+
+bool QuickJsContext::Assign(const Expression& location, JSValueConst value) {
+  ScopedValue setter(context_,
+                     JS_DupValue(context_, GetFunction(location, true)));
+  if (setter.is_exception()) {
+    return false;
+  }
+  JSValueConst arguments[] = {value};
+  ScopedValue result(
+      context_, JS_Call(context_, setter.get(), JS_UNDEFINED, 1, arguments));
+  return !result.is_exception();
+}
+
+JSValue QuickJsContext::GetFunction(const Expression& expr, bool setter) {
+  Functions& functions = setter ? setters_ : values_;
+  const CompiledExpression* compiled = expr.compiled();
+  if (compiled != nullptr &&
+      strcmp(compiled->language(), kQuickJsLanguage) == 0) {
+    const auto* quickjs =
+        static_cast<const CompiledQuickJsExpression*>(compiled);
+    const string& bytecode =
+        setter ? quickjs->setter_bytecode() : quickjs->value_bytecode();
+    if (!bytecode.empty()) {
+      const auto it = functions.compiled.find(quickjs->id());
+      if (it != functions.compiled.end()) {
+        return it->second;
+      }
+      BindFunctions(quickjs->called_names());
+      const JSValue script = JS_ReadObject(
+          context_, reinterpret_cast<const uint8_t*>(bytecode.data()),
+          bytecode.size(), JS_READ_OBJ_BYTECODE);
+      if (JS_IsException(script)) {
+        return script;
+      }
+      // Frees 'script'.
+      const JSValue function = JS_EvalFunction(context_, script);
+      if (!JS_IsException(function)) {
+        functions.compiled.emplace(quickjs->id(), function);
+      }
+      return function;
+    }
+  }
+
+  const auto it = functions.sources.find(expr.source());
+  if (it != functions.sources.end()) {
+    return it->second;
+  }
+  if (functions.sources.size() >= kMaxSourceFunctions) {
+    for (const auto& function : functions.sources) {
+      JS_FreeValue(context_, function.second);
+    }
+    functions.sources.clear();
+  }
+  BindFunctions(CalledNames(expr.source()));
+  const string source = setter ? SetterFunctionSource(expr.source())
+                               : ValueFunctionSource(expr.source());
+  const JSValue function =
+      JS_Eval(context_, source.c_str(), source.size(), kFileName,
+              JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_STRICT);
+  if (!JS_IsException(function)) {
+    functions.sources.emplace(expr.source(), function);
+  }
+  return function;
+}
+
+void QuickJsContext::BindFunctions(const std::vector<string>& names) {
+  if (dispatcher_ == nullptr) {
+    return;
+  }
+  for (const string& name : names) {
+    if (!checked_names_.insert(name).second ||
+        !dispatcher_->HasFunction(name)) {
+      continue;
+    }
+    ScopedValue global(context_, JS_GetGlobalObject(context_));
+    const JSAtom atom = JS_NewAtom(context_, name.c_str());
+    const int defined = JS_HasProperty(context_, global.get(), atom);
+    JS_FreeAtom(context_, atom);
+    if (defined != 0) {
+      continue;
+    }
+    ScopedValue data(context_, JS_NewString(context_, name.c_str()));
+    JSValueConst data_values[] = {data.get()};
+    if (JS_SetPropertyStr(context_, global.get(), name.c_str(),
+                          JS_NewCFunctionData(context_, &CallFunction, 0, 0, 1,
+                                              data_values)) < 0) {
+      LOG(INFO) << "Cannot bind function " << name << ": "
+                << TakeException(context_);
+    }
+  }
+}
+
+}  // namespace internal
+
+// static
+std::unique_ptr<QuickJsDatamodel> QuickJsDatamodel::Create(
+    FunctionDispatcher* dispatcher) {
+  auto context = internal::QuickJsContext::Create(dispatcher);
+  RETURN_NULL_IF(context == nullptr);
+  return absl::WrapUnique(new QuickJsDatamodel(dispatcher, std::move(context)));
+}
+
+// static
+std::unique_ptr<QuickJsDatamodel> QuickJsDatamodel::Create(
+    const string& serialized_data, FunctionDispatcher* dispatcher) {
+  auto datamodel = Create(dispatcher);
+  RETURN_NULL_IF(datamodel == nullptr);
+  RETURN_NULL_IF(!datamodel->ParseFromString(serialized_data));
+  return datamodel;
+}
+
+// static
+std::unique_ptr<DatamodelFactory> QuickJsDatamodel::CreateFactory() {
+  return absl::make_unique<QuickJsDatamodelFactory>();
+}
+
+// static
+const ExpressionCompiler* QuickJsDatamodel::GetExpressionCompiler() {
+  static const QuickJsExpressionCompiler* const compiler =
+      new QuickJsExpressionCompiler();
+  return compiler;
+}
+
+QuickJsDatamodel::QuickJsDatamodel(
+    FunctionDispatcher* dispatcher,
+    std::unique_ptr<internal::QuickJsContext> context)
+    : dispatcher_(dispatcher), context_(std::move(context)) {}
+
+QuickJsDatamodel::~QuickJsDatamodel() = default;
+
+void QuickJsDatamodel::SetRuntime(Runtime* runtime) {
+  runtime_ = runtime;
+  context_->set_runtime(runtime);
+}
+
+bool QuickJsDatamodel::IsUnderVariable(const string& location) const {
+  return variables_.count(TopLevelVariable(location)) > 0;
+}
+
+bool QuickJsDatamodel::IsDefined(const string& location) const {
+  return IsDefined(Expression(location));
+}
+
+bool QuickJsDatamodel::IsDefined(const Expression& location) const {
+  JSContext* context = context_->Enter();
+  ScopedValue value(context, context_->Evaluate(location));
+  if (value.is_exception()) {
+    TakeException(context);
+    return false;
+  }
+  return !JS_IsUndefined(value.get());
+}
+
+bool QuickJsDatamodel::Declare(const string& location) {
+  return Declare(Expression(location));
+}
+
+bool QuickJsDatamodel::Declare(const Expression& location) {
+  if (IsDefined(location) ||
+      (dispatcher_ != nullptr && dispatcher_->HasFunction(location.source()))) {
+    return false;
+  }
+  const string variable = TopLevelVariable(location.source());
+  if (variable.empty()) {
+    LOG(INFO) << "Declare: not a location: " << location.source();
+    return false;
+  }
+  const bool is_variable =
+      absl::StripAsciiWhitespace(location.source()) == variable;
+  if (variables_.count(variable) == 0) {
+    // Other global properties, e.g., 'Math', are not replaced.
+    if (!is_variable && IsDefined(variable)) {
+      return false;
+    }
+    JSContext* context = context_->Enter();
+    ScopedValue global(context, JS_GetGlobalObject(context));
+    if (JS_SetPropertyStr(context, global.get(), variable.c_str(),
+                          is_variable ? JS_NULL : JS_NewObject(context)) < 0) {
+      LOG(INFO) << "Declare: " << TakeException(context) << ": "
+                << location.source();
+      return false;
+    }
+    variables_.insert(variable);
+    if (is_variable) {
+      return true;
+    }
+  }
+  return AssignValue(location, Json::Value());
+}
+
+bool QuickJsDatamodel::AssignExpression(const string& location,
+                                        const string& expr) {
+  return AssignExpression(Expression(location), Expression(expr));
+}
+
+bool QuickJsDatamodel::AssignExpression(const Expression& location,
+                                        const Expression& expr) {
+  if (!IsUnderVariable(location.source())) {
+    LOG(INFO) << "AssignExpression: not a declared location: "
+              << location.source();
+    return false;
+  }
+  JSContext* context = context_->Enter();
+  ScopedValue value(context,
+                    expr.source().empty() ? JS_NULL : context_->Evaluate(expr));
+  if (value.is_exception()) {
+    LOG(INFO) << "AssignExpression: error evaluating expression: "
+              << TakeException(context) << ": " << expr.source();
+    return false;
+  }
+  if (!context_->Assign(location, value.get())) {
+    LOG(INFO) << "AssignExpression: error assigning to location: "
+              << TakeException(context) << ": " << location.source();
+    return false;
+  }
+  return true;
+}
+
+bool QuickJsDatamodel::AssignString(const string& location,
+                                    const string& str) {
+  return AssignValue(Expression(location), Json::Value(str));
+}
+
+bool QuickJsDatamodel::AssignValue(const Expression& location,
+                                   Json::Value value) {
+  if (!IsUnderVariable(location.source())) {
+    LOG(INFO) << "AssignValue: not a declared location: " << location.source();
+    return false;
+  }
+  JSContext* context = context_->Enter();
+  ScopedValue js_value(context, FromJson(context, value));
+  if (js_value.is_exception() || !context_->Assign(location, js_value.get())) {
+    LOG(INFO) << "AssignValue: error assigning to location: "
+              << TakeException(context) << ": " << location.source();
+    return false;
+  }
+  return true;
+}
+
+bool QuickJsDatamodel::EvaluateBooleanExpression(const string& expr,
+                                                 bool* result) const {
+  return EvaluateBooleanExpression(Expression(expr), result);
+}
+
+bool QuickJsDatamodel::EvaluateBooleanExpression(const Expression& expr,
+                                                 bool* result) const {
+  JSContext* context = context_->Enter();
+  ScopedValue value(context, context_->Evaluate(expr));
+  if (value.is_exception()) {
+    LOG(INFO) << "EvaluateBooleanExpression: " << TakeException(context)
+              << ": " << expr.source();
+    return false;
+  }
+  *result = JS_ToBool(context, value.get()) > 0;
+  return true;
+}
+
+bool QuickJsDatamodel::EvaluateToText(const Expression& expr,
+                                      bool quote_strings,
+                                      string* result) const {
+  JSContext* context = context_->Enter();
+  ScopedValue value(context, context_->Evaluate(expr));
+  const bool converted =
+      !value.is_exception() &&
+      (!quote_strings && JS_IsString(value.get())
+           ? ToString(context, value.get(), result)
+           : Stringify(context, value.get(), result));
+  if (!converted) {
+    LOG(INFO) << "Evaluation error: " << TakeException(context) << ": "
+              << expr.source();
+  }
+  return converted;
+}
+
+bool QuickJsDatamodel::EvaluateStringExpression(const string& expr,
+                                                string* result) const {
+  return EvaluateStringExpression(Expression(expr), result);
+}
+
+bool QuickJsDatamodel::EvaluateStringExpression(const Expression& expr,
+                                                string* result) const {
+  return EvaluateToText(expr, false, result);
+}
+
+bool QuickJsDatamodel::EvaluateExpression(const string& expr,
+                                          string* result) const {
+  return EvaluateExpression(Expression(expr), result);
+}
+
+bool QuickJsDatamodel::EvaluateExpression(const Expression& expr,
+                                          string* result) const {
+  return EvaluateToText(expr, true, result);
+}
+
+bool QuickJsDatamodel::EvaluateValue(const Expression& expr,
+                                     Json::Value* result) const {
+  JSContext* context = context_->Enter();
+  ScopedValue value(context, context_->Evaluate(expr));
+  if (value.is_exception() || !ToJson(context, value.get(), result)) {
+    LOG(INFO) << "EvaluateValue: " << TakeException(context) << ": "
+              << expr.source();
+    return false;
+  }
+  return true;
+}
+
+string QuickJsDatamodel::EncodeParameters(
+    const std::map<string, string>& parameters) const {
+  return MakeJSONFromStringMap(parameters);
+}
+
+string QuickJsDatamodel::DebugString() const { return SerializeAsString(); }
+
+void QuickJsDatamodel::Clear() {
+  variables_.clear();
+  LOG_IF(DFATAL, !context_->Reset()) << "Cannot create a QuickJS context";
+}
+
+std::unique_ptr<Datamodel> QuickJsDatamodel::Clone() const {
+  auto clone = Create(SerializeAsString(), dispatcher_);
+  RETURN_NULL_IF(clone == nullptr);
+  clone->SetRuntime(runtime_);
+  return std::move(clone);
+}
+
+string QuickJsDatamodel::SerializeAsString() const {
+  JSContext* context = context_->Enter();
+  ScopedValue global(context, JS_GetGlobalObject(context));
+  string text = "{";
+  for (const string& variable : variables_) {
+    ScopedValue value(
+        context, JS_GetPropertyStr(context, global.get(), variable.c_str()));
+    string json;
+    if (value.is_exception() || !Stringify(context, value.get(), &json)) {
+      LOG(INFO) << "Cannot serialize " << variable << ": "
+                << TakeException(context);
+      json = "null";
+    } else if (json == "undefined") {
+      json = "null";
+    }
+    if (text.size() > 1) {
+      text += ',';
+    }
+    AppendQuotedJsonString(variable.data(), variable.data() + variable.size(),
+                           &text);
+    text += ':';
+    text += json;
+  }
+  text += '}';
+  return text;
+}
+
+bool QuickJsDatamodel::ParseFromString(const string& data) {
+  Json::Value root;
+  if (!ParseJsonText(data, &root) || !(root.isNull() || root.isObject())) {
+    LOG(INFO) << "Not the JSON object of a datamodel: " << data;
+    return false;
+  }
+  JSContext* context = context_->Enter();
+  ScopedValue global(context, JS_GetGlobalObject(context));
+  for (const string& variable : root.getMemberNames()) {
+    const JSValue value = FromJson(context, root[variable]);
+    if (JS_IsException(value) ||
+        JS_SetPropertyStr(context, global.get(), variable.c_str(), value) < 0) {
+      LOG(INFO) << "Cannot restore " << variable << ": "
+                << TakeException(context);
+      return false;
+    }
+    variables_.insert(variable);
+  }
+  return true;
+}
+
+std::unique_ptr<Iterator> QuickJsDatamodel::EvaluateIterator(
+    const string& location) const {
+  return EvaluateIterator(Expression(location));
+}
+
+std::unique_ptr<Iterator> QuickJsDatamodel::EvaluateIterator(
+    const Expression& location) const {
+  Json::Value array;
+  if (!EvaluateValue(location, &array) || !array.isArray()) {
+    LOG(INFO) << "Not an array: " << location.source();
+    return nullptr;
+  }
+  return absl::make_unique<QuickJsArrayIterator>(std::move(array));
+}
+
+bool QuickJsDatamodel::AssignIteratorValue(Iterator* iterator,
+                                           const Expression& location) {
+  if (strcmp(iterator->language(), kQuickJsLanguage) != 0) {
+    return Datamodel::AssignIteratorValue(iterator, location);
+  }
+  const auto* array_iterator = static_cast<QuickJsArrayIterator*>(iterator);
+  RETURN_FALSE_IF(array_iterator->AtEnd());
+  return AssignValue(location, array_iterator->value());
+}
+
+bool QuickJsDatamodel::AssignIteratorIndex(const Iterator& iterator,
+                                           const Expression& location) {
+  if (strcmp(iterator.language(), kQuickJsLanguage) != 0) {
+    return Datamodel::AssignIteratorIndex(iterator, location);
+  }
+  return AssignValue(location,
+                     Json::Value(static_cast<const QuickJsArrayIterator&>(
+                                     iterator).index()));
+}
+
+}  // namespace state_chart
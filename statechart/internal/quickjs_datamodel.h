@@ -0,0 +1,188 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_QUICKJS_DATAMODEL_H_
+#define STATE_CHART_INTERNAL_QUICKJS_DATAMODEL_H_
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/datamodel_factory.h"
+#include "statechart/internal/function_dispatcher.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+
+namespace internal {
+class QuickJsContext;
+}  // namespace internal
+
+// An ECMAScript datamodel that evaluates expressions with the QuickJS engine,
+// so they have the full semantics of the language instead of the subset of the
+// LightWeightDatamodel. Each datamodel, i.e., each state machine, has a QuickJS
+// runtime and context of its own. The top-level variables are properties of
+// the global object, and expressions run in strict mode, so that assigning to
+// a variable that was not declared fails.
+//
+// Expressions compiled by GetExpressionCompiler(), as StateMachineFactory does
+// when a model is added, are QuickJS bytecode. All datamodels of the model
+// share it, and each loads an expression into its context the first time that
+// it evaluates it. Expressions that were not compiled are compiled in the
+// context from source, and the most recent ones are kept.
+//
+// Functions of the FunctionDispatcher are functions of the global object,
+// which are bound the first time an expression calls them by name. They are
+// passed the JSON values of their arguments and their results are parsed back.
+// In() tests the active states of the runtime and Math.random() draws from its
+// random generator.
+//
+// The datamodel serializes to the JSON object of its variables, the same form
+// as the LightWeightDatamodel, so only JSON values survive SerializeAsString()
+// and Clone(). Writes are not counted, so state machines are serialized in
+// full.
+//
+// State charts use the datamodel through the factory of CreateFactory(), e.g.,
+// as StateMachineFactory::Options::datamodel_factories["ecmascript"] in place
+// of the LightWeightDatamodel.
+class QuickJsDatamodel : public Datamodel {
+ public:
+  // Returns a new empty datamodel, or nullptr if the QuickJS runtime cannot be
+  // created. Expressions call the functions of 'dispatcher', which is not
+  // owned and may be nullptr, in which case no functions are bound.
+  static std::unique_ptr<QuickJsDatamodel> Create(
+      FunctionDispatcher* dispatcher);
+
+  // Returns a datamodel initialized from the SerializeAsString()
+  // representation 'serialized_data', or nullptr if parsing fails.
+  static std::unique_ptr<QuickJsDatamodel> Create(
+      const string& serialized_data, FunctionDispatcher* dispatcher);
+
+  // Returns a factory of QuickJsDatamodels whose expressions are compiled by
+  // GetExpressionCompiler(), for StateMachineFactory::Options.
+  static std::unique_ptr<DatamodelFactory> CreateFactory();
+
+  // Returns the compiler of expressions into QuickJS bytecode. The bytecode
+  // does not depend on any datamodel and may be shared by any number of them.
+  // Expressions that do not compile, e.g., with syntax errors, are left to be
+  // evaluated from source, where they fail.
+  static const ExpressionCompiler* GetExpressionCompiler();
+
+  QuickJsDatamodel(const QuickJsDatamodel&) = delete;
+  QuickJsDatamodel& operator=(const QuickJsDatamodel&) = delete;
+  ~QuickJsDatamodel() override;
+
+  bool IsDefined(const string& location) const override;
+  bool IsDefined(const Expression& location) const override;
+  // Declares 'location' as null. A location under a variable that is not
+  // declared declares the variable as an object first, e.g., 'a' for 'a.b',
+  // but other missing values on the way are not created.
+  bool Declare(const string& location) override;
+  bool Declare(const Expression& location) override;
+  // An empty 'expr' assigns null. Only locations under declared variables may
+  // be assigned.
+  bool AssignExpression(const string& location, const string& expr) override;
+  bool AssignExpression(const Expression& location,
+                        const Expression& expr) override;
+  bool AssignString(const string& location, const string& str) override;
+  bool AssignValue(const Expression& location, Json::Value value) override;
+
+  bool EvaluateBooleanExpression(const string& expr,
+                                 bool* result) const override;
+  bool EvaluateBooleanExpression(const Expression& expr,
+                                 bool* result) const override;
+  // Strings are not quoted. Other values are JSON text, except for
+  // 'undefined'.
+  bool EvaluateStringExpression(const string& expr,
+                                string* result) const override;
+  bool EvaluateStringExpression(const Expression& expr,
+                                string* result) const override;
+  // The result is JSON text, or 'undefined'.
+  bool EvaluateExpression(const string& expr, string* result) const override;
+  bool EvaluateExpression(const Expression& expr,
+                          string* result) const override;
+  // Undefined values are null.
+  bool EvaluateValue(const Expression& expr,
+                     Json::Value* result) const override;
+
+  string EncodeParameters(
+      const std::map<string, string>& parameters) const override;
+
+  // The JSON object of the variables.
+  string DebugString() const override;
+
+  // Removes all variables, as well as anything else that expressions stored in
+  // the global object, by replacing the context.
+  void Clear() override;
+
+  // Returns a datamodel with a context of its own that holds copies of the
+  // JSON values of the variables. The clone calls the same FunctionDispatcher
+  // and Runtime. Takes time linear in the size of the values.
+  std::unique_ptr<Datamodel> Clone() const override;
+
+  string SerializeAsString() const override;
+
+  // Iterates over a copy of the JSON array at 'location'.
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const string& location) const override;
+  std::unique_ptr<Iterator> EvaluateIterator(
+      const Expression& location) const override;
+  // The elements of iterators returned by EvaluateIterator() are assigned
+  // without being formatted as expressions.
+  bool AssignIteratorValue(Iterator* iterator,
+                           const Expression& location) override;
+  bool AssignIteratorIndex(const Iterator& iterator,
+                           const Expression& location) override;
+
+  const Runtime* GetRuntime() const override { return runtime_; }
+  void SetRuntime(Runtime* runtime) override;
+
+ protected:
+  // Parses the JSON object of the variables. Null declares no variables.
+  bool ParseFromString(const string& data) override;
+
+ private:
+  QuickJsDatamodel(FunctionDispatcher* dispatcher,
+                   std::unique_ptr<internal::QuickJsContext> context);
+
+  // Returns true if the top-level variable of 'location' is declared.
+  bool IsUnderVariable(const string& location) const;
+
+  // Evaluates 'expr' and sets 'result' to the JSON text of its value, or to
+  // 'undefined'. Strings are not quoted if 'quote_strings' is false.
+  bool EvaluateToText(const Expression& expr, bool quote_strings,
+                      string* result) const;
+
+  // The dispatcher of function calls, not owned. May be nullptr.
+  FunctionDispatcher* const dispatcher_;
+
+  // The runtime whose active states In() tests, not owned.
+  Runtime* runtime_ = nullptr;
+
+  // The QuickJS runtime and context. Evaluation loads expressions into it, so
+  // it changes in const methods too.
+  const std::unique_ptr<internal::QuickJsContext> context_;
+
+  // The names of the declared variables.
+  std::set<string> variables_;
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_QUICKJS_DATAMODEL_H_
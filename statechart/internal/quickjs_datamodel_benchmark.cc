@@ -0,0 +1,168 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the QuickJsDatamodel with the LightWeightDatamodel. Benchmarks with
+// an argument of 0 use the LightWeightDatamodel and 1 the QuickJsDatamodel.
+
+#include <memory>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "include/json/json.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/function_dispatcher_impl.h"
+#include "statechart/internal/light_weight_datamodel.h"
+#include "statechart/internal/quickjs_datamodel.h"
+#include "statechart/internal/testing/state_chart_builder.h"
+#include "statechart/proto/state_chart.pb.h"
+#include "statechart/state_machine.h"
+#include "statechart/state_machine_factory.h"
+#include "statechart/state_machine_listener.h"
+
+#include <benchmark/benchmark.h>
+
+namespace state_chart {
+namespace {
+
+constexpr char kGuard[] = "counter < limit && record.score * 2 >= record.id";
+
+bool UseQuickJs(const benchmark::State& state) { return state.range(0) != 0; }
+
+std::unique_ptr<Datamodel> CreateDatamodel(const benchmark::State& state,
+                                           FunctionDispatcher* dispatcher) {
+  if (UseQuickJs(state)) {
+    return QuickJsDatamodel::Create(dispatcher);
+  }
+  return LightWeightDatamodel::Create(dispatcher);
+}
+
+const ExpressionCompiler* GetCompiler(const benchmark::State& state) {
+  if (UseQuickJs(state)) {
+    return QuickJsDatamodel::GetExpressionCompiler();
+  }
+  return LightWeightDatamodel::GetBytecodeCompiler();
+}
+
+// Declares the variables of kGuard in 'datamodel'.
+void DeclareGuardVariables(Datamodel* datamodel) {
+  datamodel->Declare("counter");
+  datamodel->AssignExpression("counter", "1");
+  datamodel->Declare("limit");
+  datamodel->AssignExpression("limit", "1000");
+  datamodel->Declare("record");
+  datamodel->AssignExpression("record",
+                              R"({"id": 7, "name": "a", "score": 4.5})");
+}
+
+// Evaluates a compiled guard, as state machines do for transitions.
+void BM_EvaluateGuard(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = CreateDatamodel(state, &dispatcher);
+  DeclareGuardVariables(datamodel.get());
+  const Expression guard(kGuard, GetCompiler(state)->Compile(kGuard));
+  for (auto _ : state) {
+    bool result = false;
+    benchmark::DoNotOptimize(
+        datamodel->EvaluateBooleanExpression(guard, &result));
+  }
+}
+BENCHMARK(BM_EvaluateGuard)->Arg(0)->Arg(1);
+
+// The same guard evaluated from its source.
+void BM_EvaluateGuardFromSource(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = CreateDatamodel(state, &dispatcher);
+  DeclareGuardVariables(datamodel.get());
+  const Expression guard(kGuard);
+  for (auto _ : state) {
+    bool result = false;
+    benchmark::DoNotOptimize(
+        datamodel->EvaluateBooleanExpression(guard, &result));
+  }
+}
+BENCHMARK(BM_EvaluateGuardFromSource)->Arg(0)->Arg(1);
+
+// Increments a counter with a compiled <assign>.
+void BM_AssignCounter(benchmark::State& state) {
+  FunctionDispatcherImpl dispatcher;
+  auto datamodel = CreateDatamodel(state, &dispatcher);
+  DeclareGuardVariables(datamodel.get());
+  const ExpressionCompiler* compiler = GetCompiler(state);
+  const Expression location("counter",
+                            compiler->CompileLocation("counter", nullptr));
+  const Expression expr("counter + 1", compiler->Compile("counter + 1"));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(datamodel->AssignExpression(location, expr));
+  }
+}
+BENCHMARK(BM_AssignCounter)->Arg(0)->Arg(1);
+
+// A factory of a model that counts "tick" events up to a limit, with the
+// datamodel of 'state'.
+std::unique_ptr<StateMachineFactory> CreateCounterFactory(
+    const benchmark::State& state) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "counter");
+  builder.DataModel()
+      .AddDataFromExpr("counter", "0")
+      .AddDataFromExpr("limit", "1000000000")
+      .AddDataFromExpr("record", R"({"id": 7, "name": "a", "score": 4.5})");
+  auto running = builder.AddState("running");
+  running
+      .AddTransition({"tick"}, {}, kGuard,
+                     config::Transition::TYPE_INTERNAL)
+      .AddAssign("counter", "counter + 1");
+  running.AddTransition({"tick"}, {"done"});
+  builder.AddState("done");
+
+  StateMachineFactory::Options options;
+  options.compile_to_bytecode = true;
+  if (UseQuickJs(state)) {
+    options.datamodel_factories["ecmascript"] =
+        QuickJsDatamodel::CreateFactory();
+  }
+  return StateMachineFactory::CreateFromProtos(
+      state_charts, absl::make_unique<StateMachineListener>(), options);
+}
+
+// Creates and starts state machines, which is when QuickJsDatamodels create
+// their contexts and load the expressions of the model.
+void BM_StartStateMachine(benchmark::State& state) {
+  auto factory = CreateCounterFactory(state);
+  FunctionDispatcherImpl dispatcher;
+  for (auto _ : state) {
+    auto state_machine = factory->CreateStateMachine("counter", &dispatcher);
+    state_machine->Start();
+    state_machine->SendEvent("tick", "");
+    benchmark::DoNotOptimize(state_machine);
+  }
+}
+BENCHMARK(BM_StartStateMachine)->Arg(0)->Arg(1);
+
+// Sends events to a running state machine, each of which evaluates a guard
+// and an <assign>. Items processed are events.
+void BM_SendEvents(benchmark::State& state) {
+  auto factory = CreateCounterFactory(state);
+  FunctionDispatcherImpl dispatcher;
+  auto state_machine = factory->CreateStateMachine("counter", &dispatcher);
+  state_machine->Start();
+  for (auto _ : state) {
+    state_machine->SendEvent("tick", "");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SendEvents)->Arg(0)->Arg(1);
+
+}  // namespace
+}  // namespace state_chart
@@ -0,0 +1,320 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/quickjs_datamodel.h"
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "statechart/internal/random_generator.h"
+#include "statechart/internal/testing/mock_function_dispatcher.h"
+#include "statechart/internal/testing/mock_runtime.h"
+
+using testing::_;
+using testing::Eq;
+using testing::Invoke;
+using testing::NiceMock;
+using testing::Return;
+
+namespace state_chart {
+namespace {
+
+class QuickJsDatamodelTest : public testing::Test {
+ public:
+  QuickJsDatamodelTest()
+      : dispatcher_(new NiceMock<MockFunctionDispatcher>()),
+        datamodel_(QuickJsDatamodel::Create(dispatcher_.get())) {}
+
+  // Declare a variable, if successful, assign 'expr' to 'location'.
+  bool DeclareAndAssign(const string& location, const string& expr) {
+    if (!datamodel_->Declare(location)) {
+      return false;
+    }
+    return datamodel_->AssignExpression(location, expr);
+  }
+
+ protected:
+  std::unique_ptr<MockFunctionDispatcher> dispatcher_;
+  std::unique_ptr<QuickJsDatamodel> datamodel_;
+  MockRuntime runtime_;
+};
+
+TEST_F(QuickJsDatamodelTest, EvaluatesExpressions) {
+  const std::pair<string, string> kTestCases[] = {
+      {"1 + 1", "2"},
+      {"0.5 * 3", "1.5"},
+      {"'a' + 1", R"("a1")"},
+      {R"({"key": "value"})", R"({"key":"value"})"},
+      {"[1, 2, 3].map(x => x * 2)", "[2,4,6]"},
+      {"Object.keys({b: 1, a: 2}).length", "2"},
+      {"undefined", "undefined"},
+  };
+  string result;
+  for (const auto& entry : kTestCases) {
+    EXPECT_TRUE(datamodel_->EvaluateExpression(entry.first, &result))
+        << entry.first;
+    EXPECT_EQ(entry.second, result) << entry.first;
+  }
+
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("'a' + 1", &result));
+  EXPECT_EQ("a1", result);
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("[1, 'b']", &result));
+  EXPECT_EQ(R"([1,"b"])", result);
+
+  bool boolean = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression("'x' !== 'y'", &boolean));
+  EXPECT_TRUE(boolean);
+
+  Json::Value value;
+  EXPECT_TRUE(datamodel_->EvaluateValue(Expression("undefined"), &value));
+  EXPECT_TRUE(value.isNull());
+
+  EXPECT_FALSE(datamodel_->EvaluateExpression("1 +", &result));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("missing", &result));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("null.a", &result));
+}
+
+TEST_F(QuickJsDatamodelTest, DeclaresAndAssigns) {
+  string result;
+  EXPECT_FALSE(datamodel_->IsDefined("foo"));
+  EXPECT_TRUE(datamodel_->Declare("foo"));
+  EXPECT_TRUE(datamodel_->IsDefined("foo"));
+  EXPECT_FALSE(datamodel_->Declare("foo"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("foo", &result));
+  EXPECT_EQ("null", result);
+
+  EXPECT_TRUE(datamodel_->AssignExpression("foo", "{a: [1, 2]}"));
+  EXPECT_TRUE(datamodel_->AssignExpression("foo.a[1]", "foo.a[0] + 2"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("foo", &result));
+  EXPECT_EQ(R"({"a":[1,3]})", result);
+
+  // An empty expression assigns null.
+  EXPECT_TRUE(datamodel_->AssignExpression("foo", ""));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("foo", &result));
+  EXPECT_EQ("null", result);
+
+  // Nested locations declare their variable.
+  EXPECT_TRUE(datamodel_->Declare("bar.baz"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("bar", &result));
+  EXPECT_EQ(R"({"baz":null})", result);
+  EXPECT_FALSE(datamodel_->Declare("Math.foo"));
+
+  // Only declared variables are assigned, also by expressions.
+  EXPECT_FALSE(datamodel_->AssignExpression("missing", "1"));
+  EXPECT_FALSE(datamodel_->EvaluateExpression("missing = 1", &result));
+  EXPECT_FALSE(datamodel_->IsDefined("missing"));
+  EXPECT_FALSE(datamodel_->AssignExpression("foo", "missing"));
+
+  EXPECT_TRUE(datamodel_->AssignString("foo", "a\"b"));
+  EXPECT_TRUE(datamodel_->EvaluateStringExpression("foo", &result));
+  EXPECT_EQ("a\"b", result);
+  EXPECT_TRUE(datamodel_->AssignValue(Expression("foo"), Json::Value(2.5)));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("foo * 2", &result));
+  EXPECT_EQ("5", result);
+}
+
+TEST_F(QuickJsDatamodelTest, EvaluatesCompiledExpressions) {
+  const ExpressionCompiler* compiler =
+      QuickJsDatamodel::GetExpressionCompiler();
+  string result;
+  const Expression expr("1 + 1", compiler->Compile("2 + 2"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(expr, &result));
+  EXPECT_EQ("4", result);
+
+  const Expression location("foo.bar",
+                            compiler->CompileLocation("foo.bar", nullptr));
+  ASSERT_NE(nullptr, location.compiled());
+  EXPECT_TRUE(datamodel_->Declare(location));
+  EXPECT_TRUE(datamodel_->AssignExpression(location, expr));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(location, &result));
+  EXPECT_EQ("4", result);
+
+  // Expressions that do not compile are evaluated from source.
+  EXPECT_EQ(nullptr, compiler->Compile("1 +"));
+  EXPECT_EQ(nullptr, compiler->CompileLocation("1 + 1", nullptr));
+  EXPECT_FALSE(datamodel_->AssignExpression(Expression("foo.bar"),
+                                            Expression("1 +")));
+  EXPECT_FALSE(datamodel_->AssignExpression(Expression("foo.bar + 1"), expr));
+}
+
+// The bytecode of an expression is shared by datamodels, but its evaluation is
+// not.
+TEST_F(QuickJsDatamodelTest, SharesCompiledExpressions) {
+  const ExpressionCompiler* compiler =
+      QuickJsDatamodel::GetExpressionCompiler();
+  const Expression location("x", compiler->CompileLocation("x", nullptr));
+  const Expression expr("x * 2", compiler->Compile("x * 2"));
+  auto other = QuickJsDatamodel::Create(dispatcher_.get());
+  ASSERT_NE(nullptr, other);
+  for (auto* datamodel : {datamodel_.get(), other.get()}) {
+    EXPECT_TRUE(datamodel->Declare(location));
+  }
+  EXPECT_TRUE(datamodel_->AssignExpression(location, Expression("1")));
+  EXPECT_TRUE(other->AssignExpression(location, Expression("2")));
+  string result;
+  EXPECT_TRUE(datamodel_->EvaluateExpression(expr, &result));
+  EXPECT_EQ("2", result);
+  EXPECT_TRUE(other->EvaluateExpression(expr, &result));
+  EXPECT_EQ("4", result);
+}
+
+TEST_F(QuickJsDatamodelTest, CallsDispatcherFunctions) {
+  ON_CALL(*dispatcher_, HasFunction("add")).WillByDefault(Return(true));
+  ON_CALL(*dispatcher_, Execute("add", _, _))
+      .WillByDefault(Invoke([](const string& name,
+                               const std::vector<const Json::Value*>& arguments,
+                               Json::Value* result) {
+        double sum = 0;
+        for (const Json::Value* argument : arguments) {
+          sum += (*argument)["n"].asDouble();
+        }
+        *result = sum;
+        return true;
+      }));
+  ON_CALL(*dispatcher_, HasFunction("fail")).WillByDefault(Return(true));
+
+  string result;
+  EXPECT_TRUE(
+      datamodel_->EvaluateExpression("add({n: 1}, {n: 2}) * 2", &result));
+  EXPECT_EQ("6", result);
+  const Expression compiled(
+      "add({n: 3})",
+      QuickJsDatamodel::GetExpressionCompiler()->Compile("add({n: 3})"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(compiled, &result));
+  EXPECT_EQ("3", result);
+
+  // Failed calls throw.
+  EXPECT_FALSE(datamodel_->EvaluateExpression("fail()", &result));
+  EXPECT_TRUE(datamodel_->EvaluateExpression(
+      "(() => { try { fail(); } catch (e) { return 'caught'; } })()",
+      &result));
+  EXPECT_EQ(R"("caught")", result);
+
+  // Function names are not variables.
+  EXPECT_FALSE(datamodel_->Declare("add"));
+}
+
+TEST_F(QuickJsDatamodelTest, InStateAndMathRandomOfRuntime) {
+  datamodel_->SetRuntime(&runtime_);
+  EXPECT_EQ(&runtime_, datamodel_->GetRuntime());
+  EXPECT_CALL(runtime_, IsActiveState(Eq("active_state")))
+      .WillRepeatedly(Return(true));
+  EXPECT_CALL(runtime_, IsActiveState(Eq("inactive_state")))
+      .WillRepeatedly(Return(false));
+
+  bool result = false;
+  EXPECT_TRUE(datamodel_->EvaluateBooleanExpression(
+      "In('active' + '_state') && !In('inactive_state')", &result));
+  EXPECT_TRUE(result);
+  EXPECT_FALSE(datamodel_->EvaluateBooleanExpression("In(42)", &result));
+
+  RandomGenerator expected(*runtime_.GetRandomGenerator());
+  Json::Value value;
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_TRUE(datamodel_->EvaluateValue(Expression("Math.random()"), &value));
+    EXPECT_EQ(expected.NextDouble(), value.asDouble());
+  }
+}
+
+TEST_F(QuickJsDatamodelTest, SerializesAndClones) {
+  EXPECT_EQ("{}", datamodel_->SerializeAsString());
+  EXPECT_TRUE(DeclareAndAssign("b", R"({"c": [true, "x"], "f": () => 1})"));
+  EXPECT_TRUE(DeclareAndAssign("a", "1.5"));
+  const string serialized = R"({"a":1.5,"b":{"c":[true,"x"]}})";
+  EXPECT_EQ(serialized, datamodel_->SerializeAsString());
+  EXPECT_EQ(serialized, datamodel_->DebugString());
+
+  auto restored = QuickJsDatamodel::Create(serialized, dispatcher_.get());
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(serialized, restored->SerializeAsString());
+  EXPECT_TRUE(restored->AssignExpression("a", "a + 1"));
+  string result;
+  EXPECT_TRUE(restored->EvaluateExpression("a", &result));
+  EXPECT_EQ("2.5", result);
+  EXPECT_NE(nullptr, QuickJsDatamodel::Create("null", dispatcher_.get()));
+  EXPECT_EQ(nullptr, QuickJsDatamodel::Create("[1]", dispatcher_.get()));
+  EXPECT_EQ(nullptr, QuickJsDatamodel::Create("{", dispatcher_.get()));
+
+  datamodel_->SetRuntime(&runtime_);
+  auto clone = datamodel_->Clone();
+  ASSERT_NE(nullptr, clone);
+  EXPECT_EQ(&runtime_, clone->GetRuntime());
+  EXPECT_TRUE(clone->AssignExpression("b.c[0]", "false"));
+  EXPECT_TRUE(clone->EvaluateExpression("b.c[0]", &result));
+  EXPECT_EQ("false", result);
+  EXPECT_TRUE(datamodel_->EvaluateExpression("b.c[0]", &result));
+  EXPECT_EQ("true", result);
+
+  datamodel_->Clear();
+  EXPECT_EQ("{}", datamodel_->SerializeAsString());
+  EXPECT_FALSE(datamodel_->IsDefined("a"));
+  EXPECT_TRUE(datamodel_->Declare("a"));
+}
+
+TEST_F(QuickJsDatamodelTest, AssignIteratorValueAndIndex) {
+  EXPECT_TRUE(DeclareAndAssign("myarray", R"([{"a": [1]}, "b"])"));
+  EXPECT_TRUE(DeclareAndAssign("item", "null"));
+  EXPECT_TRUE(DeclareAndAssign("index", "null"));
+  const Expression item("item");
+  const Expression index("index");
+  string result;
+
+  auto iterator = datamodel_->EvaluateIterator("myarray");
+  ASSERT_NE(nullptr, iterator);
+  EXPECT_EQ(R"({"a":[1]})", iterator->GetValue());
+  EXPECT_TRUE(datamodel_->AssignIteratorValue(iterator.get(), item));
+  EXPECT_TRUE(datamodel_->AssignIteratorIndex(*iterator, index));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("item.a[0] + index", &result));
+  EXPECT_EQ("1", result);
+  EXPECT_TRUE(iterator->Next());
+  EXPECT_TRUE(datamodel_->AssignIteratorValue(iterator.get(), item));
+  EXPECT_TRUE(datamodel_->AssignIteratorIndex(*iterator, index));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("[item, index]", &result));
+  EXPECT_EQ(R"(["b",1])", result);
+  EXPECT_FALSE(iterator->Next());
+  EXPECT_TRUE(iterator->AtEnd());
+
+  // The iterator holds a copy of the array.
+  EXPECT_TRUE(datamodel_->AssignExpression("item", "null"));
+  EXPECT_TRUE(datamodel_->EvaluateExpression("myarray[0].a", &result));
+  EXPECT_EQ("[1]", result);
+
+  EXPECT_EQ(nullptr, datamodel_->EvaluateIterator("item"));
+  EXPECT_EQ(nullptr, datamodel_->EvaluateIterator("missing"));
+}
+
+TEST(QuickJsDatamodel, Factory) {
+  auto factory = QuickJsDatamodel::CreateFactory();
+  EXPECT_EQ(QuickJsDatamodel::GetExpressionCompiler(),
+            factory->GetExpressionCompiler());
+  auto datamodel = factory->Create(nullptr, nullptr);
+  ASSERT_NE(nullptr, datamodel);
+  EXPECT_TRUE(datamodel->Declare("a"));
+
+  datamodel = factory->Create(nullptr, R"({"a":1})", {}, 0, nullptr);
+  ASSERT_NE(nullptr, datamodel);
+  EXPECT_TRUE(datamodel->IsDefined("a"));
+  // Modifications are not counted, so there are none to restore.
+  EXPECT_EQ(nullptr,
+            factory->Create(nullptr, "{}", {{"a", "1"}}, 0, nullptr));
+}
+
+}  // namespace
+}  // namespace state_chart
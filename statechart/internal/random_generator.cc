@@ -0,0 +1,53 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/random_generator.h"
+
+#include <algorithm>
+#include <random>
+
+namespace state_chart {
+
+constexpr int RandomGenerator::kStateSize;
+
+RandomGenerator::RandomGenerator() {
+  // Reading std::random_device may be a system call, so it only seeds one
+  // generator per thread, whose numbers seed the generators of the thread.
+  static thread_local RandomGenerator seeds([] {
+    std::random_device device;
+    return (static_cast<uint64_t>(device()) << 32) ^ device();
+  }());
+  Seed(seeds.Next());
+}
+
+void RandomGenerator::Seed(uint64_t seed) {
+  // Expands 'seed' with SplitMix64 as recommended for xoshiro256**.
+  for (uint64_t& word : state_) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    word = z ^ (z >> 31);
+  }
+}
+
+bool RandomGenerator::SetState(const State& state) {
+  if (std::all_of(state.begin(), state.end(),
+                  [](uint64_t word) { return word == 0; })) {
+    return false;
+  }
+  state_ = state;
+  return true;
+}
+
+}  // namespace state_chart
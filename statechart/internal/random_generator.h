@@ -0,0 +1,77 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STATE_CHART_INTERNAL_RANDOM_GENERATOR_H_
+#define STATE_CHART_INTERNAL_RANDOM_GENERATOR_H_
+
+#include <array>
+#include <cstdint>
+
+namespace state_chart {
+
+// A small and fast pseudo-random number generator (xoshiro256**) for the
+// random numbers of state machines, e.g., Math.random(). Unlike the standard
+// engines, its state is four words that are cheap to copy and to serialize, so
+// that a restored state machine continues the same sequence.
+// This class is not thread-safe.
+class RandomGenerator {
+ public:
+  static constexpr int kStateSize = 4;
+  using State = std::array<uint64_t, kStateSize>;
+
+  // Creates a generator seeded with a non-deterministic seed. The seeds come
+  // from a generator per thread, which std::random_device seeds once.
+  RandomGenerator();
+
+  // Creates a generator that generates the same sequence for the same 'seed'.
+  explicit RandomGenerator(uint64_t seed) { Seed(seed); }
+
+  // Restarts the sequence of 'seed'.
+  void Seed(uint64_t seed);
+
+  // Returns the next number of the sequence.
+  uint64_t Next() {
+    const uint64_t result = RotateLeft(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = RotateLeft(state_[3], 45);
+    return result;
+  }
+
+  // Returns the next number of the sequence as a double in [0, 1).
+  double NextDouble() { return (Next() >> 11) * 0x1.0p-53; }
+
+  const State& state() const { return state_; }
+
+  // Continues the sequence from a state returned by state(). Returns false if
+  // 'state' is all zeros, which is not a valid state.
+  bool SetState(const State& state);
+
+ private:
+  static uint64_t RotateLeft(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  State state_;
+};
+
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_RANDOM_GENERATOR_H_
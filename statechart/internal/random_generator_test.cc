@@ -0,0 +1,85 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/random_generator.h"
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace state_chart {
+namespace {
+
+std::vector<uint64_t> Generate(RandomGenerator* generator, int count) {
+  std::vector<uint64_t> numbers;
+  for (int i = 0; i < count; ++i) {
+    numbers.push_back(generator->Next());
+  }
+  return numbers;
+}
+
+TEST(RandomGeneratorTest, SameSeedSameSequence) {
+  RandomGenerator generator1(42);
+  RandomGenerator generator2(42);
+  RandomGenerator generator3(43);
+  const std::vector<uint64_t> numbers = Generate(&generator1, 100);
+  EXPECT_EQ(numbers, Generate(&generator2, 100));
+  EXPECT_NE(numbers, Generate(&generator3, 100));
+
+  generator3.Seed(42);
+  EXPECT_EQ(numbers, Generate(&generator3, 100));
+}
+
+TEST(RandomGeneratorTest, DefaultSeedsDiffer) {
+  RandomGenerator generator1;
+  RandomGenerator generator2;
+  EXPECT_NE(generator1.state(), generator2.state());
+  EXPECT_NE(Generate(&generator1, 100), Generate(&generator2, 100));
+}
+
+TEST(RandomGeneratorTest, KnownSequence) {
+  // Reference values of xoshiro256** from the state {1, 2, 3, 4}.
+  RandomGenerator generator;
+  ASSERT_TRUE(generator.SetState({1, 2, 3, 4}));
+  EXPECT_EQ(11520u, generator.Next());
+  EXPECT_EQ(0u, generator.Next());
+  EXPECT_EQ(1509978240u, generator.Next());
+  EXPECT_EQ(1215971899390074240u, generator.Next());
+}
+
+TEST(RandomGeneratorTest, ContinuesFromState) {
+  RandomGenerator generator1(7);
+  Generate(&generator1, 10);
+  RandomGenerator generator2;
+  ASSERT_TRUE(generator2.SetState(generator1.state()));
+  EXPECT_EQ(Generate(&generator1, 100), Generate(&generator2, 100));
+
+  EXPECT_FALSE(generator2.SetState({0, 0, 0, 0}));
+  EXPECT_EQ(generator1.state(), generator2.state());
+}
+
+TEST(RandomGeneratorTest, NextDoubleInUnitInterval) {
+  RandomGenerator generator(1);
+  double sum = 0;
+  for (int i = 0; i < 10000; ++i) {
+    const double number = generator.NextDouble();
+    ASSERT_GE(number, 0.0);
+    ASSERT_LT(number, 1.0);
+    sum += number;
+  }
+  EXPECT_NEAR(0.5, sum / 10000, 0.02);
+}
+
+}  // namespace
+}  // namespace state_chart
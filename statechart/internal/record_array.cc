@@ -0,0 +1,336 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/record_array.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/node_hash_set.h"
+#include "absl/hash/hash.h"
+#include "absl/memory/memory.h"
+#include "statechart/internal/json_text.h"
+
+namespace state_chart {
+namespace internal {
+
+namespace {
+
+// Keys longer than this are not interned.
+constexpr int kMaxInternedKeyLength = 64;
+// The maximum number of interned keys.
+constexpr int kMaxInternedKeys = 1 << 16;
+// The smallest number of slots of a record with members.
+constexpr int kMinRecordSlots = 4;
+
+}  // namespace
+
+const char* InternKey(absl::string_view key) {
+  static auto* mutex = new absl::Mutex();
+  // Nodes are not moved, so the interned keys stay at the same address.
+  static auto* keys = new absl::node_hash_set<string>();
+  // The keys that this thread interned, which are looked up without locking.
+  // They view the keys of the table, which are never removed.
+  static thread_local absl::flat_hash_set<absl::string_view> thread_keys;
+  if (key.size() > kMaxInternedKeyLength ||
+      key.find('\0') != absl::string_view::npos) {
+    return nullptr;
+  }
+  const auto thread_key = thread_keys.find(key);
+  if (thread_key != thread_keys.end()) {
+    return thread_key->data();
+  }
+  const char* interned = nullptr;
+  {
+    absl::MutexLock lock(mutex);
+    auto it = keys->find(key);
+    if (it == keys->end() && keys->size() < kMaxInternedKeys) {
+      it = keys->emplace(key).first;
+    }
+    if (it != keys->end()) {
+      interned = it->c_str();
+    }
+  }
+  if (interned == nullptr) {
+    LOG_FIRST_N(WARNING, 1)
+        << "The table of interned keys is full with " << kMaxInternedKeys
+        << " keys. Arrays of records with other keys are held as JSON.";
+    return nullptr;
+  }
+  thread_keys.emplace(interned);
+  return interned;
+}
+
+const char* InternedKeys::Intern(absl::string_view key) {
+  for (const char* interned : keys_) {
+    if (key == interned) {
+      return interned;
+    }
+  }
+  const char* interned = InternKey(key);
+  if (interned != nullptr && keys_.size() < keys_.capacity()) {
+    keys_.push_back(interned);
+  }
+  return interned;
+}
+
+// static
+bool Record::FromJson(Json::Value* object, InternedKeys* keys, Record* record) {
+  if (!object->isObject()) {
+    return false;
+  }
+  absl::InlinedVector<const char*, 16> interned;
+  for (auto it = object->begin(); it != object->end(); ++it) {
+    const char* end = nullptr;
+    const char* name = it.memberName(&end);
+    interned.push_back(keys->Intern(absl::string_view(name, end - name)));
+    if (interned.back() == nullptr) {
+      return false;
+    }
+  }
+  Record result;
+  result.Reserve(interned.size());
+  auto key = interned.begin();
+  for (auto it = object->begin(); it != object->end(); ++it, ++key) {
+    // The keys of an object are unique, so each one finds an empty slot.
+    Member& member = result.members_[result.FindSlot(*key)];
+    member.key = *key;
+    member.value.swap(*it);
+  }
+  result.size_ = interned.size();
+  *record = std::move(result);
+  return true;
+}
+
+int Record::FindSlot(absl::string_view key) const {
+  const std::size_t mask = members_.size() - 1;
+  for (std::size_t slot = absl::Hash<absl::string_view>()(key) & mask;;
+       slot = (slot + 1) & mask) {
+    const char* slot_key = members_[slot].key;
+    if (slot_key == nullptr || slot_key == key.data() || key == slot_key) {
+      return slot;
+    }
+  }
+}
+
+void Record::Reserve(int size) {
+  if (size == 0) {
+    return;
+  }
+  int slots = std::max<int>(kMinRecordSlots, members_.size());
+  while (size * 4 > slots * 3) {
+    slots *= 2;
+  }
+  if (slots == static_cast<int>(members_.size())) {
+    return;
+  }
+  std::vector<Member> members(slots);
+  members.swap(members_);
+  for (Member& member : members) {
+    if (member.key != nullptr) {
+      Member& moved = members_[FindSlot(member.key)];
+      moved.key = member.key;
+      moved.value.swap(member.value);
+    }
+  }
+}
+
+const Json::Value* Record::Find(absl::string_view key) const {
+  if (size_ == 0) {
+    return nullptr;
+  }
+  const Member& member = members_[FindSlot(key)];
+  return member.key == nullptr ? nullptr : &member.value;
+}
+
+Json::Value* Record::Find(absl::string_view key) {
+  return const_cast<Json::Value*>(static_cast<const Record*>(this)->Find(key));
+}
+
+Json::Value* Record::FindOrAdd(absl::string_view key) {
+  Json::Value* value = Find(key);
+  if (value != nullptr) {
+    return value;
+  }
+  const char* interned = InternKey(key);
+  if (interned == nullptr) {
+    return nullptr;
+  }
+  Reserve(size_ + 1);
+  Member& member = members_[FindSlot(interned)];
+  member.key = interned;
+  ++size_;
+  return &member.value;
+}
+
+Json::Value Record::ToJson() const {
+  Json::Value object(Json::objectValue);
+  for (const Member& member : members_) {
+    if (member.key != nullptr) {
+      object[Json::StaticString(member.key)] = member.value;
+    }
+  }
+  return object;
+}
+
+Json::Value Record::ReleaseJson() {
+  Json::Value object(Json::objectValue);
+  for (Member& member : members_) {
+    if (member.key != nullptr) {
+      object[Json::StaticString(member.key)].swap(member.value);
+    }
+  }
+  members_.clear();
+  size_ = 0;
+  return object;
+}
+
+absl::InlinedVector<const Record::Member*, 16> Record::SortedMembers() const {
+  absl::InlinedVector<const Member*, 16> sorted;
+  for (const Member& member : members_) {
+    if (member.key != nullptr) {
+      sorted.push_back(&member);
+    }
+  }
+  // Json::Value orders the keys of objects by their bytes, as strcmp() does
+  // for keys without '\0'.
+  std::sort(sorted.begin(), sorted.end(), [](const Member* a, const Member* b) {
+    return std::strcmp(a->key, b->key) < 0;
+  });
+  return sorted;
+}
+
+void Record::AppendJsonText(string* output) const {
+  output->push_back('{');
+  for (const Member* member : SortedMembers()) {
+    if (output->back() != '{') {
+      output->push_back(',');
+    }
+    AppendQuotedJsonString(member->key, member->key + std::strlen(member->key),
+                           output);
+    output->push_back(':');
+    state_chart::AppendJsonText(member->value, output);
+  }
+  output->push_back('}');
+}
+
+// static
+std::unique_ptr<RecordArray> RecordArray::FromJson(Json::Value* array) {
+  if (!array->isArray() || array->size() < kMinSize) {
+    return nullptr;
+  }
+  for (const Json::Value& element : *array) {
+    if (!element.isObject()) {
+      return nullptr;
+    }
+  }
+  auto records = absl::make_unique<RecordArray>();
+  InternedKeys keys;
+  for (int i = 0; i < static_cast<int>(array->size()); ++i) {
+    Record record;
+    if (!Record::FromJson(&(*array)[i], &keys, &record)) {
+      // Moves the elements that were moved so far back.
+      for (int j = 0; j < i; ++j) {
+        (*array)[j] = records->mutable_record(j)->ReleaseJson();
+      }
+      return nullptr;
+    }
+    records->AddRecord(std::move(record));
+  }
+  return records;
+}
+
+Record* RecordArray::mutable_record(int index) {
+  ForgetJson();
+  return &(*MutableChunk(index / kChunkSize))[index % kChunkSize];
+}
+
+void RecordArray::AddRecord(Record record) {
+  ForgetJson();
+  if (size_ % kChunkSize == 0) {
+    chunks_.push_back(std::make_shared<Chunk>());
+    chunks_.back()->reserve(kChunkSize);
+    shared_chunks_.push_back(false);
+  }
+  MutableChunk(size_ / kChunkSize)->push_back(std::move(record));
+  ++size_;
+}
+
+Json::Value RecordArray::ToJson() const {
+  Json::Value array(Json::arrayValue);
+  array.resize(size_);
+  for (int i = 0; i < size(); ++i) {
+    array[i] = record(i).ToJson();
+  }
+  return array;
+}
+
+Json::Value RecordArray::ReleaseJson() {
+  Json::Value array(Json::arrayValue);
+  if (json_ != nullptr) {
+    array.swap(*json_);
+  } else {
+    array.resize(size_);
+    for (int i = 0; i < size(); ++i) {
+      // Records of shared chunks are copied.
+      array[i] = shared_chunks_[i / kChunkSize]
+                     ? record(i).ToJson()
+                     : (*chunks_[i / kChunkSize])[i % kChunkSize].ReleaseJson();
+    }
+  }
+  json_.reset();
+  chunks_.clear();
+  shared_chunks_.clear();
+  size_ = 0;
+  return array;
+}
+
+void RecordArray::AppendJsonText(string* output) const {
+  output->push_back('[');
+  for (int i = 0; i < size(); ++i) {
+    if (i > 0) {
+      output->push_back(',');
+    }
+    record(i).AppendJsonText(output);
+  }
+  output->push_back(']');
+}
+
+const Json::Value& RecordArray::json() const {
+  absl::MutexLock lock(&mutex_);
+  if (json_ == nullptr) {
+    json_ = absl::make_unique<Json::Value>(ToJson());
+  }
+  return *json_;
+}
+
+RecordArray::Chunk* RecordArray::MutableChunk(int chunk) {
+  if (shared_chunks_[chunk]) {
+    chunks_[chunk] = std::make_shared<Chunk>(*chunks_[chunk]);
+    shared_chunks_[chunk] = false;
+  }
+  return chunks_[chunk].get();
+}
+
+void RecordArray::ForgetJson() {
+  // Writes do not run concurrently with other calls, so this does not lock.
+  json_.reset();
+}
+
+}  // namespace internal
+}  // namespace state_chart
@@ -0,0 +1,207 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A compact representation of arrays of records, i.e., arrays of JSON objects
+// that mostly have the same few keys, for LightWeightDatamodel. A Json::Value
+// holds each object as a std::map with a node per member. A RecordArray holds
+// the records contiguously in chunks, and each record holds its members in one
+// hash table with keys interned in a process-wide table, so that the keys are
+// not copied per record.
+
+#ifndef STATE_CHART_INTERNAL_RECORD_ARRAY_H_
+#define STATE_CHART_INTERNAL_RECORD_ARRAY_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "include/json/json.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+namespace internal {
+
+// Returns the copy of 'key' in the process-wide table of interned keys, adding
+// it if needed. Interned keys stay at the same address for the lifetime of the
+// process. Each thread looks up the keys that it interned before without
+// locking the table. Returns nullptr if 'key' is not interned: keys longer
+// than 64 bytes or containing '\0' are not, and neither are new keys once the
+// table holds 65536 keys, which is logged once. Records with keys that are
+// not interned are held as JSON objects instead.
+const char* InternKey(absl::string_view key);
+
+// Interns keys with InternKey() and remembers the first few of them, so that
+// interning the keys of many records with the same keys compares a few
+// pointers instead of hashing each key.
+class InternedKeys {
+ public:
+  InternedKeys() = default;
+  InternedKeys(const InternedKeys&) = delete;
+  InternedKeys& operator=(const InternedKeys&) = delete;
+
+  // Same as InternKey().
+  const char* Intern(absl::string_view key);
+
+ private:
+  absl::InlinedVector<const char*, 16> keys_;
+};
+
+// A JSON object with interned keys. The members are held in an open addressing
+// hash table, which finds a member by hashing its key once instead of
+// comparing it with the keys along a path of a tree.
+class Record {
+ public:
+  Record() = default;
+  Record(const Record&) = default;
+  Record& operator=(const Record&) = default;
+  Record(Record&&) = default;
+  Record& operator=(Record&&) = default;
+
+  // Moves the members of 'object' into 'record', replacing its members.
+  // Returns false and leaves both unchanged if 'object' is not an object or
+  // one of its keys is not interned.
+  static bool FromJson(Json::Value* object, InternedKeys* keys, Record* record);
+
+  // Returns the member 'key', or nullptr if there is none.
+  const Json::Value* Find(absl::string_view key) const;
+  Json::Value* Find(absl::string_view key);
+
+  // Returns the member 'key', adding it as null if there is none. Returns
+  // nullptr if 'key' is not interned.
+  Json::Value* FindOrAdd(absl::string_view key);
+
+  // The number of members.
+  int size() const { return size_; }
+
+  // Returns a copy of the record as a JSON object, which shares its keys.
+  Json::Value ToJson() const;
+
+  // Moves the members into a JSON object, leaving the record empty.
+  Json::Value ReleaseJson();
+
+  // Appends the JSON text of the record to 'output'. The text is the same as
+  // AppendJsonText() writes for ToJson(), i.e., the members are sorted by key.
+  void AppendJsonText(string* output) const;
+
+ private:
+  struct Member {
+    // The interned key, nullptr if the slot is empty.
+    const char* key = nullptr;
+    Json::Value value;
+  };
+
+  // Returns the slot of 'key', which is empty if the record has no member
+  // 'key'. 'members_' must not be empty.
+  int FindSlot(absl::string_view key) const;
+
+  // Resizes the table to hold at least 'size' members.
+  void Reserve(int size);
+
+  // Returns the members sorted by key.
+  absl::InlinedVector<const Member*, 16> SortedMembers() const;
+
+  // The slots, a power of two of them or none. At most three quarters of them
+  // hold members.
+  std::vector<Member> members_;
+  int size_ = 0;
+};
+
+// An array of records. Once converted to a Json::Value by json(), the value is
+// kept until the array is written, so that reads of the whole array, e.g., as
+// a function argument, convert it once.
+//
+// The records are held in chunks of kChunkSize records. A copy of an array
+// shares the chunks with it, and a write to a record of a shared chunk copies
+// only that chunk. As for the values of a Store, the copy records that the
+// chunks are shared rather than reading reference counts, so an array that
+// was copied must not be written again.
+class RecordArray {
+ public:
+  // Arrays with fewer elements are not held as RecordArrays. Converting an
+  // array costs about as much as copying it, which pays off only for arrays
+  // of many records.
+  static constexpr int kMinSize = 16;
+
+  // The number of records per chunk.
+  static constexpr int kChunkSize = 16;
+
+  RecordArray() = default;
+  // Shares the chunks but does not copy the converted value. Takes time
+  // linear in the number of chunks.
+  RecordArray(const RecordArray& other)
+      : chunks_(other.chunks_),
+        shared_chunks_(other.chunks_.size(), true),
+        size_(other.size_) {}
+  RecordArray& operator=(const RecordArray&) = delete;
+
+  // Returns a RecordArray with the elements of 'array', which are moved out
+  // of it. Returns nullptr and leaves 'array' unchanged unless 'array' is an
+  // array of at least kMinSize objects with interned keys.
+  static std::unique_ptr<RecordArray> FromJson(Json::Value* array);
+
+  int size() const { return size_; }
+  const Record& record(int index) const {
+    return (*chunks_[index / kChunkSize])[index % kChunkSize];
+  }
+
+  // Returns the record at 'index' for writing. Copies its chunk first if the
+  // chunk is shared.
+  Record* mutable_record(int index);
+
+  // Appends 'record'.
+  void AddRecord(Record record);
+
+  // Returns a copy of the array as a JSON array.
+  Json::Value ToJson() const;
+
+  // Moves the records into a JSON array, leaving this array empty.
+  Json::Value ReleaseJson();
+
+  // Appends the JSON text of the array to 'output', the same as
+  // AppendJsonText() writes for ToJson().
+  void AppendJsonText(string* output) const;
+
+  // Returns the array as a JSON array, converted on the first call after the
+  // array was written. The reference is valid until the array is written.
+  // Calls on different threads are safe as long as no thread writes.
+  const Json::Value& json() const;
+
+ private:
+  using Chunk = std::vector<Record>;
+
+  // Returns the chunk 'chunk' for writing, copying it first if it is shared.
+  Chunk* MutableChunk(int chunk);
+
+  // Forgets the converted value before a write.
+  void ForgetJson();
+
+  std::vector<std::shared_ptr<Chunk>> chunks_;
+  // Whether each chunk may be shared with other arrays.
+  std::vector<bool> shared_chunks_;
+  int size_ = 0;
+  // Guards 'json_', which json() sets from const calls.
+  mutable absl::Mutex mutex_;
+  // The converted value, nullptr if the array was written since json().
+  mutable std::unique_ptr<Json::Value> json_;
+};
+
+}  // namespace internal
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_RECORD_ARRAY_H_
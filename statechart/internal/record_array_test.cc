@@ -0,0 +1,221 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/record_array.h"
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "absl/strings/str_cat.h"
+#include "include/json/json.h"
+#include "statechart/internal/json_text.h"
+
+namespace state_chart {
+namespace internal {
+namespace {
+
+// Returns an array of 'size' records with the keys "id", "name" and "tags".
+Json::Value MakeRecords(int size) {
+  Json::Value array(Json::arrayValue);
+  for (int i = 0; i < size; ++i) {
+    Json::Value& record = array[i];
+    record["id"] = i;
+    record["name"] = absl::StrCat("record ", i);
+    record["tags"].append("t");
+  }
+  return array;
+}
+
+TEST(RecordArrayTest, InternKey) {
+  const char* key = InternKey("interned_key");
+  ASSERT_NE(nullptr, key);
+  EXPECT_STREQ("interned_key", key);
+  EXPECT_EQ(key, InternKey(string("interned_key")));
+  EXPECT_EQ(nullptr, InternKey(string(100, 'k')));
+  EXPECT_EQ(nullptr, InternKey(absl::string_view("a\0b", 3)));
+
+  // Other threads find the same keys.
+  const char* other_thread_key = nullptr;
+  std::thread thread([&other_thread_key] {
+    other_thread_key = InternKey("interned_key");
+  });
+  thread.join();
+  EXPECT_EQ(key, other_thread_key);
+
+  InternedKeys keys;
+  EXPECT_EQ(key, keys.Intern("interned_key"));
+  EXPECT_EQ(key, keys.Intern("interned_key"));
+}
+
+TEST(RecordArrayTest, Record) {
+  Json::Value object;
+  object["b"] = 2;
+  object["a"] = "one";
+  object["c"]["d"] = true;
+  const Json::Value expected = object;
+
+  InternedKeys keys;
+  Record record;
+  ASSERT_TRUE(Record::FromJson(&object, &keys, &record));
+  EXPECT_EQ(3, record.size());
+  ASSERT_NE(nullptr, record.Find("a"));
+  EXPECT_EQ("one", record.Find("a")->asString());
+  EXPECT_EQ(2, record.Find("b")->asInt());
+  EXPECT_EQ(nullptr, record.Find("d"));
+  EXPECT_EQ(expected, record.ToJson());
+
+  // The text is the same as that of the object, with sorted keys.
+  string text;
+  record.AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+
+  // Adding members grows the table.
+  for (int i = 0; i < 20; ++i) {
+    *record.FindOrAdd(absl::StrCat("m", i)) = i;
+  }
+  EXPECT_EQ(23, record.size());
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_NE(nullptr, record.Find(absl::StrCat("m", i)));
+    EXPECT_EQ(i, record.Find(absl::StrCat("m", i))->asInt());
+  }
+  EXPECT_EQ("one", record.Find("a")->asString());
+  EXPECT_EQ(nullptr, record.FindOrAdd(string(100, 'k')));
+
+  const Json::Value released = record.ReleaseJson();
+  EXPECT_EQ(0, record.size());
+  EXPECT_EQ(nullptr, record.Find("a"));
+  EXPECT_EQ(23u, released.size());
+  EXPECT_EQ(2, released["b"].asInt());
+}
+
+TEST(RecordArrayTest, RecordFromJsonFailsForKeysThatAreNotInterned) {
+  Json::Value object;
+  object["a"] = 1;
+  object[string(100, 'k')] = 2;
+  const Json::Value expected = object;
+  InternedKeys keys;
+  Record record;
+  EXPECT_FALSE(Record::FromJson(&object, &keys, &record));
+  EXPECT_EQ(expected, object);
+
+  Json::Value number(1);
+  EXPECT_FALSE(Record::FromJson(&number, &keys, &record));
+}
+
+TEST(RecordArrayTest, FromJson) {
+  Json::Value array = MakeRecords(RecordArray::kMinSize);
+  const Json::Value expected = array;
+  std::unique_ptr<RecordArray> records = RecordArray::FromJson(&array);
+  ASSERT_NE(nullptr, records);
+  EXPECT_EQ(RecordArray::kMinSize, records->size());
+  EXPECT_EQ(3, records->record(3).Find("id")->asInt());
+  EXPECT_EQ(expected, records->ToJson());
+  EXPECT_EQ(expected, records->json());
+
+  string text;
+  records->AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+}
+
+TEST(RecordArrayTest, FromJsonLeavesOtherArraysUnchanged) {
+  Json::Value small = MakeRecords(RecordArray::kMinSize - 1);
+  EXPECT_EQ(nullptr, RecordArray::FromJson(&small));
+
+  Json::Value mixed = MakeRecords(RecordArray::kMinSize);
+  mixed.append(1);
+  const Json::Value expected_mixed = mixed;
+  EXPECT_EQ(nullptr, RecordArray::FromJson(&mixed));
+  EXPECT_EQ(expected_mixed, mixed);
+
+  // Elements before the one with a long key are moved back.
+  Json::Value long_key = MakeRecords(RecordArray::kMinSize);
+  long_key[RecordArray::kMinSize - 1][string(100, 'k')] = 1;
+  const Json::Value expected_long_key = long_key;
+  EXPECT_EQ(nullptr, RecordArray::FromJson(&long_key));
+  EXPECT_EQ(expected_long_key, long_key);
+
+  Json::Value object(Json::objectValue);
+  EXPECT_EQ(nullptr, RecordArray::FromJson(&object));
+}
+
+TEST(RecordArrayTest, WritesForgetTheConvertedValue) {
+  Json::Value array = MakeRecords(RecordArray::kMinSize);
+  std::unique_ptr<RecordArray> records = RecordArray::FromJson(&array);
+  ASSERT_NE(nullptr, records);
+  EXPECT_EQ(2, records->json()[2]["id"].asInt());
+
+  *records->mutable_record(2)->Find("id") = 100;
+  EXPECT_EQ(100, records->json()[2]["id"].asInt());
+
+  Json::Value object;
+  object["id"] = 200;
+  InternedKeys keys;
+  Record record;
+  ASSERT_TRUE(Record::FromJson(&object, &keys, &record));
+  records->AddRecord(std::move(record));
+  EXPECT_EQ(RecordArray::kMinSize + 1, records->size());
+  EXPECT_EQ(200, records->json()[RecordArray::kMinSize]["id"].asInt());
+
+  // Writes to a copy leave the array unchanged.
+  {
+    RecordArray copy(*records);
+    *copy.mutable_record(0)->Find("id") = -1;
+    EXPECT_EQ(0, records->record(0).Find("id")->asInt());
+    EXPECT_EQ(-1, copy.json()[0]["id"].asInt());
+  }
+
+  const Json::Value expected = records->json();
+  EXPECT_EQ(expected, records->ReleaseJson());
+  EXPECT_EQ(0, records->size());
+}
+
+TEST(RecordArrayTest, CopiesShareChunks) {
+  constexpr int kChunkSize = RecordArray::kChunkSize;
+  Json::Value array = MakeRecords(2 * kChunkSize + 1);
+  std::unique_ptr<RecordArray> records = RecordArray::FromJson(&array);
+  ASSERT_NE(nullptr, records);
+  const Json::Value expected = records->ToJson();
+
+  // A write copies only the chunk of the written record.
+  RecordArray copy(*records);
+  *copy.mutable_record(kChunkSize + 1)->Find("id") = -1;
+  EXPECT_EQ(&records->record(0), &copy.record(0));
+  EXPECT_NE(&records->record(kChunkSize), &copy.record(kChunkSize));
+  EXPECT_EQ(&records->record(2 * kChunkSize), &copy.record(2 * kChunkSize));
+  EXPECT_EQ(kChunkSize + 1,
+            records->record(kChunkSize + 1).Find("id")->asInt());
+  EXPECT_EQ(-1, copy.record(kChunkSize + 1).Find("id")->asInt());
+
+  // So does appending a record to a shared chunk.
+  Json::Value object;
+  object["id"] = -2;
+  InternedKeys keys;
+  Record record;
+  ASSERT_TRUE(Record::FromJson(&object, &keys, &record));
+  copy.AddRecord(std::move(record));
+  EXPECT_EQ(2 * kChunkSize + 2, copy.size());
+  EXPECT_EQ(2 * kChunkSize + 1, records->size());
+  EXPECT_NE(&records->record(2 * kChunkSize), &copy.record(2 * kChunkSize));
+
+  // Records of shared chunks are copied when the copy is released.
+  EXPECT_EQ(-2, copy.ReleaseJson()[2 * kChunkSize + 1]["id"].asInt());
+  EXPECT_EQ(expected, records->ToJson());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace state_chart
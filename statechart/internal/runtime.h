@@ -27,6 +27,7 @@
 namespace state_chart {
 class Datamodel;
 class EventDispatcher;
+class RandomGenerator;
 namespace model {
 class State;
 }  // namespace model
@@ -77,6 +78,10 @@ class Runtime {
   // Returns the ListenerEventDispatcher in use for this instance.
   virtual EventDispatcher* GetEventDispatcher() = 0;
 
+  // Returns the generator of the random numbers of this instance, e.g., for
+  // Math.random() in the datamodel. Its state is serialized with the runtime.
+  virtual RandomGenerator* GetRandomGenerator() = 0;
+
   // Clears all data in the runtime, including the data in the datamodel.
   virtual void Clear() = 0;
 
@@ -158,6 +158,9 @@ StateMachineContext::Runtime RuntimeImpl::Serialize() const {
   StateMachineContext::Runtime serialized_runtime;
   if (!HasInternalEvent()) {
     serialized_runtime.set_running(IsRunning());
+    for (uint64_t word : random_generator_.state()) {
+      serialized_runtime.add_random_state(word);
+    }
     for (const auto* active_state : GetActiveStates()) {
       PopulateActiveStateElement(active_state,
                                  serialized_runtime.mutable_active_state());
@@ -25,6 +25,7 @@
 
 #include "statechart/platform/types.h"
 #include "statechart/internal/event_dispatcher.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/runtime.h"
 #include "statechart/proto/state_machine_context.pb.h"
 
@@ -84,6 +85,11 @@ class RuntimeImpl : public Runtime {
     return &listener_event_dispatcher_;
   }
 
+  // The generator is seeded non-deterministically.
+  RandomGenerator* GetRandomGenerator() override {
+    return &random_generator_;
+  }
+
   void Clear() override;
 
   // Returns a string describing only the active state ids and internal event
@@ -108,6 +114,8 @@ class RuntimeImpl : public Runtime {
   std::unique_ptr<Datamodel> datamodel_;
 
   EventDispatcher listener_event_dispatcher_;
+
+  RandomGenerator random_generator_;
 };
 
 }  // namespace state_chart
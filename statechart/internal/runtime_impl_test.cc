@@ -15,6 +15,7 @@
 #include "statechart/internal/runtime_impl.h"
 
 #include "absl/memory/memory.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/platform/test_util.h"
 #include "statechart/internal/testing/mock_datamodel.h"
 #include "statechart/internal/testing/mock_state.h"
@@ -102,8 +103,11 @@ TEST_F(RuntimeImplTest, InternalEvents) {
 }
 
 TEST_F(RuntimeImplTest, Serialize) {
+  ASSERT_TRUE(runtime_->GetRandomGenerator()->SetState({1, 2, 3, 4}));
+
   // Serialize empty runtime_.
-  EXPECT_THAT(runtime_->Serialize(), EqualsProto("running: false"));
+  EXPECT_THAT(runtime_->Serialize(),
+              EqualsProto("running: false random_state: [1, 2, 3, 4]"));
 
   // Populate active states in runtime_.
   MockState state_A("A");
@@ -139,7 +143,8 @@ TEST_F(RuntimeImplTest, Serialize) {
                                         active_child { id: "A.b" }
                                       }
                                       active_state { id: "B" }
-                                      running: false)";
+                                      running: false
+                                      random_state: [1, 2, 3, 4])";
   EXPECT_THAT(runtime_->Serialize(),
               IgnoringRepeatedFieldOrdering(EqualsProto(kExpectedRuntime)));
 }
@@ -14,11 +14,16 @@
 
 #include "statechart/internal/state_machine_impl.h"
 
+#include <map>
+#include <utility>
+
 #include "absl/memory/memory.h"
+#include "statechart/internal/datamodel.h"
 #include "statechart/internal/event_dispatcher.h"
 #include "statechart/internal/executor.h"
 #include "statechart/internal/light_weight_datamodel.h"
 #include "statechart/internal/model.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/runtime.h"
 
 using ::absl::WrapUnique;
@@ -30,7 +35,7 @@ class StateMachineListener;
 namespace state_chart {
 
 // static
-std::unique_ptr<StateMachine> StateMachineImpl::Create(
+std::unique_ptr<StateMachineImpl> StateMachineImpl::Create(
     const Executor* executor, const Model* model,
     std::unique_ptr<Runtime> runtime) {
   RETURN_NULL_IF(executor == nullptr || model == nullptr || runtime == nullptr);
@@ -40,7 +45,10 @@ std::unique_ptr<StateMachine> StateMachineImpl::Create(
 StateMachineImpl::StateMachineImpl(const Executor* executor,
                                    const Model* model,
                                    std::unique_ptr<Runtime> runtime)
-    : executor_(executor), model_(model), runtime_(std::move(runtime)) {}
+    : executor_(executor),
+      model_(model),
+      runtime_(std::move(runtime)),
+      snapshot_nonce_(RandomGenerator().Next()) {}
 
 // override
 void StateMachineImpl::Start() {
@@ -52,6 +60,16 @@ void StateMachineImpl::SendEvent(const string& event, const string& payload) {
   executor_->SendEvent(model_, runtime_.get(), event, payload);
 }
 
+// override
+void StateMachineImpl::SendEvent(const string& event,
+                                 const proto2::Message* payload) {
+  if (payload == nullptr || !runtime_->datamodel().StoresMessages()) {
+    StateMachine::SendEvent(event, payload);
+    return;
+  }
+  executor_->SendMessageEvent(model_, runtime_.get(), event, *payload);
+}
+
 // override
 void StateMachineImpl::AddListener(StateMachineListener* listener) {
   runtime_->GetEventDispatcher()->AddListener(listener);
@@ -67,4 +85,81 @@ const Model& StateMachineImpl::GetModel() const {
   return *model_;
 }
 
+// override
+bool StateMachineImpl::SerializeToContext(
+    StateMachineContext* state_machine_context) const {
+  if (!StateMachine::SerializeToContext(state_machine_context)) {
+    return false;
+  }
+  // Only datamodels that count writes can be the base of delta contexts.
+  if (state_machine_context->has_datamodel_version()) {
+    const uint64_t version = state_machine_context->datamodel_version();
+    state_machine_context->set_datamodel_snapshot_id(snapshot_nonce_ +
+                                                     version);
+    absl::MutexLock lock(&base_context_mutex_);
+    base_datamodel_version_ = version;
+    base_snapshot_id_ = state_machine_context->datamodel_snapshot_id();
+  }
+  return true;
+}
+
+// override
+bool StateMachineImpl::SerializeDeltaToContext(
+    const StateMachineContext& base_context,
+    StateMachineContext* state_machine_context) const {
+  // Delta contexts are restored against full contexts only, so a delta of a
+  // delta could never be restored. A full context of another state machine,
+  // even of the same version, holds other values.
+  if (runtime_->HasInternalEvent() ||
+      !base_context.has_datamodel_snapshot_id() ||
+      base_context.has_base_datamodel_version()) {
+    return false;
+  }
+  {
+    absl::MutexLock lock(&base_context_mutex_);
+    if (base_datamodel_version_ == 0 ||
+        base_datamodel_version_ != base_context.datamodel_version() ||
+        base_snapshot_id_ != base_context.datamodel_snapshot_id()) {
+      return false;
+    }
+  }
+  const auto& datamodel = runtime_->datamodel();
+  std::map<string, string> modifications;
+  if (!datamodel.SerializeModificationsAsString(
+          base_context.datamodel_version(), &modifications)) {
+    // The base cannot be used again.
+    absl::MutexLock lock(&base_context_mutex_);
+    if (base_snapshot_id_ == base_context.datamodel_snapshot_id()) {
+      base_datamodel_version_ = 0;
+      base_snapshot_id_ = 0;
+    }
+    return false;
+  }
+  state_machine_context->Clear();
+  *state_machine_context->mutable_runtime() = runtime_->Serialize();
+  state_machine_context->set_datamodel_version(datamodel.GetVersion());
+  state_machine_context->set_base_datamodel_version(
+      base_context.datamodel_version());
+  state_machine_context->set_base_datamodel_snapshot_id(
+      base_context.datamodel_snapshot_id());
+  for (auto& modification : modifications) {
+    auto* datamodel_modification =
+        state_machine_context->add_datamodel_modification();
+    datamodel_modification->set_location(modification.first);
+    datamodel_modification->set_value(std::move(modification.second));
+  }
+  return true;
+}
+
+void StateMachineImpl::SetBaseContext(
+    const StateMachineContext& state_machine_context) {
+  if (!state_machine_context.has_datamodel_snapshot_id() ||
+      state_machine_context.has_base_datamodel_version()) {
+    return;
+  }
+  absl::MutexLock lock(&base_context_mutex_);
+  base_datamodel_version_ = state_machine_context.datamodel_version();
+  base_snapshot_id_ = state_machine_context.datamodel_snapshot_id();
+}
+
 }  // namespace state_chart
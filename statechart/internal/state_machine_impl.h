@@ -17,9 +17,12 @@
 #ifndef STATE_CHART_INTERNAL_STATE_MACHINE_IMPL_H_
 #define STATE_CHART_INTERNAL_STATE_MACHINE_IMPL_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
 #include "statechart/state_machine.h"
 
 namespace state_chart {
@@ -36,9 +39,9 @@ class StateMachineImpl : public StateMachine {
   // All input params must be non-null. The executor and the model must outlive
   // the constructed StateMachineImpl instance.
   // Returns nullptr if StateMachine cannot be created.
-  static std::unique_ptr<StateMachine> Create(const Executor* executor,
-                                              const Model* model,
-                                              std::unique_ptr<Runtime> runtime);
+  static std::unique_ptr<StateMachineImpl> Create(
+      const Executor* executor, const Model* model,
+      std::unique_ptr<Runtime> runtime);
   StateMachineImpl(const StateMachineImpl&) = delete;
   StateMachineImpl& operator=(const StateMachineImpl&) = delete;
   ~StateMachineImpl() override = default;
@@ -47,12 +50,31 @@ class StateMachineImpl : public StateMachine {
 
   void SendEvent(const string& event, const string& payload) override;
 
+  // Passes 'payload' to datamodels that store messages without converting it
+  // to JSON.
+  void SendEvent(const string& event,
+                 const proto2::Message* payload) override;
+
   void AddListener(StateMachineListener* listener) override;
 
   const Runtime& GetRuntime() const override;
 
   const Model& GetModel() const override;
 
+  // Full contexts get a snapshot id, which their delta contexts name as their
+  // base.
+  bool SerializeToContext(
+      StateMachineContext* state_machine_context) const override;
+
+  bool SerializeDeltaToContext(
+      const StateMachineContext& base_context,
+      StateMachineContext* state_machine_context) const override;
+
+  // Makes 'state_machine_context', the full context that this state machine
+  // was restored from, the base of its delta contexts. Does nothing if it has
+  // no snapshot id.
+  void SetBaseContext(const StateMachineContext& state_machine_context);
+
  private:
   StateMachineImpl(const Executor* executor, const Model* model,
                    std::unique_ptr<Runtime> runtime);
@@ -60,6 +82,19 @@ class StateMachineImpl : public StateMachine {
   const Executor* const executor_;  // Not owned.
   const Model* const model_;  // Not owned.
   std::unique_ptr<Runtime> runtime_;
+
+  // Added to the datamodel version for the snapshot ids of full contexts, so
+  // that contexts of different state machines have different ids even if
+  // their versions are the same.
+  const uint64_t snapshot_nonce_;
+
+  // The datamodel version and snapshot id of the last full context, or 0 if
+  // there is none. Serializing is const, but may be called from several
+  // threads.
+  mutable absl::Mutex base_context_mutex_;
+  mutable uint64_t base_datamodel_version_ ABSL_GUARDED_BY(
+      base_context_mutex_) = 0;
+  mutable uint64_t base_snapshot_id_ ABSL_GUARDED_BY(base_context_mutex_) = 0;
 };
 
 }  // namespace state_chart
@@ -28,7 +28,10 @@ namespace state_chart {
 // By default all calls will be delegated to actual Executor methods.
 class DelegatingMockExecutor : public Executor {
  public:
-  DelegatingMockExecutor() {
+  DelegatingMockExecutor() : DelegatingMockExecutor(false) {}
+
+  explicit DelegatingMockExecutor(bool drop_unhandled_events)
+      : Executor(drop_unhandled_events) {
     using ::testing::_;
     ON_CALL(*this, Start(_, _)).WillByDefault(
         testing::Invoke(this, &DelegatingMockExecutor::RealStart));
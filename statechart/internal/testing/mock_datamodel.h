@@ -90,7 +90,7 @@ class MockDatamodel : public Datamodel {
                      std::unique_ptr<Iterator>(const string&));
   MOCK_METHOD1(ParseFromString, bool(const string&));
   MOCK_CONST_METHOD0(GetRuntime, const Runtime*());
-  MOCK_METHOD1(SetRuntime, void(const Runtime*));
+  MOCK_METHOD1(SetRuntime, void(Runtime*));
 };
 
 }  // namespace state_chart
@@ -100,6 +100,8 @@ class MockModel : public Model {
   MOCK_CONST_METHOD2(GetTransitionsForEvent,
                      std::vector<const model::Transition*>(Runtime*,
                                                            const string&));
+  MOCK_CONST_METHOD2(HasTransitionsForEvent,
+                     bool(const Runtime*, const string&));
 
   const model::Transition* GetInitialTransition() const override {
     return initial_transition_.get();
@@ -119,6 +121,8 @@ class MockModel : public Model {
 
   MOCK_CONST_METHOD0(GetTopLevelStates, std::vector<const model::State*>());
 
+  MOCK_CONST_METHOD0(GetSymbolTable, std::shared_ptr<const SymbolTable>());
+
   MOCK_CONST_METHOD4(
       ComputeEntrySet,
       bool(const Runtime* runtime,
@@ -25,6 +25,7 @@
 
 #include "statechart/internal/datamodel.h"
 #include "statechart/internal/event_dispatcher.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/runtime.h"
 #include "statechart/internal/testing/mock_datamodel.h"
 #include "statechart/internal/testing/mock_event_dispatcher.h"
@@ -80,6 +81,10 @@ class MockRuntime : public Runtime {
     return default_event_dispatcher_;
   }
 
+  RandomGenerator* GetRandomGenerator() override {
+    return &random_generator_;
+  }
+
   MOCK_METHOD0(Clear, void());
 
   string DebugString() const override { return "MockRuntime"; }
@@ -91,6 +96,7 @@ class MockRuntime : public Runtime {
 
   testing::NiceMock<MockDatamodel> default_datamodel_;
   testing::NiceMock<MockEventDispatcher> default_event_dispatcher_;
+  RandomGenerator random_generator_{0};
 };
 
 }  // namespace state_chart
@@ -0,0 +1,224 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/value_tree.h"
+
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "absl/memory/memory.h"
+#include "statechart/internal/json_text.h"
+
+namespace state_chart {
+namespace internal {
+
+namespace {
+
+// Returns the number of values in 'value', counting the members and elements
+// of objects and arrays recursively, or at least 'limit' if there are more.
+// Stops counting at 'limit', so that counting a large value takes constant
+// time.
+int CountValues(const Json::Value& value, int limit) {
+  int count = 1;
+  if (value.isObject() || value.isArray()) {
+    for (auto it = value.begin(); it != value.end() && count < limit; ++it) {
+      count += CountValues(*it, limit - count);
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+// static
+std::shared_ptr<ValueTree> ValueTree::FromJson(Json::Value* value,
+                                               uint64_t owner) {
+  if (!(value->isObject() || value->isArray()) ||
+      CountValues(*value, kMinSize) < kMinSize) {
+    return nullptr;
+  }
+  auto tree = std::make_shared<ValueTree>(value->isArray(), owner);
+  if (value->isArray()) {
+    tree->elements_.resize(value->size());
+    for (int i = 0; i < tree->size(); ++i) {
+      SetChild(&(*value)[i], owner, &tree->elements_[i]);
+    }
+  } else {
+    for (auto it = value->begin(); it != value->end(); ++it) {
+      // The members are read in order of their keys.
+      const char* end = nullptr;
+      const char* begin = it.memberName(&end);
+      auto member = tree->members_.emplace_hint(
+          tree->members_.end(), string(begin, end), Child());
+      SetChild(&*it, owner, &member->second);
+    }
+  }
+  *value = Json::Value();
+  return tree;
+}
+
+const ValueTree::Child* ValueTree::Find(absl::string_view key) const {
+  const auto it = members_.find(key);
+  return it == members_.end() ? nullptr : &it->second;
+}
+
+const ValueTree::Child* ValueTree::element(int index) const {
+  return index >= 0 && index < static_cast<int>(elements_.size())
+             ? &elements_[index]
+             : nullptr;
+}
+
+ValueTree::Child* ValueTree::FindOrAddMember(absl::string_view key) {
+  DCHECK(!is_array_);
+  ForgetJson();
+  auto it = members_.find(key);
+  if (it == members_.end()) {
+    it = members_.emplace(string(key), Child()).first;
+  }
+  return &it->second;
+}
+
+ValueTree::Child* ValueTree::FindOrAddElement(int index) {
+  DCHECK(is_array_);
+  DCHECK(index >= 0);
+  ForgetJson();
+  if (index >= static_cast<int>(elements_.size())) {
+    elements_.resize(index + 1);
+  }
+  return &elements_[index];
+}
+
+ValueTree* ValueTree::MutableTree(Child* child) {
+  ForgetJson();
+  if (child->tree->owner_ != owner_) {
+    child->tree = std::make_shared<ValueTree>(*child->tree, owner_);
+  }
+  child->tree->ForgetJson();
+  return child->tree.get();
+}
+
+void ValueTree::Set(Child* child, Json::Value* value) {
+  ForgetJson();
+  SetChild(value, owner_, child);
+}
+
+// static
+void ValueTree::SetChild(Json::Value* value, uint64_t owner, Child* child) {
+  child->tree = FromJson(value, owner);
+  if (child->tree != nullptr) {
+    child->value = Json::Value();
+  } else {
+    child->value.swap(*value);
+  }
+}
+
+Json::Value ValueTree::ToJson() const {
+  const auto to_json = [](const Child& child) {
+    return child.tree != nullptr ? child.tree->ToJson() : child.value;
+  };
+  Json::Value value(is_array_ ? Json::arrayValue : Json::objectValue);
+  if (is_array_) {
+    value.resize(elements_.size());
+    for (int i = 0; i < size(); ++i) {
+      value[i] = to_json(elements_[i]);
+    }
+  } else {
+    for (const auto& member : members_) {
+      value[member.first] = to_json(member.second);
+    }
+  }
+  return value;
+}
+
+Json::Value ValueTree::ReleaseJson() {
+  Json::Value value;
+  if (json_ != nullptr) {
+    value.swap(*json_);
+  } else {
+    const auto release = [this](Child* child) {
+      Json::Value released;
+      if (child->tree == nullptr) {
+        released.swap(child->value);
+      } else {
+        released = child->tree->owner_ == owner_ ? child->tree->ReleaseJson()
+                                                 : child->tree->ToJson();
+      }
+      return released;
+    };
+    value = Json::Value(is_array_ ? Json::arrayValue : Json::objectValue);
+    if (is_array_) {
+      value.resize(elements_.size());
+      for (int i = 0; i < size(); ++i) {
+        value[i] = release(&elements_[i]);
+      }
+    } else {
+      for (auto& member : members_) {
+        value[member.first] = release(&member.second);
+      }
+    }
+  }
+  json_.reset();
+  members_.clear();
+  elements_.clear();
+  return value;
+}
+
+void ValueTree::AppendJsonText(string* output) const {
+  const auto append = [output](const Child& child) {
+    if (child.tree != nullptr) {
+      child.tree->AppendJsonText(output);
+    } else {
+      state_chart::AppendJsonText(child.value, output);
+    }
+  };
+  if (is_array_) {
+    output->push_back('[');
+    for (int i = 0; i < size(); ++i) {
+      if (i > 0) {
+        output->push_back(',');
+      }
+      append(elements_[i]);
+    }
+    output->push_back(']');
+    return;
+  }
+  output->push_back('{');
+  for (const auto& member : members_) {
+    if (output->back() != '{') {
+      output->push_back(',');
+    }
+    AppendQuotedJsonString(member.first.data(),
+                           member.first.data() + member.first.size(), output);
+    output->push_back(':');
+    append(member.second);
+  }
+  output->push_back('}');
+}
+
+const Json::Value& ValueTree::json() const {
+  absl::MutexLock lock(&mutex_);
+  if (json_ == nullptr) {
+    json_ = absl::make_unique<Json::Value>(ToJson());
+  }
+  return *json_;
+}
+
+void ValueTree::ForgetJson() {
+  // Writes do not run concurrently with other calls, so this does not lock.
+  json_.reset();
+}
+
+}  // namespace internal
+}  // namespace state_chart
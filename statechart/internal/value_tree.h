@@ -0,0 +1,158 @@
+/*
+ * Copyright 2018 The StateChart Authors.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A persistent representation of large JSON objects and arrays for the
+// variables of LightWeightDatamodel. A Json::Value owns all of its members, so
+// a copy of it copies them all. A ValueTree holds its large members as nodes
+// that are shared by reference counts, so a copy of it shares them, and a
+// write copies only the nodes on the path to the written member.
+
+#ifndef STATE_CHART_INTERNAL_VALUE_TREE_H_
+#define STATE_CHART_INTERNAL_VALUE_TREE_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "include/json/json.h"
+#include "statechart/platform/types.h"
+
+namespace state_chart {
+namespace internal {
+
+// A JSON object or array whose members or elements with at least kMinSize
+// values are held as subtrees, and the other ones as Json::Values. Once
+// converted to a Json::Value by json(), the value is kept until the tree is
+// written, so that reads of the whole value convert it once.
+//
+// As for the variables of a Store, whether a node is shared is recorded by
+// owner tokens rather than read from reference counts: each node is created
+// by the owner of its parent, and a writer writes in place only the nodes
+// that it created with its current owner token. Any other node on the path to
+// a written member is copied first, see MutableTree(). A copy of a node
+// shares its subtrees and copies its small members, so writing a member
+// deep in a large value copies a few nodes with fewer than about kMinSize
+// values each, plus their small members.
+class ValueTree {
+ public:
+  // Values with fewer values, counted recursively, are not held as trees.
+  // Splitting a value costs about as much as copying it, which pays off only
+  // for values that are copied by many writes.
+  static constexpr int kMinSize = 64;
+
+  // A member of an object or an element of an array. Exactly one of 'tree'
+  // and 'value' is used: 'value' is null if 'tree' is set.
+  struct Child {
+    Json::Value value;
+    std::shared_ptr<ValueTree> tree;
+  };
+
+  // An empty object or array, created by 'owner'.
+  ValueTree(bool is_array, uint64_t owner)
+      : is_array_(is_array), owner_(owner) {}
+  // A copy of 'other' that shares its subtrees but not the converted value,
+  // created by 'owner'.
+  ValueTree(const ValueTree& other, uint64_t owner)
+      : is_array_(other.is_array_),
+        owner_(owner),
+        members_(other.members_),
+        elements_(other.elements_) {}
+  ValueTree(const ValueTree&) = delete;
+  ValueTree& operator=(const ValueTree&) = delete;
+
+  // Returns a tree created by 'owner' that holds 'value', which is moved out
+  // of it. Returns nullptr and leaves 'value' unchanged unless 'value' is an
+  // object or array with at least kMinSize values.
+  static std::shared_ptr<ValueTree> FromJson(Json::Value* value,
+                                             uint64_t owner);
+
+  bool is_array() const { return is_array_; }
+  // The number of members or elements.
+  int size() const {
+    return static_cast<int>(is_array_ ? elements_.size() : members_.size());
+  }
+  uint64_t owner() const { return owner_; }
+
+  // Returns the member 'key' of an object, or nullptr if there is none or the
+  // tree is an array.
+  const Child* Find(absl::string_view key) const;
+  // Returns the element at 'index' of an array, or nullptr if there is none
+  // or the tree is an object.
+  const Child* element(int index) const;
+
+  // Returns the member 'key' of an object for writing, adding it as null if
+  // there is none. The tree must be an object.
+  Child* FindOrAddMember(absl::string_view key);
+  // Returns the element at 'index' of an array for writing. Nulls are
+  // appended up to 'index' if the array is shorter, as Json::Value does. The
+  // tree must be an array.
+  Child* FindOrAddElement(int index);
+
+  // Returns the subtree of 'child', a member or element of this tree, for
+  // writing. It is copied first if it was not created by the owner of this
+  // tree.
+  ValueTree* MutableTree(Child* child);
+
+  // Moves 'value' into 'child', a member or element of this tree, as a
+  // subtree if FromJson() accepts it. The previous value of 'child' is left
+  // in 'value' unless it was a subtree.
+  void Set(Child* child, Json::Value* value);
+
+  // Returns a copy of the tree as a Json::Value.
+  Json::Value ToJson() const;
+
+  // Moves the value into a Json::Value, leaving the tree empty. Subtrees of
+  // other owners are copied.
+  Json::Value ReleaseJson();
+
+  // Appends the JSON text of the tree to 'output', the same as
+  // AppendJsonText() writes for ToJson().
+  void AppendJsonText(string* output) const;
+
+  // Returns the tree as a Json::Value, converted on the first call after the
+  // tree was written. The reference is valid until the tree is written. Calls
+  // on different threads are safe as long as no thread writes.
+  const Json::Value& json() const;
+
+ private:
+  // Moves 'value' into 'child' as Set() does, with subtrees created by
+  // 'owner'.
+  static void SetChild(Json::Value* value, uint64_t owner, Child* child);
+
+  // Forgets the converted value before a write.
+  void ForgetJson();
+
+  const bool is_array_;
+  const uint64_t owner_;
+  // The members of an object by key, in the order of the members of a
+  // Json::Value, or the elements of an array.
+  std::map<string, Child, std::less<>> members_;
+  std::vector<Child> elements_;
+  // Guards 'json_', which json() sets from const calls.
+  mutable absl::Mutex mutex_;
+  // The converted value, nullptr if the tree was written since json().
+  mutable std::unique_ptr<Json::Value> json_;
+};
+
+}  // namespace internal
+}  // namespace state_chart
+
+#endif  // STATE_CHART_INTERNAL_VALUE_TREE_H_
@@ -0,0 +1,166 @@
+// Copyright 2018 The StateChart Authors.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "statechart/internal/value_tree.h"
+
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "absl/strings/str_cat.h"
+#include "include/json/json.h"
+#include "statechart/internal/json_text.h"
+
+namespace state_chart {
+namespace internal {
+namespace {
+
+constexpr uint64_t kOwner = 1;
+constexpr uint64_t kOtherOwner = 2;
+
+// Returns an object with the members "config", a large object of 'size'
+// numbers, "devices", a large array of 'size' small objects, and "name", a
+// string.
+Json::Value MakeValue(int size) {
+  Json::Value value;
+  for (int i = 0; i < size; ++i) {
+    value["config"][absl::StrCat("key", i)] = i;
+    value["devices"][i]["id"] = i;
+  }
+  value["name"] = "value";
+  return value;
+}
+
+TEST(ValueTreeTest, FromJson) {
+  Json::Value value = MakeValue(ValueTree::kMinSize);
+  const Json::Value expected = value;
+  std::shared_ptr<ValueTree> tree = ValueTree::FromJson(&value, kOwner);
+  ASSERT_NE(nullptr, tree);
+  EXPECT_FALSE(tree->is_array());
+  EXPECT_EQ(3, tree->size());
+  EXPECT_EQ(kOwner, tree->owner());
+  EXPECT_EQ(expected, tree->ToJson());
+  EXPECT_EQ(expected, tree->json());
+
+  // Large members are subtrees, small ones are values.
+  const ValueTree::Child* config = tree->Find("config");
+  ASSERT_NE(nullptr, config);
+  ASSERT_NE(nullptr, config->tree);
+  EXPECT_TRUE(config->value.isNull());
+  EXPECT_EQ(3, config->tree->Find("key3")->value.asInt());
+  const ValueTree::Child* devices = tree->Find("devices");
+  ASSERT_NE(nullptr, devices);
+  ASSERT_NE(nullptr, devices->tree);
+  EXPECT_TRUE(devices->tree->is_array());
+  ASSERT_NE(nullptr, devices->tree->element(2));
+  EXPECT_EQ(nullptr, devices->tree->element(2)->tree);
+  EXPECT_EQ(2, devices->tree->element(2)->value["id"].asInt());
+  EXPECT_EQ(nullptr, devices->tree->element(ValueTree::kMinSize));
+  EXPECT_EQ(nullptr, devices->tree->element(-1));
+  EXPECT_EQ(nullptr, devices->tree->Find("0"));
+  EXPECT_EQ("value", tree->Find("name")->value.asString());
+  EXPECT_EQ(nullptr, tree->Find("missing"));
+  EXPECT_EQ(nullptr, tree->element(0));
+
+  string text;
+  tree->AppendJsonText(&text);
+  EXPECT_EQ(ToJsonText(expected), text);
+}
+
+TEST(ValueTreeTest, FromJsonLeavesSmallValuesUnchanged) {
+  Json::Value small = MakeValue(ValueTree::kMinSize / 4);
+  const Json::Value expected = small;
+  EXPECT_EQ(nullptr, ValueTree::FromJson(&small, kOwner));
+  EXPECT_EQ(expected, small);
+
+  Json::Value number(1);
+  EXPECT_EQ(nullptr, ValueTree::FromJson(&number, kOwner));
+  Json::Value text(string(1000, 'x'));
+  EXPECT_EQ(nullptr, ValueTree::FromJson(&text, kOwner));
+}
+
+TEST(ValueTreeTest, WritesForgetTheConvertedValue) {
+  Json::Value value = MakeValue(ValueTree::kMinSize);
+  std::shared_ptr<ValueTree> tree = ValueTree::FromJson(&value, kOwner);
+  ASSERT_NE(nullptr, tree);
+  EXPECT_EQ(3, tree->json()["config"]["key3"].asInt());
+
+  ValueTree* config = tree->MutableTree(tree->FindOrAddMember("config"));
+  config->FindOrAddMember("key3")->value = 100;
+  EXPECT_EQ(100, tree->json()["config"]["key3"].asInt());
+
+  Json::Value added(true);
+  tree->Set(tree->FindOrAddMember("added"), &added);
+  EXPECT_EQ(4, tree->size());
+  EXPECT_TRUE(tree->json()["added"].asBool());
+
+  // Appending after the end of an array appends nulls, as Json::Value does.
+  ValueTree* devices = tree->MutableTree(tree->FindOrAddMember("devices"));
+  devices->FindOrAddElement(ValueTree::kMinSize + 1)->value = 1;
+  EXPECT_EQ(ValueTree::kMinSize + 2, devices->size());
+  EXPECT_TRUE(tree->json()["devices"][ValueTree::kMinSize].isNull());
+
+  // Large values are set as subtrees.
+  Json::Value large = MakeValue(ValueTree::kMinSize);
+  const Json::Value expected_large = large;
+  ValueTree::Child* child = tree->FindOrAddMember("large");
+  tree->Set(child, &large);
+  ASSERT_NE(nullptr, child->tree);
+  EXPECT_EQ(expected_large, tree->json()["large"]);
+
+  const Json::Value expected = tree->json();
+  EXPECT_EQ(expected, tree->ReleaseJson());
+  EXPECT_EQ(0, tree->size());
+}
+
+TEST(ValueTreeTest, CopiesShareSubtrees) {
+  Json::Value value;
+  for (int i = 0; i < 4; ++i) {
+    value[absl::StrCat("branch", i)] = MakeValue(ValueTree::kMinSize);
+  }
+  std::shared_ptr<ValueTree> tree = ValueTree::FromJson(&value, kOwner);
+  ASSERT_NE(nullptr, tree);
+  const Json::Value expected = tree->ToJson();
+
+  // A write to a copy copies only the nodes on the path to the written value.
+  ValueTree copy(*tree, kOtherOwner);
+  const ValueTree::Child* branch = tree->Find("branch1");
+  ValueTree* copied_branch = copy.MutableTree(copy.FindOrAddMember("branch1"));
+  ValueTree* copied_config = copied_branch->MutableTree(
+      copied_branch->FindOrAddMember("config"));
+  copied_config->FindOrAddMember("key1")->value = -1;
+
+  EXPECT_NE(branch->tree, copy.Find("branch1")->tree);
+  EXPECT_EQ(kOtherOwner, copied_branch->owner());
+  EXPECT_EQ(kOtherOwner, copied_config->owner());
+  EXPECT_NE(branch->tree->Find("config")->tree,
+            copied_branch->Find("config")->tree);
+  // The untouched siblings on the path stay shared.
+  EXPECT_EQ(branch->tree->Find("devices")->tree,
+            copied_branch->Find("devices")->tree);
+  for (const char* key : {"branch0", "branch2", "branch3"}) {
+    EXPECT_EQ(tree->Find(key)->tree, copy.Find(key)->tree) << key;
+  }
+  EXPECT_EQ(expected, tree->ToJson());
+  EXPECT_EQ(-1, copy.json()["branch1"]["config"]["key1"].asInt());
+
+  // A copy releases the subtrees that it shares by copying them.
+  copy.ReleaseJson();
+  EXPECT_EQ(expected, tree->ToJson());
+}
+
+}  // namespace
+}  // namespace internal
+}  // namespace state_chart
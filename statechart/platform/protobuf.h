@@ -46,12 +46,17 @@ using ::google::protobuf::MessageLite;
 using ::google::protobuf::Descriptor;
 using ::google::protobuf::DescriptorPool;
 using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::EnumValueDescriptor;
+using ::google::protobuf::MessageFactory;
+using ::google::protobuf::Reflection;
 
 namespace util {
 
 using ::google::protobuf::util::MessageDifferencer;
 using ::google::protobuf::util::JsonStringToMessage;
 using ::google::protobuf::util::MessageToJsonString;
+using ::google::protobuf::util::JsonParseOptions;
+using ::google::protobuf::util::JsonPrintOptions;
 
 class JsonFormat {
  public:
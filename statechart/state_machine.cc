@@ -50,8 +50,11 @@ const proto2::util::JsonFormat& StateMachine::json_format() const {
 
 bool StateMachine::ExtractMessageFromDatamodel(
     const string& datamodel_location, proto2::Message* message_output) const {
-  string json_object;
   const auto& datamodel = GetRuntime().datamodel();
+  if (datamodel.EvaluateMessage(datamodel_location, message_output)) {
+    return true;
+  }
+  string json_object;
   if (!datamodel.IsDefined(datamodel_location) ||
       !datamodel.EvaluateExpression(datamodel_location, &json_object)) {
     return false;
@@ -66,9 +69,25 @@ bool StateMachine::SerializeToContext(
   if (runtime.HasInternalEvent()) {
     return false;
   }
+  const auto& datamodel = runtime.datamodel();
   *state_machine_context->mutable_runtime() = runtime.Serialize();
-  state_machine_context->set_datamodel(runtime.datamodel().SerializeAsString());
+  state_machine_context->set_datamodel(datamodel.SerializeAsString());
+  if (datamodel.GetVersion() != 0) {
+    state_machine_context->set_datamodel_version(datamodel.GetVersion());
+  } else {
+    state_machine_context->clear_datamodel_version();
+  }
+  state_machine_context->clear_datamodel_snapshot_id();
+  state_machine_context->clear_base_datamodel_version();
+  state_machine_context->clear_base_datamodel_snapshot_id();
+  state_machine_context->clear_datamodel_modification();
   return true;
 }
 
+bool StateMachine::SerializeDeltaToContext(
+    const StateMachineContext& base_context,
+    StateMachineContext* state_machine_context) const {
+  return false;
+}
+
 }  // namespace state_chart
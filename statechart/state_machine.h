@@ -53,7 +53,8 @@ class StateMachine {
   // Convenience method for passing a proto buffer as a payload. If non-NULL,
   // 'payload' is converted to a JSON string and then passed into the State
   // Machine. With the ECMAScript Datamodel (the default), the JSON object will
-  // be accessible with a structure equivalent to the proto buffer.
+  // be accessible with a structure equivalent to the proto buffer. Datamodels
+  // that store messages, e.g., ProtoDatamodel, are passed the message itself.
   virtual void SendEvent(const string& event,
                          const proto2::Message* payload);
 
@@ -89,7 +90,9 @@ class StateMachine {
   // A convenience method to pull an object from the State Machine's datamodel
   // and store it in 'message_output'. The format of 'datamodel_location' is
   // specific to the type of datamodel in use. The default allows JSON
-  // object-access notation (i.e., "myobject.field1.subfield2").
+  // object-access notation (i.e., "myobject.field1.subfield2"). Datamodels
+  // that store protocol messages copy them without converting to JSON, see
+  // Datamodel::EvaluateMessage().
   //
   // Return false if nothing exists at 'datamodel_location', or if converting
   // from JSON to proto fails.
@@ -100,7 +103,25 @@ class StateMachine {
   // Returns true if successful.
   // Serializing a state machine which is not allowed to run to quiescence will
   // fail.
-  bool SerializeToContext(StateMachineContext* state_machine_Context) const;
+  virtual bool SerializeToContext(
+      StateMachineContext* state_machine_Context) const;
+
+  // Serialize the current state_machine state into a delta context that only
+  // holds the datamodel locations written since 'base_context'. See
+  // StateMachineFactory for restoring state machines from delta contexts.
+  // 'base_context' must be the last full context that this state machine was
+  // serialized into with SerializeToContext() or restored from, since a delta
+  // is restored against its base only. Further deltas are taken from the same
+  // full context and hold all locations written since it.
+  // Returns false if serializing to context fails or 'base_context' is not
+  // the last full context of this state machine, e.g., it is a delta context,
+  // an older full context or a context of another state machine. Returns false
+  // as well if the datamodel does not know the writes since 'base_context',
+  // e.g., as it does not count writes. The state machine must then be
+  // serialized in full. The default implementation takes no delta contexts.
+  virtual bool SerializeDeltaToContext(
+      const StateMachineContext& base_context,
+      StateMachineContext* state_machine_context) const;
 
  private:
   // Formatter used to convert to and from JSON in the datamodel.
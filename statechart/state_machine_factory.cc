@@ -14,26 +14,104 @@
 
 #include "statechart/state_machine_factory.h"
 
+#include <algorithm>
+#include <map>
+
 #include <glog/logging.h>
 
+#include "absl/strings/string_view.h"
+#include "absl/strings/strip.h"
 #include "statechart/internal/datamodel.h"
+#include "statechart/internal/datamodel_factory.h"
 #include "statechart/internal/executor.h"
 #include "statechart/internal/function_dispatcher.h"
+#include "statechart/internal/function_dispatcher_impl.h"
 #include "statechart/internal/light_weight_datamodel.h"
 #include "statechart/internal/model.h"
 #include "statechart/internal/model_builder.h"
 #include "statechart/internal/model_impl.h"
+#include "statechart/internal/null_datamodel.h"
+#include "statechart/internal/proto_datamodel.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/runtime.h"
 #include "statechart/internal/runtime_impl.h"
 #include "statechart/internal/state_machine_impl.h"
 #include "statechart/internal/state_machine_logger.h"
 #include "statechart/logging.h"
 #include "statechart/platform/map_util.h"
+#include "statechart/platform/protobuf.h"
 #include "statechart/proto/state_chart.pb.h"
 #include "statechart/proto/state_machine_context.pb.h"
 #include "statechart/state_machine.h"
 
 namespace state_chart {
+namespace {
+
+// The prefix of datamodel types that name a message type for ProtoDatamodel.
+constexpr char kProtoDatamodelTypePrefix[] = "proto:";
+
+// Creates LightWeightDatamodels, whose expressions are compiled to bytecode
+// or to syntax trees.
+class LightWeightDatamodelFactory : public DatamodelFactory {
+ public:
+  explicit LightWeightDatamodelFactory(bool compile_to_bytecode)
+      : compiler_(compile_to_bytecode
+                      ? LightWeightDatamodel::GetBytecodeCompiler()
+                      : LightWeightDatamodel::GetExpressionCompiler()) {}
+
+  const ExpressionCompiler* GetExpressionCompiler() const override {
+    return compiler_;
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const override {
+    auto datamodel = LightWeightDatamodel::Create(dispatcher);
+    RETURN_NULL_IF(datamodel == nullptr);
+    datamodel->SetSymbolTable(std::move(symbols));
+    datamodel->SetExpressionCompiler(compiler_);
+    return datamodel;
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const override {
+    auto datamodel = LightWeightDatamodel::Create(
+        serialized_data, modifications, version, dispatcher);
+    RETURN_NULL_IF(datamodel == nullptr);
+    datamodel->SetSymbolTable(std::move(symbols));
+    datamodel->SetExpressionCompiler(compiler_);
+    return datamodel;
+  }
+
+ private:
+  const ExpressionCompiler* const compiler_;
+};
+
+// Creates NullDatamodels, which have no data to serialize.
+class NullDatamodelFactory : public DatamodelFactory {
+ public:
+  const ExpressionCompiler* GetExpressionCompiler() const override {
+    return NullDatamodel::GetExpressionCompiler();
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const override {
+    return NullDatamodel::Create();
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const override {
+    RETURN_NULL_IF(!serialized_data.empty() || !modifications.empty());
+    return NullDatamodel::Create();
+  }
+};
+
+}  // namespace
 
 StateMachineFactory::StateMachineFactory()
     : StateMachineFactory(std::unique_ptr<StateMachineListener>(
@@ -41,20 +119,114 @@ StateMachineFactory::StateMachineFactory()
 
 StateMachineFactory::StateMachineFactory(
     std::unique_ptr<StateMachineListener> listener)
-    : executor_(new Executor()), listener_(std::move(listener)) {}
+    : StateMachineFactory(std::move(listener), Options()) {}
+
+StateMachineFactory::StateMachineFactory(
+    std::unique_ptr<StateMachineListener> listener, const Options& options)
+    : executor_(new Executor(options.drop_unhandled_events)),
+      listener_(std::move(listener)),
+      options_(options),
+      datamodel_factories_(options.datamodel_factories),
+      random_seeds_(options.random_seed) {
+  datamodel_factories_.emplace(
+      "ecmascript", std::make_shared<LightWeightDatamodelFactory>(
+                        options.compile_to_bytecode));
+  datamodel_factories_.emplace("null",
+                               std::make_shared<NullDatamodelFactory>());
+}
 
 StateMachineFactory::~StateMachineFactory() {}
 
 bool StateMachineFactory::AddModelFromProto(
     const config::StateChart& state_chart) {
   RETURN_FALSE_IF(state_chart.name().empty());
-  const Model* model = ModelBuilder::CreateModelOrNull(state_chart);
+  const auto* datamodel_factory =
+      gtl::FindOrNull(datamodel_factories_, state_chart.datamodel_type());
+  absl::string_view message_type = state_chart.datamodel_type();
+  if (datamodel_factory == nullptr &&
+      absl::ConsumePrefix(&message_type, kProtoDatamodelTypePrefix)) {
+    // Registers the datamodel of the message type on first use.
+    const proto2::Descriptor* descriptor =
+        proto2::DescriptorPool::generated_pool()->FindMessageTypeByName(
+            string(message_type));
+    std::shared_ptr<const DatamodelFactory> factory;
+    if (descriptor != nullptr) {
+      factory = ProtoDatamodel::CreateFactory(descriptor);
+    }
+    if (factory != nullptr) {
+      datamodel_factory =
+          &(datamodel_factories_[state_chart.datamodel_type()] =
+                std::move(factory));
+    }
+  }
+  if (datamodel_factory == nullptr || *datamodel_factory == nullptr) {
+    // Models were loaded with LightWeightDatamodel whatever their datamodel
+    // type before datamodels were selected by type, so they still are.
+    LOG(WARNING) << "Model " << state_chart.name()
+                 << ": unknown datamodel type '" << state_chart.datamodel_type()
+                 << "', using the \"ecmascript\" datamodel.";
+    datamodel_factory = &datamodel_factories_.at("ecmascript");
+  }
+  // Used by the datamodel that evaluates constant conditions, must outlive
+  // 'builder'.
+  FunctionDispatcherImpl function_dispatcher;
+  // Expressions are compiled once here and shared by all state machines of
+  // the model.
+  ModelBuilder builder(state_chart,
+                       (*datamodel_factory)->GetExpressionCompiler());
+  if (options_.fold_constant_conditions) {
+    builder.EnableConstantFolding(
+        (*datamodel_factory)->Create(nullptr, &function_dispatcher));
+  }
+  builder.Build();
+  std::vector<FoldedCondition> folded_conditions;
+  for (const auto& folded : builder.folded_conditions()) {
+    VLOG(1) << "Model " << state_chart.name() << ": condition '"
+            << folded.condition << "' of "
+            << (folded.kind == ModelBuilder::FoldedCondition::kIf
+                    ? "<if>"
+                    : "transition from " + folded.state_id)
+            << " is always " << (folded.value ? "true" : "false");
+    folded_conditions.push_back(
+        {folded.state_id, folded.condition, folded.value});
+  }
+  const std::map<string, string> constant_variables =
+      builder.constant_variables();
+  std::unique_ptr<const Model> model(builder.CreateModelAndReset());
   RETURN_FALSE_IF(model == nullptr);
+  // The values are compared with those of restored datamodels, which have the
+  // symbols of 'model'.
+  std::vector<std::pair<Expression, string>> folded_values;
+  const ExpressionCompiler* compiler =
+      (*datamodel_factory)->GetExpressionCompiler();
+  for (const auto& variable : constant_variables) {
+    folded_values.emplace_back(
+        compiler == nullptr
+            ? Expression(variable.first)
+            : Expression(variable.first,
+                         compiler->Compile(variable.first,
+                                           model->GetSymbolTable())),
+        variable.second);
+  }
   if (gtl::ContainsKey(models_, model->GetName())) {
     LOG(WARNING) << "Existing model replaced with:" << std::endl
                  << state_chart.DebugString();
   }
-  models_[model->GetName()].reset(model);
+  model_datamodel_factories_[model->GetName()] = datamodel_factory->get();
+  model_key_indexes_[model->GetName()] = builder.key_indexes();
+  // State machines whose restored values differ from those that the
+  // conditions were folded with run on the model without folding.
+  unfolded_state_charts_[model->GetName()] =
+      folded_conditions.empty()
+          ? nullptr
+          : ::absl::make_unique<const config::StateChart>(state_chart);
+  {
+    absl::MutexLock lock(&unfolded_models_mutex_);
+    unfolded_models_.erase(model->GetName());
+  }
+  model_folded_conditions_[model->GetName()] = std::move(folded_conditions);
+  model_folded_values_[model->GetName()] = std::move(folded_values);
+  models_[model->GetName()] = std::move(model);
   return true;
 }
 
@@ -62,10 +234,14 @@ std::unique_ptr<StateMachine> StateMachineFactory::CreateStateMachine(
     const string& model_name, FunctionDispatcher* function_dispatcher) const {
   const auto* model = gtl::FindOrNull(models_, model_name);
   RETURN_NULL_IF(model == nullptr || function_dispatcher == nullptr);
-  // TODO(qplau): Create datamodel instance based on the model's datamodel type.
+  auto datamodel = model_datamodel_factories_.at(model_name)->Create(
+      (*model)->GetSymbolTable(), function_dispatcher);
+  RETURN_NULL_IF(datamodel == nullptr);
+  AddKeyIndexes(model_name, datamodel.get());
+  auto runtime = RuntimeImpl::Create(std::move(datamodel));
+  SeedRandomGenerator(runtime.get());
   std::unique_ptr<StateMachine> state_machine = StateMachineImpl::Create(
-      executor_.get(), model->get(),
-      RuntimeImpl::Create(LightWeightDatamodel::Create(function_dispatcher)));
+      executor_.get(), model->get(), std::move(runtime));
   RETURN_NULL_IF(state_machine == nullptr);
   state_machine->AddListener(listener_.get());
   return state_machine;
@@ -74,32 +250,171 @@ std::unique_ptr<StateMachine> StateMachineFactory::CreateStateMachine(
 std::unique_ptr<StateMachine> StateMachineFactory::CreateStateMachine(
     const string& model_name, const StateMachineContext& state_machine_context,
     state_chart::FunctionDispatcher* function_dispatcher) const {
-  const auto* model = gtl::FindOrNull(models_, model_name);
-  RETURN_NULL_IF(model == nullptr);
-  // TODO(qplau): Create datamodel instance based on the model's datamodel type.
-  std::unique_ptr<Datamodel> datamodel = LightWeightDatamodel::Create(
-      state_machine_context.datamodel(), function_dispatcher);
+  RETURN_NULL_IF(state_machine_context.has_base_datamodel_version());
+  auto state_machine =
+      RestoreStateMachine(model_name, state_machine_context.datamodel(), {},
+                          state_machine_context, function_dispatcher);
+  // The restored state machine takes deltas against its context, e.g., in
+  // another process than the one that serialized it.
+  if (state_machine != nullptr) {
+    state_machine->SetBaseContext(state_machine_context);
+  }
+  return state_machine;
+}
+
+std::unique_ptr<StateMachine> StateMachineFactory::CreateStateMachine(
+    const string& model_name, const StateMachineContext& state_machine_context,
+    const StateMachineContext& state_machine_delta,
+    state_chart::FunctionDispatcher* function_dispatcher) const {
+  RETURN_NULL_IF(state_machine_context.has_base_datamodel_version());
+  // Contexts of different state machines may have the same version, so the
+  // delta must name the snapshot of 'state_machine_context' as well.
+  RETURN_NULL_IF(!state_machine_context.has_datamodel_snapshot_id() ||
+                 !state_machine_delta.has_base_datamodel_snapshot_id() ||
+                 state_machine_delta.base_datamodel_snapshot_id() !=
+                     state_machine_context.datamodel_snapshot_id() ||
+                 state_machine_delta.base_datamodel_version() !=
+                     state_machine_context.datamodel_version());
+  std::map<string, string> datamodel_modifications;
+  for (const auto& modification :
+       state_machine_delta.datamodel_modification()) {
+    datamodel_modifications[modification.location()] = modification.value();
+  }
+  return RestoreStateMachine(model_name, state_machine_context.datamodel(),
+                             datamodel_modifications, state_machine_delta,
+                             function_dispatcher);
+}
+
+std::unique_ptr<StateMachineImpl> StateMachineFactory::RestoreStateMachine(
+    const string& model_name, const string& serialized_datamodel,
+    const std::map<string, string>& datamodel_modifications,
+    const StateMachineContext& state_machine_context,
+    state_chart::FunctionDispatcher* function_dispatcher) const {
+  const auto* found_model = gtl::FindOrNull(models_, model_name);
+  RETURN_NULL_IF(found_model == nullptr);
+  const Model* model = found_model->get();
+  const DatamodelFactory* datamodel_factory =
+      model_datamodel_factories_.at(model_name);
+  auto datamodel = datamodel_factory->Create(
+      model->GetSymbolTable(), serialized_datamodel,
+      datamodel_modifications, state_machine_context.datamodel_version(),
+      function_dispatcher);
+  RETURN_NULL_IF(datamodel == nullptr);
+  if (!HasFoldedValues(model_name, *datamodel)) {
+    // The folded conditions may not hold for the restored values.
+    VLOG(1) << "Model " << model_name
+            << ": restored without folded conditions.";
+    const Model* unfolded_model = GetUnfoldedModel(model_name);
+    RETURN_NULL_IF(unfolded_model == nullptr);
+    model = unfolded_model;
+    datamodel = datamodel_factory->Create(
+        model->GetSymbolTable(), serialized_datamodel,
+        datamodel_modifications, state_machine_context.datamodel_version(),
+        function_dispatcher);
+    RETURN_NULL_IF(datamodel == nullptr);
+  }
+  // The indexes are rebuilt from the restored data on the first lookup.
+  AddKeyIndexes(model_name, datamodel.get());
 
   // Create Runtime.
   auto runtime = RuntimeImpl::Create(std::move(datamodel));
   const auto& serialized_runtime = state_machine_context.runtime();
   // Set the correct states as active in runtime.
   for (const auto* active_state :
-       (*model)->GetActiveStates(serialized_runtime.active_state())) {
+       model->GetActiveStates(serialized_runtime.active_state())) {
     runtime->AddActiveState(active_state);
   }
   runtime->SetRunning(serialized_runtime.running());
+  if (serialized_runtime.random_state_size() > 0) {
+    RETURN_NULL_IF(serialized_runtime.random_state_size() !=
+                   RandomGenerator::kStateSize);
+    RandomGenerator::State random_state;
+    std::copy(serialized_runtime.random_state().begin(),
+              serialized_runtime.random_state().end(), random_state.begin());
+    RETURN_NULL_IF(!runtime->GetRandomGenerator()->SetState(random_state));
+  } else {
+    SeedRandomGenerator(runtime.get());
+  }
+  // Datamodels that do not serialize the system variables, like
+  // ProtoDatamodel, have them bound again.
+  if (runtime->datamodel().HasSystemVariables() &&
+      !runtime->datamodel().IsDefined("_name")) {
+    executor_->BindSystemVariables(model, runtime.get());
+  }
 
   // Create StateMachine.
-  std::unique_ptr<StateMachine> state_machine = StateMachineImpl::Create(
-      executor_.get(), model->get(), std::move(runtime));
+  auto state_machine =
+      StateMachineImpl::Create(executor_.get(), model, std::move(runtime));
   RETURN_NULL_IF(state_machine == nullptr);
   state_machine->AddListener(listener_.get());
   return state_machine;
 }
 
+void StateMachineFactory::AddKeyIndexes(const string& model_name,
+                                        Datamodel* datamodel) const {
+  for (const auto& index : model_key_indexes_.at(model_name)) {
+    if (!datamodel->AddKeyIndex(index.first, index.second)) {
+      VLOG(1) << "Model " << model_name << ": lookups of '" << index.first
+              << "' by '" << index.second << "' are not indexed.";
+    }
+  }
+}
+
+void StateMachineFactory::SeedRandomGenerator(Runtime* runtime) const {
+  if (options_.random_seed == 0) {
+    return;
+  }
+  uint64_t seed;
+  {
+    absl::MutexLock lock(&random_seeds_mutex_);
+    seed = random_seeds_.Next();
+  }
+  runtime->GetRandomGenerator()->Seed(seed);
+}
+
+bool StateMachineFactory::HasFoldedValues(const string& model_name,
+                                          const Datamodel& datamodel) const {
+  if (unfolded_state_charts_.at(model_name) == nullptr) {
+    return true;
+  }
+  for (const auto& variable : model_folded_values_.at(model_name)) {
+    string value;
+    if (!datamodel.EvaluateExpression(variable.first, &value) ||
+        value != variable.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const Model* StateMachineFactory::GetUnfoldedModel(
+    const string& model_name) const {
+  const auto& state_chart = unfolded_state_charts_.at(model_name);
+  RETURN_NULL_IF(state_chart == nullptr);
+  absl::MutexLock lock(&unfolded_models_mutex_);
+  auto& unfolded_model = unfolded_models_[model_name];
+  if (unfolded_model == nullptr) {
+    unfolded_model.reset(ModelBuilder::CreateModelOrNull(
+        *state_chart,
+        model_datamodel_factories_.at(model_name)->GetExpressionCompiler()));
+  }
+  return unfolded_model.get();
+}
+
 bool StateMachineFactory::HasModel(const string& model_name) const {
   return gtl::ContainsKey(models_, model_name);
 }
 
+std::vector<StateMachineFactory::FoldedCondition>
+StateMachineFactory::GetFoldedConditions(const string& model_name) const {
+  const auto* folded_conditions =
+      gtl::FindOrNull(model_folded_conditions_, model_name);
+  return folded_conditions == nullptr ? std::vector<FoldedCondition>()
+                                      : *folded_conditions;
+}
+
+int64_t StateMachineFactory::num_dropped_events() const {
+  return executor_->num_dropped_events();
+}
+
 }  // namespace state_chart
@@ -17,6 +17,7 @@
 #ifndef STATE_CHART_STATE_MACHINE_FACTORY_H_
 #define STATE_CHART_STATE_MACHINE_FACTORY_H_
 
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
@@ -24,15 +25,21 @@
 #include <vector>
 
 #include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "statechart/internal/datamodel.h"
+#include "statechart/internal/random_generator.h"
 #include "statechart/internal/state_machine_logger.h"
 #include "statechart/proto/state_machine_context.pb.h"
 #include "statechart/state_machine_listener.h"
 
 namespace state_chart {
+class DatamodelFactory;
 class Executor;
 class FunctionDispatcher;
 class Model;
+class Runtime;
 class StateMachine;
+class StateMachineImpl;
 namespace config {
 class StateChart;
 }  // namespace config
@@ -43,6 +50,66 @@ namespace state_chart {
 // Manages models and instantiates StateMachines based on these models.
 class StateMachineFactory {
  public:
+  // Options that apply to all models and state machines of a factory.
+  struct Options {
+    // If true, the expressions of the models are compiled to bytecode that runs
+    // on a stack machine, otherwise their syntax trees are evaluated. Both
+    // produce the same results.
+    bool compile_to_bytecode = false;
+
+    // If true, the conditions of <if> branches and transitions that only
+    // depend on literals and read-only <data> variables are evaluated once
+    // when a model is added. See ModelBuilder::EnableConstantFolding() and
+    // GetFoldedConditions().
+    //
+    // The conditions are folded with the values that the state chart
+    // initializes the variables with. A state machine restored from a
+    // StateMachineContext keeps the serialized values, which differ if the
+    // context was serialized with another definition of the chart, e.g.,
+    // when a feature flag changed between deploys. Such state machines run
+    // on the model without folded conditions, which the factory builds when
+    // it first restores one.
+    bool fold_constant_conditions = false;
+
+    // If true, state machines drop external events that no transition of their
+    // active states matches by event name, without assigning '_event' or
+    // evaluating any condition. Dropped events are counted by
+    // num_dropped_events().
+    bool drop_unhandled_events = false;
+
+    // If not 0, the random numbers of state machines, e.g., of Math.random(),
+    // are reproducible: each state machine is seeded with the next number of
+    // the sequence of this seed, so state machines of the same factory have
+    // different sequences, which are the same for factories with the same
+    // seed that create their state machines in the same order. Otherwise
+    // state machines are seeded non-deterministically. State machines that
+    // are created from a StateMachineContext continue the sequence of the
+    // serialized machine.
+    uint64_t random_seed = 0;
+
+    // Datamodels by the 'datamodel_type' of state charts, in addition to the
+    // built-in "ecmascript" datamodel, i.e., LightWeightDatamodel, and the
+    // SCXML "null" datamodel, i.e., NullDatamodel, which they may replace.
+    // A type "proto:<message type>" that is not in the map names a generated
+    // message type as the store of a ProtoDatamodel. Models with other
+    // datamodel types are added with the "ecmascript" datamodel and a
+    // warning.
+    std::map<string, std::shared_ptr<const DatamodelFactory>>
+        datamodel_factories;
+  };
+
+  // A condition that was evaluated once when its model was added, see
+  // Options::fold_constant_conditions. Transitions and <if> branches whose
+  // conditions are always false were dropped, and conditions that are always
+  // true were removed.
+  struct FoldedCondition {
+    // The source state of a transition, empty for the condition of an <if>
+    // branch.
+    string state_id;
+    string condition;
+    bool value;
+  };
+
   // Create a factory with models from a list of StateChart protos.
   // Template param 'Range' must be a range type like 'vector' or 'value_view'
   // of a map.
@@ -51,7 +118,15 @@ class StateMachineFactory {
   template <typename Range>
   static std::unique_ptr<StateMachineFactory> CreateFromProtos(
       const Range& state_charts,
-      std::unique_ptr<StateMachineListener> listener);
+      std::unique_ptr<StateMachineListener> listener) {
+    return CreateFromProtos(state_charts, std::move(listener), Options());
+  }
+
+  // Same as above, with the given 'options'.
+  template <typename Range>
+  static std::unique_ptr<StateMachineFactory> CreateFromProtos(
+      const Range& state_charts, std::unique_ptr<StateMachineListener> listener,
+      const Options& options);
 
   // Same as above, with a StateMachineLogger as a default listener.
   template <typename Range>
@@ -76,19 +151,46 @@ class StateMachineFactory {
       state_chart::FunctionDispatcher* function_dispatcher) const;
 
   // Same as above but with an additional argument 'state_machine_context'
-  // which stores serialized state of the state machine.
+  // which stores serialized state of the state machine. The state machine
+  // takes delta contexts against 'state_machine_context' if it is a full
+  // context.
+  std::unique_ptr<StateMachine> CreateStateMachine(
+      const string& model_name,
+      const StateMachineContext& state_machine_context,
+      state_chart::FunctionDispatcher* function_dispatcher) const;
+
+  // Same as above but restores the state machine from 'state_machine_delta',
+  // a delta context of 'state_machine_context' that was serialized by
+  // StateMachine::SerializeDeltaToContext(). The datamodel of the state machine
+  // counts writes from the version of 'state_machine_delta'.
+  // Returns nullptr if 'state_machine_delta' is not a delta context of
+  // 'state_machine_context', i.e., it does not name the snapshot id and the
+  // datamodel version of 'state_machine_context' as its base.
   std::unique_ptr<StateMachine> CreateStateMachine(
       const string& model_name,
       const StateMachineContext& state_machine_context,
+      const StateMachineContext& state_machine_delta,
       state_chart::FunctionDispatcher* function_dispatcher) const;
 
   // Check that a given model exists, i.e., a state machine can be created from
   // this model name.
   bool HasModel(const string& model_name) const;
 
+  // Returns the conditions of 'model_name' that were folded when the model was
+  // added, in the order of the state chart. Empty if there is no such model or
+  // Options::fold_constant_conditions is false.
+  std::vector<FoldedCondition> GetFoldedConditions(
+      const string& model_name) const;
+
+  // The number of events dropped by all state machines created by this
+  // factory. See Options::drop_unhandled_events.
+  int64_t num_dropped_events() const;
+
  protected:
   StateMachineFactory();
   explicit StateMachineFactory(std::unique_ptr<StateMachineListener> listener);
+  StateMachineFactory(std::unique_ptr<StateMachineListener> listener,
+                      const Options& options);
 
   // Adds a model from a StateChart proto. If a model with the same model name
   // exists, it will be replaced.
@@ -98,17 +200,71 @@ class StateMachineFactory {
   bool AddModelFromProto(const config::StateChart& state_chart);
 
  private:
+  // Creates a state machine of 'model_name' from 'serialized_datamodel' with
+  // 'datamodel_modifications' assigned, and the runtime and the datamodel
+  // version of 'state_machine_context'.
+  std::unique_ptr<StateMachineImpl> RestoreStateMachine(
+      const string& model_name, const string& serialized_datamodel,
+      const std::map<string, string>& datamodel_modifications,
+      const StateMachineContext& state_machine_context,
+      state_chart::FunctionDispatcher* function_dispatcher) const;
+
+  // Adds the key indexes of 'model_name' to 'datamodel'. Datamodels that do
+  // not support indexes answer lookups by scanning instead.
+  void AddKeyIndexes(const string& model_name, Datamodel* datamodel) const;
+
+  // Seeds the random generator of 'runtime', a new state machine, with the
+  // next seed of Options::random_seed. Does nothing if it is 0.
+  void SeedRandomGenerator(Runtime* runtime) const;
+
+  // Returns true if the constant variables that the conditions of 'model_name'
+  // were folded with have the same values in 'datamodel'.
+  bool HasFoldedValues(const string& model_name,
+                       const Datamodel& datamodel) const;
+
+  // Returns the model of 'model_name' without folded conditions, which is
+  // built on the first call. Returns nullptr if the model has no folded
+  // conditions or it fails to build.
+  const Model* GetUnfoldedModel(const string& model_name) const;
+
   std::unique_ptr<const Executor> executor_;
   std::unique_ptr<StateMachineListener> listener_;
+  const Options options_;
+  // The built-in datamodels and those of 'options_' by datamodel type.
+  std::map<string, std::shared_ptr<const DatamodelFactory>>
+      datamodel_factories_;
   std::map<string, std::unique_ptr<const Model>> models_;
+  // The datamodels of 'models_' by model name.
+  std::map<string, const DatamodelFactory*> model_datamodel_factories_;
+  // The key indexes of the datamodels of 'models_' by model name, see
+  // ModelBuilder::key_indexes().
+  std::map<string, std::vector<std::pair<string, string>>> model_key_indexes_;
+  // The folded conditions of 'models_' by model name, and the constant
+  // variables that they were folded with, compiled for the symbols of the
+  // model, with their values, see ModelBuilder::constant_variables().
+  std::map<string, std::vector<FoldedCondition>> model_folded_conditions_;
+  std::map<string, std::vector<std::pair<Expression, string>>>
+      model_folded_values_;
+  // The state charts of the 'models_' that have folded conditions, and the
+  // models built from them without folding. Restores are rarely of values
+  // that differ from the folded ones, so these models are built on demand.
+  std::map<string, std::unique_ptr<const config::StateChart>>
+      unfolded_state_charts_;
+  mutable absl::Mutex unfolded_models_mutex_;
+  mutable std::map<string, std::unique_ptr<const Model>> unfolded_models_;
+  // The seeds of the random generators of state machines if
+  // Options::random_seed is not 0.
+  mutable absl::Mutex random_seeds_mutex_;
+  mutable RandomGenerator random_seeds_;
 };
 
 // static
 template <typename Range>
 std::unique_ptr<StateMachineFactory> StateMachineFactory::CreateFromProtos(
-    const Range& state_charts, std::unique_ptr<StateMachineListener> listener) {
-  auto factory =
-      ::absl::WrapUnique(new StateMachineFactory(std::move(listener)));
+    const Range& state_charts, std::unique_ptr<StateMachineListener> listener,
+    const Options& options) {
+  auto factory = ::absl::WrapUnique(
+      new StateMachineFactory(std::move(listener), options));
   for (const auto& state_chart : state_charts) {
     if (!factory->AddModelFromProto(state_chart)) {
       return nullptr;
@@ -16,10 +16,15 @@
 
 #include <set>
 
+#include "absl/memory/memory.h"
+#include "absl/strings/str_cat.h"
+#include "statechart/internal/datamodel_factory.h"
 #include "statechart/internal/function_dispatcher.h"
 #include "statechart/internal/model.h"
 #include "statechart/internal/model/model.h"
+#include "statechart/internal/null_datamodel.h"
 #include "statechart/internal/runtime.h"
+#include "statechart/internal/state_machine_logger.h"
 #include "statechart/internal/testing/mock_function_dispatcher.h"
 #include "statechart/internal/testing/state_chart_builder.h"
 #include "statechart/platform/test_util.h"
@@ -31,7 +36,10 @@
 #include <gtest/gtest.h>
 
 using proto2::contrib::parse_proto::ParseTextOrDie;
+using testing::_;
+using testing::ElementsAre;
 using testing::NiceMock;
+using testing::Return;
 using testing::UnorderedElementsAre;
 
 namespace state_chart {
@@ -169,5 +177,654 @@ TEST(StateMachineFactoryTest, CreateFromProtos) {
   EXPECT_FALSE(state_machine_factory->HasModel("model3"));
 }
 
+// Test that state machines created by a factory that compiles expressions to
+// bytecode evaluate them.
+TEST(StateMachineFactoryTest, CreateFromProtosWithBytecode) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel().AddDataFromExpr("x", "1");
+  builder.AddState("a").AddTransition({}, {"b"}, "x + 1 == 2 && !(x > 1)");
+  builder.AddState("b");
+
+  StateMachineFactory::Options options;
+  options.compile_to_bytecode = true;
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  std::unique_ptr<StateMachine> state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+}
+
+// Test that state machines of a model with folded constant conditions take the
+// transitions that are always enabled.
+TEST(StateMachineFactoryTest, CreateFromProtosWithConstantFolding) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel().AddDataFromExpr("x", "1").AddDataFromExpr("y", "0");
+  auto state_a = builder.AddState("a");
+  state_a.AddTransition({}, {"c"}, "x > 1");
+  state_a.AddTransition({}, {"b"}, "x == 1").AddAssign("y", "x + 1");
+  builder.AddState("b").AddTransition({}, {"c"}, "y == 2");
+  builder.AddState("c");
+
+  StateMachineFactory::Options options;
+  options.fold_constant_conditions = true;
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  std::unique_ptr<StateMachine> state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("c"));
+
+  std::vector<string> folded;
+  for (const auto& condition :
+       state_machine_factory->GetFoldedConditions("model")) {
+    folded.push_back(absl::StrCat(condition.state_id, ": ",
+                                  condition.condition, " is ",
+                                  condition.value ? "true" : "false"));
+  }
+  EXPECT_THAT(folded, ElementsAre("a: x > 1 is false", "a: x == 1 is true"));
+  EXPECT_TRUE(state_machine_factory->GetFoldedConditions("other").empty());
+}
+
+// Test that state machines restored with values that differ from those that
+// the conditions were folded with do not take the folded conditions.
+TEST(StateMachineFactoryTest, CreateFromContextWithChangedConstants) {
+  auto create_factory = [](const string& flag) {
+    std::vector<config::StateChart> state_charts(1);
+    config::StateChartBuilder builder(&state_charts[0], "model");
+    builder.DataModel().AddDataFromExpr("flag", flag);
+    builder.AddState("a").AddTransition({"E"}, {"b"}, "flag");
+    builder.AddState("b");
+    StateMachineFactory::Options options;
+    options.fold_constant_conditions = true;
+    return StateMachineFactory::CreateFromProtos(
+        state_charts,
+        std::unique_ptr<StateMachineListener>(
+            ::absl::make_unique<StateMachineLogger>()),
+        options);
+  };
+  auto enabled_factory = create_factory("true");
+  auto disabled_factory = create_factory("false");
+  ASSERT_NE(nullptr, enabled_factory);
+  ASSERT_NE(nullptr, disabled_factory);
+  ASSERT_EQ(1, disabled_factory->GetFoldedConditions("model").size());
+  EXPECT_FALSE(disabled_factory->GetFoldedConditions("model")[0].value);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto state_machine =
+      enabled_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&context));
+
+  // The restored flag is true, so the transition is taken although the model
+  // of the factory dropped it.
+  auto restored =
+      disabled_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  restored->SendEvent("E", "");
+  EXPECT_TRUE(restored->GetRuntime().IsActiveState("b"));
+  // The model without folded conditions is built once.
+  auto restored_again =
+      disabled_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored_again);
+  EXPECT_EQ(&restored->GetModel(), &restored_again->GetModel());
+
+  // With the same values, the folded model drops the transition.
+  auto fresh = disabled_factory->CreateStateMachine("model", &dispatcher);
+  fresh->Start();
+  ASSERT_TRUE(fresh->SerializeToContext(&context));
+  restored =
+      disabled_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(&fresh->GetModel(), &restored->GetModel());
+  restored->SendEvent("E", "");
+  EXPECT_TRUE(restored->GetRuntime().IsActiveState("a"));
+}
+
+// Test that state machines drop events that no transition handles if enabled.
+TEST(StateMachineFactoryTest, CreateFromProtosDroppingUnhandledEvents) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.AddState("a").AddTransition({"E"}, {"b"}, "");
+  builder.AddState("b");
+
+  StateMachineFactory::Options options;
+  options.drop_unhandled_events = true;
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  std::unique_ptr<StateMachine> state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  state_machine->SendEvent("F", "");
+  state_machine->SendEvent("E.sub", "");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+  EXPECT_EQ(1, state_machine_factory->num_dropped_events());
+}
+
+// Test that Math.random() of state machines follows the seed of the factory,
+// with a different sequence for each state machine, and that restored state
+// machines continue their sequence.
+TEST(StateMachineFactoryTest, CreateFromProtosWithRandomSeed) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel().AddDataFromExpr("r", "0");
+  builder.AddState("a").AddTransition({"E"}, {"a"}, "").AddAssign(
+      "r", "Math.random()");
+
+  StateMachineFactory::Options options;
+  options.random_seed = 42;
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto random_values = [&dispatcher](StateMachine* state_machine, int count) {
+    std::vector<string> values;
+    for (int i = 0; i < count; ++i) {
+      state_machine->SendEvent("E", "");
+      values.emplace_back();
+      state_machine->GetRuntime().datamodel().EvaluateExpression(
+          "r", &values.back());
+    }
+    return values;
+  };
+  std::unique_ptr<StateMachine> state_machine1 =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  std::unique_ptr<StateMachine> state_machine2 =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  state_machine1->Start();
+  state_machine2->Start();
+  const std::vector<string> values = random_values(state_machine1.get(), 4);
+  const std::vector<string> values2 = random_values(state_machine2.get(), 4);
+  EXPECT_NE(values, values2);
+
+  // The state machines of another factory with the same seed have the same
+  // sequences.
+  auto other_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, other_factory);
+  std::unique_ptr<StateMachine> other1 =
+      other_factory->CreateStateMachine("model", &dispatcher);
+  std::unique_ptr<StateMachine> other2 =
+      other_factory->CreateStateMachine("model", &dispatcher);
+  other1->Start();
+  other2->Start();
+  EXPECT_EQ(values, random_values(other1.get(), 4));
+  EXPECT_EQ(values2, random_values(other2.get(), 4));
+
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine1->SerializeToContext(&context));
+  std::unique_ptr<StateMachine> restored =
+      state_machine_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(random_values(state_machine1.get(), 4),
+            random_values(restored.get(), 4));
+  EXPECT_NE(values, random_values(restored.get(), 4));
+}
+
+// Test that state machines are restored from delta contexts that hold only
+// the variables written since a full context.
+TEST(StateMachineFactoryTest, CreateFromDeltaContext) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel()
+      .AddDataFromExpr("counter", "0")
+      .AddDataFromExpr("records", "[1, 2, 3]");
+  builder.AddState("a").AddTransition({"E"}, {"b"}, "").AddAssign(
+      "counter", "counter + 1");
+  builder.AddState("b").AddTransition({"E"}, {"a"}, "").AddAssign(
+      "counter", "counter + 1");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  state_machine->Start();
+  state_machine->SendEvent("E", "");
+
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&context));
+  state_machine->SendEvent("E", R"({"payload": 1})");
+  state_machine->SendEvent("E", "");
+  StateMachineContext delta;
+  ASSERT_TRUE(state_machine->SerializeDeltaToContext(context, &delta));
+  EXPECT_TRUE(delta.datamodel().empty());
+  EXPECT_EQ(context.datamodel_version(), delta.base_datamodel_version());
+  EXPECT_EQ(context.datamodel_snapshot_id(),
+            delta.base_datamodel_snapshot_id());
+  std::set<string> locations;
+  for (const auto& modification : delta.datamodel_modification()) {
+    locations.insert(modification.location());
+  }
+  // The executor writes the members of '_event'.
+  EXPECT_THAT(locations,
+              UnorderedElementsAre("_event.data", "_event.name", "counter"));
+
+  auto restored = state_machine_factory->CreateStateMachine(
+      "model", context, delta, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(state_machine->GetRuntime().datamodel().SerializeAsString(),
+            restored->GetRuntime().datamodel().SerializeAsString());
+  EXPECT_TRUE(restored->GetRuntime().IsActiveState("b"));
+
+  // Further deltas of the state machine are taken from the same full context
+  // and hold all variables written since it.
+  state_machine->SendEvent("E", "");
+  StateMachineContext second_delta;
+  ASSERT_TRUE(state_machine->SerializeDeltaToContext(context, &second_delta));
+  EXPECT_FALSE(state_machine->SerializeDeltaToContext(delta, &second_delta));
+  auto second_restored = state_machine_factory->CreateStateMachine(
+      "model", context, second_delta, &dispatcher);
+  ASSERT_NE(nullptr, second_restored);
+  EXPECT_EQ(state_machine->GetRuntime().datamodel().SerializeAsString(),
+            second_restored->GetRuntime().datamodel().SerializeAsString());
+  EXPECT_TRUE(second_restored->GetRuntime().IsActiveState("a"));
+
+  // State machines restored from a full context take deltas against it.
+  auto full_restored =
+      state_machine_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, full_restored);
+  full_restored->SendEvent("E", "");
+  StateMachineContext full_delta;
+  ASSERT_TRUE(full_restored->SerializeDeltaToContext(context, &full_delta));
+  auto full_delta_restored = state_machine_factory->CreateStateMachine(
+      "model", context, full_delta, &dispatcher);
+  ASSERT_NE(nullptr, full_delta_restored);
+  EXPECT_EQ(full_restored->GetRuntime().datamodel().SerializeAsString(),
+            full_delta_restored->GetRuntime().datamodel().SerializeAsString());
+
+  // Restored state machines continue counting from the delta, which is not a
+  // base of deltas. They are serialized in full before their next delta.
+  restored->SendEvent("E", "");
+  StateMachineContext next_delta;
+  EXPECT_FALSE(restored->SerializeDeltaToContext(delta, &next_delta));
+  EXPECT_FALSE(restored->SerializeDeltaToContext(context, &next_delta));
+  StateMachineContext next_context;
+  ASSERT_TRUE(restored->SerializeToContext(&next_context));
+  restored->SendEvent("E", "");
+  ASSERT_TRUE(restored->SerializeDeltaToContext(next_context, &next_delta));
+  EXPECT_EQ(2, next_delta.datamodel_modification_size());
+  auto next_restored = state_machine_factory->CreateStateMachine(
+      "model", next_context, next_delta, &dispatcher);
+  ASSERT_NE(nullptr, next_restored);
+  EXPECT_EQ(restored->GetRuntime().datamodel().SerializeAsString(),
+            next_restored->GetRuntime().datamodel().SerializeAsString());
+  EXPECT_TRUE(next_restored->GetRuntime().IsActiveState("b"));
+  // Only the last full context of a state machine is the base of its deltas.
+  StateMachineContext last_context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&last_context));
+  state_machine->SendEvent("E", "");
+  EXPECT_FALSE(state_machine->SerializeDeltaToContext(context, &next_delta));
+  EXPECT_TRUE(
+      state_machine->SerializeDeltaToContext(last_context, &next_delta));
+}
+
+// Test that delta contexts are not applied to contexts other than their base,
+// even if the other context has the same datamodel version.
+TEST(StateMachineFactoryTest, CreateFromMismatchedDeltaContext) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel().AddDataFromExpr("value", "0");
+  builder.AddState("a").AddTransition({"E"}, {"a"}, "").AddAssign(
+      "value", "_event.data");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto first = state_machine_factory->CreateStateMachine("model", &dispatcher);
+  auto second = state_machine_factory->CreateStateMachine("model", &dispatcher);
+  first->Start();
+  second->Start();
+  first->SendEvent("E", "1");
+  second->SendEvent("E", "2");
+
+  StateMachineContext first_context;
+  StateMachineContext second_context;
+  ASSERT_TRUE(first->SerializeToContext(&first_context));
+  ASSERT_TRUE(second->SerializeToContext(&second_context));
+  ASSERT_EQ(first_context.datamodel_version(),
+            second_context.datamodel_version());
+
+  // A state machine takes deltas only against its own full contexts.
+  StateMachineContext foreign_delta;
+  EXPECT_FALSE(second->SerializeDeltaToContext(first_context, &foreign_delta));
+  EXPECT_TRUE(second->SerializeDeltaToContext(second_context, &foreign_delta));
+
+  first->SendEvent("E", "3");
+  StateMachineContext delta;
+  ASSERT_TRUE(first->SerializeDeltaToContext(first_context, &delta));
+  EXPECT_DEBUG_DEATH(
+      {
+        EXPECT_EQ(nullptr, state_machine_factory->CreateStateMachine(
+                               "model", second_context, delta, &dispatcher));
+      },
+      "base_datamodel_snapshot_id\\(\\) != "
+      "state_machine_context.datamodel_snapshot_id\\(\\)");
+
+  auto restored = state_machine_factory->CreateStateMachine(
+      "model", first_context, delta, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_EQ(first->GetRuntime().datamodel().SerializeAsString(),
+            restored->GetRuntime().datamodel().SerializeAsString());
+
+  // A state machine restored from the base takes deltas against it.
+  auto first_copy = state_machine_factory->CreateStateMachine(
+      "model", first_context, &dispatcher);
+  ASSERT_NE(nullptr, first_copy);
+  first_copy->SendEvent("E", "3");
+  StateMachineContext copy_delta;
+  ASSERT_TRUE(first_copy->SerializeDeltaToContext(first_context, &copy_delta));
+  auto copy_restored = state_machine_factory->CreateStateMachine(
+      "model", first_context, copy_delta, &dispatcher);
+  ASSERT_NE(nullptr, copy_restored);
+  EXPECT_EQ(first_copy->GetRuntime().datamodel().SerializeAsString(),
+            copy_restored->GetRuntime().datamodel().SerializeAsString());
+
+  // Neither takes deltas against the other's full contexts of the same
+  // version, which have other snapshot ids.
+  first_copy->SendEvent("E", "4");
+  first->SendEvent("E", "5");
+  StateMachineContext first_next_context;
+  StateMachineContext copy_context;
+  ASSERT_TRUE(first->SerializeToContext(&first_next_context));
+  ASSERT_TRUE(first_copy->SerializeToContext(&copy_context));
+  ASSERT_EQ(first_next_context.datamodel_version(),
+            copy_context.datamodel_version());
+  EXPECT_NE(first_next_context.datamodel_snapshot_id(),
+            copy_context.datamodel_snapshot_id());
+  EXPECT_FALSE(
+      first_copy->SerializeDeltaToContext(first_next_context, &foreign_delta));
+  first->SendEvent("E", "6");
+  StateMachineContext first_delta;
+  ASSERT_TRUE(first->SerializeDeltaToContext(first_next_context, &first_delta));
+  EXPECT_DEBUG_DEATH(
+      {
+        EXPECT_EQ(nullptr,
+                  state_machine_factory->CreateStateMachine(
+                      "model", copy_context, first_delta, &dispatcher));
+      },
+      "base_datamodel_snapshot_id\\(\\) != "
+      "state_machine_context.datamodel_snapshot_id\\(\\)");
+}
+
+// A factory of the null datamodel that counts the datamodels it creates.
+class CountingDatamodelFactory : public DatamodelFactory {
+ public:
+  const ExpressionCompiler* GetExpressionCompiler() const override {
+    return NullDatamodel::GetExpressionCompiler();
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols,
+      FunctionDispatcher* dispatcher) const override {
+    ++num_created_;
+    return NullDatamodel::Create();
+  }
+
+  std::unique_ptr<Datamodel> Create(
+      std::shared_ptr<const SymbolTable> symbols, const string& serialized_data,
+      const std::map<string, string>& modifications, uint64_t version,
+      FunctionDispatcher* dispatcher) const override {
+    return Create(symbols, dispatcher);
+  }
+
+  mutable int num_created_ = 0;
+};
+
+// Test that state machines of models with the null datamodel have no data
+// and follow In() conditions, and that other datamodel types are created by
+// the factories of the options.
+TEST(StateMachineFactoryTest, CreateFromProtosWithDatamodelTypes) {
+  std::vector<config::StateChart> state_charts(2);
+  config::StateChartBuilder builder(&state_charts[0], "null_model");
+  builder.SetDataModelType("null");
+  builder.AddState("a").AddTransition({"E"}, {"b"}, "In('a')");
+  builder.AddState("b").AddTransition({"E"}, {"a"}, "In('a')");
+  state_charts[1] = state_charts[0];
+  state_charts[1].set_name("custom_model");
+  state_charts[1].set_datamodel_type("custom");
+
+  StateMachineFactory::Options options;
+  auto custom_factory = std::make_shared<CountingDatamodelFactory>();
+  options.datamodel_factories["custom"] = custom_factory;
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts,
+      std::unique_ptr<StateMachineListener>(
+          ::absl::make_unique<StateMachineLogger>()),
+      options);
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto state_machine =
+      state_machine_factory->CreateStateMachine("null_model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  state_machine->SendEvent("E", R"({"payload": 1})");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+  EXPECT_FALSE(state_machine->GetRuntime().HasInternalEvent());
+  EXPECT_FALSE(state_machine->GetRuntime().datamodel().IsDefined("_event"));
+  state_machine->SendEvent("E", "");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&context));
+  EXPECT_TRUE(context.datamodel().empty());
+  auto restored = state_machine_factory->CreateStateMachine(
+      "null_model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_TRUE(restored->GetRuntime().IsActiveState("b"));
+
+  EXPECT_NE(nullptr,
+            state_machine_factory->CreateStateMachine("custom_model",
+                                                      &dispatcher));
+  EXPECT_EQ(1, custom_factory->num_created_);
+}
+
+// Test that models of unknown datamodel types are added with the
+// "ecmascript" datamodel, as before datamodels were selected by type.
+TEST(StateMachineFactoryTest, CreateFromProtosWithUnknownDatamodelType) {
+  std::vector<config::StateChart> state_charts(3);
+  config::StateChartBuilder builder(&state_charts[0], "xpath_model");
+  builder.SetDataModelType("xpath");
+  builder.DataModel().AddDataFromExpr("counter", "1");
+  builder.AddState("a").AddTransition({"E"}, {"b"}, "counter == 1");
+  builder.AddState("b");
+  state_charts[1] = state_charts[0];
+  state_charts[1].set_name("empty_type_model");
+  state_charts[1].set_datamodel_type("");
+  state_charts[2] = state_charts[0];
+  state_charts[2].set_name("unknown_message_model");
+  state_charts[2].set_datamodel_type("proto:state_chart.NoSuchMessage");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  for (const char* model :
+       {"xpath_model", "empty_type_model", "unknown_message_model"}) {
+    auto state_machine =
+        state_machine_factory->CreateStateMachine(model, &dispatcher);
+    ASSERT_NE(nullptr, state_machine) << model;
+    state_machine->Start();
+    state_machine->SendEvent("E", "");
+    EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b")) << model;
+  }
+}
+
+TEST(StateMachineFactoryTest, CreateFromProtosWithProtoDatamodel) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.SetDataModelType("proto:state_chart.StateMachineContext.Runtime");
+  builder.DataModel().AddDataFromExpr("running", "true");
+  builder.AddState("a")
+      .AddTransition({"E"}, {"b"},
+                     "running && In('a') && _event.data.seven > 5")
+      .AddAssign("random_state[0]", "_event.data.seven")
+      .AddAssign("active_state[0].id", "'x'");
+  builder.AddState("b");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  state_machine->SendEvent("E", R"({"seven": 7})");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+
+  StateMachineContext::Runtime runtime;
+  ASSERT_TRUE(state_machine->ExtractMessageFromDatamodel("", &runtime));
+  EXPECT_TRUE(runtime.running());
+  ASSERT_EQ(1, runtime.random_state_size());
+  EXPECT_EQ(7, runtime.random_state(0));
+  StateMachineContext::Runtime::ActiveStateElement element;
+  ASSERT_TRUE(
+      state_machine->ExtractMessageFromDatamodel("active_state[0]", &element));
+  EXPECT_EQ("x", element.id());
+
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&context));
+  StateMachineContext::Runtime serialized;
+  ASSERT_TRUE(serialized.ParseFromString(context.datamodel()));
+  EXPECT_EQ(7, serialized.random_state(0));
+  auto restored =
+      state_machine_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  EXPECT_TRUE(restored->ExtractMessageFromDatamodel("", &runtime));
+  EXPECT_EQ(7, runtime.random_state(0));
+  // The system variables are bound again.
+  const Datamodel& restored_datamodel = restored->GetRuntime().datamodel();
+  string value;
+  ASSERT_TRUE(restored_datamodel.EvaluateStringExpression("_name", &value));
+  EXPECT_EQ("model", value);
+  EXPECT_TRUE(
+      restored_datamodel.EvaluateStringExpression("_sessionid", &value));
+  EXPECT_TRUE(restored_datamodel.IsDefined("_event"));
+  EXPECT_FALSE(restored->GetRuntime().HasInternalEvent());
+}
+
+TEST(StateMachineFactoryTest, SendMessageToProtoDatamodel) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.SetDataModelType("proto:state_chart.StateMachineContext.Runtime");
+  builder.AddState("a")
+      .AddTransition({"E"}, {"b"},
+                     "_event.data.running && "
+                     "_event.data.active_state[0].id == 'x'")
+      .AddAssign("active_state", "_event.data.active_state")
+      .AddAssign("random_state", "_event.data.random_state");
+  builder.AddState("b");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  auto state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  ASSERT_NE(nullptr, state_machine);
+  state_machine->Start();
+  // The message is passed to the datamodel as it is, not as JSON.
+  StateMachineContext::Runtime payload;
+  payload.set_running(true);
+  payload.add_active_state()->set_id("x");
+  payload.add_random_state(7);
+  state_machine->SendEvent("E", &payload);
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+
+  StateMachineContext::Runtime runtime;
+  ASSERT_TRUE(state_machine->ExtractMessageFromDatamodel("", &runtime));
+  ASSERT_EQ(1, runtime.active_state_size());
+  EXPECT_EQ("x", runtime.active_state(0).id());
+  ASSERT_EQ(1, runtime.random_state_size());
+  EXPECT_EQ(7, runtime.random_state(0));
+  ASSERT_TRUE(
+      state_machine->ExtractMessageFromDatamodel("_event.data", &payload));
+  EXPECT_TRUE(payload.running());
+}
+
+// Test that lookups on the arrays of <data> with index keys are answered by
+// the datamodel, also after restoring the state machine.
+TEST(StateMachineFactoryTest, CreateFromProtosWithKeyIndexes) {
+  std::vector<config::StateChart> state_charts(1);
+  config::StateChartBuilder builder(&state_charts[0], "model");
+  builder.DataModel().AddDataFromExpr("devices", R"([{"id": "x"}])");
+  state_charts[0].mutable_datamodel()->mutable_data(0)->add_index_key("id");
+  auto state_a = builder.AddState("a");
+  state_a.AddTransition({"E"}, {"b"},
+                        R"(ContainsKeyValue(devices, "id", "y"))");
+  state_a.AddTransition({"Add"}, {}, "").AddAssign("devices[1]",
+                                                    R"({"id": "y"})");
+  builder.AddState("b");
+
+  auto state_machine_factory = StateMachineFactory::CreateFromProtos(
+      state_charts, std::unique_ptr<StateMachineListener>(
+                        ::absl::make_unique<StateMachineLogger>()));
+  ASSERT_NE(nullptr, state_machine_factory);
+  NiceMock<MockFunctionDispatcher> dispatcher;
+  ON_CALL(dispatcher, HasFunction("ContainsKeyValue"))
+      .WillByDefault(Return(true));
+  EXPECT_CALL(dispatcher, Execute(_, _, _)).Times(0);
+  auto state_machine =
+      state_machine_factory->CreateStateMachine("model", &dispatcher);
+  state_machine->Start();
+  state_machine->SendEvent("E", "");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("a"));
+  state_machine->SendEvent("Add", "");
+
+  StateMachineContext context;
+  ASSERT_TRUE(state_machine->SerializeToContext(&context));
+  auto restored =
+      state_machine_factory->CreateStateMachine("model", context, &dispatcher);
+  ASSERT_NE(nullptr, restored);
+  restored->SendEvent("E", "");
+  EXPECT_TRUE(restored->GetRuntime().IsActiveState("b"));
+  state_machine->SendEvent("E", "");
+  EXPECT_TRUE(state_machine->GetRuntime().IsActiveState("b"));
+}
+
 }  // namespace
 }  // namespace state_chart